@@ -261,6 +261,9 @@ const char* usbip::device_control_name(ULONG ioctl_code)
         case vhci::ioctl::STOP_ATTACH_ATTEMPTS: return "vhci_stop_attach_attempts";
         case vhci::ioctl::PLUGIN_HARDWARE_ONCE: return "vhci_plugin_hardware_once";
         case vhci::ioctl::PLUGOUT_HARDWARE_AND_REATTACH: return "vhci_plugout_hardware_and_reattach";
+        case vhci::ioctl::GET_IMPORTED_DEVICES_DELTA: return "vhci_get_imported_devices_delta";
+        case vhci::ioctl::SET_CAPTURE: return "vhci_set_capture";
+        case vhci::ioctl::READ_CAPTURE: return "vhci_read_capture";
 
 	case IOCTL_USB_DIAG_IGNORE_HUBS_ON: return "USB_DIAG_IGNORE_HUBS_ON";
 	case IOCTL_USB_DIAG_IGNORE_HUBS_OFF: return "USB_DIAG_IGNORE_HUBS_OFF";
@@ -3,7 +3,7 @@
  */
 
 #include "pdu.h"
-#include <usbip\proto.h>
+#include <usbip/proto.h>
 
 #include <intrin.h>
 #include <wdm.h>
@@ -16,7 +16,7 @@ using namespace usbip;
 void bswap(header_basic &r) 
 {
         UINT32* v[]{ &r.command, &r.seqnum, &r.devid, &r.direction, &r.ep };
-        static_assert(sizeof(*v[0]) == sizeof(unsigned long));
+        static_assert(sizeof(*v[0]) == sizeof(ULONG));
 
         for (auto val: v) {
 		*val = RtlUlongByteSwap(*val); // _byteswap_ulong
@@ -25,11 +25,11 @@ void bswap(header_basic &r)
 
 void bswap(header_cmd_submit &r) 
 {
-	static_assert(sizeof(r.transfer_flags) == sizeof(unsigned long));
+	static_assert(sizeof(r.transfer_flags) == sizeof(ULONG));
 	r.transfer_flags = RtlUlongByteSwap(r.transfer_flags);
 
         INT32 *v[] {&r.transfer_buffer_length, &r.start_frame, &r.number_of_packets, &r.interval};
-        static_assert(sizeof(*v[0]) == sizeof(unsigned long));
+        static_assert(sizeof(*v[0]) == sizeof(ULONG));
 
 	for (auto val: v) {
 		*val = RtlUlongByteSwap(*val);
@@ -39,22 +39,25 @@ void bswap(header_cmd_submit &r)
 void bswap(header_ret_submit &r) 
 {
         INT32 *v[] {&r.status, &r.actual_length, &r.start_frame, &r.number_of_packets, &r.error_count};
-        static_assert(sizeof(*v[0]) == sizeof(unsigned long));
+        static_assert(sizeof(*v[0]) == sizeof(ULONG));
 
 	for (auto val: v) {
 		*val = RtlUlongByteSwap(*val);
 	}
+
+	static_assert(sizeof(r.ext_flags) == sizeof(ULONG));
+	r.ext_flags = RtlUlongByteSwap(r.ext_flags);
 }
 
 inline void bswap(header_cmd_unlink &r) 
 {
-	static_assert(sizeof(r.seqnum) == sizeof(unsigned long));
+	static_assert(sizeof(r.seqnum) == sizeof(ULONG));
 	r.seqnum = RtlUlongByteSwap(r.seqnum);
 }
 
 inline void bswap(header_ret_unlink &r) 
 {
-	static_assert(sizeof(r.status) == sizeof(unsigned long));
+	static_assert(sizeof(r.status) == sizeof(ULONG));
 	r.status = RtlUlongByteSwap(r.status);
 }
 
@@ -92,7 +95,7 @@ void usbip::byteswap(iso_packet_descriptor *d, size_t cnt)
 	for (size_t i = 0; i < cnt; ++i, ++d) {
 
 		UINT32 *v[] {&d->offset, &d->length, &d->actual_length, &d->status};
-		static_assert(sizeof(*v[0]) == sizeof(unsigned long));
+		static_assert(sizeof(*v[0]) == sizeof(ULONG));
 
 		for (auto val: v) {
 			*val = RtlUlongByteSwap(*val);
@@ -135,7 +138,7 @@ size_t usbip::get_isoc_descr(iso_packet_descriptor* &isoc, header &hdr)
 	}
 
 	isoc = reinterpret_cast<iso_packet_descriptor*>(buf_end);
-	return cnt == number_of_packets_non_isoch ? 0 : cnt;
+	return cnt == static_cast<size_t>(number_of_packets_non_isoch) ? 0 : cnt; // INT32 -1 is sign-extended
 }
 
 size_t usbip::get_total_size(const header &hdr) 
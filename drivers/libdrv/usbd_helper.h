@@ -4,7 +4,7 @@
 
 #pragma once
 
-#include <usbip\proto.h>
+#include <usbip/proto.h>
 
 #include <ntddk.h>
 #include <usb.h>
@@ -773,6 +773,50 @@ PAGED NTSTATUS wsk::get_keepalive_opts(_In_ SOCKET *sock, int *idle, int *cnt, i
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_max_(APC_LEVEL)
+PAGED NTSTATUS wsk::get_buffer_sizes(_In_ SOCKET *sock, int *sndbuf, int *rcvbuf)
+{
+        PAGED_CODE();
+
+        if (sndbuf) {
+                if (auto err = getsockopt(sock, SOL_SOCKET, SO_SNDBUF, sndbuf, sizeof(*sndbuf))) {
+                        return err;
+                }
+        }
+
+        if (rcvbuf) {
+                if (auto err = getsockopt(sock, SOL_SOCKET, SO_RCVBUF, rcvbuf, sizeof(*rcvbuf))) {
+                        return err;
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Setting SO_RCVBUF disables receive window autotuning of the stack for the socket.
+ * @param sndbuf, rcvbuf are not set if not positive
+ */
+_IRQL_requires_max_(APC_LEVEL)
+PAGED NTSTATUS wsk::set_buffer_sizes(_In_ SOCKET *sock, int sndbuf, int rcvbuf)
+{
+        PAGED_CODE();
+
+        if (sndbuf > 0) {
+                if (auto err = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf))) {
+                        return err;
+                }
+        }
+
+        if (rcvbuf > 0) {
+                if (auto err = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf))) {
+                        return err;
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS wsk::initialize()
 {
@@ -100,6 +100,12 @@ PAGED NTSTATUS get_keepalive_opts(_In_ SOCKET *sock, int *idle, int *cnt, int *i
 _IRQL_requires_max_(APC_LEVEL)
 PAGED NTSTATUS set_keepalive(_In_ SOCKET *sock, int idle = 0, int cnt = 0, int intvl = 0);
 
+_IRQL_requires_max_(APC_LEVEL)
+PAGED NTSTATUS get_buffer_sizes(_In_ SOCKET *sock, int *sndbuf, int *rcvbuf);
+
+_IRQL_requires_max_(APC_LEVEL)
+PAGED NTSTATUS set_buffer_sizes(_In_ SOCKET *sock, int sndbuf, int rcvbuf);
+
 //
 
 _IRQL_requires_max_(APC_LEVEL)
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "capture.h"
+#include "trace.h"
+#include "capture.tmh"
+
+#include "context.h"
+#include "wsk_context.h"
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG {
+        RING_SIZE_DEFAULT = 1024*1024,
+        RING_SIZE_MIN = 64*1024,
+        RING_SIZE_MAX = 64*1024*1024,
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto now()
+{
+        LARGE_INTEGER t;
+        KeQuerySystemTimePrecise(&t);
+        return static_cast<ULONG64>(t.QuadPart);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto& get_capture_ctx(_In_ WDFMEMORY mem)
+{
+        return *static_cast<capture_ctx*>(WdfMemoryGetBuffer(mem, nullptr));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+constexpr ULONG round_ring_size(_In_ ULONG size)
+{
+        if (!size) {
+                return RING_SIZE_DEFAULT;
+        }
+
+        ULONG sz = RING_SIZE_MIN;
+        while (sz < size && sz < RING_SIZE_MAX) {
+                sz <<= 1;
+        }
+
+        return sz;
+}
+
+/*
+ * The ring is not freed when the capture is disabled because writers can still use it.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_capture_mem(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev, _In_ ULONG ring_size)
+{
+        PAGED_CODE();
+
+        if (dev.capture_mem) {
+                return STATUS_SUCCESS;
+        }
+
+        auto capacity = round_ring_size(ring_size);
+        static_assert(!(sizeof(capture_ctx) % capture::alignment));
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        WDFMEMORY mem{};
+        capture_ctx *ctx{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, 0, sizeof(*ctx) + capacity, &mem, reinterpret_cast<PVOID*>(&ctx))) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, WdfMemoryCreate(%lu) %!STATUS!", ptr04x(device), capacity, err);
+                return err;
+        }
+
+        RtlZeroMemory(ctx, sizeof(*ctx));
+        ctx->ring.init(ctx + 1, capacity);
+
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&dev.capture_mem), mem, nullptr)) {
+                WdfObjectDelete(mem); // concurrent call has created it
+        } else {
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, capture ring %lu bytes", ptr04x(device), capacity);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/*
+ * @return number of bytes that were not copied
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto copy(_Inout_ UCHAR* &dst, _In_ size_t len, _In_opt_ MDL *mdl)
+{
+        for ( ; mdl && len; mdl = mdl->Next) {
+
+                auto src = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+                if (!src) {
+                        break;
+                }
+
+                auto cnt = min(len, MmGetMdlByteCount(mdl));
+                RtlCopyMemory(dst, src, cnt);
+
+                dst += cnt;
+                len -= cnt;
+        }
+
+        return len;
+}
+
+/*
+ * @param hdr is not null if payload does not contain it
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void record(
+        _Inout_ capture_ctx &cap, _In_ capture::direction dir, _In_ ULONG64 time, _In_ size_t pdu_len,
+        _In_opt_ const header *hdr, _In_opt_ MDL *payload)
+{
+        auto caplen = min(pdu_len, size_t(cap.snaplen));
+
+        auto r = cap.ring.reserve(caplen);
+        if (!r) {
+                return; // is counted by the ring
+        }
+
+        r->time = time;
+        r->pdu_len = static_cast<ULONG>(pdu_len);
+        r->dir = dir;
+
+        auto dst = capture::data(*r);
+        auto len = caplen;
+
+        if (hdr) {
+                auto cnt = min(len, sizeof(*hdr));
+                RtlCopyMemory(dst, hdr, cnt);
+                dst += cnt;
+                len -= cnt;
+        }
+
+        len = copy(dst, len, payload);
+        r->data_len = static_cast<ULONG>(caplen - len);
+
+        cap.ring.commit(*r);
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::set_capture(_In_ UDECXUSBDEVICE device, _In_ ULONG snaplen, _In_ ULONG ring_size)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        TraceDbg("dev %04x, snaplen %lu, ring_size %lu", ptr04x(device), snaplen, ring_size);
+
+        if (!snaplen) {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.capture), nullptr);
+                return STATUS_SUCCESS;
+        }
+
+        if (auto err = create_capture_mem(device, dev, ring_size)) {
+                return err;
+        }
+
+        auto &cap = get_capture_ctx(dev.capture_mem);
+
+        auto max_snaplen = static_cast<ULONG>(cap.ring.capacity()/4);
+        cap.snaplen = max(min(snaplen, max_snaplen), static_cast<ULONG>(sizeof(header)));
+
+        InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.capture), &cap);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::read_capture(
+        _In_ device_ctx &dev, _Out_writes_bytes_(length) void *buf, _In_ ULONG length,
+        _Out_ ULONG &written, _Out_ UINT64 &dropped)
+{
+        PAGED_CODE();
+
+        written = 0;
+        dropped = 0;
+
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.capture_mem)));
+        if (!mem) {
+                return STATUS_INVALID_DEVICE_STATE; // capture was never enabled
+        }
+
+        auto &cap = get_capture_ctx(mem);
+
+        if (set_flag(cap.reading)) {
+                return STATUS_DEVICE_BUSY;
+        }
+
+        written = static_cast<ULONG>(cap.ring.read(buf, length));
+        dropped = static_cast<UINT64>(cap.ring.dropped());
+
+        InterlockedExchange(&cap.reading, false);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_sent(_Inout_ capture_ctx &cap, _In_ const WSK_BUF &buf)
+{
+        NT_ASSERT(!buf.Offset);
+        record(cap, capture::out, now(), buf.Length, nullptr, buf.Mdl);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_received_header(_Out_ capture_recv &r, _In_ capture_ctx &cap, _In_ const header &hdr)
+{
+        r.ctx = &cap;
+        r.time = now();
+        r.hdr = hdr;
+}
+
+/*
+ * Isochronous OUT has descriptors only, @see make_mdl_chain.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_received(_Inout_ capture_recv &r, _In_ const wsk_context &ctx, _In_ size_t payload, _In_ bool has_payload)
+{
+        MDL *mdl{};
+
+        if (!has_payload) {
+                //
+        } else if (ctx.mdl_buf) {
+                mdl = ctx.mdl_buf.get();
+        } else if (ctx.is_isoc) {
+                mdl = ctx.mdl_isoc.get();
+        }
+
+        record(*r.ctx, capture::in, r.time, sizeof(r.hdr) + payload, &r.hdr, mdl);
+        r.ctx = nullptr;
+}
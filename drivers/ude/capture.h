@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv/codeseg.h>
+#include <libdrv/wdf_cpp.h>
+
+#include <usbip/proto.h>
+#include <usbip/capture.h>
+
+#include <usb.h>
+#include <wdfusb.h>
+#include <UdeCx.h>
+#include <wsk.h>
+
+/*
+ * Opt-in capture of USB/IP PDUs of a device, @see vhci::ioctl::set_capture.
+ * If it is disabled, the cost is a check of device_ctx::capture for every PDU.
+ */
+namespace usbip
+{
+
+struct device_ctx;
+struct wsk_context;
+
+struct interlocked // @see capture::ring
+{
+        static auto load(_In_ const volatile long long &v) { return ReadAcquire64(&v); }
+        static int load(_In_ const volatile int &v) { return ReadAcquire(reinterpret_cast<const volatile LONG*>(&v)); }
+
+        static void store(_Out_ volatile long long &v, _In_ long long val) { WriteRelease64(&v, val); }
+        static void store(_Out_ volatile int &v, _In_ int val) { WriteRelease(reinterpret_cast<volatile LONG*>(&v), val); }
+
+        static bool compare_exchange(_Inout_ volatile long long &target, _In_ long long expected, _In_ long long desired)
+        {
+                return InterlockedCompareExchange64(&target, desired, expected) == expected;
+        }
+
+        static void increment(_Inout_ volatile long long &v) { InterlockedIncrement64(&v); }
+};
+
+/*
+ * Is placed at the beginning of device_ctx::capture_mem, the storage of the ring follows it.
+ */
+struct capture_ctx
+{
+        capture::ring<interlocked> ring;
+        ULONG snaplen;
+        LONG reading; // serializes readers, use set_flag
+};
+
+/*
+ * A received PDU is recorded after its payload is read, with the time of its header.
+ */
+struct capture_recv
+{
+        capture_ctx *ctx; // not null if the PDU is being recorded
+        ULONG64 time;
+        header hdr; // in network byte order
+};
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_capture(_In_ UDECXUSBDEVICE device, _In_ ULONG snaplen, _In_ ULONG ring_size);
+
+/*
+ * @param written is a multiple of capture::alignment
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_capture(
+        _In_ device_ctx &dev, _Out_writes_bytes_(length) void *buf, _In_ ULONG length,
+        _Out_ ULONG &written, _Out_ UINT64 &dropped);
+
+/*
+ * The header is in network byte order already.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_sent(_Inout_ capture_ctx &cap, _In_ const WSK_BUF &buf);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_received_header(_Out_ capture_recv &r, _In_ capture_ctx &cap, _In_ const header &hdr);
+
+/*
+ * @param payload length of payload of the PDU
+ * @param has_payload the payload was read into the buffers of ctx
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_received(_Inout_ capture_recv &r, _In_ const wsk_context &ctx, _In_ size_t payload, _In_ bool has_payload);
+
+} // namespace usbip
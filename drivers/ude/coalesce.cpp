@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "coalesce.h"
+#include "trace.h"
+#include "coalesce.tmh"
+
+#include "wsk_context.h"
+#include "device_ioctl.h"
+#include "request_list.h"
+
+namespace
+{
+
+using namespace usbip;
+
+enum { ticks_per_usec = 10 }; // KeQueryInterruptTime
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto& get_coalesce_ctx(_In_ WDFMEMORY mem)
+{
+        return *static_cast<coalesce_ctx*>(WdfMemoryGetBuffer(mem, nullptr));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto now()
+{
+        return static_cast<long long>(KeQueryInterruptTime());
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void start_timer(_In_ coalesce_ctx &ctx)
+{
+        auto usec = (ctx.win.deadline() - now())/ticks_per_usec;
+        WdfTimerStart(ctx.timer, WDF_REL_TIMEOUT_IN_US(usec > 0 ? usec : 1));
+}
+
+/*
+ * Must be called under coalesce_ctx::lock.
+ * @return held PDUs, the list is emptied
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto take_held(_Inout_ coalesce_ctx &ctx)
+{
+        auto head = ctx.head;
+        ctx.head = ctx.tail = nullptr;
+        return head;
+}
+
+/*
+ * PDUs of a disconnected device are released as if WskSend has failed, @see send_complete.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void release_held(_Inout_ device_ctx &dev, _In_opt_ SLIST_ENTRY *head)
+{
+        for (auto entry = head; entry; ) {
+
+                wsk_context_ptr ctx(CONTAINING_RECORD(entry, wsk_context, entry), true);
+                entry = entry->Next;
+
+                if (auto request = ctx->request) {
+                        device::request_sent(dev, request, STATUS_CANCELLED);
+                }
+        }
+}
+
+/*
+ * @return true if the PDUs were pushed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool push_held(_Inout_ device_ctx &dev, _In_opt_ SLIST_ENTRY *head)
+{
+        if (!head) {
+                return false;
+        }
+
+        if (get_flag(dev.unplugged)) {
+                release_held(dev, head);
+                return false;
+        }
+
+        for (auto entry = head; entry; ) {
+                auto next = entry->Next; // is overwritten by the push
+                InterlockedPushEntrySList(&dev.pending_sends, entry);
+                entry = next;
+        }
+
+        return true;
+}
+
+/*
+ * @param all close the window regardless of the deadline
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void flush(_Inout_ device_ctx &dev, _Inout_ coalesce_ctx &ctx, _In_ bool all)
+{
+        SLIST_ENTRY *head{};
+        {
+                wdf::Lock lck(ctx.lock);
+
+                if (all ? ctx.win.take() : ctx.win.expire(now())) {
+                        head = take_held(ctx);
+                } else if (ctx.win.held()) {
+                        start_timer(ctx); // has fired earlier than the deadline
+                }
+        }
+
+        if (push_held(dev, head)) {
+                device::send_pending(dev);
+        }
+}
+
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void on_coalesce_timer(_In_ WDFTIMER timer)
+{
+        auto device = static_cast<UDECXUSBDEVICE>(WdfTimerGetParentObject(timer));
+        auto &dev = *get_device_ctx(device);
+
+        flush(dev, get_coalesce_ctx(dev.coalesce_mem), false);
+}
+
+/*
+ * The context is not freed when coalescing is disabled because send() can still use it.
+ * The timer is a child of the device, it is deleted with the device.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_coalesce_mem(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (dev.coalesce_mem) {
+                return STATUS_SUCCESS;
+        }
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        WDFMEMORY mem{};
+        coalesce_ctx *ctx{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, 0, sizeof(*ctx), &mem, reinterpret_cast<PVOID*>(&ctx))) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, WdfMemoryCreate(%Iu) %!STATUS!", ptr04x(device), sizeof(*ctx), err);
+                return err;
+        }
+
+        ObjectDelete mem_guard(mem);
+
+        RtlZeroMemory(ctx, sizeof(*ctx));
+        ctx->win.configure(0, 0);
+
+        attr.ParentObject = mem;
+
+        if (auto err = WdfSpinLockCreate(&attr, &ctx->lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, on_coalesce_timer);
+        cfg.AutomaticSerialization = false;
+        cfg.UseHighResolutionTimer = WdfTrue; // windows are fractions of a millisecond
+
+        attr.ParentObject = device; // WdfTimerGetParentObject must return it
+        attr.ExecutionLevel = WdfExecutionLevelDispatch; // high resolution timer requires it
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &ctx->timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&dev.coalesce_mem), mem, nullptr)) {
+                WdfObjectDelete(ctx->timer); // concurrent call has created it
+        } else {
+                mem_guard.release();
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, coalescing %Iu bytes", ptr04x(device), sizeof(*ctx));
+        }
+
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::set_coalesce(_In_ UDECXUSBDEVICE device, _In_ ULONG window, _In_ ULONG max_batch)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        TraceDbg("dev %04x, window %lu us, max batch %lu", ptr04x(device), window, max_batch);
+
+        if (max_batch > coalesce::max_batch_limit) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        if (!window && !dev.coalesce_mem) {
+                return STATUS_SUCCESS; // was never enabled
+        }
+
+        if (auto err = create_coalesce_mem(device, dev)) {
+                return err;
+        }
+
+        auto &ctx = get_coalesce_ctx(dev.coalesce_mem);
+        {
+                wdf::Lock lck(ctx.lock);
+                ctx.win.configure(static_cast<long long>(window)*ticks_per_usec, max_batch);
+        }
+
+        if (window) {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.coalesce), &ctx);
+        } else {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.coalesce), nullptr);
+                WdfTimerStop(ctx.timer, true);
+                flush(dev, ctx, true);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::get_coalesce(_Inout_ device_ctx &dev, _Out_ coalesce::stats &stats, _In_ bool reset)
+{
+        stats = {};
+
+        auto &cnt = stats.overhead;
+        cnt = dev.overhead;
+
+        if (reset) {
+                dev.overhead = {}; // the writers do not lock, concurrent increments can be lost
+        }
+
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.coalesce_mem)));
+        if (!mem) {
+                return;
+        }
+
+        auto &ctx = get_coalesce_ctx(mem);
+        wdf::Lock lck(ctx.lock);
+
+        auto &w = ctx.win;
+
+        stats.windows = w.windows();
+        stats.closed_by_timer = w.closed(coalesce::closed_by::timer);
+        stats.closed_by_size = w.closed(coalesce::closed_by::size);
+        stats.closed_by_traffic = w.closed(coalesce::closed_by::traffic);
+
+        stats.window = static_cast<unsigned int>(w.length()/ticks_per_usec);
+        stats.max_batch = w.max_batch();
+
+        if (reset) {
+                w.reset_stats();
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::coalesce_hold(
+        _Inout_ device_ctx &dev, _Inout_ coalesce_ctx &ctx, _Inout_ wsk_context &wsk, _In_ bool coalescible)
+{
+        SLIST_ENTRY *head{};
+        auto held = false;
+        {
+                wdf::Lock lck(ctx.lock);
+
+                switch (ctx.win.add(now(), coalescible)) {
+                case coalesce::action::open:
+                        start_timer(ctx);
+                        [[fallthrough]];
+                case coalesce::action::hold:
+                        wsk.entry.Next = nullptr;
+                        if (ctx.tail) {
+                                ctx.tail->Next = &wsk.entry;
+                        } else {
+                                ctx.head = &wsk.entry;
+                        }
+                        ctx.tail = &wsk.entry;
+                        held = true;
+                        break;
+                case coalesce::action::flush:
+                        head = take_held(ctx); // the timer will find the window closed
+                        break;
+                case coalesce::action::send:
+                        break;
+                }
+        }
+
+        push_held(dev, head); // the caller calls send_pending
+        return held;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::stop_coalescing(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+        NT_ASSERT(get_flag(dev.unplugged)); // push_held releases PDUs
+
+        if (auto mem = dev.coalesce_mem) {
+                auto &ctx = get_coalesce_ctx(mem);
+                WdfTimerStop(ctx.timer, true);
+                flush(dev, ctx, true);
+        }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+#include <usbip/coalesce.h>
+
+/*
+ * Opt-in coalescing of interrupt IN resubmits of a device, @see vhci::ioctl::set_coalesce.
+ * If it is disabled, the cost is a check of device_ctx::coalesce for every sent PDU.
+ */
+namespace usbip
+{
+
+struct wsk_context;
+
+/*
+ * Is placed in device_ctx::coalesce_mem.
+ */
+struct coalesce_ctx
+{
+        WDFSPINLOCK lock; // for the members below
+        coalesce::window win; // in units of KeQueryInterruptTime
+        SLIST_ENTRY *head; // held wsk_context::entry-s in the order of sending
+        SLIST_ENTRY *tail;
+
+        WDFTIMER timer; // closes the window
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto is_interrupt_in(_In_ const endpoint_ctx &endp)
+{
+        auto &d = endp.descriptor;
+        return usb_endpoint_type(d) == UsbdPipeTypeInterrupt && usb_endpoint_dir_in(d);
+}
+
+/*
+ * @param window microseconds, zero disables coalescing
+ * @param max_batch PDUs of a window, coalesce::default_max_batch if zero
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_coalesce(_In_ UDECXUSBDEVICE device, _In_ ULONG window, _In_ ULONG max_batch);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void get_coalesce(_Inout_ device_ctx &dev, _Out_ coalesce::stats &stats, _In_ bool reset);
+
+/*
+ * Is called before the PDU is pushed to device_ctx::pending_sends.
+ * If the window is closed by this PDU, the held PDUs are pushed first.
+ * @param coalescible interrupt IN CMD_SUBMIT
+ * @return true if the PDU is held, it will be sent when the window is closed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool coalesce_hold(_Inout_ device_ctx &dev, _Inout_ coalesce_ctx &ctx, _Inout_ wsk_context &wsk, _In_ bool coalescible);
+
+/*
+ * Stops the timer and releases held PDUs without sending them, is called after the device was disconnected.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void stop_coalescing(_Inout_ device_ctx &dev);
+
+} // namespace usbip
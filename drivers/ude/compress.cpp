@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "compress.h"
+#include "trace.h"
+#include "compress.tmh"
+
+#include "context.h"
+#include "wsk_context.h"
+#include "persistent.h"
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG
+{
+        max_payload = 64*1024, // runs at DISPATCH_LEVEL, larger transfer buffers are sent as is
+        table_size = lz4::hash_size*sizeof(unsigned int),
+        packed_size = table_size + max_payload, // the hash table is followed by the frame
+};
+
+bool g_initialized;
+LOOKASIDE_LIST_EX g_packed;
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::init_compression(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        using compress::ep_type;
+
+        ULONG bytes[static_cast<int>(ep_type::count_)]{}; // see .inf
+
+        const wchar_t* const names[] {
+                L"CompressControlMinimum",
+                L"CompressBulkMinimum",
+                L"CompressInterruptMinimum",
+        };
+        static_assert(ARRAYSIZE(names) == ARRAYSIZE(bytes));
+
+        if (Registry key; NT_SUCCESS(open(key, DriverRegKeyParameters))) {
+                for (size_t i = 0; i < ARRAYSIZE(names); ++i) {
+
+                        UNICODE_STRING value_name;
+                        RtlUnicodeStringInit(&value_name, names[i]);
+
+                        if (ULONG val{}; auto err = WdfRegistryQueryULong(key.get<WDFKEY>(), &value_name, &val)) {
+                                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                        } else {
+                                bytes[i] = val;
+                        }
+                }
+        }
+
+        auto &ext = vhci.compress_offer;
+        ext = compress::extension{};
+
+        for (size_t i = 0; i < ARRAYSIZE(bytes); ++i) {
+                if (auto &shift = ext.min_shift[i]; (shift = compress::to_shift(bytes[i]))) {
+                        ext.codecs = compress::codec_lz4;
+                }
+        }
+
+        if (ext.codecs) {
+                RtlCopyMemory(ext.magic, compress::magic, sizeof(ext.magic));
+        }
+
+        TraceDbg("compression is %s, minimum{control %lu, bulk %lu, interrupt %lu}",
+                  ext.codecs ? "offered" : "disabled", bytes[0], bytes[1], bytes[2]);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::pack_payload(_Inout_ wsk_context &ctx, _In_ const compress::extension &ext, _In_ unsigned int usb_type)
+{
+        NT_ASSERT(!ctx.is_isoc);
+        NT_ASSERT(!ctx.packed);
+
+        auto len = ctx.mdl_buf.size();
+
+        if (ctx.mdl_buf.next() || ctx.wsk_buf.Length != sizeof(ctx.hdr) + len) { // a chain is not compressed
+                return;
+        }
+
+        if (auto threshold = compress::threshold(ext, usb_type); !threshold || len < threshold || len > max_payload) {
+                return;
+        }
+
+        auto src = ctx.mdl_buf.sysaddr();
+        if (!src) {
+                return;
+        }
+
+        auto buf = ExAllocateFromLookasideListEx(&g_packed);
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "ExAllocateFromLookasideListEx error");
+                return; // send it as is
+        }
+
+        auto table = static_cast<unsigned int*>(buf);
+        auto frame = reinterpret_cast<UCHAR*>(table) + table_size;
+
+        auto n = static_cast<ULONG>(compress::pack(src, len, frame, table));
+
+        if (!n) {
+                free_packed(buf);
+                return;
+        } else if (ctx.mdl_packed = Mdl(frame, n); !ctx.mdl_packed || NT_ERROR(ctx.mdl_packed.prepare_nonpaged())) {
+                ctx.mdl_packed.reset();
+                free_packed(buf);
+                return;
+        }
+
+        ctx.packed = buf;
+        ctx.mdl_hdr.next(ctx.mdl_packed); // replaces the tie to mdl_buf, it is retained until the completion
+
+        ctx.wsk_buf.Length = sizeof(ctx.hdr) + n;
+        ctx.hdr.cmd_submit.transfer_flags |= RtlUlongByteSwap(compress::submit_flag);
+
+        TraceDbg("seqnum %u, %lu -> %lu bytes", RtlUlongByteSwap(ctx.hdr.seqnum), len, n);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::init_pack_list()
+{
+        if (g_initialized) {
+                return STATUS_ALREADY_INITIALIZED;
+        }
+
+        auto err = ExInitializeLookasideListEx(&g_packed, nullptr, nullptr,
+                                               NonPagedPoolNx, 0, packed_size, libdrv::unique_ptr::pooltag, 0);
+
+        g_initialized = !err;
+        return err;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::delete_pack_list()
+{
+        if (g_initialized) {
+                ExDeleteLookasideListEx(&g_packed);
+                g_initialized = false;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void *usbip::alloc_packed(_In_ size_t len)
+{
+        return len <= packed_size ? ExAllocateFromLookasideListEx(&g_packed) : nullptr;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::free_packed(_In_opt_ void *packed)
+{
+        if (packed) {
+                ExFreeToLookasideListEx(&g_packed, packed);
+        }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv/codeseg.h>
+#include <libdrv/wdf_cpp.h>
+
+#include <usbip/compress.h>
+
+/*
+ * Optional compression of transfer buffers, @see usbip/compress.h.
+ * It is offered in OP_REQ_IMPORT if a threshold is set in the registry, plain USB/IP is used
+ * if the server declines it. If it is not negotiated, the cost is a check for every CMD_SUBMIT OUT.
+ */
+namespace usbip
+{
+
+struct vhci_ctx;
+struct wsk_context;
+
+/*
+ * @see .inf, CompressControlMinimum, CompressBulkMinimum, CompressInterruptMinimum
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_compression(_Inout_ vhci_ctx &vhci);
+
+/*
+ * Buffers of pack_payload and received blocks are taken from a lookaside list,
+ * so they are not allocated for every PDU.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS init_pack_list();
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void delete_pack_list();
+
+/*
+ * @return buffer for a received LZ4 block, nullptr if it does not fit or if the allocation has failed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void *alloc_packed(_In_ size_t len);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_packed(_In_opt_ void *packed);
+
+/*
+ * Replaces the transfer buffer of CMD_SUBMIT OUT by a compressed frame if the payload shrinks.
+ * Is called after the header was converted to network byte order.
+ * @param usb_type of the endpoint, @see compress::threshold
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void pack_payload(_Inout_ wsk_context &ctx, _In_ const compress::extension &ext, _In_ unsigned int usb_type);
+
+} // namespace usbip
@@ -166,7 +166,8 @@ PAGED NTSTATUS usbip::init_device_attributes(
                 return err;
         }
 
-        return hash_location(attr.location_hash, attr);
+        attr.location_key = make_location_key(attr);
+        return STATUS_SUCCESS;
 }
 
 /**
@@ -15,6 +15,15 @@
 
 #include <initguid.h>
 #include <usbip\vhci.h>
+#include <usbip\event_journal.h>
+#include <usbip\reattach_wheel.h>
+#include <usbip\link_health.h>
+#include <usbip\socket_buffer.h>
+#include <usbip\thread_placement.h>
+#include <usbip\latency.h>
+#include <usbip\isoch_pacing.h>
+#include <usbip\coalesce.h>
+#include <usbip\compress.h>
 
 /*
  * Macro WDF_TYPE_NAME_TO_TYPE_INFO (see WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE)
@@ -29,6 +38,13 @@ namespace wsk
 namespace usbip
 {
 
+struct address_cache;
+struct server_table;
+struct urb_trace_ctx;
+struct latency_ctx;
+struct jitter_ctx;
+struct coalesce_ctx;
+
 /*
  * Context space for WDFDEVICE, Virtual Host Controller Interface.
  * The parent is WDFDRIVER.
@@ -41,9 +57,14 @@ struct vhci_ctx
         UDECXUSBDEVICE *devices; // do not access directly, functions must be used
         WDFSPINLOCK devices_lock;
 
+        UINT64 *port_generation; // [devices_cnt], generation of the last change of the port
+        UINT64 generation; // incremented when a port is claimed or reclaimed, protected by devices_lock
+        UINT64 first_generation; // constant
+
         LIST_ENTRY fileobjects; // @see fileobject_ctx::entry
         WDFQUEUE reads; // IRP_MJ_READ
         int events_subscribers; // SUM(fileobject_ctx::process_events)
+        event_journal<vhci::imported_device, vhci::state> events; // shared by subscribers, allocated for the first one
         WDFWAITLOCK events_lock;
 
         WDFIOTARGET target_self;
@@ -51,9 +72,35 @@ struct vhci_ctx
         unsigned int reattach_max_attempts; // constants
         unsigned int reattach_first_delay;
         unsigned int reattach_max_delay;
+        unsigned int reattach_max_concurrency;
+
+        reattach::scheduler reattach; // attach attempts of persistent devices, @see persistent.cpp
+        WDFTIMER reattach_timer;
+        UINT64 reattach_timer_due; // tick of reattach::scheduler, zero if the timer is not started
+        WDFSPINLOCK reattach_lock;
+        WDFWAITLOCK attach_history_lock; // @see remember_attach
+        UINT64 *attach_history; // [devices_cnt], location keys, the most recent first
+        ULONG attach_history_cnt;
+        bool attach_history_dirty; // is not written to the registry yet
+        WDFTIMER attach_history_timer;
+
+        address_cache *addr_cache; // resolved server names, @see resolver.h
+        WDFWAITLOCK addr_cache_lock;
+
+        server_table *servers; // liveness of servers, @see resolver.h
+        WDFSPINLOCK servers_lock;
+
+        unsigned int dead_peer_timeout; // constants, @see link_monitor.h
+        bool dead_peer_reconnect;
 
-        WDFCOLLECTION reattach_req; // WDFREQUEST
-        WDFSPINLOCK reattach_req_lock;
+        sockbuf::budget sockbuf_budget; // of all connections, @see adjust_socket_buffers
+        WDFSPINLOCK sockbuf_lock;
+
+        placement::config recv_placement; // constant, @see init_recv_thread_placement
+        compress::extension compress_offer; // constant, codecs is zero if it is not offered, @see init_compression
+
+        urb_trace_ctx *urb_trace; // not null if the trace is enabled, @see urb_trace.h
+        WDFMEMORY urb_trace_mem; // child of the vhci, holds urb_trace_ctx
 
         LONG removing; // use set_flag/get_flag
 };
@@ -73,6 +120,7 @@ bool is_valid_port(_In_ const vhci_ctx &ctx, _In_ int port);
 
 struct wsk_context;
 struct device_ctx;
+struct capture_ctx;
 
 struct device_attributes
 {
@@ -80,7 +128,7 @@ struct device_attributes
         UNICODE_STRING node_name;
         UNICODE_STRING service_name;
         UNICODE_STRING busid;
-        ULONG location_hash; // hash(node_name,service_name,busid)
+        UINT64 location_key; // @see usbip/location_key.h
         //
         vhci::imported_device_properties properties; // for ioctl::get_imported_devices
 };
@@ -103,12 +151,13 @@ struct device_ctx_ext
         wsk::SOCKET *sock;
 
         device_attributes attr;
+        compress::extension compression; // negotiated in OP_REQ_IMPORT, codecs is zero for plain USB/IP
 
         auto node_name() { return &attr.node_name; }
         auto service_name() { return &attr.service_name; }
         auto busid() { return &attr.busid; }
 
-        auto location_hash() const { return attr.location_hash; }
+        auto location_key() const { return attr.location_key; }
         auto& properties() { return attr.properties; }
 };
 
@@ -156,6 +205,33 @@ struct device_ctx
         SLIST_HEADER pending_sends;
         LONG sending;
 
+        capture_ctx *capture; // not null if the capture is enabled, @see capture.h
+        WDFMEMORY capture_mem; // child of the device, holds capture_ctx
+
+        latency_ctx *latency; // not null if URBs are sampled, @see latency.h
+        WDFMEMORY latency_mem; // child of the device, holds latency_ctx
+
+        isoch::frame_clock frame_clock; // constant, URB_FUNCTION_GET_CURRENT_FRAME_NUMBER, @see isoch_pacing.h
+        jitter_ctx *jitter; // not null if isochronous IN endpoints are paced
+        WDFMEMORY jitter_mem; // child of the device, holds jitter_ctx
+
+        coalesce_ctx *coalesce; // not null if interrupt IN resubmits are held, @see coalesce.h
+        WDFMEMORY coalesce_mem; // child of the device, holds coalesce_ctx
+        coalesce::counters overhead;
+
+        // dead peer detection, @see link_monitor.h
+        WDFTIMER link_timer;
+        LONG64 last_recv; // KeQueryInterruptTime of the last USBIP_RET_*
+        link::rtt_estimator rtt; // microseconds, updated by the receive thread
+        link::rtt_estimator net_rtt; // of pings, microseconds, updated by the receive thread
+        LONG64 ping_time; // KeQueryInterruptTime of the last ping, @see send_cmd_unlink_ping
+        LONG ping_seqnum; // of the last ping that is not answered yet, zero if none
+        link::health health; // accessed by link_timer only
+        link::probe probe; // accessed by link_timer only
+        unsigned int link_ticks;
+        size_t sockbuf; // SO_SNDBUF and SO_RCVBUF, zero if the defaults of the stack are used
+
+        LONG endpoint_types; // bit mask of (1 << USBD_PIPE_TYPE) of added endpoints, @see apply_placement
         LONG unplugged; // initiated detach that may still be ongoing, use set_flag/get_flag
         bool ep0_added;
 };
@@ -201,10 +277,20 @@ inline auto& get_endpoint(_In_ WDFQUEUE queue)
  */
 struct request_ctx
 {
+        // the receive thread reads them for every item of device_ctx::requests, @see remove_request
         LIST_ENTRY entry; // head is device_ctx::requests
-        UDECXUSBENDPOINT endpoint;
         seqnum_t seqnum;
-        bool cancelable;
+
+        // accessed once per request
+        UDECXUSBENDPOINT endpoint;
+        LONG state; // request_state::state, @see usbip/request_state.h
+        ULONGLONG send_time; // KeQueryInterruptTime, zero if the server can delay the response
+        LONG64 stamp[latency::point_count]; // KeQueryPerformanceCounter, zero if not sampled, @see latency.h
+
+        // isochronous IN URB, @see isoch_pacing.h
+        ULONGLONG isoch_end; // frame after the last one of the URB, zero if it is not paced
+        ULONGLONG isoch_release; // frame to complete the held URB in
+        NTSTATUS held_status; // to complete the held URB with
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(request_ctx, get_request_ctx)
 
@@ -236,8 +322,9 @@ inline auto get_vhci(_In_ WDFREQUEST Request)
 struct fileobject_ctx
 {
         LIST_ENTRY entry; // head is vhci_ctx::fileobjects
-        WDFCOLLECTION events; // WDFMEMORY(device_state_ex) that are waiting for IRP_MJ_READ
+        UINT64 events_seqnum; // of the next event to read, @see vhci_ctx::events
         bool process_events; // if IRP_MJ_READ was issued, see vhci_ctx::events_subscribers
+        ULONG events_version; // @see vhci::ioctl::set_device_state_version
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(fileobject_ctx, get_fileobject_ctx)
 
@@ -254,10 +341,6 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 seqnum_t next_seqnum(_Inout_ device_ctx &dev, _In_ bool dir_in);
 
-constexpr auto extract_num(seqnum_t seqnum) { return seqnum >> 1; }
-constexpr auto extract_dir(seqnum_t seqnum) { return usbip::direction(seqnum & 1); }
-constexpr bool is_valid_seqnum(seqnum_t seqnum) { return extract_num(seqnum); }
-
 constexpr UINT32 make_devid(UINT16 busnum, UINT16 devnum)
 {
         return (busnum << 16) | devnum;
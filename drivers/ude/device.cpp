@@ -15,6 +15,9 @@
 #include "device_ioctl.h"
 #include "request_list.h"
 #include "endpoint_list.h"
+#include "link_monitor.h"
+#include "isoch_pacing.h"
+#include "coalesce.h"
 
 #include <libdrv/lists.h>
 #include <libdrv/dbgcommon.h>
@@ -77,11 +80,12 @@ PAGED void device_cleanup(_In_ WDFOBJECT Object)
 }
 
 /*
+ * @param deadline the value of KeQueryInterruptTime, the wait does not last longer
  * @return object_reference defer dereference of receive thread if it executes this function
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto recv_thread_join(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
+PAGED auto recv_thread_join(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev, _In_ ULONGLONG deadline)
 {
         PAGED_CODE();
         wdm::object_reference thread(InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.recv_thread), nullptr), false);
@@ -97,7 +101,10 @@ PAGED auto recv_thread_join(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
         NT_ASSERT(get_flag(dev.unplugged)); // thread checks it
         TraceDbg("dev %04x", ptr04x(device));
 
-        if (auto timeout = make_timeout(1*wdm::minute, wdm::period::relative);
+        auto now = KeQueryInterruptTime();
+        auto remaining = deadline > now ? static_cast<LONGLONG>(deadline - now) : 0; // zero polls the thread
+
+        if (auto timeout = make_timeout(remaining, wdm::period::relative);
             auto err = KeWaitForSingleObject(thread.get(), Executive, KernelMode, false, &timeout)) {
                 Trace(TRACE_LEVEL_ERROR, "dev %04x, KeWaitForSingleObject %!STATUS!", ptr04x(device), err);
         } else {
@@ -179,7 +186,11 @@ void endpoint_purge(_In_ UDECXUSBENDPOINT endpoint)
         TraceDbg("dev %04x, endp %04x, queue %04x", ptr04x(endp.device), ptr04x(endpoint), ptr04x(endp.queue));
 
         while (auto request = device::remove_request(dev, endpoint)) {
-                device::send_cmd_unlink_and_cancel(endp.device, request);
+                device::unlink_and_cancel(endp.device, request);
+        }
+
+        if (auto &d = endp.descriptor; usb_endpoint_type(d) == UsbdPipeTypeIsochronous && usb_endpoint_dir_in(d)) {
+                jitter_flush(dev, usb_endpoint_num(d)); // WdfIoQueuePurge waits for held requests
         }
 
         auto purge_complete = [] ([[maybe_unused]] auto queue, auto ctx) // EVT_WDF_IO_QUEUE_STATE
@@ -370,6 +381,8 @@ PAGED NTSTATUS endpoint_add(_In_ UDECXUSBDEVICE device, _In_ UDECX_USB_ENDPOINT_
                 dev.ep0_added = true;
         }
 
+        InterlockedOr(&dev.endpoint_types, 1L << usb_endpoint_type(epd)); // the receive thread checks it
+
         if (auto dispatch = usb_endpoint_type(epd) == UsbdPipeTypeControl ?
                             WdfIoQueueDispatchSequential : WdfIoQueueDispatchParallel;
             auto err = create_endpoint_queue(endp.queue, endpoint, dispatch)) {
@@ -546,8 +559,9 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
 
         InitializeListHead(&dev.requests);
         InitializeSListHead(&dev.pending_sends);
+        init_frame_clock(dev.frame_clock);
 
-        return STATUS_SUCCESS;
+        return create_link_monitor(device, dev);
 }
 
 _IRQL_requires_same_
@@ -729,6 +743,8 @@ PAGED NTSTATUS usbip::device::recv_thread_start(_In_ UDECXUSBDEVICE device)
         NT_VERIFY(!InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev->recv_thread), thread));
         NT_VERIFY(NT_SUCCESS(ZwClose(handle)));
 
+        start_link_monitor(*dev);
+
         TraceDbg("dev %04x", ptr04x(device));
         return STATUS_SUCCESS;
 }
@@ -776,14 +792,29 @@ PAGED wdm::object_reference usbip::device::detach(
         _In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete, _In_ bool reattach)
 {
         PAGED_CODE();
-        wdm::object_reference thread;
 
+        if (!disconnect(device)) {
+                return wdm::object_reference();
+        }
+
+        auto deadline = KeQueryInterruptTime() + 1*wdm::minute;
+        return finish_detach(device, plugout_and_delete, reattach, deadline);
+}
+
+/*
+ * The first phase of detach, it does not wait.
+ * @return false if the device is already unplugged
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED bool usbip::device::disconnect(_In_ UDECXUSBDEVICE device)
+{
+        PAGED_CODE();
         auto &dev = *get_device_ctx(device);
-        auto vhci = dev.vhci;
 
         if (set_flag(dev.unplugged)) {
                 TraceDbg("dev %04x, already unplugged", ptr04x(device));
-                return thread;
+                return false;
         }
 
         if (close_socket(dev.sock())) {
@@ -791,7 +822,27 @@ PAGED wdm::object_reference usbip::device::detach(
                 device_state_changed(dev, vhci::state::disconnected);
         }
 
-        thread = recv_thread_join(device, dev);
+        return true;
+}
+
+/*
+ * The second phase of detach, must be called once after disconnect returned true.
+ * @param deadline the value of KeQueryInterruptTime, see recv_thread_join
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED wdm::object_reference usbip::device::finish_detach(
+        _In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete, _In_ bool reattach, _In_ ULONGLONG deadline)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        auto vhci = dev.vhci;
+
+        stop_link_monitor(dev);
+        auto thread = recv_thread_join(device, dev, deadline);
+        stop_jitter_buffer(dev);
+        stop_coalescing(dev);
 
         auto port = vhci::reclaim_roothub_port(device);
         if (port) {
@@ -39,6 +39,19 @@ _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED wdm::object_reference detach(_In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete, _In_ bool reattach = false);
 
+/*
+ * detach is split into two phases to detach many devices in parallel,
+ * disconnect all of them, then call finish_detach for each with the same deadline.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED bool disconnect(_In_ UDECXUSBDEVICE device);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED wdm::object_reference finish_detach(
+        _In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete, _In_ bool reattach, _In_ ULONGLONG deadline);
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 inline auto detach_and_delete(_In_ UDECXUSBDEVICE device, _In_ bool reattach = false)
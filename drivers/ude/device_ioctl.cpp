@@ -14,6 +14,12 @@
 #include "proto.h"
 #include "network.h"
 #include "ioctl.h"
+#include "capture.h"
+#include "urb_trace.h"
+#include "latency.h"
+#include "isoch_pacing.h"
+#include "coalesce.h"
+#include "compress.h"
 
 #include "filter_request.h"
 #include <ude_filter/request.h>
@@ -29,6 +35,8 @@
 #include <libdrv/dbgcommon.h>
 #include <libdrv/usbd_helper.h>
 
+#include <usbip/submit.h>
+
 #include <ntstrsafe.h>
 
 namespace
@@ -56,18 +64,17 @@ NTSTATUS send_complete(_In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_I
         TraceWSK("req %04x -> wsk irp %04x, %!STATUS!, Information %Iu", 
                   ptr04x(request), ptr04x(wsk_irp), wsk.Status, wsk.Information);
 
-        if (!request) {
-                // nothing to do
-        } else if (NT_SUCCESS(wsk.Status)) {
-                ++dev.sent_requests;
-                if (auto seqnum = ctx.seqnum(true); auto err = device::mark_request_cancelable(dev, seqnum)) {
-                        auto device = get_handle(&dev);
-                        device::send_cmd_unlink_and_complete(device, request, err);
+        if (request) {
+                device::request_sent(dev, request, wsk.Status);
+        }
+
+        for (auto g = ctx->gathered; g; ) { // their IRPs were not used
+                wsk_context_ptr p(g, true);
+                g = g->gathered;
+
+                if (auto r = p->request) {
+                        device::request_sent(dev, r, wsk.Status);
                 }
-        } else if (device::remove_request(dev, request, false)) {
-                complete(request, wsk.Status);
-        } else {
-                TraceDbg("req %04x not found, could not complete", ptr04x(request));
         }
 
         if (wsk.Status == STATUS_FILE_FORCED_CLOSED && !get_flag(dev.unplugged)) {
@@ -111,36 +118,43 @@ auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void send_pending(_Inout_ device_ctx &dev)
+inline auto header_only(_In_ const wsk_context &ctx)
 {
-        if (InterlockedExchange(&dev.sending, true)) {
-                return; // the other thread won the race
-        }
+        return ctx.wsk_buf.Mdl == ctx.mdl_hdr.get() && !ctx.mdl_hdr.next();
+}
 
-        do {
-                for (auto entry = libdrv::reverse(InterlockedFlushSList(&dev.pending_sends)); entry; ) {
+/*
+ * PDUs that consist of a header only (CMD_SUBMIT of IN transfers, CMD_UNLINK) and follow each other
+ * are sent by one WskSend, their MDLs are chained to the MDL of the first one.
+ * This is what makes coalesced interrupt IN resubmits a single TCP segment.
+ *
+ * @param entry the next pending PDU
+ * @return the PDU after the gathered ones
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto gather(_Inout_ wsk_context &ctx, _Inout_ WSK_BUF &buf, _In_opt_ SLIST_ENTRY *entry)
+{
+        ctx.gathered = nullptr;
 
-                        auto &ctx = *CONTAINING_RECORD(entry, wsk_context, entry);
-                        {
-                                auto nxt = entry->Next;
-                                entry->Next = nullptr;
-                                entry = nxt;
-                        }
-                        auto req = ctx.request;
-                        auto irp = ctx.wsk_irp.get();
+        auto is_header_only = [] (auto &e) { return header_only(*CONTAINING_RECORD(&e, wsk_context, entry)); };
 
-                        auto buf = ctx.wsk_buf;
-                        ctx.wsk_buf = WSK_BUF{};
+        auto join = [&buf] (auto &prev, auto &e)
+        {
+                auto &last = *CONTAINING_RECORD(&prev, wsk_context, entry);
+                auto &g = *CONTAINING_RECORD(&e, wsk_context, entry);
 
-                        auto st = send(dev.sock(), &buf, WSK_FLAG_NODELAY, irp);
+                g.entry.Next = nullptr;
 
-                        TraceWSK("req %04x -> wsk irp %04x, %Iu bytes, %!STATUS!",
-                                  ptr04x(req), ptr04x(irp), buf.Length, st);
-                }
+                buf.Length += g.wsk_buf.Length;
+                g.wsk_buf = WSK_BUF{};
 
-                InterlockedExchange(&dev.sending, false);
+                last.mdl_hdr.next(g.mdl_hdr.get()); // prepare_wsk_buf replaces the tie
+                last.gathered = &g;
+                g.gathered = nullptr;
+        };
 
-        } while (!(libdrv::empty(&dev.pending_sends) || InterlockedExchange(&dev.sending, true)));
+        return coalesce::gather(ctx.entry, entry, is_header_only, join);
 }
 
 /*
@@ -156,27 +170,58 @@ void send_pending(_Inout_ device_ctx &dev)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto send(_In_opt_ UDECXUSBENDPOINT endpoint, _Inout_ wsk_context_ptr &ctx, _Inout_ device_ctx &dev,
-        _In_ bool log_setup, _Inout_opt_ const URB* transfer_buffer = nullptr)
+        _Inout_opt_ const URB* transfer_buffer = nullptr)
 {
         auto request = ctx->request; // can be WDF_NO_HANDLE, do not access after send
 
         if (auto &buf = ctx->wsk_buf; auto err = prepare_wsk_buf(buf, *ctx, transfer_buffer)) {
                 return err;
         } else {
-                char str[DBG_USBIP_HDR_BUFSZ];
-                TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x -> %Iu%s",
-                        ptr04x(request), buf.Length, dbg_usbip_hdr(str, sizeof(str), &ctx->hdr, log_setup));
+                auto &hdr = ctx->hdr;
+                TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x -> %Iu, %!usbip_request_type!, seqnum %u, ep %u, %!usbip_dir!",
+                        ptr04x(request), buf.Length, hdr.command, hdr.seqnum, hdr.ep, hdr.direction);
         }
 
-        if (request && endpoint) {
-                device::append_request(dev, *ctx, endpoint);
+        auto coalescible = false;
+
+        if (!(request && endpoint)) {
+                // not a submit
+        } else if (auto err = device::append_request(dev, *ctx, endpoint)) {
+                return err;
+        } else if (is_interrupt_in(*get_endpoint_ctx(endpoint))) {
+                InterlockedIncrement64(reinterpret_cast<LONG64*>(&dev.overhead.interrupt_submits));
+                coalescible = true;
+        }
+
+        if (auto t = get_vhci_ctx(dev.vhci)->urb_trace) [[unlikely]] {
+                urb_trace_log(*t, dev.port, ctx->hdr, request);
         }
 
         byteswap_header(ctx->hdr, swap_dir::host2net);
+
+        if (auto cap = dev.capture) [[unlikely]] {
+                capture_sent(*cap, ctx->wsk_buf); // uncompressed
+        }
+
+        if (endpoint && ctx->mdl_buf && !ctx->is_isoc) { // CMD_SUBMIT OUT
+                if (auto &ext = dev.ext().compression; ext.codecs) [[unlikely]] {
+                        pack_payload(*ctx, ext, usb_endpoint_type(get_endpoint_ctx(endpoint)->descriptor));
+                }
+        }
+
+        if (request && endpoint) {
+                latency_stamp(*get_request_ctx(request), latency::queued);
+        }
+
         IoSetCompletionRoutine(ctx->wsk_irp.get(), send_complete, ctx.get(), true, true, true);
 
+        if (auto c = dev.coalesce; c && coalesce_hold(dev, *c, *ctx, coalescible)) [[unlikely]] {
+                ctx.release(); // will be sent when the window is closed
+                return STATUS_PENDING;
+        }
+
         InterlockedPushEntrySList(&dev.pending_sends, &ctx.release()->entry);
-        send_pending(dev);
+        device::send_pending(dev);
 
         return STATUS_PENDING;
 }
@@ -259,17 +304,10 @@ auto control_transfer(
                 return err;
         }
 
-        {
-                char buf_flags[USBD_TRANSFER_FLAGS_BUFBZ];
-                char buf_setup[USB_SETUP_PKT_STR_BUFBZ];
-
-                TraceUrb("req %04x -> PipeHandle %04x, %s, TransferBufferLength %lu, Timeout %lu, %s",
-                        ptr04x(request), ptr04x(r.PipeHandle),
-                        usbd_transfer_flags(buf_flags, sizeof(buf_flags), r.TransferFlags),
-                        r.TransferBufferLength,
-                        urb.UrbHeader.Function == URB_FUNCTION_CONTROL_TRANSFER_EX ? r.Timeout : 0,
-                        usb_setup_pkt_str(buf_setup, sizeof(buf_setup), r.SetupPacket));
-        }
+        TraceUrb("req %04x -> PipeHandle %04x, TransferFlags %#lx, TransferBufferLength %lu, Timeout %lu, SetupPacket%!BIN!",
+                ptr04x(request), ptr04x(r.PipeHandle), r.TransferFlags, r.TransferBufferLength,
+                urb.UrbHeader.Function == URB_FUNCTION_CONTROL_TRANSFER_EX ? r.Timeout : 0,
+                WppBinary(r.SetupPacket, sizeof(r.SetupPacket)));
 
         auto buf_len = r.TransferBufferLength;
         auto &pkt = get_setup_packet(r); // @see UdecxUrbRetrieveControlSetupPacket
@@ -303,7 +341,7 @@ auto control_transfer(
         static_assert(sizeof(ctx->hdr.cmd_submit.setup) == sizeof(pkt));
         RtlCopyMemory(ctx->hdr.cmd_submit.setup, &pkt, sizeof(pkt));
 
-        return send(endpoint, ctx, dev, true, &urb);
+        return send(endpoint, ctx, dev, &urb);
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -321,14 +359,9 @@ auto bulk_or_interrupt_transfer(
                 endp.PipeHandle = r.PipeHandle;
         }
 
-        {
-                auto func = urb.UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER_USING_CHAINED_MDL ? ", MDL" : " ";
-                char buf[USBD_TRANSFER_FLAGS_BUFBZ];
-
-                TraceUrb("req %04x -> PipeHandle %04x, %s, TransferBufferLength %lu%s",
-                        ptr04x(request), ptr04x(r.PipeHandle), usbd_transfer_flags(buf, sizeof(buf), r.TransferFlags),
-                        r.TransferBufferLength, func);
-        }
+        TraceUrb("req %04x -> PipeHandle %04x, TransferFlags %#lx, TransferBufferLength %lu%s",
+                ptr04x(request), ptr04x(r.PipeHandle), r.TransferFlags, r.TransferBufferLength,
+                urb.UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER_USING_CHAINED_MDL ? ", MDL" : "");
 
         wsk_context_ptr ctx(&dev, request);
         if (!ctx) {
@@ -339,41 +372,59 @@ auto bulk_or_interrupt_transfer(
                 return err;
         }
 
-        return send(endpoint, ctx, dev, false, &urb);
+        return send(endpoint, ctx, dev, &urb);
 }
 
 /*
- * USBD_ISO_PACKET_DESCRIPTOR.Length is not used (zero) for USB_DIR_OUT transfer.
+ * @see submit::repack
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto repack(_In_ iso_packet_descriptor *d, _In_ const _URB_ISOCH_TRANSFER &r)
 {
-        ULONG length = 0;
-
-        for (ULONG i = 0; i < r.NumberOfPackets; ++d) {
-
-                auto offset = r.IsoPacket[i].Offset;
-                auto next_offset = ++i < r.NumberOfPackets ? r.IsoPacket[i].Offset : r.TransferBufferLength;
-
-                if (next_offset >= offset && next_offset <= r.TransferBufferLength) {
-                        d->offset = offset;
-                        d->length = next_offset - offset;
-                        d->actual_length = 0;
-                        d->status = 0;
-                        length += d->length;
-                } else {
-                        Trace(TRACE_LEVEL_ERROR, "[%lu] next_offset(%lu) >= offset(%lu) && next_offset <= r.TransferBufferLength(%lu)",
-                                i, next_offset, offset, r.TransferBufferLength);
-                        return STATUS_INVALID_PARAMETER;
-                }
+        auto cnt = r.NumberOfPackets;
+
+        if (auto i = submit::repack(d, r.IsoPacket, cnt, r.TransferBufferLength); i < cnt) {
+                auto next_offset = i + 1 < cnt ? r.IsoPacket[i + 1].Offset : r.TransferBufferLength;
+                Trace(TRACE_LEVEL_ERROR, "[%lu] next_offset(%lu) >= offset(%lu) && next_offset <= r.TransferBufferLength(%lu)",
+                        i + 1, next_offset, r.IsoPacket[i].Offset, r.TransferBufferLength);
+                return STATUS_INVALID_PARAMETER;
         }
 
-        NT_ASSERT(length == r.TransferBufferLength);
+        NT_ASSERT(!cnt || !r.IsoPacket[0].Offset); // SUM(length) == TransferBufferLength
         return STATUS_SUCCESS;
 }
 
 /*
- * USBD_START_ISO_TRANSFER_ASAP is appended because URB_GET_CURRENT_FRAME_NUMBER is not implemented.
+ * USBD_START_ISO_TRANSFER_ASAP is appended because frames of the server are not related to the frame clock
+ * of the device.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto send_isoch(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ const endpoint_ctx &endp,
+        _Inout_ wsk_context_ptr &ctx, _In_ URB &urb)
+{
+        auto &r = urb.UrbIsochronousTransfer;
+
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, 
+                               r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP, r.TransferBufferLength)) {
+                return err;
+        }
+
+        if (auto err = repack(ctx->isoc, r)) {
+                return err;
+        }
+
+        if (auto cmd = &ctx->hdr.cmd_submit) {
+                cmd->start_frame = r.StartFrame;
+                cmd->number_of_packets = r.NumberOfPackets;
+        }
+
+        return send(endpoint, ctx, dev, &urb);
+}
+
+/*
+ * StartFrame is assigned by the clock if the endpoint is paced, @see jitter_schedule.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
@@ -388,18 +439,10 @@ auto isoch_transfer(
                 endp.PipeHandle = r.PipeHandle;
         }
 
-        {
-                const char *func = urb.UrbHeader.Function == URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL ? ", MDL" : " ";
-                char buf[USBD_TRANSFER_FLAGS_BUFBZ];
-                TraceUrb("req %04x -> PipeHandle %04x, %s, TransferBufferLength %lu, StartFrame %lu, NumberOfPackets %lu, ErrorCount %lu%s",
-                        ptr04x(request), ptr04x(r.PipeHandle),
-                        usbd_transfer_flags(buf, sizeof(buf), r.TransferFlags),
-                        r.TransferBufferLength,
-                        r.StartFrame,
-                        r.NumberOfPackets,
-                        r.ErrorCount,
-                        func);
-        }
+        TraceUrb("req %04x -> PipeHandle %04x, TransferFlags %#lx, TransferBufferLength %lu, StartFrame %lu, NumberOfPackets %lu, ErrorCount %lu%s",
+                ptr04x(request), ptr04x(r.PipeHandle), r.TransferFlags, r.TransferBufferLength,
+                r.StartFrame, r.NumberOfPackets, r.ErrorCount,
+                urb.UrbHeader.Function == URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL ? ", MDL" : "");
 
         if (r.NumberOfPackets > max_iso_packets) {
                 Trace(TRACE_LEVEL_ERROR, "NumberOfPackets(%lu) > USBIP_MAX_ISO_PACKETS(%d)", 
@@ -412,21 +455,31 @@ auto isoch_transfer(
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, 
-                               r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP, r.TransferBufferLength)) {
-                return err;
-        }
+        isoch::slot slot{};
+        auto paced = jitter_schedule(dev, endp, *get_request_ctx(request), r, slot);
 
-        if (auto err = repack(ctx->isoc, r)) {
-                return err;
-        }
+        auto st = send_isoch(dev, endpoint, endp, ctx, urb); // request can be completed already if it was sent
 
-        if (auto cmd = &ctx->hdr.cmd_submit) {
-                cmd->start_frame = r.StartFrame;
-                cmd->number_of_packets = r.NumberOfPackets;
+        if (paced) {
+                jitter_commit(dev, endp, slot, NT_SUCCESS(st));
         }
 
-        return send(endpoint, ctx, dev, false, &urb);
+        return st;
+}
+
+/*
+ * The frame is not sent to the server, it is the frame of the virtual clock of the device.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(urb_function_t)
+auto get_current_frame_number(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT, _In_ endpoint_ctx&, _In_ WDFREQUEST request, _In_ URB &urb)
+{
+        auto &r = urb.UrbGetCurrentFrameNumber;
+        r.FrameNumber = static_cast<ULONG>(current_frame(dev));
+
+        TraceUrb("req %04x -> FrameNumber %lu", ptr04x(request), r.FrameNumber);
+        return STATUS_SUCCESS;
 }
 
 /*
@@ -459,6 +512,10 @@ auto usb_submit_urb(
                 return err;
         }
 
+        auto &req = *get_request_ctx(request); // is not zeroed
+        latency_arrive(dev, req);
+        req.isoch_end = 0; // jitter_schedule sets it
+
         auto &urb = get_urb(request);
         urb_function_t *handler{};
 
@@ -475,6 +532,9 @@ auto usb_submit_urb(
         case URB_FUNCTION_CONTROL_TRANSFER:
                 handler = control_transfer;
                 break;
+        case URB_FUNCTION_GET_CURRENT_FRAME_NUMBER:
+                handler = get_current_frame_number;
+                break;
         default:
                 Trace(TRACE_LEVEL_ERROR, "%s(%#04x), dev %04x, endp %04x", urb_function_str(func), func, 
                                           ptr04x(endp.device), ptr04x(endpoint));
@@ -500,6 +560,12 @@ auto send_ep0_out(
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
+        if (request) {
+                auto &req = *get_request_ctx(request);
+                latency_arrive(dev, req);
+                req.isoch_end = 0;
+        }
+
         auto &ep0 = *get_endpoint_ctx(dev.ep0);
         const ULONG TransferFlags = USBD_DEFAULT_PIPE_TRANSFER | USBD_TRANSFER_DIRECTION_OUT;
 
@@ -513,12 +579,55 @@ auto send_ep0_out(
                 NT_ASSERT(is_transfer_dir_out(r));
         }
 
-        return ::send(dev.ep0, ctx, dev, true);
+        return ::send(dev.ep0, ctx, dev);
 }
 
 } // namespace
 
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::send_pending(_Inout_ device_ctx &dev)
+{
+        if (InterlockedExchange(&dev.sending, true)) {
+                return; // the other thread won the race
+        }
+
+        do {
+                for (auto entry = libdrv::reverse(InterlockedFlushSList(&dev.pending_sends)); entry; ) {
+
+                        auto &ctx = *CONTAINING_RECORD(entry, wsk_context, entry);
+                        {
+                                auto nxt = entry->Next;
+                                entry->Next = nullptr;
+                                entry = nxt;
+                        }
+                        auto req = ctx.request;
+                        auto irp = ctx.wsk_irp.get();
+
+                        auto buf = ctx.wsk_buf;
+                        entry = gather(ctx, buf, entry);
+                        ctx.wsk_buf = WSK_BUF{};
+
+                        for (auto c = &ctx; c; c = c->gathered) {
+                                if (auto r = c->request) { // is referenced, @see append_request
+                                        latency_stamp(*get_request_ctx(r), latency::sent);
+                                }
+                                ++dev.overhead.pdus_sent;
+                        }
+                        ++dev.overhead.sends;
+
+                        auto st = wsk::send(dev.sock(), &buf, WSK_FLAG_NODELAY, irp);
+
+                        TraceWSK("req %04x -> wsk irp %04x, %Iu bytes, %!STATUS!",
+                                  ptr04x(req), ptr04x(irp), buf.Length, st);
+                }
+
+                InterlockedExchange(&dev.sending, false);
+
+        } while (!(libdrv::empty(&dev.pending_sends) || InterlockedExchange(&dev.sending, true)));
+}
+
  /*
   * There is a race condition between IRP cancelation and RET_SUBMIT.
   * Sequence of events:
@@ -549,7 +658,7 @@ void usbip::device::send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In
                 TraceDbg("Unplugged, do not send unlink");
         } else if (auto ctx = wsk_context_ptr(&dev, WDFREQUEST(WDF_NO_HANDLE))) {
                 set_cmd_unlink_usbip_header(ctx->hdr, dev, req.seqnum);
-                ::send(WDF_NO_HANDLE, ctx, dev, false); // ignore error
+                ::send(WDF_NO_HANDLE, ctx, dev); // ignore error
         } else {
                 Trace(TRACE_LEVEL_ERROR, "dev %04x, seqnum %u, wsk_context_ptr error", ptr04x(device), req.seqnum);
         }
@@ -557,6 +666,27 @@ void usbip::device::send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In
         complete(request, status);
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::send_cmd_unlink_ping(_In_ UDECXUSBDEVICE device)
+{
+        auto &dev = *get_device_ctx(device);
+
+        if (get_flag(dev.unplugged)) {
+                TraceDbg("Unplugged, do not send unlink");
+        } else if (auto ctx = wsk_context_ptr(&dev, WDFREQUEST(WDF_NO_HANDLE))) {
+                auto seqnum = next_seqnum(dev, false); // is not used by any request
+                set_cmd_unlink_usbip_header(ctx->hdr, dev, seqnum);
+
+                InterlockedExchange64(&dev.ping_time, KeQueryInterruptTime()); // @see link_response_received
+                InterlockedExchange(&dev.ping_seqnum, static_cast<LONG>(seqnum));
+
+                ::send(WDF_NO_HANDLE, ctx, dev); // ignore error
+        } else {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, wsk_context_ptr error", ptr04x(device));
+        }
+}
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 USB_DEFAULT_PIPE_SETUP_PACKET usbip::device::make_set_configuration(_In_ UCHAR ConfigurationValue)
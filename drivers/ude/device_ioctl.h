@@ -10,9 +10,21 @@
 #include <wdfusb.h>
 #include <UdeCx.h>
 
+namespace usbip
+{
+        struct device_ctx;
+}
+
 namespace usbip::device
 {
 
+/*
+ * Sends device_ctx::pending_sends, WskSend calls of a device are serialized.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send_pending(_Inout_ device_ctx &dev);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request, _In_ NTSTATUS status);
@@ -24,6 +36,13 @@ inline void send_cmd_unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUE
         send_cmd_unlink_and_complete(device, request, STATUS_CANCELLED);
 }
 
+/*
+ * CMD_UNLINK of a request that was never submitted, the server replies with RET_UNLINK at once.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send_cmd_unlink_ping(_In_ UDECXUSBDEVICE device);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 USB_DEFAULT_PIPE_SETUP_PACKET make_set_configuration(_In_ UCHAR ConfigurationValue);
@@ -9,6 +9,7 @@
 
 #include "context.h"
 #include "wsk_context.h"
+#include "compress.h"
 
 #include <libdrv\wsk_cpp.h>
 
@@ -29,6 +30,7 @@ PAGED void driver_cleanup(_In_ WDFOBJECT Object)
 
 	wsk::shutdown();
 	delete_wsk_context_list();
+	delete_pack_list();
 
 	auto drvobj = WdfDriverWdmGetDriverObject(drv);
 	WPP_CLEANUP(drvobj);
@@ -62,6 +64,11 @@ CS_INIT auto init()
 		return err;
 	}
 
+	if (auto err = init_pack_list()) {
+		Trace(TRACE_LEVEL_CRITICAL, "ExInitializeLookasideListEx %!STATUS!", err);
+		return err;
+	}
+
 	if (auto err = wsk::initialize()) {
 		Trace(TRACE_LEVEL_CRITICAL, "WskRegister %!STATUS!", err);
 		return err;
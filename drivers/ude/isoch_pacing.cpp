@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "isoch_pacing.h"
+#include "trace.h"
+#include "isoch_pacing.tmh"
+
+#include "wsk_receive.h"
+#include <libdrv/ch9.h>
+
+namespace
+{
+
+using namespace usbip;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto& get_jitter_ctx(_In_ WDFMEMORY mem)
+{
+        return *static_cast<jitter_ctx*>(WdfMemoryGetBuffer(mem, nullptr));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto endpoint_num(_In_ const request_ctx &req)
+{
+        return usb_endpoint_num(get_endpoint_ctx(req.endpoint)->descriptor);
+}
+
+/*
+ * The timer expires in the first tick of the frame.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void start_timer(_In_ const device_ctx &dev, _In_ jitter_ctx &ctx, _In_ ULONGLONG frame)
+{
+        auto &clock = dev.frame_clock;
+        auto ticks = clock.ticks(frame) - KeQueryPerformanceCounter(nullptr).QuadPart;
+
+        auto usec = ticks > 0 ? static_cast<ULONGLONG>(ticks)*1'000'000/clock.frequency : 0;
+        WdfTimerStart(ctx.timer, WDF_REL_TIMEOUT_IN_US(usec ? usec : 1));
+}
+
+/*
+ * @param frame complete requests which frames have come
+ * @param endpoint number, complete all its requests if not zero
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void complete_held(_In_ device_ctx &dev, _Inout_ jitter_ctx &ctx, _In_ ULONGLONG frame, _In_ ULONG endpoint)
+{
+        LIST_ENTRY due;
+        InitializeListHead(&due);
+
+        {
+                wdf::Lock lck(ctx.lock);
+
+                for (auto head = &ctx.held, entry = head->Flink; entry != head; ) {
+
+                        auto req = CONTAINING_RECORD(entry, request_ctx, entry);
+                        entry = entry->Flink;
+
+                        if (req->isoch_release <= frame || (endpoint && endpoint_num(*req) == endpoint)) {
+                                RemoveEntryList(&req->entry);
+                                InsertTailList(&due, &req->entry);
+                        } else if (!endpoint) {
+                                break; // the list is sorted
+                        }
+                }
+
+                if (auto head = &ctx.held; !IsListEmpty(head)) {
+                        start_timer(dev, ctx, CONTAINING_RECORD(head->Flink, request_ctx, entry)->isoch_release);
+                }
+        }
+
+        while (!IsListEmpty(&due)) {
+                auto req = CONTAINING_RECORD(RemoveHeadList(&due), request_ctx, entry);
+                complete(get_handle(req), req->held_status);
+        }
+}
+
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void on_jitter_timer(_In_ WDFTIMER timer)
+{
+        auto device = static_cast<UDECXUSBDEVICE>(WdfTimerGetParentObject(timer));
+        auto &dev = *get_device_ctx(device);
+
+        complete_held(dev, get_jitter_ctx(dev.jitter_mem), current_frame(dev), 0);
+}
+
+/*
+ * The context is not freed when the pacing is disabled because the receive thread can still use it.
+ * The timer is a child of the device, it is deleted with the device.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_jitter_mem(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (dev.jitter_mem) {
+                return STATUS_SUCCESS;
+        }
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        WDFMEMORY mem{};
+        jitter_ctx *ctx{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, 0, sizeof(*ctx), &mem, reinterpret_cast<PVOID*>(&ctx))) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, WdfMemoryCreate(%Iu) %!STATUS!", ptr04x(device), sizeof(*ctx), err);
+                return err;
+        }
+
+        ObjectDelete mem_guard(mem);
+
+        RtlZeroMemory(ctx, sizeof(*ctx));
+        InitializeListHead(&ctx->held);
+
+        attr.ParentObject = mem;
+
+        if (auto err = WdfSpinLockCreate(&attr, &ctx->lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, on_jitter_timer);
+        cfg.AutomaticSerialization = false;
+        cfg.UseHighResolutionTimer = WdfTrue; // frames are one millisecond
+
+        attr.ParentObject = device; // WdfTimerGetParentObject must return it
+        attr.ExecutionLevel = WdfExecutionLevelDispatch; // high resolution timer requires it
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &ctx->timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&dev.jitter_mem), mem, nullptr)) {
+                WdfObjectDelete(ctx->timer); // concurrent call has created it
+        } else {
+                mem_guard.release();
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, jitter buffer %Iu bytes", ptr04x(device), sizeof(*ctx));
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void configure(_Inout_ jitter_ctx &ctx, _In_ ULONG endpoint, _In_ ULONG depth)
+{
+        wdf::Lock lck(ctx.lock);
+
+        for (ULONG i = 1; i < ARRAYSIZE(ctx.ep); ++i) { // endpoint zero is never isochronous
+                if (!endpoint || endpoint == i) {
+                        ctx.ep[i].configure(depth);
+                }
+        }
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::set_jitter_buffer(_In_ UDECXUSBDEVICE device, _In_ ULONG endpoint, _In_ ULONG depth)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        TraceDbg("dev %04x, endpoint %lu, depth %lu", ptr04x(device), endpoint, depth);
+
+        if (endpoint >= isoch::endpoint_count) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        if (!depth && !dev.jitter_mem) {
+                return STATUS_SUCCESS; // was never enabled
+        }
+
+        if (auto err = create_jitter_mem(device, dev)) {
+                return err;
+        }
+
+        auto &ctx = get_jitter_ctx(dev.jitter_mem);
+        configure(ctx, endpoint, depth);
+
+        if (depth) {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.jitter), &ctx);
+        } else {
+                if (!endpoint) {
+                        InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.jitter), nullptr);
+                }
+                jitter_flush(dev, endpoint);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::get_jitter_buffer(
+        _In_ device_ctx &dev, _Out_ isoch::stats (&stats)[isoch::endpoint_count], _In_ bool reset)
+{
+        RtlZeroMemory(stats, sizeof(stats));
+
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.jitter_mem)));
+        if (!mem) {
+                return;
+        }
+
+        auto &ctx = get_jitter_ctx(mem);
+        wdf::Lock lck(ctx.lock);
+
+        for (int i = 0; i < isoch::endpoint_count; ++i) {
+                auto &jb = ctx.ep[i];
+                stats[i] = jb.get_stats();
+                if (reset) {
+                        jb.reset_stats();
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::jitter_schedule(
+        _In_ device_ctx &dev, _In_ const endpoint_ctx &endp, _Inout_ request_ctx &req, _Inout_ _URB_ISOCH_TRANSFER &r,
+        _Out_ isoch::slot &slot)
+{
+        req.isoch_end = 0;
+
+        auto ctx = dev.jitter;
+        if (!ctx || !usb_endpoint_dir_in(endp.descriptor)) [[likely]] {
+                return false;
+        }
+
+        auto &d = endp.descriptor;
+        auto frames = isoch::urb_frames(r.NumberOfPackets, d.bInterval, dev.speed() >= USB_SPEED_HIGH);
+
+        auto now = current_frame(dev);
+
+        // StartFrame is the low part of a frame of URB_FUNCTION_GET_CURRENT_FRAME_NUMBER
+        ULONGLONG requested = now + static_cast<LONG>(r.StartFrame - static_cast<ULONG>(now));
+        auto asap = r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP;
+
+        if (auto &jb = ctx->ep[usb_endpoint_num(d)]; true) {
+                wdf::Lock lck(ctx->lock);
+                if (!jb.enabled()) {
+                        return false;
+                }
+                slot = jb.schedule(now, frames, asap ? nullptr : &requested);
+        }
+
+        r.StartFrame = static_cast<ULONG>(slot.start);
+        req.isoch_end = slot.end;
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::jitter_commit(_In_ device_ctx &dev, _In_ const endpoint_ctx &endp, _In_ const isoch::slot &slot, _In_ bool sent)
+{
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.jitter_mem)));
+        NT_ASSERT(mem); // jitter_schedule has used it, the pacing can be disabled since then
+
+        auto &ctx = get_jitter_ctx(mem);
+        auto &jb = ctx.ep[usb_endpoint_num(endp.descriptor)];
+
+        wdf::Lock lck(ctx.lock);
+
+        if (sent) {
+                jb.commit();
+        } else {
+                jb.cancel(slot);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::jitter_hold(_Inout_ device_ctx &dev, _Inout_ jitter_ctx &ctx, _In_ WDFREQUEST request, _In_ NTSTATUS status)
+{
+        auto &req = *get_request_ctx(request);
+        if (!req.isoch_end) {
+                return false;
+        }
+
+        auto &jb = ctx.ep[endpoint_num(req)];
+        auto now = current_frame(dev);
+
+        wdf::Lock lck(ctx.lock);
+
+        if (!jb.enabled() || get_flag(dev.unplugged)) {
+                return false;
+        }
+
+        auto release = jb.release(now, req.isoch_end);
+        if (release <= now) {
+                return false;
+        }
+
+        req.isoch_release = release;
+        req.held_status = status;
+
+        auto head = &ctx.held;
+        auto pos = head->Blink;
+
+        for ( ; pos != head && CONTAINING_RECORD(pos, request_ctx, entry)->isoch_release > release; pos = pos->Blink);
+        InsertHeadList(pos, &req.entry); // after pos
+
+        if (head->Flink == &req.entry) {
+                start_timer(dev, ctx, release);
+        }
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::jitter_flush(_Inout_ device_ctx &dev, _In_ ULONG endpoint)
+{
+        if (auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.jitter_mem)))) {
+                complete_held(dev, get_jitter_ctx(mem), endpoint ? 0 : ~0ULL, endpoint);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::stop_jitter_buffer(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+        NT_ASSERT(get_flag(dev.unplugged)); // jitter_hold does not hold requests
+
+        if (auto mem = dev.jitter_mem) {
+                WdfTimerStop(get_jitter_ctx(mem).timer, true);
+                jitter_flush(dev, 0);
+        }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+#include <usbip/isoch_pacing.h>
+
+/*
+ * Virtual frame clock of a device and opt-in jitter buffer of its isochronous IN endpoints,
+ * @see vhci::ioctl::set_jitter_buffer.
+ * If it is disabled, the cost is a check of device_ctx::jitter for every isochronous URB and every completed URB.
+ */
+namespace usbip
+{
+
+/*
+ * Is placed in device_ctx::jitter_mem.
+ */
+struct jitter_ctx
+{
+        WDFSPINLOCK lock; // for the members below
+        LIST_ENTRY held; // request_ctx::entry-s sorted by request_ctx::isoch_release
+        isoch::jitter_buffer ep[isoch::endpoint_count]; // by endpoint number
+
+        WDFTIMER timer; // completes held requests when their frames come
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void init_frame_clock(_Out_ isoch::frame_clock &clock)
+{
+        LARGE_INTEGER freq;
+        clock.epoch = KeQueryPerformanceCounter(&freq).QuadPart;
+        clock.frequency = freq.QuadPart;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto current_frame(_In_ const device_ctx &dev)
+{
+        return dev.frame_clock.frame(KeQueryPerformanceCounter(nullptr).QuadPart);
+}
+
+/*
+ * @param endpoint number, zero for all
+ * @param depth frames, zero disables the pacing, isoch::depth_auto
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_jitter_buffer(_In_ UDECXUSBDEVICE device, _In_ ULONG endpoint, _In_ ULONG depth);
+
+/*
+ * @param stats by endpoint number, zeroed if the pacing was never enabled
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void get_jitter_buffer(
+        _In_ device_ctx &dev, _Out_ isoch::stats (&stats)[isoch::endpoint_count], _In_ bool reset);
+
+/*
+ * Assigns StartFrame of isochronous IN URB if its endpoint is paced, sets request_ctx::isoch_end.
+ * @param slot the frames of the URB, they are reserved until jitter_commit
+ * @return true if the URB is paced, jitter_commit must be called then
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool jitter_schedule(
+        _In_ device_ctx &dev, _In_ const endpoint_ctx &endp, _Inout_ request_ctx &req, _Inout_ _URB_ISOCH_TRANSFER &r,
+        _Out_ isoch::slot &slot);
+
+/*
+ * Keeps the schedule if the URB was sent, otherwise returns its frames, so the pacing clock has no hole.
+ * @param sent the URB was sent, it can be completed already
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void jitter_commit(_In_ device_ctx &dev, _In_ const endpoint_ctx &endp, _In_ const isoch::slot &slot, _In_ bool sent);
+
+/*
+ * Is called by the receive thread instead of completing a request.
+ * @return true if the request is held, it will be completed with the given status when its frame comes
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool jitter_hold(_Inout_ device_ctx &dev, _Inout_ jitter_ctx &ctx, _In_ WDFREQUEST request, _In_ NTSTATUS status);
+
+/*
+ * Completes held requests of the endpoint right now.
+ * @param endpoint number, zero for all
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void jitter_flush(_Inout_ device_ctx &dev, _In_ ULONG endpoint);
+
+/*
+ * Stops the timer and completes all held requests, is called after the receive thread has exited.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void stop_jitter_buffer(_Inout_ device_ctx &dev);
+
+} // namespace usbip
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "latency.h"
+#include "trace.h"
+#include "latency.tmh"
+
+namespace
+{
+
+using namespace usbip;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto& get_latency_ctx(_In_ WDFMEMORY mem)
+{
+        return *static_cast<latency_ctx*>(WdfMemoryGetBuffer(mem, nullptr));
+}
+
+/*
+ * The histograms are not freed when the sampling is disabled because the receive thread can still use them.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_latency_mem(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (dev.latency_mem) {
+                return STATUS_SUCCESS;
+        }
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        WDFMEMORY mem{};
+        latency_ctx *ctx{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, 0, sizeof(*ctx), &mem, reinterpret_cast<PVOID*>(&ctx))) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, WdfMemoryCreate(%Iu) %!STATUS!", ptr04x(device), sizeof(*ctx), err);
+                return err;
+        }
+
+        RtlZeroMemory(ctx, sizeof(*ctx));
+
+        LARGE_INTEGER freq;
+        KeQueryPerformanceCounter(&freq);
+        ctx->frequency = freq.QuadPart;
+
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&dev.latency_mem), mem, nullptr)) {
+                WdfObjectDelete(mem); // concurrent call has created it
+        } else {
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, latency histograms %Iu bytes", ptr04x(device), sizeof(*ctx));
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto has_samples(_In_ const latency::histogram (&h)[latency::stage_count])
+{
+        for (auto &i: h) {
+                if (i.count) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::set_latency(_In_ UDECXUSBDEVICE device, _In_ ULONG period, _In_ ULONG stages)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        TraceDbg("dev %04x, period %lu, stages %#lx", ptr04x(device), period, stages);
+
+        if (!period) {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.latency), nullptr);
+                return STATUS_SUCCESS;
+        }
+
+        if (auto err = create_latency_mem(device, dev)) {
+                return err;
+        }
+
+        auto &ctx = get_latency_ctx(dev.latency_mem);
+
+        ctx.period = period;
+        ctx.stages = stages & latency::all_stages ? stages & latency::all_stages : latency::all_stages;
+
+        InterlockedExchangePointer(reinterpret_cast<PVOID*>(&dev.latency), &ctx);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::read_latency(
+        _In_ device_ctx &dev, _Out_writes_bytes_(length) void *buf, _In_ ULONG length, _Out_ ULONG &written,
+        _In_ bool reset)
+{
+        PAGED_CODE();
+        written = 0;
+
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&dev.latency_mem)));
+        if (!mem) {
+                return STATUS_INVALID_DEVICE_STATE; // the sampling was never enabled
+        }
+
+        auto &ctx = get_latency_ctx(mem);
+
+        if (set_flag(ctx.reading)) {
+                return STATUS_DEVICE_BUSY;
+        }
+
+        auto dst = static_cast<latency::endpoint_stats*>(buf);
+
+        for (unsigned int i = 0; i < latency::endpoint_count; ++i) {
+
+                auto &h = ctx.hist[i];
+                if (!has_samples(h)) {
+                        continue;
+                } else if (length - written < sizeof(*dst)) {
+                        break;
+                }
+
+                RtlZeroMemory(dst, sizeof(*dst));
+                dst->address = latency::endpoint_address(i);
+                RtlCopyMemory(dst->stages, h, sizeof(h));
+
+                if (reset) { // a sample that is being added can be lost
+                        RtlZeroMemory(h, sizeof(h));
+                }
+
+                ++dst;
+                written += sizeof(*dst);
+        }
+
+        InterlockedExchange(&ctx.reading, false);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::latency_complete(_Inout_ latency_ctx &ctx, _Inout_ request_ctx &req)
+{
+        PAGED_CODE();
+
+        if (!req.stamp[latency::arrive]) {
+                return; // is not sampled
+        }
+
+        LONG64 t[latency::point_count];
+        RtlCopyMemory(t, req.stamp, sizeof(t));
+
+        t[latency::send_done] = ReadAcquire64(&req.stamp[latency::send_done]); // request_sent can store it now
+        t[latency::complete] = latency_now();
+
+        auto &endp = *get_endpoint_ctx(req.endpoint);
+        auto &h = ctx.hist[latency::endpoint_index(endp.descriptor.bEndpointAddress)];
+
+        latency::fold(h, t, ctx.stages, [freq = ctx.frequency] (auto ticks)
+        {
+                return static_cast<ULONGLONG>(ticks)*1'000'000/freq;
+        });
+
+        req.stamp[latency::arrive] = 0; // stamps of request_sent that is called later are ignored
+}
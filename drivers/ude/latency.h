@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+#include <usbip/latency.h>
+
+/*
+ * Opt-in latency breakdown of URBs of a device, @see vhci::ioctl::set_latency.
+ * If it is disabled, the cost is a check of device_ctx::latency and a store into request_ctx for every URB.
+ */
+namespace usbip
+{
+
+/*
+ * Is placed in device_ctx::latency_mem.
+ */
+struct latency_ctx
+{
+        ULONG period; // every Nth request is sampled
+        ULONG stages; // bit mask of latency::stage_mask-s to fold
+        LONG counter; // of arrived requests
+        LONG reading; // serializes readers, use set_flag
+        LONGLONG frequency; // of the performance counter
+        latency::histogram hist[latency::endpoint_count][latency::stage_count];
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto latency_now()
+{
+        return KeQueryPerformanceCounter(nullptr).QuadPart;
+}
+
+/*
+ * Is called for every request that will be sent, request_ctx is not zeroed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void latency_arrive(_In_ device_ctx &dev, _Inout_ request_ctx &req)
+{
+        auto &t = req.stamp;
+
+        if (auto ctx = dev.latency; !ctx) [[likely]] {
+                t[latency::arrive] = 0;
+        } else if (ULONG(InterlockedIncrement(&ctx->counter)) % ctx->period) {
+                t[latency::arrive] = 0;
+        } else {
+                RtlZeroMemory(t, sizeof(t));
+                t[latency::arrive] = latency_now();
+        }
+}
+
+/*
+ * @param p is not arrive, send_done must be stored with WriteRelease64 because the receive thread can read it
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void latency_stamp(_Inout_ request_ctx &req, _In_ latency::point p)
+{
+        if (req.stamp[latency::arrive]) [[unlikely]] {
+                WriteRelease64(&req.stamp[p], latency_now());
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_latency(_In_ UDECXUSBDEVICE device, _In_ ULONG period, _In_ ULONG stages);
+
+/*
+ * @param written the length of latency::endpoint_stats-s
+ * @param reset zero the histograms after they are copied
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_latency(
+        _In_ device_ctx &dev, _Out_writes_bytes_(length) void *buf, _In_ ULONG length, _Out_ ULONG &written,
+        _In_ bool reset);
+
+/*
+ * Is called by the receive thread before the request is completed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void latency_complete(_Inout_ latency_ctx &ctx, _Inout_ request_ctx &req);
+
+} // namespace usbip
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "link_monitor.h"
+#include "trace.h"
+#include "link_monitor.tmh"
+
+#include "context.h"
+#include "wsk_context.h"
+#include "device.h"
+#include "device_ioctl.h"
+#include "persistent.h"
+#include "vhci.h"
+#include "network.h"
+
+#include <usbip/socket_buffer.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum {
+        TIMER_PERIOD = 500, // milliseconds
+        SOCKBUF_TICKS = 20, // timer periods between readjustments of socket buffers
+};
+
+constexpr sockbuf::policy sockbuf_policy {
+        64*1024, // min_size
+        8*1024*1024, // max_size
+        64*1024, // granularity
+};
+
+enum : link::time_t { // microseconds
+        MSEC = 1000,
+        SEC = 1000*MSEC,
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+constexpr auto to_usec(_In_ ULONGLONG interrupt_time)
+{
+        return interrupt_time/10; // 100-nanosecond units to microseconds
+}
+
+/*
+ * IN transfers of bulk and interrupt endpoints can wait for data indefinitely.
+ * Other transfers can be held by a device as well, link::probe tells a slow device from a dead server.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto is_prompt(_In_ const wsk_context &wsk)
+{
+        auto &hdr = wsk.hdr;
+        return wsk.is_isoc || !hdr.ep || hdr.direction == direction::out;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_policy(_In_ const vhci_ctx &vhci)
+{
+        return link::stall_policy {
+                MSEC, SEC, // min_rto, max_rto
+                8, SEC, // degraded_rto, degraded_min
+                16, vhci.dead_peer_timeout*SEC, // dead_rto, dead_min
+        };
+}
+
+/*
+ * Requests are appended to device_ctx::requests in the order of sending,
+ * so the first prompt request is the oldest one.
+ *
+ * @return stall in microseconds, zero if there are no outstanding prompt requests
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_stall(_In_ device_ctx &dev, _In_ ULONGLONG now)
+{
+        ULONGLONG since = 0;
+
+        if (wdf::Lock lck(dev.requests_lock); true) {
+                for (auto head = &dev.requests, entry = head->Flink; entry != head; entry = entry->Flink) {
+                        if (auto req = CONTAINING_RECORD(entry, request_ctx, entry); req->send_time) {
+                                since = req->send_time;
+                                break;
+                        }
+                }
+        }
+
+        if (!since) {
+                return link::time_t();
+        }
+
+        if (ULONGLONG last_recv = InterlockedCompareExchange64(&dev.last_recv, 0, 0); last_recv > since) {
+                since = last_recv;
+        }
+
+        return now > since ? to_usec(now - since) : 1;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void set_health(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev, _In_ link::health health, _In_ link::time_t stall)
+{
+        PAGED_CODE();
+
+        auto prev = dev.health;
+        dev.health = health;
+
+        auto &rtt = dev.rtt;
+        Trace(TRACE_LEVEL_WARNING, "dev %04x, health %d -> %d, stall %I64u ms, srtt %I64u us, rttvar %I64u us",
+                ptr04x(device), static_cast<int>(prev), static_cast<int>(health), stall/MSEC, rtt.srtt(), rtt.rttvar());
+
+        if (prev == link::health::healthy) {
+                vhci::device_state_changed(dev, vhci::state::degraded);
+        } else if (health == link::health::healthy) {
+                vhci::device_state_changed(dev, vhci::state::plugged);
+        }
+}
+
+/*
+ * Stall is time since the last received message while prompt requests are outstanding.
+ * If it is long relative to observed round trips, the server is pinged. If it does not answer,
+ * the device is degraded. If the stall lasts longer, the server is considered dead and the device is reattached.
+ */
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_link_timer(_In_ WDFTIMER timer)
+{
+        PAGED_CODE();
+
+        auto device = static_cast<UDECXUSBDEVICE>(WdfTimerGetParentObject(timer));
+        auto &dev = *get_device_ctx(device);
+
+        if (get_flag(dev.unplugged)) {
+                return;
+        }
+
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+
+        auto now = KeQueryInterruptTime();
+        auto stall = get_stall(dev, now);
+
+        auto health = dev.probe.update(to_usec(now), stall, dev.rtt, get_policy(vhci));
+        if (dev.probe.ping()) {
+                TraceDbg("dev %04x, stall %I64u ms, ping", ptr04x(device), stall/MSEC);
+                device::send_cmd_unlink_ping(device); // the server must answer RET_UNLINK at once
+        }
+
+        if (health == link::health::dead && vhci.dead_peer_reconnect) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, server does not respond for %I64u ms, reconnecting",
+                        ptr04x(device), stall/MSEC);
+
+                device::async_detach_and_delete(device, true);
+                return;
+        }
+
+        if (health == link::health::dead) {
+                health = link::health::degraded;
+        }
+
+        if (health != dev.health) {
+                set_health(device, dev, health, stall);
+        }
+
+        if (++dev.link_ticks % SOCKBUF_TICKS == 0) {
+                if (dev.net_rtt.samples()) {
+                        adjust_socket_buffers(dev, dev.net_rtt.srtt());
+                }
+                device::send_cmd_unlink_ping(device); // measures the round trip time of the network
+        }
+
+        if (!get_flag(dev.unplugged)) {
+                WdfTimerStart(timer, WDF_REL_TIMEOUT_IN_MS(TIMER_PERIOD));
+        }
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::init_link_monitor(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        enum { DEF_TIMEOUT = 10, MAX_TIMEOUT = 60*60 }; // seconds, see .inf
+        enum { DEF_BUDGET = 64, MAX_BUDGET = 4*1024 }; // megabytes, see .inf
+
+        auto &timeout = vhci.dead_peer_timeout;
+        auto &reconnect = vhci.dead_peer_reconnect;
+
+        timeout = DEF_TIMEOUT;
+        reconnect = true;
+        ULONG budget = DEF_BUDGET;
+
+        Registry key;
+        if (NT_ERROR(open(key, DriverRegKeyParameters))) {
+                vhci.sockbuf_budget.init(budget*1024*1024);
+                return;
+        }
+
+        UNICODE_STRING value_name;
+
+        RtlUnicodeStringInit(&value_name, L"DeadPeerTimeout");
+        if (ULONG val{}; auto err = WdfRegistryQueryULong(key.get<WDFKEY>(), &value_name, &val)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+        } else {
+                timeout = min(static_cast<unsigned int>(val), static_cast<unsigned int>(MAX_TIMEOUT));
+        }
+
+        RtlUnicodeStringInit(&value_name, L"DeadPeerReconnect");
+        if (ULONG val{}; auto err = WdfRegistryQueryULong(key.get<WDFKEY>(), &value_name, &val)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+        } else {
+                reconnect = val;
+        }
+
+        RtlUnicodeStringInit(&value_name, L"SocketBufferBudget");
+        if (ULONG val{}; auto err = WdfRegistryQueryULong(key.get<WDFKEY>(), &value_name, &val)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+        } else {
+                budget = min(val, static_cast<ULONG>(MAX_BUDGET));
+        }
+
+        vhci.sockbuf_budget.init(size_t(budget)*1024*1024);
+
+        TraceDbg("DeadPeerTimeout=%u, DeadPeerReconnect=%!bool!, SocketBufferBudget=%lu MB",
+                  timeout, reconnect, budget);
+}
+
+/*
+ * The timer is a child of the device, it is deleted with the device.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_link_monitor(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, on_link_timer);
+        cfg.AutomaticSerialization = false;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+        attr.ExecutionLevel = WdfExecutionLevelPassive;
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &dev.link_timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::start_link_monitor(_In_ device_ctx &dev)
+{
+        InterlockedExchange64(&dev.last_recv, KeQueryInterruptTime());
+        WdfTimerStart(dev.link_timer, WDF_REL_TIMEOUT_IN_MS(TIMER_PERIOD));
+}
+
+/*
+ * Must not be called from on_link_timer.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::stop_link_monitor(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+        NT_ASSERT(get_flag(dev.unplugged)); // the timer is not restarted
+
+        if (auto t = dev.link_timer) {
+                WdfTimerStop(t, true);
+        }
+
+        if (auto &sz = dev.sockbuf) {
+                auto &vhci = *get_vhci_ctx(dev.vhci);
+                wdf::Lock lck(vhci.sockbuf_lock);
+                vhci.sockbuf_budget.release(2*sz);
+                sz = 0;
+        }
+}
+
+/*
+ * SO_SNDBUF and SO_RCVBUF have the same size, both are reserved in the budget.
+ * A socket which buffers were set can't return to the defaults of the stack, the minimal size is set instead.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::adjust_socket_buffers(_Inout_ device_ctx &dev, _In_ link::time_t rtt)
+{
+        PAGED_CODE();
+
+        auto device = get_handle(&dev);
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+
+        auto speed = dev.speed();
+        auto cur = dev.sockbuf;
+
+        auto target = sockbuf::target_size(sockbuf::bus_rate(speed), rtt, sockbuf_policy);
+        if (!target && cur) {
+                target = sockbuf_policy.min_size;
+        }
+
+        if (target == cur || !sockbuf::should_resize(cur, target)) {
+                return;
+        }
+
+        size_t used;
+        size_t total;
+
+        if (wdf::Lock lck(vhci.sockbuf_lock); true) {
+                auto &b = vhci.sockbuf_budget;
+                target = sockbuf::reserve(b, cur, target, sockbuf_policy);
+                used = b.used();
+                total = b.total();
+        }
+
+        if (target == cur) {
+                TraceDbg("dev %04x, socket buffers budget is exhausted, %Iu/%Iu", ptr04x(device), used, total);
+                return;
+        }
+
+        auto sz = static_cast<int>(target);
+
+        if (auto err = wsk::set_buffer_sizes(dev.sock(), sz, sz)) {
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, set_buffer_sizes(%d) %!STATUS!", ptr04x(device), sz, err);
+
+                wdf::Lock lck(vhci.sockbuf_lock);
+                vhci.sockbuf_budget.reserve(2*target, 2*cur); // rollback
+                return;
+        }
+
+        dev.sockbuf = target;
+
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %!usb_device_speed!, rtt %I64u us, SO_SNDBUF=SO_RCVBUF %Iu -> %Iu, "
+                "budget %Iu/%Iu", ptr04x(device), speed, rtt, cur, target, used, total);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::link_request_sent(_Inout_ request_ctx &req, _In_ const wsk_context &wsk)
+{
+        req.send_time = is_prompt(wsk) ? KeQueryInterruptTime() : 0;
+}
+
+/*
+ * Only the receive thread updates device_ctx::rtt.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::link_response_received(_Inout_ device_ctx &dev, _In_opt_ WDFREQUEST request, _In_ const header &hdr)
+{
+        auto now = KeQueryInterruptTime();
+        InterlockedExchange64(&dev.last_recv, now);
+
+        if (!request) {
+                if (auto seqnum = static_cast<LONG>(hdr.seqnum); 
+                    hdr.command == RET_UNLINK && InterlockedCompareExchange(&dev.ping_seqnum, 0, seqnum) == seqnum) {
+                        if (ULONGLONG sent = InterlockedCompareExchange64(&dev.ping_time, 0, 0); now > sent) {
+                                dev.net_rtt.sample(to_usec(now - sent));
+                        }
+                } // otherwise RET_UNLINK of a request or the request was canceled
+        } else if (auto &req = *get_request_ctx(request); req.send_time && now > req.send_time) {
+                dev.rtt.sample(to_usec(now - req.send_time));
+        }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv/codeseg.h>
+#include <libdrv/wdf_cpp.h>
+
+#include <usb.h>
+#include <wdfusb.h>
+#include <UdeCx.h>
+
+#include <usbip/link_health.h>
+
+/*
+ * Dead peer detection that does not wait for TCP keepalive, @see usbip/link_health.h
+ * Sizes of socket buffers follow the bandwidth-delay product, @see usbip/socket_buffer.h
+ * The round trip time of the network is measured by pings, URBs can be held by devices.
+ */
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+struct request_ctx;
+struct wsk_context;
+struct header;
+
+/*
+ * @see .inf, DeadPeerTimeout, DeadPeerReconnect, SocketBufferBudget
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_link_monitor(_Inout_ vhci_ctx &vhci);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_link_monitor(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void start_link_monitor(_In_ device_ctx &dev);
+
+/*
+ * Also releases socket buffers of the device.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void stop_link_monitor(_Inout_ device_ctx &dev);
+
+/*
+ * @param rtt round trip time of the network in microseconds
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void adjust_socket_buffers(_Inout_ device_ctx &dev, _In_ link::time_t rtt);
+
+/*
+ * The request is about to be sent to the server.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void link_request_sent(_Inout_ request_ctx &req, _In_ const wsk_context &wsk);
+
+/*
+ * The receive thread has read a header of USBIP_RET_*.
+ * @param request is completed by RET_SUBMIT, can be WDF_NO_HANDLE
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void link_response_received(_Inout_ device_ctx &dev, _In_opt_ WDFREQUEST request, _In_ const header &hdr);
+
+} // namespace usbip
@@ -11,6 +11,8 @@
 #include "vhci.h"
 
 #include <libdrv/strconv.h>
+#include <usbip/attach_plan.h>
+#include <usbip/location_key.h>
 #include <resources/messages.h>
 
 #include <ntstrsafe.h>
@@ -25,16 +27,13 @@ using namespace usbip;
  */
 struct attach_ctx
 {
-        ULONG location_hash; // hash(host,port,busid)
+        reattach::entry entry; // @see vhci_ctx::reattach
 
         WDFDEVICE vhci;
-        WDFTIMER timer;
+        ULONGLONG start_time; // KeQueryInterruptTime, to report attach latency
 
         WDFMEMORY inbuf;
         WDFMEMORY outbuf;
-
-        unsigned int retry_cnt;
-        unsigned int delay;
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(attach_ctx, get_attach_ctx);
 
@@ -46,72 +45,103 @@ PAGED auto empty(_In_ const UNICODE_STRING &s)
         return libdrv::empty(s) || !*s.Buffer;
 }
 
+/*
+ * Tick of reattach::scheduler is a second, the time spent in sleep/hibernation is not counted.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto reattach_req_count(_Inout_ vhci_ctx &vhci)
+inline auto get_tick()
 {
-        wdf::Lock(vhci.reattach_req_lock);
-        return WdfCollectionGetCount(vhci.reattach_req);
+        return KeQueryUnbiasedInterruptTime()/(10*1000*1000);
 }
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto reattach_req_add(_Inout_ vhci_ctx &vhci, _In_ WDFOBJECT request)
+inline auto get_request(_In_ reattach::entry &e)
 {
-        wdf::Lock lck(vhci.reattach_req_lock);
+        auto ctx = CONTAINING_RECORD(&e, attach_ctx, entry);
+        return static_cast<WDFREQUEST>(WdfObjectContextGetObject(ctx));
+}
 
-        if (auto err = WdfCollectionAdd(vhci.reattach_req, request)) {
-                Trace(TRACE_LEVEL_ERROR, "%04x, WdfCollectionAdd %!STATUS!", ptr04x(request), err);
-                return false;
-        }
+/*
+ * WdfTimerStart resets the due time of the timer that is already started,
+ * so it is restarted only if it must fire earlier.
+ * vhci_ctx::reattach_lock must be acquired.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(DISPATCH_LEVEL)
+void start_timer(_Inout_ vhci_ctx &vhci)
+{
+        auto &sched = vhci.reattach;
+        auto &due = vhci.reattach_timer_due;
 
-        return true;
+        if (auto timeout = sched.next_timeout(); !timeout) {
+                //
+        } else if (auto t = sched.now() + timeout; !due || t < due) {
+                due = t;
+                WdfTimerStart(vhci.reattach_timer, WDF_REL_TIMEOUT_IN_SEC(timeout)); // @see on_reattach_timer
+        }
 }
 
 /*
- * WdfCollectionRemove issues bugcheck if object is not found in collection.
- * imp_WdfCollectionRemove:WDFOBJECT XXX not in WDFCOLLECTION XXX, 0xc0000225(STATUS_NOT_FOUND)
+ * A response of the server means it is reachable even if the attach has failed.
+ * @see messages.mc
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void reattach_req_remove(_Inout_ vhci_ctx &vhci, _In_ WDFOBJECT request)
+constexpr auto is_server_reachable(_In_ NTSTATUS status)
 {
-        auto col = vhci.reattach_req;
-        wdf::Lock lck(vhci.reattach_req_lock);
+        return ((status >> 16) & 0xFFF) == FACILITY_DRIVER;
+}
 
-        for (auto n = WdfCollectionGetCount(col), i = 0UL; i < n; ++i) {
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_outcome(_In_ vhci_ctx &vhci, _In_ UINT64 location_key, _In_ NTSTATUS status)
+{
+        using reattach::outcome;
 
-                if (WdfCollectionGetItem(col, i) == request) {
-                        WdfCollectionRemoveItem(col, i);
-                        break;
-                }
+        if (!NT_ERROR(status)) {
+                return outcome::success;
+        } else if (get_flag(vhci.removing) || !can_reattach(get_handle(&vhci), location_key, status)) {
+                return outcome::aborted;
         }
+
+        return is_server_reachable(status) ? outcome::failed : outcome::unreachable;
 }
 
-/**
- * @param location_hash remove unconditionally if zero
- */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto reattach_req_remove(_Inout_ vhci_ctx &vhci, _In_ ULONG location_hash)
+void complete_attempt(_Inout_ vhci_ctx &vhci, _Inout_ attach_ctx &r, _In_ NTSTATUS status)
 {
-        wdf::ObjectRef ref;
-        auto col = vhci.reattach_req;
+        auto request = WdfObjectContextGetObject(&r);
+        auto result = get_outcome(vhci, r.entry.location_key, status);
 
-        wdf::Lock lck(vhci.reattach_req_lock);
+        wdf::Lock lck(vhci.reattach_lock);
+        auto &sched = vhci.reattach;
 
-        for (auto n = WdfCollectionGetCount(col), i = 0UL; i < n; ++i) {
+        sched.complete(r.entry, result, get_tick());
 
-                auto req = WdfCollectionGetItem(col, i);
-                
-                if (!location_hash || location_hash == get_attach_ctx(req)->location_hash) {
-                        ref.reset(req);
-                        WdfCollectionRemoveItem(col, i);
-                        break;
-                }
+        if (result == reattach::outcome::success) {
+                auto ms = (KeQueryInterruptTime() - r.start_time)/(10*1000);
+                Trace(TRACE_LEVEL_INFORMATION, "req %04x, key %I64x, attached in %I64u ms, retries %u",
+                        ptr04x(request), r.entry.location_key, ms, r.entry.retries);
+        } else if (auto &e = r.entry; e.st == reattach::state::scheduled) {
+                TraceDbg("req %04x, %!STATUS!, retry #%u in %I64u secs.",
+                          ptr04x(request), status, e.retries, e.expires - sched.now());
+        } else {
+                TraceDbg("req %04x, %!STATUS!", ptr04x(request), status);
         }
 
-        return ref;
+        start_timer(vhci);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void dispatch(_Inout_ vhci_ctx &vhci);
+
+constexpr auto length(_In_ const UNICODE_STRING &s)
+{
+        return s.Length/sizeof(*s.Buffer);
 }
 
 _IRQL_requires_same_
@@ -164,7 +194,7 @@ PAGED auto get_persistent_devices(_Inout_ ULONG &cnt, _In_ ULONG max_cnt)
 /*
  * @param r must be zeroed
  * @param device_str host,port,busid[,serial]
- * @see hash_location
+ * @see make_location_key
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -188,8 +218,12 @@ PAGED auto parse_device_str(_Inout_ device_attributes &r, _In_ const UNICODE_STR
                 return err;
         }
 
-        return  empty(r.node_name) || empty(r.service_name) || empty(r.busid) ?
-                STATUS_INVALID_PARAMETER : hash_location(r.location_hash, r);
+        if (empty(r.node_name) || empty(r.service_name) || empty(r.busid)) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        r.location_key = make_location_key(r);
+        return STATUS_SUCCESS;
 }
 
 _IRQL_requires_same_
@@ -230,42 +264,11 @@ _IRQL_requires_same_
 void on_plugin_hardware(
         _In_ WDFREQUEST request, _In_ WDFIOTARGET, _In_ WDF_REQUEST_COMPLETION_PARAMS*, _In_ WDFCONTEXT)
 {
-        ObjectDelete ptr(request);
-
-        auto &req = *get_attach_ctx(request);
-        auto &vhci = *get_vhci_ctx(req.vhci);
-
-        auto retry_cnt = req.retry_cnt++; // from zero
-
-        auto st = WdfRequestGetStatus(request);
-        auto failed = NT_ERROR(st);
-        auto retry = failed && retry_cnt < vhci.reattach_max_attempts &&
-                     can_reattach(req.vhci, req.location_hash, st);
-
-        if (auto ok = retry && !get_flag(vhci.removing); !ok) {
-                auto s = !failed ? " " : // "" prints as "<NULL>"
-                         !retry ? ", cannot retry" : 
-                         ", vhci is being removing";
-
-                TraceDbg("req %04x, %!STATUS!%s", ptr04x(request), st, s);
-                return;
-        }
-
-        WDF_REQUEST_REUSE_PARAMS params;
-        WDF_REQUEST_REUSE_PARAMS_INIT(&params, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
-
-        if (auto err = WdfRequestReuse(request, &params)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfRequestReuse(%04x) %!STATUS!", ptr04x(request), err);
-                return;
-        }
-
-        auto delay = req.delay;
-        req.delay = get_next_delay(delay, vhci.reattach_max_delay);
-
-        TraceDbg("req %04x, %!STATUS!, retry #%u in %u secs.", ptr04x(request), st, retry_cnt, delay);
-        NT_VERIFY(!WdfTimerStart(req.timer, WDF_REL_TIMEOUT_IN_SEC(delay))); // @see on_attach_timer
+        auto &r = *get_attach_ctx(request);
+        auto &vhci = *get_vhci_ctx(r.vhci);
 
-        ptr.release();
+        complete_attempt(vhci, r, WdfRequestGetStatus(request));
+        dispatch(vhci);
 }
 
 /*
@@ -275,16 +278,23 @@ void on_plugin_hardware(
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void send_plugin_hardware(
-        _In_ WDFIOTARGET target, _In_ WDFMEMORY inbuf, _In_ WDFMEMORY outbuf, _Inout_ ObjectDelete &req)
+NTSTATUS send_plugin_hardware(_In_ WDFIOTARGET target, _In_ WDFREQUEST request)
 {
-        auto request = req.get<WDFREQUEST>();
         TraceDbg("req %04x", ptr04x(request));
+        auto &r = *get_attach_ctx(request);
+
+        WDF_REQUEST_REUSE_PARAMS params;
+        WDF_REQUEST_REUSE_PARAMS_INIT(&params, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+
+        if (auto err = WdfRequestReuse(request, &params)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestReuse(%04x) %!STATUS!", ptr04x(request), err);
+                return err;
+        }
 
         if (auto err = WdfIoTargetFormatRequestForIoctl(target, request,
-                        vhci::ioctl::PLUGIN_HARDWARE_ONCE, inbuf, nullptr, outbuf, nullptr)) {
+                        vhci::ioctl::PLUGIN_HARDWARE_ONCE, r.inbuf, nullptr, r.outbuf, nullptr)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfIoTargetFormatRequestForIoctl %!STATUS!", err);
-                return;
+                return err;
         }
 
         WdfRequestSetCompletionRoutine(request, on_plugin_hardware, WDF_NO_CONTEXT);
@@ -292,62 +302,96 @@ void send_plugin_hardware(
         if (!WdfRequestSend(request, target, WDF_NO_SEND_OPTIONS)) {
                 auto err = WdfRequestGetStatus(request);
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestSend %!STATUS!", err);
-        } else {
-                req.release();
+                return err;
         }
+
+        return STATUS_SUCCESS;
 }
 
 /*
- * If an EvtTimerFunc callback function running at PASSIVE_LEVEL calls WdfObjectDelete,
- * this results in deadlock. Request is a parent of a timer, the timer will be
- * implicitly deleted when the request is deleted.
+ * stop_attach_attempts can cancel an entry after it was popped but before its request was sent,
+ * WdfRequestCancelSentRequest does nothing in this case. The scheduler marks such entry as sending,
+ * the request is canceled here after it was sent.
  */
-_Function_class_(EVT_WDF_TIMER)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void on_attach_timer(_In_ WDFTIMER timer)
+void send_attempt(_Inout_ vhci_ctx &vhci, _In_ WDFREQUEST request)
 {
-        ObjectDelete req(WdfTimerGetParentObject(timer));
+        auto &r = *get_attach_ctx(request);
+        wdf::ObjectRef ref(request); // can be completed and deleted after it was sent
 
-        auto &r = *get_attach_ctx(req.get());
-        auto &vhci = *get_vhci_ctx(r.vhci);
+        auto err = get_flag(vhci.removing) ? STATUS_CANCELLED : send_plugin_hardware(vhci.target_self, request);
+        if (err) {
+                complete_attempt(vhci, r, err);
+                return;
+        }
 
-        if (get_flag(vhci.removing)) [[unlikely]] {
-                TraceDbg("req %04x, vhci is being removing", ptr04x(req.get()));
-        } else {
-                send_plugin_hardware(vhci.target_self, r.inbuf, r.outbuf, req);
+        if (wdf::Lock lck(vhci.reattach_lock); vhci.reattach.started(r.entry)) {
+                return;
         }
+
+        auto delivered = WdfRequestCancelSentRequest(request);
+        TraceDbg("req %04x, canceled while sending, cancel request was delivered %!BOOLEAN!",
+                  ptr04x(request), delivered);
 }
 
+/*
+ * Send the requests of ready entries and destroy the requests of finished ones.
+ * Must be called without vhci_ctx::reattach_lock after the scheduler was changed.
+ */
 _IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED bool create_timer(_Inout_ WDFTIMER &result, _Inout_ WDF_OBJECT_ATTRIBUTES &attr)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void dispatch(_Inout_ vhci_ctx &vhci)
 {
-        PAGED_CODE();
-        NT_ASSERT(!result);
+        for (auto &sched = vhci.reattach; ; ) {
 
-        WDF_TIMER_CONFIG cfg;
-        WDF_TIMER_CONFIG_INIT(&cfg, on_attach_timer);
-        cfg.TolerableDelay = TolerableDelayUnlimited;
+                WDFREQUEST request{};
+                bool send{};
 
-        if (auto err = WdfTimerCreate(&cfg, &attr, &result)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                if (wdf::Lock lck(vhci.reattach_lock); auto e = sched.pop_ready()) {
+                        request = get_request(*e);
+                        send = true;
+                } else if (e = sched.pop_finished(); e) {
+                        request = get_request(*e);
+                } else {
+                        break;
+                }
+
+                if (send) {
+                        send_attempt(vhci, request);
+                } else {
+                        TraceDbg("req %04x, delete", ptr04x(request));
+                        WdfObjectDelete(request);
+                }
         }
+}
 
-        return result;
+/*
+ * One timer for all attach attempts, the scheduler tells when it must fire.
+ */
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void on_reattach_timer(_In_ WDFTIMER timer)
+{
+        auto vhci = static_cast<WDFDEVICE>(WdfTimerGetParentObject(timer));
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        if (wdf::Lock lck(ctx.reattach_lock); true) {
+                ctx.reattach_timer_due = 0;
+                ctx.reattach.advance(get_tick());
+                start_timer(ctx);
+        }
+
+        dispatch(ctx);
 }
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto init_attach_ctx(_Inout_ vhci_ctx &vhci, _Inout_ attach_ctx &r, _In_ const device_attributes &attr)
+PAGED auto init_attach_ctx(_Inout_ attach_ctx &r, _In_ const device_attributes &attr)
 {
         PAGED_CODE();
 
-        r.location_hash = attr.location_hash;
-        NT_ASSERT(r.location_hash);
-
-        r.delay = vhci.reattach_first_delay;
-
         size_t len;
         auto &req = *static_cast<vhci::ioctl::plugin_hardware*>(WdfMemoryGetBuffer(r.inbuf, &len));
         NT_ASSERT(len == sizeof(req));
@@ -364,18 +408,21 @@ PAGED auto init_attach_ctx(_Inout_ vhci_ctx &vhci, _Inout_ attach_ctx &r, _In_ c
         return NT_SUCCESS(fill_location(req, attr));
 }
 
+/*
+ * The entry is already detached from the scheduler unless vhci is being deleted.
+ */
 _Function_class_(EVT_WDF_OBJECT_CONTEXT_CLEANUP)
 _IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED void cleanup_attach_request(_In_ WDFOBJECT obj)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void cleanup_attach_request(_In_ WDFOBJECT obj)
 {
-        PAGED_CODE();
         TraceDbg("%04x", ptr04x(obj));
 
-        auto r = get_attach_ctx(obj);
-        auto vhci = get_vhci_ctx(r->vhci);
+        auto &r = *get_attach_ctx(obj);
+        auto &vhci = *get_vhci_ctx(r.vhci);
 
-        reattach_req_remove(*vhci, obj);
+        wdf::Lock lck(vhci.reattach_lock);
+        vhci.reattach.remove(r.entry);
 }
 
 _IRQL_requires_same_
@@ -394,11 +441,12 @@ PAGED auto create_attach_request(_In_ WDFDEVICE vhci, _In_ vhci_ctx &ctx, _In_ c
                 return req;
         }
 
-        Trace(TRACE_LEVEL_INFORMATION, "%04x, %!USTR!:%!USTR!/%!USTR!, hash %lx",
-                ptr04x(req.get()), &dev.node_name, &dev.service_name, &dev.busid, dev.location_hash);
+        Trace(TRACE_LEVEL_INFORMATION, "%04x, %!USTR!:%!USTR!/%!USTR!, key %I64x",
+                ptr04x(req.get()), &dev.node_name, &dev.service_name, &dev.busid, dev.location_key);
 
         auto &r = *get_attach_ctx(req.get());
         r.vhci = vhci;
+        r.start_time = KeQueryInterruptTime();
 
         vhci::ioctl::plugin_hardware *buf{};
 
@@ -407,9 +455,7 @@ PAGED auto create_attach_request(_In_ WDFDEVICE vhci, _In_ vhci_ctx &ctx, _In_ c
 
         auto ok = create_inbuf(r.inbuf, buf, attr) &&
                   create_outbuf(r.outbuf, buf, attr) &&
-                  create_timer(r.timer, attr) &&
-                  init_attach_ctx(ctx, r, dev) &&
-                  reattach_req_add(ctx, req.get());
+                  init_attach_ctx(r, dev);
 
         if (!ok) {
                 req.reset();
@@ -418,6 +464,32 @@ PAGED auto create_attach_request(_In_ WDFDEVICE vhci, _In_ vhci_ctx &ctx, _In_ c
         return req;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto add_attach_request(
+        _Inout_ vhci_ctx &vhci, _Inout_ attach_ctx &r, _In_ const device_attributes &attr,
+        _In_ UINT64 server_key, _In_ unsigned int delay)
+{
+        wdf::Lock lck(vhci.reattach_lock);
+        auto &sched = vhci.reattach;
+
+        auto ret = sched.add(r.entry, attr.location_key, server_key, delay, get_tick());
+
+        switch (ret) {
+        case reattach::add_result::added:
+                start_timer(vhci);
+                break;
+        case reattach::add_result::duplicate:
+                TraceDbg("key %I64x, attach attempts are already scheduled", attr.location_key);
+                break;
+        case reattach::add_result::full:
+                Trace(TRACE_LEVEL_WARNING, "too many active attach requests, %Iu", sched.size());
+                break;
+        }
+
+        return ret == reattach::add_result::added;
+}
+
 /*
  * WDF does not have a function for DriverRegKeySharedPersistentState yet.
  *
@@ -441,68 +513,247 @@ PAGED decltype(WdfDriverOpenParametersRegistryKey) *get_function(_In_ DRIVER_REG
         }
 }
 
+constexpr auto &attach_history_value_name = L"AttachHistory";
+
+/*
+ * @return number of location keys
+ * @see remember_attach
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED ULONG read_attach_history(_In_ WDFKEY key, _Out_writes_(max_cnt) UINT64 *history, _In_ ULONG max_cnt)
+{
+        PAGED_CODE();
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, attach_history_value_name);
+
+        ULONG len{};
+        ULONG type{};
+
+        if (auto err = WdfRegistryQueryValue(key, &value_name, max_cnt*sizeof(*history), history, &len, &type)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryValue('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                return 0;
+        }
+
+        return type == REG_BINARY ? len/sizeof(*history) : 0;
+}
+
+/*
+ * vhci_ctx::attach_history_lock must be acquired.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void write_attach_history(_Inout_ vhci_ctx &ctx)
+{
+        PAGED_CODE();
+
+        if (!ctx.attach_history_dirty) {
+                return;
+        }
+
+        Registry key;
+        if (NT_ERROR(open(key, DriverRegKeyPersistentState, KEY_SET_VALUE))) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, attach_history_value_name);
+
+        auto len = ctx.attach_history_cnt*sizeof(*ctx.attach_history);
+
+        if (auto err = WdfRegistryAssignValue(key.get(), &value_name, REG_BINARY, len, ctx.attach_history)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRegistryAssignValue('%!USTR!') %!STATUS!", &value_name, err);
+        } else {
+                ctx.attach_history_dirty = false;
+                TraceDbg("%lu location key(s)", ctx.attach_history_cnt);
+        }
+}
+
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_attach_history_timer(_In_ WDFTIMER timer)
+{
+        PAGED_CODE();
+
+        auto vhci = static_cast<WDFDEVICE>(WdfTimerGetParentObject(timer));
+        save_attach_history(vhci);
+}
+
+/*
+ * The history is read once and is kept in memory.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS init_attach_history(_In_ WDFDEVICE vhci, _Inout_ vhci_ctx &ctx)
+{
+        PAGED_CODE();
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, on_attach_history_timer);
+        cfg.AutomaticSerialization = false;
+        cfg.TolerableDelay = TolerableDelayUnlimited;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = vhci;
+        attr.ExecutionLevel = WdfExecutionLevelPassive;
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &ctx.attach_history_timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        auto max_cnt = static_cast<ULONG>(ctx.devices_cnt);
+
+        unique_ptr buf(PagedPool, max_cnt*sizeof(*ctx.attach_history));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate UINT64[%lu]", max_cnt);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        ctx.attach_history = buf.release<UINT64>();
+
+        if (Registry key; NT_SUCCESS(open(key, DriverRegKeyPersistentState))) {
+                ctx.attach_history_cnt = read_attach_history(key.get(), ctx.attach_history, max_cnt);
+        }
+
+        return STATUS_SUCCESS;
+}
+
 } // namespace 
 
 /*
- * There can be many reattach requests that are canceled but its timer callback has not been called yet.
- * Because of that the limit of active requests is 4x higher than the number of hub ports.
- * @see stop_attach_attempts
+ * There can be many reattach requests that are canceled but its completion routine has not been called yet.
+ * Because of that the scheduler can hold 4x more requests than the number of hub ports.
+ *
+ * Attempts are dispatched by the parallel queue, @see is_reattach.
+ * @see vhci_cleanup
  */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::init_attach_attempts(_In_ WDFDEVICE vhci, _Inout_ vhci_ctx &ctx)
+{
+        PAGED_CODE();
+
+        if (auto err = init_attach_history(vhci, ctx)) {
+                return err;
+        }
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, on_reattach_timer);
+        cfg.TolerableDelay = TolerableDelayUnlimited;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = vhci;
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &ctx.reattach_timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        auto cnt = 4*static_cast<size_t>(ctx.devices_cnt);
+        auto sz = reattach::scheduler::storage_size(cnt);
+
+        unique_ptr buf(NonPagedPoolNx, sz);
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", sz);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        reattach::config const c {
+                .first_delay = ctx.reattach_first_delay,
+                .max_delay = ctx.reattach_max_delay,
+                .max_retries = ctx.reattach_max_attempts,
+                .max_inflight = ctx.reattach_max_concurrency
+        };
+
+        auto seed = KeQueryPerformanceCounter(nullptr).QuadPart ^ KeQueryInterruptTime();
+        ctx.reattach.init(buf.release(), cnt, c, get_tick(), seed);
+
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void usbip::start_attach_attempts(
         _In_ WDFDEVICE vhci, _Inout_ vhci_ctx &ctx, _In_ const device_attributes &attr, _In_ bool delayed)
 {
         PAGED_CODE();
+        enum { DELAY = 30 }; // long delay after UdecxUsbDevicePlugOutAndDelete
 
         if (get_flag(ctx.removing)) {
                 TraceDbg("vhci is being removing");
-        } else if (auto cnt = reattach_req_count(ctx); cnt >= 4*static_cast<ULONG>(ctx.devices_cnt)) {
-                Trace(TRACE_LEVEL_WARNING, "too many active attach requests, %lu", cnt);
         } else if (auto req = create_attach_request(vhci, ctx, attr); !req) {
                 //
-        } else if (auto &r = *get_attach_ctx(req.get()); !delayed) {
-                send_plugin_hardware(ctx.target_self, r.inbuf, r.outbuf, req);
-        } else {
-                ++r.retry_cnt;
-
-                enum { DELAY = 30 }; // long delay after UdecxUsbDevicePlugOutAndDelete
-                NT_VERIFY(!WdfTimerStart(r.timer, WDF_REL_TIMEOUT_IN_SEC(DELAY)));
-
-                TraceDbg("req %04x, delayed for %u secs.", ptr04x(req.get()), DELAY);
-                req.release();
+        } else if (auto server_key = make_server_key(attr);
+                   add_attach_request(ctx, *get_attach_ctx(req.get()), attr, server_key, delayed ? DELAY : 0)) {
+                TraceDbg("req %04x, server key %I64x, delayed %!bool!", ptr04x(req.get()), server_key, delayed);
+                req.release(); // owned by the scheduler
+                dispatch(ctx);
         }
 }
 
 /*
- * You cannot access request's context space here even when an extra reference is acquired.
- * The request can be in undefined state (completing/completed), a BSOD can occur.
- *
- * The timer callback will be fired. If it calls WdfRequestSend, STATUS_CANCELLED
- * will be immetiately returned due to previosly called WdfRequestCancelSentRequest.
- * WdfRequestReuse does not clear cancellation flag.
- *
- * If timer in system queue, its callback will delete cancelled request sooner or later.
- * The latter is a problem, these requests will be piling up and can cause Denial Of Service.
+ * The request in flight is canceled, its completion routine passes it to the scheduler that destroys it.
+ * A canceled request is never sent again, so canceled requests do not pile up.
+ * The request that is being sent is canceled by send_attempt.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-int usbip::stop_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ ULONG location_hash)
+int usbip::stop_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ UINT64 location_key)
 {
         int cnt = 0;
 
-        while (auto req = reattach_req_remove(vhci, location_hash)) {
+        for (auto &sched = vhci.reattach; ; ++cnt) {
 
-                ++cnt;
-                auto delivered = WdfRequestCancelSentRequest(req.get<WDFREQUEST>());
+                wdf::ObjectRef req;
 
-                TraceDbg("hash %lx -> req %04x, cancel request was delivered %!BOOLEAN!",
-                          location_hash, ptr04x(req.get()), delivered);
+                if (wdf::Lock lck(vhci.reattach_lock); auto e = sched.cancel(location_key)) {
+                        if (e->st == reattach::state::canceled && !e->sending) { // in flight
+                                req.reset(get_request(*e));
+                        }
+                } else {
+                        break;
+                }
+
+                if (req) {
+                        auto delivered = WdfRequestCancelSentRequest(req.get<WDFREQUEST>());
+                        TraceDbg("key %I64x -> req %04x, cancel request was delivered %!BOOLEAN!",
+                                  location_key, ptr04x(req.get()), delivered);
+                }
         }
 
+        dispatch(vhci);
         return cnt;
 }
 
+/*
+ * The server is known to be reachable now, its scheduled attempts are made at once.
+ * @see server_connected
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::wake_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ UINT64 server_key)
+{
+        if (wdf::Lock lck(vhci.reattach_lock); auto cnt = vhci.reattach.wake(server_key, get_tick())) {
+                TraceDbg("server key %I64x, %Iu attempt(s) woken", server_key, cnt);
+        } else {
+                return;
+        }
+
+        dispatch(vhci);
+}
+
+/*
+ * Devices are passed to the scheduler in the order of the last successful attach.
+ * The scheduler limits the number of simultaneous attempts and attempts one device per server first,
+ * the addresses of the server are cached after that, so every server is resolved once.
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void usbip::plugin_persistent_devices(_In_ WDFDEVICE vhci)
@@ -512,6 +763,26 @@ PAGED void usbip::plugin_persistent_devices(_In_ WDFDEVICE vhci)
 
         ULONG cnt{};
         auto col = get_persistent_devices(cnt, ctx.devices_cnt);
+        if (!cnt) {
+                return;
+        }
+
+        auto history_max = static_cast<ULONG>(ctx.devices_cnt);
+        auto sz = cnt*(sizeof(device_attributes) + 2*sizeof(size_t) + sizeof(UINT64)) + history_max*sizeof(UINT64);
+
+        unique_ptr buf(PagedPool, sz);
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", sz);
+                return;
+        }
+
+        auto devices = buf.get<device_attributes>();
+        auto order = reinterpret_cast<size_t*>(devices + cnt);
+        auto ranks = order + cnt;
+        auto keys = reinterpret_cast<UINT64*>(ranks + cnt);
+        auto history = keys + cnt;
+
+        ULONG n = 0;
 
         for (ULONG i = 0; i < cnt; ++i) {
 
@@ -520,12 +791,71 @@ PAGED void usbip::plugin_persistent_devices(_In_ WDFDEVICE vhci)
                 UNICODE_STRING device_str;
                 WdfStringGetUnicodeString(str, &device_str);
 
-                if (device_attributes attr{}; auto err = parse_device_str(attr, device_str)) {
+                if (auto &attr = devices[n]; auto err = parse_device_str(attr, device_str)) {
                         Trace(TRACE_LEVEL_ERROR, "parse_device_str(%!USTR!) %!STATUS!", &device_str, err);
+                        attr = device_attributes{};
                 } else {
-                        start_attach_attempts(vhci, ctx, attr);
+                        keys[n++] = attr.location_key;
                 }
         }
+
+        ULONG history_cnt{};
+        if (wdf::WaitLock lck(ctx.attach_history_lock); auto src = ctx.attach_history) {
+                history_cnt = min(ctx.attach_history_cnt, history_max);
+                RtlCopyMemory(history, src, history_cnt*sizeof(*history));
+        }
+
+        attach_plan::order(order, ranks, keys, n, history, history_cnt);
+        Trace(TRACE_LEVEL_INFORMATION, "%lu devices, %lu known", n, history_cnt);
+
+        for (ULONG i = 0; i < n; ++i) {
+                start_attach_attempts(vhci, ctx, devices[order[i]]);
+        }
+}
+
+/*
+ * Keeps location keys of successfully attached devices, the most recent first.
+ * The history is written to the registry once per ATTACH_HISTORY_DELAY, so the attaches at boot
+ * cost one write instead of one per device.
+ * @see plugin_persistent_devices, save_attach_history
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::remember_attach(_In_ WDFDEVICE vhci, _In_ UINT64 location_key)
+{
+        PAGED_CODE();
+
+        enum { ATTACH_HISTORY_DELAY = 10 }; // seconds
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::WaitLock lck(ctx.attach_history_lock);
+
+        auto history = ctx.attach_history;
+        if (!history || (ctx.attach_history_cnt && *history == location_key)) { // the most recent already
+                return;
+        }
+
+        auto max_cnt = static_cast<ULONG>(ctx.devices_cnt);
+        ctx.attach_history_cnt = static_cast<ULONG>(attach_plan::remember(history, ctx.attach_history_cnt, 
+                                                                          max_cnt, location_key));
+        if (!ctx.attach_history_dirty) {
+                ctx.attach_history_dirty = true;
+                WdfTimerStart(ctx.attach_history_timer, WDF_REL_TIMEOUT_IN_SEC(ATTACH_HISTORY_DELAY));
+        }
+}
+
+/*
+ * Writes pending changes of the history, it is also called when vhci leaves D0.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::save_attach_history(_In_ WDFDEVICE vhci)
+{
+        PAGED_CODE();
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::WaitLock lck(ctx.attach_history_lock);
+        write_attach_history(ctx);
 }
 
 _IRQL_requires_same_
@@ -601,7 +931,7 @@ ObjectDelete usbip::create_request(_In_ WDFIOTARGET target, _In_ WDF_OBJECT_ATTR
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-bool usbip::can_reattach(_In_ WDFDEVICE vhci, _In_ ULONG location_hash, _In_ NTSTATUS status)
+bool usbip::can_reattach(_In_ WDFDEVICE vhci, _In_ UINT64 location_key, _In_ NTSTATUS status)
 {
         NT_ASSERT(NT_ERROR(status));
 
@@ -611,7 +941,7 @@ bool usbip::can_reattach(_In_ WDFDEVICE vhci, _In_ ULONG location_hash, _In_ NTS
         case USBIP_ERROR_PROTOCOL:
                 return false; // unrecoverable errors
         case USBIP_ERROR_ST_DEV_BUSY:
-                return !vhci::has_device(vhci, location_hash);
+                return !vhci::has_device(vhci, location_key);
         }
 
         return status != STATUS_CANCELLED;
@@ -622,36 +952,26 @@ bool usbip::can_reattach(_In_ WDFDEVICE vhci, _In_ ULONG location_hash, _In_ NTS
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS usbip::hash_location(_Inout_ ULONG &hash, _In_ const device_attributes &r)
+PAGED UINT64 usbip::make_location_key(_In_ const device_attributes &r)
 {
         PAGED_CODE();
-        hash = 0;
 
-        static_assert(sizeof(L",,") == 3*sizeof(wchar_t)); // must have space for null terminator
-        USHORT cb = r.node_name.Length + r.service_name.Length + r.busid.Length + sizeof(L",,"); // see format string
-
-        unique_ptr buf(libdrv::uninitialized, PagedPool, cb);
-        if (!buf) {
-                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %d bytes", cb);
-                return USBD_STATUS_INSUFFICIENT_RESOURCES;
-        }
-
-        UNICODE_STRING str { 
-                .MaximumLength = cb, 
-                .Buffer = buf.get<wchar_t>()
-        };
-
-        if (auto err = RtlUnicodeStringPrintf(&str, L"%wZ,%wZ,%wZ", &r.node_name, &r.service_name, &r.busid)) {
-                Trace(TRACE_LEVEL_ERROR, "RtlUnicodeStringPrintf %!STATUS!", err);
-                return err;
-        }
+        return location::make_key(r.node_name.Buffer, length(r.node_name),
+                                  r.service_name.Buffer, length(r.service_name),
+                                  r.busid.Buffer, length(r.busid));
+}
 
-        if (auto err = RtlHashUnicodeString(&str, true, HASH_STRING_ALGORITHM_DEFAULT, &hash)) {
-                Trace(TRACE_LEVEL_ERROR, "RtlHashUnicodeString('%!USTR!') %!STATUS!", &str, err);
-                return err;
-        }
+/*
+ * Devices of the same server are grouped by reattach::scheduler and server_liveness.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED UINT64 usbip::make_server_key(_In_ const device_attributes &r)
+{
+        PAGED_CODE();
 
-        return STATUS_SUCCESS;
+        return location::make_server_key(r.node_name.Buffer, length(r.node_name),
+                                         r.service_name.Buffer, length(r.service_name));
 }
 
 _IRQL_requires_same_
@@ -30,7 +30,11 @@ PAGED NTSTATUS fill_location(_Inout_ vhci::imported_device_location &r, _In_ con
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS hash_location(_Inout_ ULONG &hash, _In_ const device_attributes &r);
+PAGED UINT64 make_location_key(_In_ const device_attributes &r);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED UINT64 make_server_key(_In_ const device_attributes &r);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -40,6 +44,18 @@ _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void plugin_persistent_devices(_In_ WDFDEVICE vhci);
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void remember_attach(_In_ WDFDEVICE vhci, _In_ UINT64 location_key);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void save_attach_history(_In_ WDFDEVICE vhci);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS init_attach_attempts(_In_ WDFDEVICE vhci, _Inout_ vhci_ctx &ctx);
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void start_attach_attempts(
@@ -47,16 +63,24 @@ PAGED void start_attach_attempts(
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-int stop_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ ULONG location_hash);
+int stop_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ UINT64 location_key);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void wake_attach_attempts(_Inout_ vhci_ctx &vhci, _In_ UINT64 server_key);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-bool can_reattach(_In_ WDFDEVICE vhci, _In_ ULONG location_hash, _In_ NTSTATUS status);
+bool can_reattach(_In_ WDFDEVICE vhci, _In_ UINT64 location_key, _In_ NTSTATUS status);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS validate_serial_number(_In_ const char (&serial)[SERIAL_BUFSZ]);
 
+/*
+ * Backoff without jitter, it is used to estimate the default number of attempts.
+ * @see reattach::scheduler
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 constexpr auto get_next_delay(_In_ unsigned int delay, _In_ unsigned int max_delay)
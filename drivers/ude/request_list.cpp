@@ -9,6 +9,11 @@
 #include "context.h"
 #include "wsk_context.h"
 #include "device_ioctl.h"
+#include "link_monitor.h"
+#include "wsk_receive.h"
+#include "latency.h"
+
+#include <usbip/request_state.h>
 
 namespace
 {
@@ -17,13 +22,13 @@ using namespace usbip;
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto matches(_In_ WDFREQUEST request, _In_ const request_ctx &req, _In_ const device::request_search &crit)
+auto matches(_In_ request_ctx &req, _In_ const device::request_search &crit)
 {
         switch (crit.what) {
         case crit.SEQNUM:
                 return crit.seqnum == req.seqnum;
         case crit.REQUEST:
-                return crit.request == request;
+                return crit.request == get_handle(&req); // WDF object header is in another cache line
         case crit.ENDPOINT:
                 return crit.endpoint == req.endpoint;
         }
@@ -32,6 +37,29 @@ auto matches(_In_ WDFREQUEST request, _In_ const request_ctx &req, _In_ const de
         return false;
 }
 
+/*
+ * Each event happens once for a request, so compare-exchange fails once at most.
+ * @return what the caller must do with the request
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto advance(_Inout_ request_ctx &req, _In_ request_state::event e)
+{
+        for (auto cur = ReadNoFence(&req.state); ; ) {
+
+                auto t = request_state::on(static_cast<request_state::state>(cur), e);
+
+                if (auto prev = InterlockedCompareExchange(&req.state, t.next, cur); prev == cur) {
+                        return t;
+                } else {
+                        cur = prev;
+                }
+        }
+}
+
+/*
+ * The request can be still being sent, @see unlink_and_cancel.
+ */
 _Function_class_(EVT_WDF_REQUEST_CANCEL)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -43,18 +71,24 @@ void cancel_request(_In_ WDFREQUEST request)
         bool removed = device::remove_request(*dev, request, false); // can clash with concurrent remove_request(, true)
         TraceDbg("%04x, removed %d", ptr04x(request), removed);
 
-        device::send_cmd_unlink_and_cancel(device, request);
+        device::unlink_and_cancel(device, request);
 }
 
 } // namespace
 
 
+/*
+ * The request is referenced until request_sent, so its context can be accessed
+ * after it is completed by the receive thread and the handle can't be reused for another transfer.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void usbip::device::append_request(_Inout_ device_ctx &dev, _In_ const wsk_context &wsk, _In_ UDECXUSBENDPOINT endpoint)
+NTSTATUS usbip::device::append_request(_Inout_ device_ctx &dev, _In_ const wsk_context &wsk, _In_ UDECXUSBENDPOINT endpoint)
 {
-        auto &req = *get_request_ctx(wsk.request); // is not zeroed
-        req.cancelable = false;
+        auto request = wsk.request;
+        auto &req = *get_request_ctx(request); // is not zeroed
+
+        req.state = request_state::queued;
 
         NT_ASSERT(endpoint);
         req.endpoint = endpoint;
@@ -62,44 +96,77 @@ void usbip::device::append_request(_Inout_ device_ctx &dev, _In_ const wsk_conte
         req.seqnum = wsk.hdr.seqnum;
         NT_ASSERT(is_valid_seqnum(req.seqnum));
 
-        wdf::Lock lck(dev.requests_lock);
+        link_request_sent(req, wsk);
+
+        wdf::Lock lck(dev.requests_lock); // cancel_request waits for it
+
+        if (auto err = WdfRequestMarkCancelableEx(request, cancel_request)) {
+                TraceDbg("%04x, %!STATUS!", ptr04x(request), err);
+                return err; // was not sent, can be completed by the caller
+        }
+
         InsertTailList(&dev.requests, &req.entry);
+        ++dev.cancelable_requests;
+
+        WdfObjectReference(request);
+        return STATUS_SUCCESS;
 }
 
 /*
- * seqnum is used instead of WDFREQUEST because
- * - request can be already completed and must be used for value comparison only
- * - if request is completed, the same request instance can be allocated from a cache
- *   for next transfer and put in the list
+ * The request is referenced by append_request, so the handle is valid even if it was completed.
+ * If the send has failed, the server has not got the request and CMD_UNLINK is not sent.
+ * The request is completed here unless the cancel routine or endpoint purge has got it,
+ * the last of them and request_sent completes it then.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS usbip::device::mark_request_cancelable(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
+void usbip::device::request_sent(_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ NTSTATUS status)
 {
-        NT_ASSERT(is_valid_seqnum(seqnum));
+        auto &req = *get_request_ctx(request);
+        latency_stamp(req, latency::send_done);
 
-        wdf::Lock lck(dev.requests_lock);
+        if (NT_SUCCESS(status)) {
+                ++dev.sent_requests;
 
-        for (auto head = &dev.requests, entry = head->Flink; entry != head; entry = entry->Flink) {
-
-                if (auto req = CONTAINING_RECORD(entry, request_ctx, entry); req->seqnum != seqnum) {
-                        // continue;
-                } else if (auto request = get_handle(req); auto err = WdfRequestMarkCancelableEx(request, cancel_request)) {
-                        TraceDbg("%04x, %!STATUS!", ptr04x(request), err);
-                        RemoveEntryList(entry);
-                        return err; // must do the same as cancel_request after that
-                } else {
-                        req->cancelable = true;
-                        ++dev.cancelable_requests;
-                        break;
+                if (advance(req, request_state::event::send_complete).unlink_and_cancel) {
+                        TraceDbg("req %04x, was cancelled while being sent", ptr04x(request));
+                        send_cmd_unlink_and_cancel(get_handle(&dev), request);
                 }
+        } else if (remove_request(dev, request)) {
+                TraceDbg("req %04x, %!STATUS!", ptr04x(request), status);
+                advance(req, request_state::event::send_failed);
+                complete(request, STATUS_CANCELLED);
+        } else if (advance(req, request_state::event::send_failed).cancel) {
+                TraceDbg("req %04x, %!STATUS!, was cancelled while being sent", ptr04x(request), status);
+                complete(request, STATUS_CANCELLED);
+        } else {
+                TraceDbg("req %04x, %!STATUS!, will be cancelled", ptr04x(request), status);
         }
 
-        return STATUS_SUCCESS;
+        WdfObjectDereference(request);
 }
 
 /*
- * Its rival is cancel_request if it is marked cancellable, otherwise mark_request_cancelable.
+ * The transfer buffer can't be released while it is being sent,
+ * the last of the cancel routine and request_sent completes the request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request)
+{
+        if (auto t = advance(*get_request_ctx(request), request_state::event::cancel); t.unlink_and_cancel) {
+                send_cmd_unlink_and_cancel(device, request);
+        } else if (t.cancel) {
+                TraceDbg("req %04x, was not sent", ptr04x(request));
+                complete(request, STATUS_CANCELLED);
+        } else {
+                TraceDbg("req %04x, is being sent, will be cancelled after that", ptr04x(request));
+        }
+}
+
+/*
+ * A request is always marked cancelable while it is in the list, its rival is cancel_request.
+ * @param unmark_cancelable false for the cancel routine only
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -111,15 +178,15 @@ WDFREQUEST usbip::device::remove_request(
         for (auto head = &dev.requests, entry = head->Flink; entry != head; entry = entry->Flink) {
 
                 auto req = CONTAINING_RECORD(entry, request_ctx, entry);
-                auto request = get_handle(req);
-
-                if (!matches(request, *req, crit)) {
+                if (!matches(*req, crit)) {
                         continue;
                 }
 
+                auto request = get_handle(req);
+
                 RemoveEntryList(entry);
 
-                if (!(unmark_cancelable && req->cancelable)) {
+                if (!unmark_cancelable) {
                         // not required
                 } else if (auto ret = WdfRequestUnmarkCancelable(request)) {
                         TraceDbg("%04x, unmark cancelable %!STATUS!", ptr04x(request), ret);
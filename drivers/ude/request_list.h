@@ -45,13 +45,29 @@ struct request_search
 };
 
 
+/*
+ * The request is put in the list and marked cancelable, it must be sent after that.
+ * @return error if the request is already cancelled, it is not in the list
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void append_request(_Inout_ device_ctx &dev, _In_ const wsk_context &wsk, _In_ UDECXUSBENDPOINT endpoint);
+NTSTATUS append_request(_Inout_ device_ctx &dev, _In_ const wsk_context &wsk, _In_ UDECXUSBENDPOINT endpoint);
 
+/*
+ * Send completion of a request that was passed to append_request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void request_sent(_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ NTSTATUS status);
+
+/*
+ * The caller has removed the request from the list.
+ * CMD_UNLINK is sent and the request is cancelled when it is sent, @see request_sent.
+ * If the send has failed, the request is cancelled without CMD_UNLINK.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS mark_request_cancelable(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum);
+void unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
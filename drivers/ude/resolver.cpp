@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "resolver.h"
+#include "trace.h"
+#include "resolver.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "persistent.h"
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * WskGetAddressInfo does not return TTL of DNS records.
+ */
+enum : address_cache::time_t { // milliseconds
+        POSITIVE_TTL = 60*1000,
+        NEGATIVE_TTL = 5*1000,
+};
+
+enum : server_table::time_t { // milliseconds, @see server_table
+        MIN_DOWN_TIME = 2*1000,
+        MAX_DOWN_TIME = 30*1000,
+};
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline address_cache::time_t now()
+{
+        return KeQueryInterruptTime()/(10*1000); // 100-nanosecond units to milliseconds
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto length(_In_ const UNICODE_STRING &s)
+{
+        return s.Length/sizeof(*s.Buffer);
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_address_cache(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+        NT_ASSERT(!vhci.addr_cache);
+
+        unique_ptr ptr(PagedPool, sizeof(*vhci.addr_cache)); // zeroed
+        if (!ptr) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", sizeof(*vhci.addr_cache));
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        vhci.addr_cache = ptr.release<address_cache>();
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::destroy_address_cache(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        unique_ptr(vhci.addr_cache); // destroy
+        vhci.addr_cache = nullptr;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto usbip::resolve_lookup(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr,
+        _Out_ resolved_addresses &result, _Out_ NTSTATUS &status) -> address_cache_result
+{
+        PAGED_CODE();
+        status = STATUS_SUCCESS;
+
+        if (!vhci.addr_cache) {
+                return address_cache_result::miss;
+        }
+
+        auto &host = attr.node_name;
+        auto &service = attr.service_name;
+
+        wdf::WaitLock lck(vhci.addr_cache_lock);
+
+        long err;
+        auto ret = vhci.addr_cache->lookup(host.Buffer, length(host), service.Buffer, length(service),
+                                           now(), result, err);
+        lck.release();
+
+        status = err;
+        TraceDbg("%!USTR!:%!USTR! -> %d, %!STATUS!", &host, &service, static_cast<int>(ret), status);
+
+        return ret;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::resolve_complete(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr,
+        _In_ NTSTATUS status, _In_ const resolved_addresses &result)
+{
+        PAGED_CODE();
+
+        if (status == STATUS_CANCELLED) {
+                resolve_abandon(vhci, attr);
+                return;
+        } else if (!vhci.addr_cache) {
+                return;
+        }
+
+        auto &host = attr.node_name;
+        auto &service = attr.service_name;
+
+        TraceDbg("%!USTR!:%!USTR! %!STATUS!, %d address(es)", &host, &service, status,
+                  NT_SUCCESS(status) ? result.cnt : 0);
+
+        auto ok = NT_SUCCESS(status);
+
+        wdf::WaitLock lck(vhci.addr_cache_lock);
+
+        vhci.addr_cache->complete(host.Buffer, length(host), service.Buffer, length(service), now(),
+                                  ok ? 0 : status, &result, ok ? POSITIVE_TTL : NEGATIVE_TTL);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::resolve_abandon(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr)
+{
+        PAGED_CODE();
+
+        if (!vhci.addr_cache) {
+                return;
+        }
+
+        auto &host = attr.node_name;
+        auto &service = attr.service_name;
+
+        TraceDbg("%!USTR!:%!USTR!", &host, &service);
+
+        wdf::WaitLock lck(vhci.addr_cache_lock);
+        vhci.addr_cache->abandon(host.Buffer, length(host), service.Buffer, length(service));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_server_table(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+        NT_ASSERT(!vhci.servers);
+
+        unique_ptr ptr(NonPagedPoolNx, sizeof(*vhci.servers)); // zeroed, is accessed under spinlock
+        if (!ptr) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", sizeof(*vhci.servers));
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        vhci.servers = ptr.release<server_table>();
+        vhci.servers->init(MIN_DOWN_TIME, MAX_DOWN_TIME);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::destroy_server_table(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        unique_ptr(vhci.servers); // destroy
+        vhci.servers = nullptr;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto usbip::check_server(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _Out_ NTSTATUS &status) -> server_verdict
+{
+        PAGED_CODE();
+        status = STATUS_SUCCESS;
+
+        if (!vhci.servers) {
+                return server_verdict::connect;
+        }
+
+        auto key = make_server_key(attr);
+        long err;
+
+        wdf::Lock lck(vhci.servers_lock);
+        auto ret = vhci.servers->check(key, now(), err);
+        lck.release();
+
+        status = err;
+
+        if (ret != server_verdict::connect) {
+                TraceDbg("%!USTR!:%!USTR! -> %d, %!STATUS!", &attr.node_name, &attr.service_name,
+                          static_cast<int>(ret), status);
+        }
+
+        return ret;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::server_connected(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _In_ ULONGLONG connect_time)
+{
+        PAGED_CODE();
+
+        if (!vhci.servers) {
+                return;
+        }
+
+        auto key = make_server_key(attr);
+        auto rtt = (KeQueryInterruptTime() - connect_time)/(10*1000);
+
+        wdf::Lock lck(vhci.servers_lock);
+        auto was_down = vhci.servers->connected(key, now(), rtt);
+        lck.release();
+
+        TraceDbg("%!USTR!:%!USTR!, connected in %I64u ms, was down %!bool!",
+                  &attr.node_name, &attr.service_name, rtt, was_down);
+
+        if (was_down) {
+                wake_attach_attempts(vhci, key);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::server_failed(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _In_ NTSTATUS status)
+{
+        PAGED_CODE();
+
+        if (!vhci.servers) {
+                return;
+        }
+
+        auto key = make_server_key(attr);
+
+        wdf::Lock lck(vhci.servers_lock);
+        auto backoff = vhci.servers->failed(key, now(), status);
+        lck.release();
+
+        TraceDbg("%!USTR!:%!USTR! %!STATUS!, down for %I64u ms",
+                  &attr.node_name, &attr.service_name, status, backoff);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::server_abandon(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr)
+{
+        PAGED_CODE();
+
+        if (!vhci.servers) {
+                return;
+        }
+
+        auto key = make_server_key(attr);
+        TraceDbg("%!USTR!:%!USTR!", &attr.node_name, &attr.service_name);
+
+        wdf::Lock lck(vhci.servers_lock);
+        vhci.servers->abandon(key);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::copy(_Out_ resolved_addresses &result, _In_opt_ const ADDRINFOEXW *head)
+{
+        RtlZeroMemory(&result, sizeof(result));
+
+        for (auto ai = head; ai && result.cnt < result.MAX_CNT; ai = ai->ai_next) {
+
+                switch (ai->ai_family) {
+                case AF_INET:
+                case AF_INET6:
+                        if (ai->ai_addrlen <= sizeof(*result.addr)) {
+                                RtlCopyMemory(result.addr + result.cnt++, ai->ai_addr, ai->ai_addrlen);
+                        }
+                }
+        }
+
+        return result.cnt ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ADDRINFOEXW *usbip::make_addrinfo(
+        _Out_writes_(resolved_addresses::MAX_CNT) ADDRINFOEXW *ai, _In_ resolved_addresses &r)
+{
+        NT_ASSERT(r.cnt > 0);
+        NT_ASSERT(r.cnt <= r.MAX_CNT);
+
+        for (int i = 0; i < r.cnt; ++i) {
+                auto &sa = r.addr[i];
+
+                ai[i] = ADDRINFOEXW {
+                        .ai_family = sa.si_family,
+                        .ai_socktype = SOCK_STREAM,
+                        .ai_protocol = IPPROTO_TCP,
+                        .ai_addrlen = sa.si_family == AF_INET ? sizeof(sa.Ipv4) : sizeof(sa.Ipv6),
+                        .ai_addr = reinterpret_cast<SOCKADDR*>(&sa),
+                        .ai_next = i + 1 < r.cnt ? ai + i + 1 : nullptr
+                };
+        }
+
+        return ai;
+}
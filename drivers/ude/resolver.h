@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv/codeseg.h>
+#include <libdrv/wsk_cpp.h>
+
+#include <usbip/resolver_cache.h>
+#include <usbip/server_liveness.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_attributes;
+
+/*
+ * Result of WskGetAddressInfo, SOCK_STREAM and IPPROTO_TCP are implied.
+ */
+struct resolved_addresses
+{
+        enum { MAX_CNT = 8 };
+
+        int cnt;
+        SOCKADDR_INET addr[MAX_CNT];
+};
+
+/*
+ * Attach attempts of all devices on the same server resolve its name once per TTL.
+ */
+struct address_cache : resolver_cache<resolved_addresses, 16, wchar_t> {};
+using address_cache_result = address_cache::result;
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_address_cache(_Inout_ vhci_ctx &vhci);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void destroy_address_cache(_Inout_ vhci_ctx &vhci);
+
+/*
+ * @param status of the cached lookup if negative_hit is returned
+ * @return if miss, the caller must call resolve_complete() or resolve_abandon()
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED address_cache_result resolve_lookup(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr,
+        _Out_ resolved_addresses &result, _Out_ NTSTATUS &status);
+
+/*
+ * STATUS_CANCELLED is not cached, resolve_abandon() is called instead.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void resolve_complete(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr,
+        _In_ NTSTATUS status, _In_ const resolved_addresses &result);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void resolve_abandon(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr);
+
+/*
+ * Attach attempts to a server that is known to be down fail at once instead of waiting for connect timeout.
+ */
+struct server_table : server_liveness<32> {};
+using server_verdict = server_table::verdict;
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_server_table(_Inout_ vhci_ctx &vhci);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void destroy_server_table(_Inout_ vhci_ctx &vhci);
+
+/*
+ * It is called for attach attempts of persistent devices only, the attaches of the user always connect.
+ * @param status of the last connect if fail_fast is returned
+ * @return if probe, the caller must call server_connected(), server_failed() or server_abandon()
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED server_verdict check_server(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _Out_ NTSTATUS &status);
+
+/*
+ * Attach attempts of the server that wait for it are woken if it was down.
+ * @param connect_time the value of KeQueryInterruptTime when connect was started
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void server_connected(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _In_ ULONGLONG connect_time);
+
+/*
+ * Connect to all addresses of the server has failed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void server_failed(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr, _In_ NTSTATUS status);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void server_abandon(_Inout_ vhci_ctx &vhci, _In_ const device_attributes &attr);
+
+/*
+ * @return STATUS_NOT_FOUND if there are no IPv4/IPv6 addresses in the list
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS copy(_Out_ resolved_addresses &result, _In_opt_ const ADDRINFOEXW *head);
+
+/*
+ * Build the list that can be passed to connect() like one returned by WskGetAddressInfo.
+ * @return list head
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ADDRINFOEXW *make_addrinfo(_Out_writes_(resolved_addresses::MAX_CNT) ADDRINFOEXW *ai, _In_ resolved_addresses &r);
+
+} // namespace usbip
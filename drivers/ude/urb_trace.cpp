@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "urb_trace.h"
+#include "trace.h"
+#include "urb_trace.tmh"
+
+#include "context.h"
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG { // records per processor
+        CAPACITY_MIN = 1024,
+        CAPACITY_MAX = 1024*1024,
+};
+
+enum : SIZE_T { TOTAL_MAX = 64*1024*1024 }; // bytes of records of all processors, NonPagedPool
+
+using ring = urb_trace::ring<interlocked>;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto& get_urb_trace_ctx(_In_ WDFMEMORY mem)
+{
+        return *static_cast<urb_trace_ctx*>(WdfMemoryGetBuffer(mem, nullptr));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+constexpr ULONG round_capacity(_In_ ULONG capacity, _In_ ULONG cpu_cnt)
+{
+        ULONG cap = CAPACITY_MIN;
+        while (cap < capacity && cap < CAPACITY_MAX) {
+                cap <<= 1;
+        }
+
+        while (cap > CAPACITY_MIN && SIZE_T(cap)*cpu_cnt*sizeof(urb_trace::record) > TOTAL_MAX) {
+                cap >>= 1;
+        }
+
+        return cap;
+}
+
+/*
+ * The rings are not freed when the trace is disabled because writers can still use them.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_urb_trace_mem(_In_ WDFDEVICE vhci, _Inout_ vhci_ctx &ctx, _In_ ULONG capacity)
+{
+        PAGED_CODE();
+
+        if (ctx.urb_trace_mem) {
+                return STATUS_SUCCESS;
+        }
+
+        auto cpu_cnt = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        capacity = round_capacity(capacity, cpu_cnt);
+
+        static_assert(!(sizeof(urb_trace_ctx) % alignof(ring)));
+        static_assert(!(sizeof(ring) % alignof(urb_trace::record)));
+
+        auto size = sizeof(urb_trace_ctx) + cpu_cnt*(sizeof(ring) + capacity*sizeof(urb_trace::record));
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = vhci;
+
+        WDFMEMORY mem{};
+        urb_trace_ctx *t{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, 0, size, &mem, reinterpret_cast<PVOID*>(&t))) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate(%Iu) %!STATUS!", size, err);
+                return err;
+        }
+
+        RtlZeroMemory(t, sizeof(*t) + cpu_cnt*sizeof(ring));
+
+        t->cpu_count = cpu_cnt;
+        t->rings = reinterpret_cast<ring*>(t + 1);
+
+        auto storage = reinterpret_cast<urb_trace::record*>(t->rings + cpu_cnt);
+
+        for (ULONG i = 0; i < cpu_cnt; ++i, storage += capacity) {
+                t->rings[i].init(storage, capacity);
+        }
+
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&ctx.urb_trace_mem), mem, nullptr)) {
+                WdfObjectDelete(mem); // concurrent call has created it
+        } else {
+                Trace(TRACE_LEVEL_INFORMATION, "%lu processors, %lu records per processor, %Iu bytes", cpu_cnt, capacity, size);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void fill(_Out_ urb_trace::record &r, _In_ int port, _In_ const header &hdr, _In_opt_ WDFREQUEST request)
+{
+        r.time = KeQueryPerformanceCounter(nullptr).QuadPart;
+        r.request = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(request));
+        r.seqnum = hdr.seqnum;
+        r.port = static_cast<unsigned short>(port);
+        r.ep = static_cast<unsigned char>(hdr.ep | (hdr.direction == direction::in ? urb_trace::dir_in : 0));
+
+        r.transfer_flags = 0;
+        r.length = 0;
+        r.status = 0;
+        r.number_of_packets = 0;
+        r.extra = 0;
+        RtlZeroMemory(r.setup, sizeof(r.setup));
+
+        switch (hdr.command) {
+        case CMD_SUBMIT:
+                r.type = urb_trace::cmd_submit;
+                r.transfer_flags = hdr.cmd_submit.transfer_flags;
+                r.length = hdr.cmd_submit.transfer_buffer_length;
+                r.number_of_packets = hdr.cmd_submit.number_of_packets;
+                r.extra = hdr.cmd_submit.interval;
+                RtlCopyMemory(r.setup, hdr.cmd_submit.setup, sizeof(r.setup));
+                break;
+        case RET_SUBMIT:
+                r.type = urb_trace::ret_submit;
+                r.status = hdr.ret_submit.status;
+                r.length = hdr.ret_submit.actual_length;
+                r.number_of_packets = hdr.ret_submit.number_of_packets;
+                r.extra = hdr.ret_submit.error_count;
+                break;
+        case CMD_UNLINK:
+                r.type = urb_trace::cmd_unlink;
+                r.extra = static_cast<int>(hdr.cmd_unlink.seqnum);
+                break;
+        case RET_UNLINK:
+                r.type = urb_trace::ret_unlink;
+                r.status = hdr.ret_unlink.status;
+                break;
+        }
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::set_urb_trace(_In_ WDFDEVICE vhci, _In_ ULONG capacity)
+{
+        PAGED_CODE();
+
+        auto &ctx = *get_vhci_ctx(vhci);
+        TraceDbg("capacity %lu", capacity);
+
+        if (!capacity) {
+                InterlockedExchangePointer(reinterpret_cast<PVOID*>(&ctx.urb_trace), nullptr);
+                return STATUS_SUCCESS;
+        }
+
+        if (auto err = create_urb_trace_mem(vhci, ctx, capacity)) {
+                return err;
+        }
+
+        auto &t = get_urb_trace_ctx(ctx.urb_trace_mem);
+        InterlockedExchangePointer(reinterpret_cast<PVOID*>(&ctx.urb_trace), &t);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::read_urb_trace(_In_ vhci_ctx &vhci, _Out_writes_bytes_(length) void *buf, _In_ ULONG length, _Out_ ULONG &written)
+{
+        PAGED_CODE();
+        written = 0;
+
+        auto mem = static_cast<WDFMEMORY>(ReadPointerAcquire(reinterpret_cast<PVOID*>(&vhci.urb_trace_mem)));
+        if (!mem) {
+                return STATUS_INVALID_DEVICE_STATE; // the trace was never enabled
+        }
+
+        auto &t = get_urb_trace_ctx(mem);
+
+        if (set_flag(t.reading)) {
+                return STATUS_DEVICE_BUSY;
+        }
+
+        auto dst = static_cast<UCHAR*>(buf);
+
+        for (ULONG i = 0; i < t.cpu_count; ++i) {
+
+                auto &r = t.rings[i];
+                auto avail = length - written;
+
+                if (!r.size()) {
+                        continue;
+                } else if (avail < sizeof(urb_trace::chunk) + sizeof(urb_trace::record)) {
+                        break;
+                }
+
+                auto &c = *reinterpret_cast<urb_trace::chunk*>(dst + written);
+                auto records = reinterpret_cast<urb_trace::record*>(&c + 1);
+
+                auto max_cnt = (avail - sizeof(c))/sizeof(*records);
+
+                c.processor = i;
+                c.count = static_cast<unsigned int>(r.read(records, max_cnt));
+                c.dropped = static_cast<unsigned long long>(r.dropped());
+
+                written += static_cast<ULONG>(sizeof(c) + c.count*sizeof(*records));
+        }
+
+        InterlockedExchange(&t.reading, false);
+        return STATUS_SUCCESS;
+}
+
+/*
+ * IRQL is raised to make the current processor the only writer of its ring.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::urb_trace_log(_Inout_ urb_trace_ctx &ctx, _In_ int port, _In_ const header &hdr, _In_opt_ WDFREQUEST request)
+{
+        KIRQL irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+
+        if (auto cpu = KeGetCurrentProcessorNumberEx(nullptr); cpu < ctx.cpu_count) {
+                auto &r = ctx.rings[cpu];
+                if (auto rec = r.prepare()) {
+                        fill(*rec, port, hdr, request);
+                        r.commit();
+                }
+        }
+
+        KeLowerIrql(irql);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "capture.h"
+#include <usbip/urb_trace.h>
+
+/*
+ * Opt-in binary trace of USB/IP PDUs, @see vhci::ioctl::set_urb_trace.
+ * If it is disabled, the cost is a check of vhci_ctx::urb_trace for every PDU.
+ */
+namespace usbip
+{
+
+struct vhci_ctx;
+
+/*
+ * Is placed at the beginning of vhci_ctx::urb_trace_mem, the rings and their storage follow it.
+ */
+struct urb_trace_ctx
+{
+        ULONG cpu_count;
+        LONG reading; // serializes readers, use set_flag
+        urb_trace::ring<interlocked> *rings; // [cpu_count]
+};
+
+/*
+ * @param capacity records per processor, it is reduced if the rings of all processors exceed 64 MiB
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_urb_trace(_In_ WDFDEVICE vhci, _In_ ULONG capacity);
+
+/*
+ * @param written the length of chunks with their records
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_urb_trace(_In_ vhci_ctx &vhci, _Out_writes_bytes_(length) void *buf, _In_ ULONG length, _Out_ ULONG &written);
+
+/*
+ * @param hdr in host byte order
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void urb_trace_log(_Inout_ urb_trace_ctx &ctx, _In_ int port, _In_ const header &hdr, _In_opt_ WDFREQUEST request);
+
+} // namespace usbip
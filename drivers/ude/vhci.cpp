@@ -10,6 +10,10 @@
 #include "device.h"
 #include "vhci_ioctl.h"
 #include "persistent.h"
+#include "resolver.h"
+#include "link_monitor.h"
+#include "wsk_receive.h"
+#include "compress.h"
 
 #include <libdrv/wdm_cpp.h>
 #include <libdrv/utils.h>
@@ -46,6 +50,21 @@ PAGED void vhci_cleanup(_In_ WDFOBJECT object)
         unique_ptr(ctx.devices); // destroy
         ctx.devices = nullptr;
 
+        unique_ptr(ctx.port_generation); // destroy
+        ctx.port_generation = nullptr;
+
+        destroy_address_cache(ctx);
+        destroy_server_table(ctx);
+
+        unique_ptr(ctx.events.sources()); // destroy, records follow them
+        ctx.events.init(nullptr, 0, nullptr, 0);
+
+        unique_ptr(ctx.reattach.storage()); // destroy
+        ctx.reattach = reattach::scheduler{};
+
+        unique_ptr(ctx.attach_history); // destroy
+        ctx.attach_history = nullptr;
+
         ctx.devices_cnt = 0;
         ctx.usb2_ports = 0;
 }
@@ -169,9 +188,19 @@ PAGED auto alloc_devices(_Inout_ vhci_ctx &vhci)
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
+        unique_ptr gen(NonPagedPoolNx, n*sizeof(*vhci.port_generation));
+        if (!gen) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate array UINT64[%d]", n);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
         vhci.usb2_ports = usb2_ports;
         vhci.devices_cnt = n;
         vhci.devices = ptr.release<UDECXUSBDEVICE>();
+        vhci.port_generation = gen.release<UINT64>();
+
+        // a generation of the previous instance of the driver must be less
+        vhci.generation = vhci.first_generation = KeQueryInterruptTime();
 
         Trace(TRACE_LEVEL_INFORMATION, "usb2 ports %d, UDECXUSBDEVICE[%d]", vhci.usb2_ports, vhci.devices_cnt);
         return STATUS_SUCCESS;
@@ -248,12 +277,13 @@ constexpr auto get_max_attach_attempts(
 }
 
 /*
- * @see .inf, ReattachMaxAttempts, ReattachFirstDelay, ReattachMaxDelay
+ * @see .inf, ReattachMaxAttempts, ReattachFirstDelay, ReattachMaxDelay, ReattachMaxConcurrency
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void init_constants(
-        _Inout_ unsigned int &max_attempts, _Inout_ unsigned int &first_delay, _Inout_ unsigned int &max_delay)
+        _Inout_ unsigned int &max_attempts, _Inout_ unsigned int &first_delay, _Inout_ unsigned int &max_delay,
+        _Inout_ unsigned int &max_concurrency)
 {
         PAGED_CODE();
 
@@ -261,7 +291,8 @@ PAGED void init_constants(
                 HOUR = 60*60,
                 DEF_FIRST_DELAY = 30, DEF_MAX_DELAY = 8*60, // see .inf
                 DEF_MAX_ATTEMPTS = get_max_attach_attempts(DEF_FIRST_DELAY, DEF_MAX_DELAY, 2*HOUR), 
-                MIN_DELAY = 1, MAX_DELAY = HOUR, MAX_TOTAL_DELAY = 72*HOUR
+                MIN_DELAY = 1, MAX_DELAY = HOUR, MAX_TOTAL_DELAY = 72*HOUR,
+                DEF_MAX_CONCURRENCY = 4, MAX_CONCURRENCY = 64 // simultaneous attach attempts
         };
         static_assert(DEF_MAX_ATTEMPTS == 20); // see.inf
 
@@ -270,6 +301,7 @@ PAGED void init_constants(
                 max_attempts = DEF_MAX_ATTEMPTS;
                 first_delay = DEF_FIRST_DELAY;
                 max_delay = DEF_MAX_DELAY;
+                max_concurrency = DEF_MAX_CONCURRENCY;
                 return;
         }
 
@@ -280,6 +312,7 @@ PAGED void init_constants(
                 { L"ReattachMaxAttempts", max_attempts },
                 { L"ReattachFirstDelay", first_delay },
                 { L"ReattachMaxDelay", max_delay },
+                { L"ReattachMaxConcurrency", max_concurrency },
         };
 
         for (auto& [name, value]: v) {
@@ -307,7 +340,10 @@ PAGED void init_constants(
                 max_attempts = n;
         }
 
-        TraceDbg("%S=%u, %S=%u, %S=%u", v[0].name, max_attempts, v[1].name, first_delay, v[2].name, max_delay);
+        max_concurrency = max_concurrency ? min(max_concurrency, MAX_CONCURRENCY) : DEF_MAX_CONCURRENCY;
+
+        TraceDbg("%S=%u, %S=%u, %S=%u, %S=%u", v[0].name, max_attempts, v[1].name, first_delay, 
+                  v[2].name, max_delay, v[3].name, max_concurrency);
 
         NT_ASSERT(first_delay >= MIN_DELAY);
         NT_ASSERT(first_delay <= max_delay);
@@ -334,20 +370,26 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
         WDF_OBJECT_ATTRIBUTES_INIT(&attr);
         attr.ParentObject = vhci;
 
-        for (WDFSPINLOCK* v[] { &ctx.devices_lock, &ctx.reattach_req_lock }; auto lck: v) {
+        for (WDFSPINLOCK* v[] { &ctx.devices_lock, &ctx.reattach_lock, &ctx.servers_lock, &ctx.sockbuf_lock };
+             auto lck: v) {
                 if (auto err = WdfSpinLockCreate(&attr, lck)) {
                         Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
                         return err;
                 }
         }
 
-        if (auto err = WdfWaitLockCreate(&attr, &ctx.events_lock)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfWaitLockCreate %!STATUS!", err);
+        for (WDFWAITLOCK* v[] { &ctx.events_lock, &ctx.addr_cache_lock, &ctx.attach_history_lock }; auto lck: v) {
+                if (auto err = WdfWaitLockCreate(&attr, lck)) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfWaitLockCreate %!STATUS!", err);
+                        return err;
+                }
+        }
+
+        if (auto err = create_address_cache(ctx)) {
                 return err;
         }
 
-        if (auto err = WdfCollectionCreate(&attr, &ctx.reattach_req)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfCollectionCreate %!STATUS!", err);
+        if (auto err = create_server_table(ctx)) {
                 return err;
         }
 
@@ -359,8 +401,13 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
                 return err;
         }
 
-        init_constants(ctx.reattach_max_attempts, ctx.reattach_first_delay, ctx.reattach_max_delay);
-        return STATUS_SUCCESS;
+        init_constants(ctx.reattach_max_attempts, ctx.reattach_first_delay, ctx.reattach_max_delay,
+                       ctx.reattach_max_concurrency);
+
+        init_link_monitor(ctx);
+        init_recv_thread_placement(ctx);
+        init_compression(ctx);
+        return init_attach_attempts(vhci, ctx);
 }
 
 _Function_class_(init_func_t)
@@ -427,10 +474,12 @@ NTSTATUS query_usb_capability(
 _Function_class_(EVT_WDF_DEVICE_D0_EXIT)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED NTSTATUS NTAPI vhci_d0_exit(_In_ WDFDEVICE, _In_ WDF_POWER_DEVICE_STATE TargetState)
+PAGED NTSTATUS NTAPI vhci_d0_exit(_In_ WDFDEVICE vhci, _In_ WDF_POWER_DEVICE_STATE TargetState)
 {
         PAGED_CODE();
         TraceDbg("TargetState %!WDF_POWER_DEVICE_STATE!", TargetState);
+
+        save_attach_history(vhci);
         return STATUS_SUCCESS;
 }
 
@@ -498,19 +547,6 @@ PAGED NTSTATUS vhci_query_remove(_In_ WDFDEVICE vhci)
         return STATUS_SUCCESS;
 }
 
-_IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto create_collection(_Out_ WDFCOLLECTION &result, _In_ WDFOBJECT parent)
-{
-        PAGED_CODE();
-
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.ParentObject = parent;
-
-        return WdfCollectionCreate(&attr, &result);
-}
-
 _Function_class_(EVT_WDF_DEVICE_FILE_CREATE)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -521,17 +557,14 @@ PAGED void device_file_create(_In_ WDFDEVICE vhci, _In_ WDFREQUEST request, _In_
 
         auto &fobj = *get_fileobject_ctx(fileobj);
         InitializeListHead(&fobj.entry);
+        fobj.events_version = vhci::ioctl::DEVICE_STATE_V1;
 
-        auto st = create_collection(fobj.events, fileobj);
-
-        if (NT_ERROR(st)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfCollectionCreate %!STATUS!", st);
-        } else if (auto v = get_vhci_ctx(vhci)) {
+        if (auto v = get_vhci_ctx(vhci)) {
                 wdf::WaitLock lck(v->events_lock);
                 InsertTailList(&v->fileobjects, &fobj.entry);
         }
 
-        WdfRequestComplete(request, st);
+        WdfRequestComplete(request, STATUS_SUCCESS);
 }
 
 _Function_class_(EVT_WDF_FILE_CLEANUP)
@@ -749,89 +782,65 @@ PAGED auto make_source_id(_In_ const void *ptr)
         return hash;
 }
 
+/*
+ * vhci_ctx::events_lock must be acquired.
+ */
 _IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto make_device_state(
-        _In_ WDFOBJECT parent, _In_ const device_attributes &dev, _In_ int port, _In_ vhci::state state)
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto add_event(
+        _Inout_ vhci_ctx &vhci, _In_ const device_attributes &dev, _In_ int port, _In_ vhci::state state)
 {
         PAGED_CODE();
 
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.EvtDestroyCallback = [] (auto p) { TraceDbg("destroy %04x", ptr04x(p)); };
-        attr.ParentObject = parent;
-
-        WDFMEMORY mem{};
-        vhci::device_state *r{};
-        if (auto err = WdfMemoryCreate(&attr, PagedPool, 0, sizeof(*r), &mem, reinterpret_cast<PVOID*>(&r))) {
-                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
-                return mem;
-        }
+        auto source_id = make_source_id(&dev); // CONTAINING_RECORD(&dev, device_ctx_ext, attr)
+        auto &info = vhci.events.prepare(source_id);
 
-        RtlZeroMemory(r, sizeof(*r));
-        r->size = sizeof(*r);
-        r->state = state;
-        r->source_id = make_source_id(&dev); // CONTAINING_RECORD(&dev, device_ctx_ext, attr)
+        RtlZeroMemory(&info, sizeof(info));
 
-        if (auto err = fill(*r, dev, port)) {
-                WdfObjectDelete(mem);
-                mem = WDF_NO_HANDLE;
+        if (auto err = fill(info, dev, port)) {
+                vhci.events.discard();
+                return err;
         }
 
-        TraceDbg("%04x", ptr04x(mem));
-        return mem;
+        auto seqnum = vhci.events.commit(port, state); // the oldest event is dropped if the ring is full
+        TraceDbg("seqnum %I64u, events %Iu", seqnum, vhci.events.size());
+
+        return STATUS_SUCCESS;
 }
 
 /*
+ * Complete pending reads of the subscribers.
  * vhci_ctx::events_lock must be acquired.
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void process_event(
-        _In_ WDFQUEUE queue, _Inout_ fileobject_ctx &fobj, _In_ WDFMEMORY evt, _In_ ULONG max_events)
+PAGED void process_event(_Inout_ vhci_ctx &vhci)
 {
         PAGED_CODE();
+        int cnt = 0;
 
-        auto fileobj = get_handle(&fobj);
-        WDFREQUEST request{};
-
-        switch (auto st = WdfIoQueueRetrieveRequestByFileObject(queue, fileobj, &request)) {
-        case STATUS_SUCCESS:
-                NT_ASSERT(!WdfCollectionGetCount(fobj.events));
-                vhci::complete_read(request, evt);
-                break;
-        case STATUS_NO_MORE_ENTRIES:
-                if (auto err = WdfCollectionAdd(fobj.events, evt)) { // append and increment reference count
-                        Trace(TRACE_LEVEL_ERROR, "WdfCollectionAdd %!STATUS!", err);
-                } else if (auto cnt = WdfCollectionGetCount(fobj.events); cnt > max_events) {
-                        auto head = WdfCollectionGetFirstItem(fobj.events);
-                        WdfCollectionRemove(fobj.events, head); // decrements reference count
-
-                        TraceDbg("fobj %04x, drop %04x[0], add %04x[%lu]",
-                                  ptr04x(fileobj), ptr04x(head), ptr04x(evt), --cnt - 1);
-                } else {
-                        TraceDbg("fobj %04x, add %04x[%lu]", ptr04x(fileobj), ptr04x(evt), cnt - 1);
+        for (auto head = &vhci.fileobjects, entry = head->Flink; entry != head; entry = entry->Flink) {
+
+                auto &fobj = *CONTAINING_RECORD(entry, fileobject_ctx, entry);
+                if (!fobj.process_events) {
+                        continue;
                 }
-                break;
-        default:
-                Trace(TRACE_LEVEL_ERROR, "WdfIoQueueRetrieveRequestByFileObject %!STATUS!", st);
-        }
-}
 
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED void process_event(_In_ vhci_ctx &vhci, _In_ WDFMEMORY evt)
-{
-        PAGED_CODE();
+                ++cnt;
 
-        int cnt = 0;
-        wdf::WaitLock lck(vhci.events_lock);
+                while (vhci.events.available(fobj.events_seqnum)) {
 
-        for (auto head = &vhci.fileobjects, entry = head->Flink; entry != head; entry = entry->Flink) {
-                auto &fobj = *CONTAINING_RECORD(entry, fileobject_ctx, entry);
-                if (fobj.process_events) {
-                        process_event(vhci.reads, fobj, evt, 4*vhci.devices_cnt);
-                        ++cnt;
+                        WDFREQUEST request{};
+                        auto st = WdfIoQueueRetrieveRequestByFileObject(vhci.reads, get_handle(&fobj), &request);
+
+                        if (NT_SUCCESS(st)) {
+                                vhci::complete_read(request, vhci, fobj);
+                                continue;
+                        } else if (st != STATUS_NO_MORE_ENTRIES) {
+                                Trace(TRACE_LEVEL_ERROR, "WdfIoQueueRetrieveRequestByFileObject %!STATUS!", st);
+                        }
+
+                        break; // the event waits for IRP_MJ_READ
                 }
         }
 
@@ -863,7 +872,8 @@ int usbip::vhci::claim_roothub_port(_In_ UDECXUSBDEVICE device)
 
                 if (auto &handle = vhci.devices[i]; !handle) {
                         WdfObjectReference(handle = device);
-                        
+                        vhci.port_generation[i] = ++vhci.generation;
+
                         port = i + 1;
                         NT_ASSERT(is_valid_port(vhci, port));
 
@@ -894,6 +904,8 @@ int usbip::vhci::reclaim_roothub_port(_In_ UDECXUSBDEVICE device)
                 NT_ASSERT(handle == device);
 
                 handle = WDF_NO_HANDLE;
+                vhci.port_generation[port - 1] = ++vhci.generation;
+
                 port = 0;
         }
 
@@ -906,9 +918,9 @@ int usbip::vhci::reclaim_roothub_port(_In_ UDECXUSBDEVICE device)
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-bool usbip::vhci::has_device(_In_ WDFDEVICE vhci, _In_ ULONG location_hash)
+bool usbip::vhci::has_device(_In_ WDFDEVICE vhci, _In_ UINT64 location_key)
 {
-        NT_ASSERT(location_hash);
+        NT_ASSERT(location_key);
 
         auto &ctx = *get_vhci_ctx(vhci);
         wdf::Lock lck(ctx.devices_lock); 
@@ -917,7 +929,7 @@ bool usbip::vhci::has_device(_In_ WDFDEVICE vhci, _In_ ULONG location_hash)
 
                 if (auto hdev = ctx.devices[i]) {
                         auto dev = get_device_ctx(hdev);
-                        if (auto &ext = dev->ext(); ext.location_hash() == location_hash) {
+                        if (auto &ext = dev->ext(); ext.location_key() == location_key) {
                                 return true;
                         }
                 }
@@ -929,15 +941,27 @@ bool usbip::vhci::has_device(_In_ WDFDEVICE vhci, _In_ ULONG location_hash)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port)
+{
+        UINT64 generation;
+        return get_device(vhci, port, generation);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port, _Out_ UINT64 &generation)
 {
         auto &ctx = *get_vhci_ctx(vhci);
 
         wdf::ObjectRef ptr;
+        generation = 0;
+
         if (!is_valid_port(ctx, port)) {
                 return ptr;
         }
 
         wdf::Lock lck(ctx.devices_lock); 
+        generation = ctx.port_generation[port - 1];
+
         if (auto handle = ctx.devices[port - 1]) {
                 NT_ASSERT(get_device_ctx(handle)->port == port);
                 ptr.reset(handle); // adds reference
@@ -946,6 +970,16 @@ wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port)
         return ptr;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT64 usbip::vhci::get_generation(_In_ WDFDEVICE vhci)
+{
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::Lock lck(ctx.devices_lock); 
+        return ctx.generation;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void usbip::vhci::detach_all_devices(_In_ WDFDEVICE vhci, _In_ bool plugout_and_delete)
@@ -955,11 +989,36 @@ PAGED void usbip::vhci::detach_all_devices(_In_ WDFDEVICE vhci, _In_ bool plugou
         TraceDbg("%04x", ptr04x(vhci));
         auto &ctx = *get_vhci_ctx(vhci);
 
-        for (int port = 1; port <= ctx.devices_cnt; ++port) {
-                if (auto dev = get_device(vhci, port)) {
-                        device::detach(dev.get<UDECXUSBDEVICE>(), plugout_and_delete);
+        unique_ptr buf(PagedPool, ctx.devices_cnt*sizeof(UDECXUSBDEVICE));
+        auto devices = buf.get<UDECXUSBDEVICE>();
+
+        if (!devices) {
+                Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes, detaching sequentially", ctx.devices_cnt*sizeof(*devices));
+
+                for (int port = 1; port <= ctx.devices_cnt; ++port) {
+                        if (auto dev = get_device(vhci, port)) {
+                                device::detach(dev.get<UDECXUSBDEVICE>(), plugout_and_delete);
+                        }
+                }
+                return;
+        }
+
+        int cnt = 0;
+
+        for (int port = 1; port <= ctx.devices_cnt; ++port) { // receive threads exit concurrently
+                if (auto dev = get_device(vhci, port); dev && device::disconnect(dev.get<UDECXUSBDEVICE>())) {
+                        devices[cnt++] = static_cast<UDECXUSBDEVICE>(dev.release());
                 }
         }
+
+        auto deadline = KeQueryInterruptTime() + 1*wdm::minute; // for all devices
+
+        for (int i = 0; i < cnt; ++i) {
+                wdf::ObjectRef dev(devices[i], false);
+                device::finish_detach(dev.get<UDECXUSBDEVICE>(), plugout_and_delete, false, deadline);
+        }
+
+        TraceDbg("%04x, %d device(s) detached", ptr04x(vhci), cnt);
 }
 
 _IRQL_requires_same_
@@ -978,35 +1037,107 @@ PAGED NTSTATUS usbip::vhci::fill(_Out_ imported_device &dev, _In_ const device_a
         return STATUS_SUCCESS;
 }
 
+/*
+ * Events are allocated on demand. A description of a device is about 1.2KB, it is stored once per event source,
+ * an event is 16 bytes. Capacity is sufficient for dozens of state changes of every device.
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt)
+PAGED NTSTATUS usbip::vhci::subscribe(_Inout_ vhci_ctx &vhci, _Inout_ fileobject_ctx &fobj)
 {
         PAGED_CODE();
 
-        device_state *dst{};
-        auto dst_sz = sizeof(*dst);
+        if (fobj.process_events) {
+                return STATUS_SUCCESS;
+        }
 
-        auto st = WdfRequestRetrieveOutputBuffer(request, dst_sz, reinterpret_cast<PVOID*>(&dst), nullptr);
-        
-        if (NT_SUCCESS(st)) {
-                size_t size{};
-                *dst = *reinterpret_cast<device_state*>(WdfMemoryGetBuffer(evt, &size));
-                NT_ASSERT(size == dst_sz);
-        } else {
-                Trace(TRACE_LEVEL_ERROR, "WdfRequestRetrieveOutputBuffer %!STATUS!", st);
-                dst_sz = 0;
+        if (auto &j = vhci.events; !j) {
+                using journal = decltype(vhci.events);
+
+                size_t source_cnt = 2*vhci.devices_cnt; // a device is re-created on every attach
+                size_t record_cnt = 64*vhci.devices_cnt;
+
+                auto sources_sz = source_cnt*sizeof(journal::source);
+                auto sz = sources_sz + record_cnt*sizeof(journal::record);
+
+                unique_ptr ptr(PagedPool, sz);
+                if (!ptr) {
+                        Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", sz);
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                RtlZeroMemory(ptr.get(), sources_sz);
+
+                auto sources = ptr.release<journal::source>();
+                j.init(sources, source_cnt, reinterpret_cast<journal::record*>(sources + source_cnt), record_cnt);
         }
 
-        TraceDbg("fobj %04x, req %04x, device_state %04x, %!STATUS!", ptr04x(WdfRequestGetFileObject(request)), 
-                  ptr04x(request), ptr04x(evt), st);
+        fobj.events_seqnum = vhci.events.next_seqnum(); // previous events are not interesting
+        fobj.process_events = true;
+        ++vhci.events_subscribers;
+
+        TraceDbg("fobj %04x, seqnum %I64u, subscribers %d", 
+                  ptr04x(get_handle(&fobj)), fobj.events_seqnum, vhci.events_subscribers);
 
-        WdfRequestCompleteWithInformation(request, st, dst_sz);
+        return STATUS_SUCCESS;
 }
 
 /*
- * Each WDFMEMORY object is shared between FILEOBJECT-s, thus parent is set to WDFDEVICE.
+ * Copy as many events as fit into the output buffer.
+ * vhci_ctx::events_lock must be acquired.
+ *
+ * The layout of events is selected by ioctl::set_device_state_version.
  */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _In_ const vhci_ctx &vhci, _Inout_ fileobject_ctx &fobj)
+{
+        PAGED_CODE();
+
+        static_assert(state_resync == event_resync);
+        static_assert(state_lost == event_lost);
+
+        UCHAR *buf{};
+        size_t length{};
+        size_t cnt = 0;
+
+        auto sz = event_size(fobj);
+        auto st = WdfRequestRetrieveOutputBuffer(request, sz, reinterpret_cast<PVOID*>(&buf), &length);
+
+        if (NT_ERROR(st)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestRetrieveOutputBuffer %!STATUS!", st);
+        } else {
+                if (auto n = vhci.events.lost(fobj.events_seqnum)) { // the latest states will be resent
+                        Trace(TRACE_LEVEL_WARNING, "fobj %04x, %I64u event(s) dropped", ptr04x(get_handle(&fobj)), n);
+                }
+
+                cnt = vhci.events.read(fobj.events_seqnum, length/sz, 
+                        [dst = buf, sz] (auto &info, auto source_id, auto port, auto state, auto seqnum, auto flags) mutable
+                {
+                        auto &r = *reinterpret_cast<device_state*>(dst);
+                        dst += sz;
+
+                        RtlZeroMemory(&r, sz);
+
+                        r.size = static_cast<ULONG>(sz);
+                        static_cast<imported_device&>(r) = info;
+                        r.port = port;
+                        r.state = state;
+                        r.source_id = source_id;
+
+                        if (sz == sizeof(r)) {
+                                r.seqnum = seqnum;
+                                r.flags = flags;
+                        }
+                });
+        }
+
+        TraceDbg("fobj %04x, req %04x, device_state[%Iu], next seqnum %I64u, %!STATUS!", 
+                  ptr04x(get_handle(&fobj)), ptr04x(request), cnt, fobj.events_seqnum, st);
+
+        WdfRequestCompleteWithInformation(request, st, cnt*sz);
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void usbip::vhci::device_state_changed(
@@ -1021,17 +1152,17 @@ PAGED void usbip::vhci::device_state_changed(
                   &attr.node_name, &attr.service_name, &attr.busid, port, int(state), subscribers);
 
         if (!subscribers) {
-                wdf::WaitLock lck(ctx.events_lock);
-                if (!ctx.events_subscribers) {
-                        return; // don't create device state unnecessarily
-                }
+                return; // don't store the event unnecessarily, a new subscriber reads only later events
         }
 
-        if (auto evt = make_device_state(vhci, attr, port, state)) {
-                process_event(ctx, evt);
-                WdfObjectDelete(evt); // will be deleted after its reference count becomes zero
+        wdf::WaitLock lck(ctx.events_lock);
+
+        if (!ctx.events_subscribers) {
+                // the last one has gone
+        } else if (auto err = add_event(ctx, attr, port, state)) {
+                Trace(TRACE_LEVEL_ERROR, "Failed to add state '%!vhci_state!' %!STATUS!", int(state), err);
         } else {
-                Trace(TRACE_LEVEL_ERROR, "Failed to create state '%!vhci_state!'", int(state));
+                process_event(ctx);
         }
 }
 
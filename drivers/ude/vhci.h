@@ -30,12 +30,23 @@ int reclaim_roothub_port(_In_ UDECXUSBDEVICE device);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-bool has_device(_In_ WDFDEVICE vhci, _In_ ULONG location_hash);
+bool has_device(_In_ WDFDEVICE vhci, _In_ UINT64 location_key);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef get_device(_In_ WDFDEVICE vhci, _In_ int port);
 
+/*
+ * @param generation of the last change of the port, see vhci_ctx::port_generation
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+wdf::ObjectRef get_device(_In_ WDFDEVICE vhci, _In_ int port, _Out_ UINT64 &generation);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT64 get_generation(_In_ WDFDEVICE vhci);
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void detach_all_devices(_In_ WDFDEVICE vhci, _In_ bool plugout_and_delete);
@@ -54,7 +65,19 @@ inline auto fill(_Out_ imported_device &dev, _In_ const device_ctx &ctx)
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt);
+PAGED NTSTATUS subscribe(_Inout_ vhci_ctx &vhci, _Inout_ fileobject_ctx &fobj);
+
+/*
+ * @return size of the layout of events that the reader has selected
+ */
+inline size_t event_size(_In_ const fileobject_ctx &fobj)
+{
+        return fobj.events_version == ioctl::DEVICE_STATE_V2 ? sizeof(device_state) : sizeof(device_state_v1);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void complete_read(_In_ WDFREQUEST request, _In_ const vhci_ctx &vhci, _Inout_ fileobject_ctx &fobj);
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
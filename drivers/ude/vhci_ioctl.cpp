@@ -12,8 +12,18 @@
 #include "network.h"
 #include "ioctl.h"
 #include "persistent.h"
+#include "resolver.h"
+#include "link_monitor.h"
+#include "capture.h"
+#include "urb_trace.h"
+#include "latency.h"
+#include "isoch_pacing.h"
+#include "coalesce.h"
+#include "compress.h"
 
 #include <usbip/proto_op.h>
+#include <usbip/device_delta.h>
+#include <usbip/location_key.h>
 
 #include <libdrv/dbgcommon.h>
 #include <libdrv/strconv.h>
@@ -41,7 +51,18 @@ struct workitem_ctx
         WDFMEMORY ctx_ext;
         auto& ext() const { return get_device_ctx_ext(ctx_ext); }
 
-        ADDRINFOEXW *addrinfo; // list head
+        ADDRINFOEXW *addrinfo; // list head, WskGetAddressInfo result
+
+        resolved_addresses addrs; // from addrinfo or address_cache
+        ADDRINFOEXW ai[resolved_addresses::MAX_CNT]; // list over addrs, see make_addrinfo
+        NTSTATUS cached_status;
+
+        ULONGLONG connect_time; // KeQueryInterruptTime, @see server_connected
+        ULONGLONG connect_rtt; // duration of TCP handshake, @see adjust_socket_buffers
+
+        bool cached; // addrs and cached_status are taken from address_cache or server_table
+        bool resolving; // must call resolve_complete or resolve_abandon
+        bool probing; // must call server_connected, server_failed or server_abandon
         bool one_attempt;
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(workitem_ctx, get_workitem_ctx)
@@ -79,7 +100,7 @@ PAGED void log(_In_ const usbip_usb_device &d)
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto send_req_import(_In_ device_ctx_ext &ext)
+PAGED auto send_req_import(_In_ device_ctx_ext &ext, _In_ const compress::extension &offer)
 {
         PAGED_CODE();
 
@@ -94,6 +115,8 @@ PAGED auto send_req_import(_In_ device_ctx_ext &ext)
         if (auto &dst = req.body.busid; auto err = libdrv::unicode_to_utf8(dst, sizeof(dst), *busid)) {
                 Trace(TRACE_LEVEL_ERROR, "unicode_to_utf8('%!USTR!') %!STATUS!", busid, err);
                 return err;
+        } else if (offer.codecs && !compress::put(dst, offer)) {
+                Trace(TRACE_LEVEL_WARNING, "busid '%!USTR!' is too long, compression is not offered", busid);
         }
 
         byteswap(req.hdr);
@@ -133,11 +156,11 @@ PAGED NTSTATUS recv_rep_import(_In_ device_ctx_ext &ext, _In_ memory pool, _Out_
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext)
+PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext, _In_ const compress::extension &offer)
 {
         PAGED_CODE();
 
-        if (auto err = send_req_import(ext)) {
+        if (auto err = send_req_import(ext, offer)) {
                 Trace(TRACE_LEVEL_ERROR, "Send OP_REQ_IMPORT %!STATUS!", err);
                 return err;
         }
@@ -150,6 +173,15 @@ PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext)
         auto &udev = reply.udev; 
         log(udev);
 
+        ext.compression = offer.codecs ? compress::accepted(offer, udev.path) : compress::extension{};
+
+        if (auto &c = ext.compression; c.codecs) {
+                Trace(TRACE_LEVEL_INFORMATION, "compression is accepted, log2 of thresholds{control %d, bulk %d, interrupt %d}",
+                      c.min_shift[0], c.min_shift[1], c.min_shift[2]);
+        } else if (offer.codecs) {
+                Trace(TRACE_LEVEL_INFORMATION, "compression is declined by the server, plain USB/IP is used");
+        }
+
         {
                 auto &p = ext.properties();
 
@@ -276,7 +308,7 @@ PAGED auto connected(_In_ WDFREQUEST request, _Inout_ workitem_ctx &ctx, _Inout_
 
         device_state_changed(ctx.vhci, ext.attr, 0, vhci::state::connected);
 
-        if (auto err = import_remote_device(ext)) {
+        if (auto err = import_remote_device(ext, get_vhci_ctx(ctx.vhci)->compress_offer)) {
                 return err;
         }
 
@@ -286,6 +318,8 @@ PAGED auto connected(_In_ WDFREQUEST request, _Inout_ workitem_ctx &ctx, _Inout_
         }
         ctx.ctx_ext = WDF_NO_HANDLE; // now dev owns it
 
+        adjust_socket_buffers(*get_device_ctx(dev), ctx.connect_rtt/10); // microseconds, the speed of the device is known now
+
         if (bool plugout_and_delete{}; auto err = plugin(dev, r->port, plugout_and_delete)) {
                 device::detach(dev, plugout_and_delete);
                 if (!plugout_and_delete) {
@@ -354,7 +388,8 @@ PAGED auto create_socket(_Inout_ wsk::SOCKET* &sock, _In_ const ADDRINFOEXW &ai)
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto connect(
-        _In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ wsk::SOCKET* &sock, _In_ const ADDRINFOEXW &ai)
+        _In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ workitem_ctx &ctx,
+        _Inout_ wsk::SOCKET* &sock, _In_ const ADDRINFOEXW &ai)
 {
         PAGED_CODE();
 
@@ -373,6 +408,8 @@ PAGED auto connect(
         auto irp = set_args(request, __func__, &ai);
         IoSetCompletionRoutine(irp, irp_complete, wi, true, true, true);
 
+        ctx.connect_time = KeQueryInterruptTime();
+
         auto st = connect(sock, ai.ai_addr, irp); // completion handler will be called anyway
         TraceDbg("%!STATUS!", st);
 
@@ -390,23 +427,59 @@ PAGED auto on_connect(
 {
         PAGED_CODE();
 
+        auto &vhci = *get_vhci_ctx(ctx.vhci);
         auto st = WdfRequestGetStatus(request);
 
         if (NT_SUCCESS(st)) {
+                ctx.probing = false;
+                ctx.connect_rtt = KeQueryInterruptTime() - ctx.connect_time;
+                server_connected(vhci, ext.attr, ctx.connect_time);
+
                 st = connected(request, ctx, ext);
                 NT_ASSERT(st != STATUS_PENDING);
         } else {
                 NT_VERIFY(NT_SUCCESS(close(ext.sock)));
                 free(ext.sock);
 
-                if (st != STATUS_CANCELLED && ai.ai_next) {
-                        st = connect(request, wi, ext.sock, *ai.ai_next);
+                if (st == STATUS_CANCELLED) {
+                        // server_abandon is called by workitem_cleanup if probing
+                } else if (ai.ai_next) {
+                        st = connect(request, wi, ctx, ext.sock, *ai.ai_next);
+                } else {
+                        ctx.probing = false;
+                        server_failed(vhci, ext.attr, st);
                 }
         }
 
         return st;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto on_addrinfo(
+        _Inout_ vhci_ctx &vhci, _Inout_ workitem_ctx &ctx, _In_ const device_ctx_ext &ext, _In_ NTSTATUS st)
+{
+        PAGED_CODE();
+
+        if (ctx.cached) {
+                return ctx.cached_status;
+        }
+
+        if (NT_SUCCESS(st)) {
+                st = copy(ctx.addrs, ctx.addrinfo);
+        }
+
+        wsk::free(ctx.addrinfo);
+        ctx.addrinfo = nullptr;
+
+        if (ctx.resolving) {
+                ctx.resolving = false;
+                resolve_complete(vhci, ext.attr, st, ctx.addrs);
+        }
+
+        return st;
+}
+
 _Function_class_(EVT_WDF_WORKITEM)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -432,9 +505,9 @@ PAGED void NTAPI complete(_In_ WDFWORKITEM wi)
                 TraceDbg("req %04x, set %!STATUS!, vhci is being removing", ptr04x(request), st);
         } else if (auto ai = libdrv::argv<ADDRINFOEXW*, ARG_AI>(irp)) {
                 st = on_connect(request, wi, ctx, ext, *ai);
-        } else if (NT_SUCCESS(st)) { // on_addrinfo
-                NT_ASSERT(ctx.addrinfo);
-                st = connect(request, wi, ext.sock, *ctx.addrinfo);
+        } else if (st = on_addrinfo(vhci, ctx, ext, st); NT_SUCCESS(st)) {
+                auto head = make_addrinfo(ctx.ai, ctx.addrs);
+                st = connect(request, wi, ctx, ext.sock, *head);
         }
 
         if (st == STATUS_PENDING) {
@@ -444,12 +517,16 @@ PAGED void NTAPI complete(_In_ WDFWORKITEM wi)
         TraceDbg("req %04x, %!STATUS!", ptr04x(request), st);
         WdfRequestComplete(request, st);
 
+        if (NT_SUCCESS(st)) {
+                remember_attach(ctx.vhci, ext.location_key());
+        }
+
         if (ctx.one_attempt) {
                 //
-        } else if (auto hash = ext.location_hash(); NT_SUCCESS(st)) {
-                stop_attach_attempts(vhci, hash);
-        } else if (NT_ERROR(st) && can_reattach(ctx.vhci, hash, st)) {
-                stop_attach_attempts(vhci, hash);
+        } else if (auto key = ext.location_key(); NT_SUCCESS(st)) {
+                stop_attach_attempts(vhci, key);
+        } else if (NT_ERROR(st) && can_reattach(ctx.vhci, key, st)) {
+                stop_attach_attempts(vhci, key);
                 start_attach_attempts(ctx.vhci, vhci, ext.attr, true);
         }
 
@@ -475,6 +552,16 @@ PAGED void workitem_cleanup(_In_ WDFOBJECT object)
         wsk::free(ctx.addrinfo);
         ctx.addrinfo = nullptr;
 
+        if (ctx.resolving && ctx.ctx_ext) { // vhci is being removing
+                ctx.resolving = false;
+                resolve_abandon(*get_vhci_ctx(ctx.vhci), ctx.ext().attr);
+        }
+
+        if (ctx.probing && ctx.ctx_ext) { // the server was not connected, e.g. name resolution has failed
+                ctx.probing = false;
+                server_abandon(*get_vhci_ctx(ctx.vhci), ctx.ext().attr);
+        }
+
         if (auto &mem = ctx.ctx_ext) {
                 auto &ext = get_device_ctx_ext(mem); // or ctx.ext()
 
@@ -527,6 +614,33 @@ PAGED void getaddrinfo(
         TraceDbg("%!STATUS!", st);
 }
 
+/*
+ * Reattach attempts of all devices on the same server do not flood the resolver.
+ * The completion handler will be called anyway.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void resolve(
+        _In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ workitem_ctx &ctx, _Inout_ device_ctx_ext &ext)
+{
+        PAGED_CODE();
+        auto &vhci = *get_vhci_ctx(ctx.vhci);
+
+        switch (resolve_lookup(vhci, ext.attr, ctx.addrs, ctx.cached_status)) {
+        case address_cache_result::hit:
+        case address_cache_result::negative_hit:
+                ctx.cached = true;
+                set_args(request, "address_cache");
+                WdfWorkItemEnqueue(wi);
+                break;
+        case address_cache_result::miss:
+                ctx.resolving = true;
+                [[fallthrough]];
+        case address_cache_result::pending: // a reattach attempt of another device is resolving the same name
+                getaddrinfo(request, wi, ctx, ext);
+        }
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto plugin_hardware(
@@ -558,7 +672,23 @@ PAGED auto plugin_hardware(
         auto &ext = ctx.ext();
         device_state_changed(vhci, ext.attr, 0, vhci::state::connecting);
 
-        getaddrinfo(request, wi, ctx, ext); // completion handler will be called anyway
+        auto reattach = WdfRequestGetRequestorMode(request) == KernelMode; // @see send_plugin_hardware
+        auto verdict = reattach ? check_server(*get_vhci_ctx(vhci), ext.attr, ctx.cached_status) :
+                                  server_verdict::connect; // the user always waits for the connect
+
+        switch (verdict) {
+        case server_verdict::fail_fast:
+                ctx.cached = true;
+                set_args(request, "server_table");
+                WdfWorkItemEnqueue(wi);
+                break;
+        case server_verdict::probe:
+                ctx.probing = true;
+                [[fallthrough]];
+        case server_verdict::connect:
+                resolve(request, wi, ctx, ext);
+        }
+
         return STATUS_PENDING;
 }
 
@@ -583,27 +713,25 @@ PAGED NTSTATUS stop_attach_attempts(_In_ WDFREQUEST request)
 
         TraceDbg("host '%s', service '%s', busid '%s'", r->host, r->service, r->busid);
 
-        ULONG location_hash{};
-        NTSTATUS st;
+        UINT64 location_key{}; // stop all
 
         if (auto cnt = bool(*r->host) + bool(*r->service) + bool(*r->busid); !cnt) {
-                st = STATUS_SUCCESS; // stop all
+                //
         } else if (cnt != 3) {
-                st = STATUS_INVALID_PARAMETER;
-        } else if (device_attributes attr{}; NT_SUCCESS(st = init_device_attributes(attr, *r))) {
-                location_hash = attr.location_hash;
-                free(attr);
+                return STATUS_INVALID_PARAMETER;
+        } else { // UTF-8 gives the same key as UNICODE_STRING-s of device_attributes
+                location_key = location::make_key(r->host, strnlen(r->host, sizeof(r->host)),
+                                                  r->service, strnlen(r->service, sizeof(r->service)),
+                                                  r->busid, strnlen(r->busid, sizeof(r->busid)));
         }
 
-        if (NT_SUCCESS(st)) {
-                auto vhci = get_vhci(request);
-                auto ctx = get_vhci_ctx(vhci);
+        auto vhci = get_vhci(request);
+        auto ctx = get_vhci_ctx(vhci);
 
-                r->count = stop_attach_attempts(*ctx, location_hash);
-                WdfRequestSetInformation(request, sizeof(*r));
-        }
+        r->count = stop_attach_attempts(*ctx, location_key);
+        WdfRequestSetInformation(request, sizeof(*r));
 
-        return st;
+        return STATUS_SUCCESS;
 }
 
 _IRQL_requires_same_
@@ -718,6 +846,448 @@ PAGED NTSTATUS get_imported_devices(_In_ WDFREQUEST request)
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto make_delta(_In_ const vhci::imported_device &d)
+{
+        auto str = [] (auto &s) { return delta::string_ref{ s, delta::length(s, sizeof(s)) }; };
+
+        return delta::device {
+                .port = static_cast<unsigned int>(d.port),
+                .devid = d.devid,
+                .speed = static_cast<unsigned int>(d.speed),
+                .vendor = d.vendor,
+                .product = d.product,
+                .host = str(d.host),
+                .service = str(d.service),
+                .busid = str(d.busid),
+                .serial = str(d.serial),
+        };
+}
+
+/*
+ * A port can be changed after its generation was read, but then its generation will be greater 
+ * than the returned one and the caller will get the port again with the next request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_imported_devices_delta(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        using vhci::ioctl::get_imported_devices_delta;
+        constexpr auto hdr_sz = offsetof(get_imported_devices_delta, data);
+
+        size_t outlen;
+        get_imported_devices_delta *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, hdr_sz, reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_imported_devices_delta.size %lu != sizeof(get_imported_devices_delta) %Iu", 
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        auto since = r->generation; // METHOD_BUFFERED, input and output share the buffer
+        auto generation = vhci::get_generation(vhci);
+
+        auto reply = delta::make_reply(since, ctx.first_generation, generation);
+        auto full = reply == delta::reply::full; // the first call or another driver instance
+
+        r->generation = generation;
+        r->flags = full ? vhci::ioctl::DELTA_FULL : 0;
+        r->length = 0;
+
+        if (reply == delta::reply::unchanged) {
+                r->flags = vhci::ioctl::DELTA_UNCHANGED;
+                WdfRequestSetInformation(request, hdr_sz);
+                return STATUS_SUCCESS;
+        }
+
+        unique_ptr tmp(PagedPool, sizeof(vhci::imported_device)); // too large for the stack
+        if (!tmp) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        auto &dev = *tmp.get<vhci::imported_device>();
+        delta::writer w(r->data, outlen - hdr_sz);
+
+        for (int port = 1; port <= ctx.devices_cnt; ++port) {
+
+                UINT64 port_gen;
+                auto hdev = vhci::get_device(vhci, port, port_gen);
+
+                if (!full && port_gen <= since) {
+                        //
+                } else if (!hdev) {
+                        if (!full) {
+                                w.removed(port);
+                        }
+                } else if (auto err = fill(dev, *get_device_ctx(hdev.get()))) {
+                        return err;
+                } else {
+                        w.present(make_delta(dev));
+                }
+        }
+
+        r->length = static_cast<ULONG>(w.size());
+        TraceDbg("generation %I64u -> %I64u, flags %#lx, length %lu", since, generation, r->flags, r->length);
+
+        if (w.overflow()) {
+                WdfRequestSetInformation(request, hdr_sz);
+                return STATUS_BUFFER_OVERFLOW;
+        }
+
+        WdfRequestSetInformation(request, hdr_sz + w.size());
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_capture(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_capture *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_capture.size %lu != sizeof(set_capture) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        } else if (auto dev = vhci::get_device(vhci, r->port)) {
+                return usbip::set_capture(dev.get<UDECXUSBDEVICE>(), r->snaplen, r->ring_size);
+        } else {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_capture(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        using vhci::ioctl::read_capture;
+        constexpr auto hdr_sz = offsetof(read_capture, data);
+
+        size_t outlen;
+        read_capture *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, hdr_sz, reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "read_capture.size %lu != sizeof(read_capture) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) { // METHOD_BUFFERED, input and output share the buffer
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(vhci, r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        auto len = static_cast<ULONG>(min(outlen - hdr_sz, ULONG_MAX));
+
+        if (auto err = usbip::read_capture(*get_device_ctx(dev.get()), r->data, len, r->length, r->dropped)) {
+                return err;
+        }
+
+        WdfRequestSetInformation(request, hdr_sz + r->length);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_urb_trace(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_urb_trace *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_urb_trace.size %lu != sizeof(set_urb_trace) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        return usbip::set_urb_trace(get_vhci(request), r->capacity);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_urb_trace(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        using vhci::ioctl::read_urb_trace;
+        constexpr auto hdr_sz = offsetof(read_urb_trace, data);
+
+        size_t outlen;
+        read_urb_trace *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, hdr_sz, reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "read_urb_trace.size %lu != sizeof(read_urb_trace) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto len = static_cast<ULONG>(min(outlen - hdr_sz, ULONG_MAX));
+
+        if (auto err = usbip::read_urb_trace(*get_vhci_ctx(get_vhci(request)), r->data, len, r->length)) {
+                return err;
+        }
+
+        LARGE_INTEGER freq;
+        KeQueryPerformanceCounter(&freq);
+        r->frequency = freq.QuadPart;
+
+        WdfRequestSetInformation(request, hdr_sz + r->length);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_latency(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_latency *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_latency.size %lu != sizeof(set_latency) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        } else if (auto dev = vhci::get_device(vhci, r->port)) {
+                return usbip::set_latency(dev.get<UDECXUSBDEVICE>(), r->period, r->stages);
+        } else {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS read_latency(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        using vhci::ioctl::read_latency;
+        constexpr auto hdr_sz = offsetof(read_latency, data);
+
+        size_t outlen;
+        read_latency *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, hdr_sz, reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "read_latency.size %lu != sizeof(read_latency) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) { // METHOD_BUFFERED, input and output share the buffer
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(vhci, r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        auto len = static_cast<ULONG>(min(outlen - hdr_sz, ULONG_MAX));
+
+        if (auto err = usbip::read_latency(*get_device_ctx(dev.get()), r->data, len, r->length, r->reset)) {
+                return err;
+        }
+
+        WdfRequestSetInformation(request, hdr_sz + r->length);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_jitter_buffer(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_jitter_buffer *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_jitter_buffer.size %lu != sizeof(set_jitter_buffer) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        } else if (auto dev = vhci::get_device(vhci, r->port)) {
+                return usbip::set_jitter_buffer(dev.get<UDECXUSBDEVICE>(), r->endpoint, r->depth);
+        } else {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_jitter_buffer(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        vhci::ioctl::get_jitter_buffer *r{};
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), nullptr)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_jitter_buffer.size %lu != sizeof(get_jitter_buffer) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) { // METHOD_BUFFERED, input and output share the buffer
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(vhci, r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        auto &ctx = *get_device_ctx(dev.get());
+
+        r->current_frame = current_frame(ctx);
+        usbip::get_jitter_buffer(ctx, r->stats, r->reset);
+
+        WdfRequestSetInformation(request, sizeof(*r));
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_coalesce(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_coalesce *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_coalesce.size %lu != sizeof(set_coalesce) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        } else if (auto dev = vhci::get_device(vhci, r->port)) {
+                return usbip::set_coalesce(dev.get<UDECXUSBDEVICE>(), r->window, r->max_batch);
+        } else {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_coalesce(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        vhci::ioctl::get_coalesce *r{};
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), nullptr)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_coalesce.size %lu != sizeof(get_coalesce) %Iu", r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) { // METHOD_BUFFERED, input and output share the buffer
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(vhci, r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        usbip::get_coalesce(*get_device_ctx(dev.get()), r->stats, r->reset);
+
+        WdfRequestSetInformation(request, sizeof(*r));
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS set_device_state_version(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        vhci::ioctl::set_device_state_version *r{};
+
+        if (auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), nullptr)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_device_state_version.size %lu != sizeof(set_device_state_version) %Iu", 
+                                          r->size, sizeof(*r));
+                return USBIP_ERROR_ABI;
+        } else if (!(r->version == vhci::ioctl::DEVICE_STATE_V1 || r->version == vhci::ioctl::DEVICE_STATE_V2)) {
+                return STATUS_NOT_SUPPORTED;
+        }
+
+        auto fileobj = WdfRequestGetFileObject(request);
+        auto &fobj = *get_fileobject_ctx(fileobj);
+
+        auto &vhci = *get_vhci_ctx(get_vhci(request));
+        wdf::WaitLock lck(vhci.events_lock);
+
+        if (fobj.process_events && fobj.events_version != r->version) {
+                return STATUS_INVALID_DEVICE_STATE; // the reads are pending or done
+        }
+
+        TraceDbg("fobj %04x, version %lu", ptr04x(fileobj), r->version);
+        fobj.events_version = r->version;
+
+        return STATUS_SUCCESS;
+}
+
 /*
  * @see get_persistent_devices
  */
@@ -872,6 +1442,30 @@ PAGED decltype(get_persistent) *get_parallel_handler(_In_ ULONG IoControlCode)
         switch (IoControlCode) {
         case vhci::ioctl::GET_IMPORTED_DEVICES:
                 return get_imported_devices;
+        case vhci::ioctl::GET_IMPORTED_DEVICES_DELTA:
+                return get_imported_devices_delta;
+        case vhci::ioctl::SET_CAPTURE:
+                return set_capture;
+        case vhci::ioctl::READ_CAPTURE:
+                return read_capture;
+        case vhci::ioctl::SET_URB_TRACE:
+                return set_urb_trace;
+        case vhci::ioctl::READ_URB_TRACE:
+                return read_urb_trace;
+        case vhci::ioctl::SET_LATENCY:
+                return set_latency;
+        case vhci::ioctl::READ_LATENCY:
+                return read_latency;
+        case vhci::ioctl::SET_JITTER_BUFFER:
+                return set_jitter_buffer;
+        case vhci::ioctl::GET_JITTER_BUFFER:
+                return get_jitter_buffer;
+        case vhci::ioctl::SET_COALESCE:
+                return set_coalesce;
+        case vhci::ioctl::GET_COALESCE:
+                return get_coalesce;
+        case vhci::ioctl::SET_DEVICE_STATE_VERSION:
+                return set_device_state_version;
         case vhci::ioctl::SET_PERSISTENT:
                 return set_persistent;
         case vhci::ioctl::GET_PERSISTENT:
@@ -883,6 +1477,21 @@ PAGED decltype(get_persistent) *get_parallel_handler(_In_ ULONG IoControlCode)
         }
 }
 
+/*
+ * Attempts of persistent devices are sent by the driver itself and are not serialized by the default queue,
+ * otherwise every attempt would hold it during connect and import and ReattachMaxConcurrency would be void.
+ * @see send_plugin_hardware
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto is_reattach(_In_ WDFREQUEST request, _In_ ULONG IoControlCode)
+{
+        PAGED_CODE();
+
+        return IoControlCode == vhci::ioctl::PLUGIN_HARDWARE_ONCE &&
+               WdfRequestGetRequestorMode(request) == KernelMode;
+}
+
 _Function_class_(EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -897,7 +1506,10 @@ PAGED void device_control_parallel(
 
         NTSTATUS st;
 
-        if (auto handler = get_parallel_handler(IoControlCode)) {
+        if (is_reattach(Request, IoControlCode)) { // does not wait for the attaches of the user
+                TraceDbg("req %04x, reattach", ptr04x(Request));
+                st = plugin_hardware(Request, true);
+        } else if (auto handler = get_parallel_handler(IoControlCode)) {
                 TraceDbg("req %04x, %s(%#08lX), OutputBufferLength %Iu, InputBufferLength %Iu", 
                           ptr04x(Request), device_control_name(IoControlCode), IoControlCode, 
                           OutputBufferLength, InputBufferLength);
@@ -934,7 +1546,7 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
 
         TraceDbg("fobj %04x, request %04x, length %Iu", ptr04x(fileobj), ptr04x(request), length);
 
-        if (length != sizeof(vhci::device_state)) {
+        if (!length || length % vhci::event_size(fobj)) { // read as many events as fit
                 WdfRequestCompleteWithInformation(request, STATUS_INVALID_BUFFER_SIZE, 0);
                 return;
         }
@@ -944,14 +1556,10 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
         
         wdf::WaitLock lck(vhci.events_lock);
 
-        if (auto &val = fobj.process_events; !val) {
-                ++vhci.events_subscribers;
-                val = true;
-        }
-
-        if (auto evt = (WDFMEMORY)WdfCollectionGetFirstItem(fobj.events)) {
-                vhci::complete_read(request, evt);
-                WdfCollectionRemove(fobj.events, evt); // decrements reference count
+        if (auto err = vhci::subscribe(vhci, fobj)) {
+                WdfRequestCompleteWithInformation(request, err, 0);
+        } else if (vhci.events.available(fobj.events_seqnum)) {
+                vhci::complete_read(request, vhci, fobj);
         } else if (auto err = WdfRequestForwardToIoQueue(request, vhci.reads)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestForwardToIoQueue %!STATUS!", err);
                 if (err == STATUS_WDF_BUSY) { // the queue is not accepting new requests, purged
@@ -7,6 +7,7 @@
 #include "wsk_context.tmh"
 
 #include "driver.h"
+#include "compress.h"
 
 namespace
 {
@@ -44,7 +45,7 @@ void *allocate_function_ex(
         NT_ASSERT(PoolType == NonPagedPoolNx);
         wsk_context *ctx{};
 
-        if (unique_ptr ptr(PoolType, NumberOfBytes); !ptr) {
+        if (unique_ptr ptr(NonPagedPoolNxCacheAligned, NumberOfBytes); !ptr) { // @see wsk_context
                 Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", NumberOfBytes);
                 return nullptr;
         } else {
@@ -163,7 +164,9 @@ auto usbip::alloc_wsk_context(
 
 /*
  * alloc_wsk_context sets dev, request, is_isoc. It's safe do not clear them.
+ * Other hot members are overwritten for every PDU.
  * Retain mdl_buf_tail.
+ * Return packed to its lookaside list, @see pack_payload.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -175,6 +178,12 @@ void usbip::free(_In_opt_ wsk_context *ctx, _In_ bool reuse_irp)
 
         ctx->mdl_buf.reset();
 
+        if (ctx->packed) {
+                ctx->mdl_packed.reset();
+                free_packed(ctx->packed);
+                ctx->packed = nullptr;
+        }
+
         if (reuse_irp) {
                 IoReuseIrp(ctx->wsk_irp.get(), STATUS_SUCCESS);
         }
@@ -266,13 +275,3 @@ wsk_context* usbip::wsk_context_ptr::release()
         m_ctx = nullptr; 
         return tmp;
 }
-
-seqnum_t usbip::wsk_context_ptr::seqnum(bool byte_swap) const
-{
-        NT_ASSERT(m_ctx);
-        
-        auto seqnum = m_ctx->hdr.seqnum;
-        static_assert(sizeof(seqnum) == sizeof(unsigned long));
-
-        return byte_swap ? RtlUlongByteSwap(seqnum) : seqnum;
-}
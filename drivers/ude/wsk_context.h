@@ -17,34 +17,48 @@ namespace usbip
 
 struct device_ctx;
 
+/*
+ * Members that are accessed for every PDU take the first 128 bytes on 64-bit targets,
+ * these are two cache lines on x64 and one on ARM64. is_isoc is also read for every PDU,
+ * it starts the next cache line together with the members of isochronous transfers.
+ *
+ * The context is allocated cache aligned, so contexts that are used concurrently by the receive thread
+ * and send completions do not share cache lines. @see wsk_context in userspace/microbench.
+ */
 struct wsk_context
 {
-        device_ctx *dev; // UDECXUSBDEVICE can be obtained from WDFREQUEST, but it is optional
-
-        // transient data
-
-        WDFREQUEST request; // can be WDF_NO_HANDLE
-        Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
+        // hot data
 
         SLIST_ENTRY entry; // head is device_ctx::pending_sends
+        device_ctx *dev; // UDECXUSBDEVICE can be obtained from WDFREQUEST, but it is optional
+        WDFREQUEST request; // can be WDF_NO_HANDLE
         WSK_BUF wsk_buf; // .Mdl used to point to mdl_hdr or mdl_buf
+        libdrv::irp_ptr wsk_irp; // preallocated
+        Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
+        Mdl mdl_hdr; // preallocated, describes hdr
+        usbip::header hdr;
 
-        // preallocated data
+        // isochronous transfers and buffers for short transfers
 
-        libdrv::irp_ptr wsk_irp;
+        bool is_isoc;
+        Mdl mdl_isoc;
+        iso_packet_descriptor *isoc;
+        ULONG isoc_alloc_cnt;
 
         void *buf_tail;
         Mdl mdl_buf_tail; // mdl_buf may describe a buffer shorter than required
 
-        Mdl mdl_hdr;
-        usbip::header hdr;
+        wsk_context *gathered; // the next PDU that was sent by the WskSend of this one, @see send_pending
 
-        Mdl mdl_isoc;
-        iso_packet_descriptor *isoc;
-        ULONG isoc_alloc_cnt;
-        bool is_isoc;
+        void *packed; // compressed transfer buffer of CMD_SUBMIT OUT, @see pack_payload
+        Mdl mdl_packed;
 };
 
+#ifdef _WIN64
+static_assert(offsetof(wsk_context, is_isoc) == 128); // hot data
+static_assert(!(128 % SYSTEM_CACHE_ALIGNMENT_SIZE)); // 64 on x64, 128 on ARM64
+#endif
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS init_wsk_context_list();
@@ -100,8 +114,6 @@ public:
         auto operator ->() const { return m_ctx; }
         auto& operator *() const { return *m_ctx; }
 
-        seqnum_t seqnum(bool byte_swap) const;
-
         auto get() const { return m_ctx; }
         wsk_context *release();
 
@@ -14,6 +14,14 @@
 #include "network.h"
 #include "driver.h"
 #include "ioctl.h"
+#include "link_monitor.h"
+#include "persistent.h"
+#include "capture.h"
+#include "urb_trace.h"
+#include "latency.h"
+#include "isoch_pacing.h"
+#include "coalesce.h"
+#include "compress.h"
 
 #include <libdrv\usbd_helper.h>
 #include <libdrv\dbgcommon.h>
@@ -21,9 +29,7 @@
 #include <libdrv\irp.h>
 #include <libdrv\pdu.h>
 
-extern "C" {
-#include <usbdlib.h>
-}
+#include <usbip\receive.h>
 
 namespace
 {
@@ -84,124 +90,40 @@ PAGED inline auto& get_ret_submit(_In_ const wsk_context &ctx)
 	return hdr.ret_submit;
 }
 
-/*
- * For LS/FS interrupt endpoint only.
- * @param bInterval milliseconds
- * @return 1-16, for HS interrupt endpoint
- */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED UCHAR to_high_speed_interval(_In_ UCHAR bInterval)
+PAGED void log_patched(_In_ const UCHAR *dsc, _In_ UINT16 old_pkt, _In_ UCHAR old_intvl)
 {
-        PAGED_CODE();
-        enum { MIN_INTVL = 1, MAX_INTVL = 16 }; // result
-
-        NT_ASSERT(bInterval);
-        auto microframes = 8*bInterval;
-	
-        for (UCHAR i = MIN_INTVL; i <= MAX_INTVL; ++i) {
-                if ((1 << (i - 1)) >= microframes) {
-                        return i;
-                }
-        }
-	
-        return MAX_INTVL;
+	PAGED_CODE();
+	auto &e = *reinterpret_cast<const USB_ENDPOINT_DESCRIPTOR*>(dsc);
+
+	TraceDbg("bLength %d, %!usb_descriptor_type!, bEndpointAddress %#x, "
+		 "bmAttributes %#x, wMaxPacketSize %d (was %d), bInterval %d (was %d)",
+		 e.bLength, e.bDescriptorType, e.bEndpointAddress, e.bmAttributes,
+		 e.wMaxPacketSize, old_pkt, e.bInterval, old_intvl);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void log_control(_In_ const UCHAR*)
+{
+	PAGED_CODE();
+	Trace(TRACE_LEVEL_WARNING, "control endpoint found in configuration descriptor");
 }
 
 /*
- * UDE/USBHUB3 internally treats all devices as High-Speed.
- * Full-Speed bulk endpoints have wMaxPacketSize <= 64, but HS requires 512.
- * USBHUB3 rejects the configuration descriptor if bulk endpoints don't match HS rules,
- * causing repeated enumeration failures ("Invalid Configuration Descriptor").
- *
- * USB_SPEED_FULL audio devices do not work if ISOCH IN/OUT USB_ENDPOINT_DESCRIPTOR.bInterval = 1. 
- * ucx01000!UrbHandler_USBPORTStyle_Legacy_IsochTransfer completes IRP with USBD_STATUS_INVALID_PARAMETER,
- * this error can be observed in the filter driver, this driver will not get ISOCH transfers at all.
- * it always treats bInterval as 0.125ms intervals, and it doesn't care if everything else in the device
- * descriptor or speed is correct.
- *
- * Isochronous transfers can only be used by full-speed and high-speed devices.
- * For devices and host controllers that can operate at full speed, the period is measured in units of 1 millisecond frames.
- * 
- * For devices and host controllers that can operate at high speed, the period is measured in units of microframes.
- * There are eight microframes in each 1 millisecond frame.
- * The period is related to the value in bInterval by the formula 2**(bInterval - 1), the result is number of microframes.
- *
- * 5.5.3 Control Transfer Packet Size Constraints
- * The allowable maximum control transfer data payload sizes for full-speed devices is 8, 16, 32, or 64 bytes;
- * for high-speed devices, it is 64 bytes and for low-speed devices, it is 8 bytes.
- * 
- * 5.6.4 Isochronous Transfer Bus Access Constraints
- * An isochronous endpoint must specify its required bus access period. Full-/high-speed endpoints must specify
- * a desired period as (2**bInterval-1)*F, where bInterval is in the range 1-16 and F is 125µs for high-speed
- * and 1ms for full-speed.
- * 
- * 5.7.4 Interrupt Transfer Packet Size Constraints
- * A full-speed endpoint can specify a desired period from 1 ms to 255 ms. Low-speed endpoints are limited
- * to specifying only 10 ms to 255 ms. High-speed endpoints can specify a desired period (2**bInterval-1)*125µs,
- * where bInterval is in the range 1-16.
- *
- * 5.8.3 Bulk Transfer Packet Size Constraints
- * An endpoint for bulk transfers specifies the maximum data payload size that the endpoint can accept from
- * or transmit to the bus. The USB defines the allowable maximum bulk data payload sizes to be only 8, 16,
- * 32, or 64 bytes for full-speed endpoints and 512 bytes for high-speed endpoints. A low-speed device must
- * not have bulk endpoints
+ * @see receive::patch_config
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void patch_config(_In_ USB_CONFIGURATION_DESCRIPTOR *cd)
+PAGED void patch_config(_In_ USB_CONFIGURATION_DESCRIPTOR &cd)
 {
 	PAGED_CODE();
-
-	for (auto cur = reinterpret_cast<USB_COMMON_DESCRIPTOR*>(cd); 
-	     bool(cur = USBD_ParseDescriptors(cd, cd->wTotalLength, cur, USB_ENDPOINT_DESCRIPTOR_TYPE));
-             cur = libdrv::next(cur)) {
-
-                auto &e = *reinterpret_cast<USB_ENDPOINT_DESCRIPTOR*>(cur);
-
-                auto old_pkt = e.wMaxPacketSize; // maximum payload size for this endpoint
-                auto old_intvl = e.bInterval; // polling interval, frames
-
-                switch (usb_endpoint_type(e)) {
-                case UsbdPipeTypeBulk:
-                        e.wMaxPacketSize = 512; // fixed value for HS
-                        break;
-                case UsbdPipeTypeIsochronous: // 2**(bInterval - 1) frames
-                        enum { MIN_INTVL = 1, MAX_INTVL = 16 };
-                        NT_ASSERT(e.bInterval >= MIN_INTVL);
-                        NT_ASSERT(e.bInterval <= MAX_INTVL);
-                        e.bInterval = min(e.bInterval + 3, MAX_INTVL); // 2**(bInterval-1) microframes
-                        break;
-                case UsbdPipeTypeInterrupt: // 1-255 ms
-                        e.bInterval = to_high_speed_interval(e.bInterval); // 2**(bInterval-1) microframes
-                        break;
-                case UsbdPipeTypeControl:
-                        Trace(TRACE_LEVEL_WARNING, "control endpoint found in configuration descriptor");
-                        break;
-                }
-
-                if (auto equal = e.wMaxPacketSize == old_pkt && e.bInterval == old_intvl; !equal) {
-                        TraceDbg("bLength %d, %!usb_descriptor_type!, bEndpointAddress %#x, "
-                                "bmAttributes %#x, wMaxPacketSize %d (was %d), bInterval %d (was %d)", 
-                                e.bLength, e.bDescriptorType, e.bEndpointAddress, e.bmAttributes, 
-                                e.wMaxPacketSize, old_pkt, e.bInterval, old_intvl);
-                }
-	}
+	receive::patch_config(&cd, cd.wTotalLength, log_patched, log_control);
 }
 
 /*
- * Buffer from the server has no gaps (compacted), SUM(src->actual_length) == actual_length,
- * src->offset is ignored for that reason.
- *
- * For isochronous packets: actual length is the sum of
- * the actual length of the individual, packets, but as
- * the packet offsets are not changed there will be
- * padding between the packets. To optimally use the
- * bandwidth the padding is not transmitted.
- *
- * See:
- * <linux>/drivers/usb/usbip/stub_tx.c, stub_send_ret_submit
- * <linux>/drivers/usb/usbip/usbip_common.c, usbip_pad_iso
+ * @see receive::fill_isoc_data
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -209,67 +131,27 @@ PAGED auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer
 	_In_ const iso_packet_descriptor *src)
 {
 	PAGED_CODE();
-
 	NT_ASSERT(length <= r.TransferBufferLength);
-	auto dir_out = !buffer;
-
-	for (auto i = LONG64(r.NumberOfPackets) - 1; i >= 0; --i) { // set dd.Status and dd.Length
-
-		auto sd = src + i;
-		auto dd = r.IsoPacket + i;
-
-		dd->Status = sd->status ? to_windows_status_isoch(sd->status) : USBD_STATUS_SUCCESS;
-
-		if (dir_out) {
-			continue; // dd->Length is not used for OUT transfers
-		}
-
-		if (!sd->actual_length) {
-			dd->Length = 0;
-			continue;
-		}
-
-		if (sd->actual_length > sd->length) {
-			Trace(TRACE_LEVEL_ERROR, "actual_length(%u) > length(%u)", sd->actual_length, sd->length);
-			return STATUS_INVALID_PARAMETER;
-		}
-
-		if (sd->offset != dd->Offset) { // buffer is compacted, but offsets are intact
-			Trace(TRACE_LEVEL_ERROR, "src.offset(%u) != dst.Offset(%lu)", sd->offset, dd->Offset);
-			return STATUS_INVALID_PARAMETER;
-		}
 
-		if (length >= sd->actual_length) {
-			length -= sd->actual_length;
-		} else {
-			Trace(TRACE_LEVEL_ERROR, "length(%lu) >= actual_length(%u)", length, sd->actual_length);
-			return STATUS_INVALID_PARAMETER;
-		}
+	unsigned int i{};
 
-		if (dd->Offset + sd->actual_length > r.TransferBufferLength) {
-			Trace(TRACE_LEVEL_ERROR, "dst.Offset(%lu) + src.actual_length(%u) > r.TransferBufferLength(%lu)",
-				dd->Offset, sd->actual_length, r.TransferBufferLength);
-			return STATUS_INVALID_PARAMETER;
-		}
-		
-		if (dd->Offset < length) { // source buffer has no gaps
-			Trace(TRACE_LEVEL_ERROR, "dst.Offset(%lu) < length(%lu)", dd->Offset, length);
-			return STATUS_INVALID_PARAMETER;
-		}
-
-		if (dd->Offset > length) {
-			RtlMoveMemory(buffer + dd->Offset, buffer + length, sd->actual_length);
-		}
+	auto err = receive::fill_isoc_data(r.IsoPacket, r.NumberOfPackets, buffer, r.TransferBufferLength, length,
+					   src, to_windows_status_isoch, i);
 
-		dd->Length = sd->actual_length;
-	}
-
-	if (length && !dir_out) {
-		Trace(TRACE_LEVEL_ERROR, "SUM(actual_length) != actual_length, delta is %lu", length);
-		return STATUS_INVALID_PARAMETER; 
+	switch (err) {
+	case receive::error::none:
+		return STATUS_SUCCESS;
+	case receive::error::sum:
+		Trace(TRACE_LEVEL_ERROR, "SUM(actual_length) != actual_length(%lu)", length);
+		break;
+	default:
+		Trace(TRACE_LEVEL_ERROR, "%s: packet[%u] offset %u, length %u, actual_length %u, Offset %lu; "
+			"actual_length %lu, TransferBufferLength %lu", receive::str(err), i,
+			src[i].offset, src[i].length, src[i].actual_length, r.IsoPacket[i].Offset,
+			length, r.TransferBufferLength);
 	}
 
-	return STATUS_SUCCESS;
+	return STATUS_INVALID_PARAMETER;
 }
 
 /*
@@ -289,13 +171,14 @@ PAGED auto isoch_transfer(_In_ wsk_context &ctx, _In_ const header_ret_submit &r
 		r.Hdr.Status = USBD_STATUS_ISOCH_REQUEST_FAILED;
 	}
 
-	if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
+	if ((r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) &&
+	    !get_request_ctx(ctx.request)->isoch_end) { // is not paced, @see jitter_schedule
 		r.StartFrame = ret.start_frame;
 	}
 
 	if (cnt >= 0 && ULONG(cnt) == r.NumberOfPackets) {
 		NT_ASSERT(r.NumberOfPackets == number_of_packets(ctx));
-		byteswap(ctx.isoc, cnt);
+		receive::byteswap(ctx.isoc, cnt);
 	} else {
 		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) != NumberOfPackets(%lu)", cnt, r.NumberOfPackets);
 		return STATUS_INVALID_PARAMETER;
@@ -351,7 +234,7 @@ PAGED void post_control_transfer(_In_ const device_ctx &dev, _In_ const _URB_CON
                         NT_ASSERT(libdrv::is_valid(d));
                         log(d);
                         if (dev.speed() < USB_SPEED_HIGH) {
-                                patch_config(&d);
+                                patch_config(d);
                         }
 		}
 		break;
@@ -608,6 +491,150 @@ PAGED auto recv_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
         return receive(ctx, buf);
 }
 
+/*
+ * @param mdl describes the transfer buffer, can be a chain
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto unpack(_In_ MDL *mdl, _In_ const void *block, _In_ size_t block_len, _In_ size_t length)
+{
+	PAGED_CODE();
+
+	auto direct = !mdl->Next;
+	unique_ptr tmp;
+	void *dst{};
+
+	if (direct) {
+		dst = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+	} else if (tmp = unique_ptr(libdrv::uninitialized, PagedPool, length); tmp) {
+		dst = tmp.get();
+	}
+
+	if (!dst) {
+		Trace(TRACE_LEVEL_ERROR, "Cannot map or allocate %Iu bytes", length);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (!compress::unpack(block, block_len, dst, length)) {
+		Trace(TRACE_LEVEL_ERROR, "Malformed LZ4 block, %Iu -> %Iu bytes", block_len, length);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	auto src = static_cast<const UCHAR*>(dst);
+
+	for (auto remain = length; !direct && mdl && remain; mdl = mdl->Next) {
+
+		auto va = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+		if (!va) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		auto n = min(static_cast<size_t>(MmGetMdlByteCount(mdl)), remain);
+		RtlCopyMemory(va, src, n);
+
+		src += n;
+		remain -= n;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto recv_block(_Inout_ wsk_context &ctx, _In_ void *packed, _In_ size_t block, _In_ size_t length)
+{
+	PAGED_CODE();
+
+	Mdl mdl(packed, static_cast<ULONG>(block));
+	if (!mdl) {
+		Trace(TRACE_LEVEL_ERROR, "Cannot allocate MDL");
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (auto err = mdl.prepare_nonpaged()) {
+		return err;
+	}
+
+	if (WSK_BUF buf{ .Mdl = mdl.get(), .Length = block }; auto err = receive(ctx, buf)) {
+		return err;
+	}
+
+	if (!ctx.request) {
+		return STATUS_SUCCESS; // drained
+	}
+
+	WSK_BUF buf{ .Length = length };
+
+	if (auto err = prepare_wsk_mdl(buf.Mdl, ctx)) {
+		Trace(TRACE_LEVEL_ERROR, "prepare_wsk_mdl %!STATUS!", err);
+		return err;
+	}
+
+	return unpack(buf.Mdl, packed, block, length);
+}
+
+/*
+ * RET_SUBMIT IN with compress::ret_flag, the payload is a frame, @see usbip/compress.h.
+ * The block is decompressed into the transfer buffer that prepare_wsk_mdl describes.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto recv_packed(_Inout_ wsk_context &ctx, _In_ size_t length)
+{
+	PAGED_CODE();
+
+	if (auto &ret = get_ret_submit(ctx); ret.number_of_packets) {
+		Trace(TRACE_LEVEL_ERROR, "Isochronous transfer is compressed, number_of_packets %d", ret.number_of_packets);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	UCHAR frame[compress::frame_hdr];
+	if (auto err = recv(ctx.dev->sock(), memory::stack, frame, sizeof(frame))) {
+		return err;
+	}
+
+	auto block = compress::block_size(frame);
+	if (!compress::is_valid_block_size(block, length)) {
+		Trace(TRACE_LEVEL_ERROR, "LZ4 block size %Iu, actual_length %Iu", block, length);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	unique_ptr large; // the block does not fit a buffer of the lookaside list
+
+	auto packed = alloc_packed(block);
+	if (!packed) {
+		large = unique_ptr(libdrv::uninitialized, NonPagedPoolNx, block);
+		packed = large.get();
+	}
+
+	if (!packed) {
+		Trace(TRACE_LEVEL_ERROR, "Cannot allocate %Iu bytes", block);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	auto st = recv_block(ctx, packed, block, length);
+
+	if (!large) {
+		free_packed(packed);
+	}
+
+	return st;
+}
+
+/*
+ * The flag is ignored if compression was not negotiated.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto is_packed(_In_ const device_ctx &dev, _In_ const header &hdr)
+{
+	PAGED_CODE();
+
+	return  hdr.command == RET_SUBMIT && hdr.direction == direction::in &&
+		(hdr.ret_submit.ext_flags & compress::ret_flag) &&
+		dev.ext().compression.codecs;
+}
+
 /*
  * For RET_UNLINK irp was completed right after CMD_UNLINK was issued.
  * @see send_cmd_unlink
@@ -623,13 +650,32 @@ PAGED auto ret_command(_Inout_ wsk_context &ctx)
 {
 	PAGED_CODE();
 	auto &hdr = ctx.hdr;
+	auto &dev = *ctx.dev;
 
 	auto request = hdr.command == RET_SUBMIT ? // request must be completed
-		       device::remove_request(*ctx.dev, hdr.seqnum) : WDF_NO_HANDLE;
+		       device::remove_request(dev, hdr.seqnum) : WDF_NO_HANDLE;
+
+	link_response_received(dev, request, hdr);
+
+	if (hdr.command == RET_SUBMIT) {
+		++dev.overhead.ret_submits;
+	}
 
-	char buf[DBG_USBIP_HDR_BUFSZ];
-	TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x <- %Iu%s", ptr04x(request), 
-		    get_total_size(hdr), dbg_usbip_hdr(buf, sizeof(buf), &hdr, false));
+	if (request) {
+		auto &req = *get_request_ctx(request);
+		latency_stamp(req, latency::received);
+
+		if (is_interrupt_in(*get_endpoint_ctx(req.endpoint))) {
+			++dev.overhead.interrupt_rets;
+		}
+	}
+
+	TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x <- %Iu, %!usbip_request_type!, seqnum %u, status %d",
+		    ptr04x(request), get_total_size(hdr), hdr.command, hdr.seqnum, hdr.ret_submit.status);
+
+	if (auto t = get_vhci_ctx(dev.vhci)->urb_trace) [[unlikely]] {
+		urb_trace_log(*t, dev.port, hdr, request);
+	}
 
 	return request;
 }
@@ -639,41 +685,29 @@ _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto validate_header(_Inout_ header &hdr)
 {
 	PAGED_CODE();
-	byteswap_header(hdr, swap_dir::net2host);
-
-	auto cmd = static_cast<request_type>(hdr.command);
-
-	switch (cmd) {
-	case RET_SUBMIT: {
-		auto &ret = hdr.ret_submit;
-		if (ret.number_of_packets == number_of_packets_non_isoch) {
-			ret.number_of_packets = 0;
-		} else if (!is_valid_number_of_packets(ret.number_of_packets)) {
-			Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) is out of range", ret.number_of_packets);
-			return false;
-		}
-	}	break;
-	case RET_UNLINK:
-		break;
-	default:
-		Trace(TRACE_LEVEL_ERROR, "USBIP_RET_* expected, got %!usbip_request_type!", cmd);
-		return false;
-	}
 
-	auto ok = is_valid_seqnum(hdr.seqnum);
-
-	if (ok) {
-		hdr.direction = extract_dir(hdr.seqnum); // always zero in server response
-	} else {
+	switch (auto err = receive::validate_header(hdr)) {
+	case receive::error::none:
+		return true;
+	case receive::error::number_of_packets:
+		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) is out of range", hdr.ret_submit.number_of_packets);
+		break;
+	case receive::error::command:
+		Trace(TRACE_LEVEL_ERROR, "USBIP_RET_* expected, got %!usbip_request_type!", hdr.command);
+		break;
+	case receive::error::seqnum:
 		Trace(TRACE_LEVEL_ERROR, "Invalid seqnum %u", hdr.seqnum);
+		break;
+	default:
+		Trace(TRACE_LEVEL_ERROR, "%s", receive::str(err));
 	}
 
-	return ok;
+	return false;
 }
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto recv_usbip_header(_Inout_ wsk_context &ctx)
+PAGED auto recv_usbip_header(_Inout_ wsk_context &ctx, _Inout_ capture_recv &cap)
 {
 	PAGED_CODE();
 
@@ -686,39 +720,179 @@ PAGED auto recv_usbip_header(_Inout_ wsk_context &ctx)
 		return err;
 	}
 
+	if (auto c = ctx.dev->capture) [[unlikely]] {
+		capture_received_header(cap, *c, ctx.hdr); // before byteswap
+	}
+
 	return validate_header(ctx.hdr) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
 }
 
+/*
+ * Is called by the receive thread for itself.
+ * @see usbip/thread_placement.h
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void apply_placement(_In_ device_ctx &dev, _In_ LONG endpoint_types)
+{
+	PAGED_CODE();
+
+	auto device = get_handle(&dev);
+	auto &cfg = get_vhci_ctx(dev.vhci)->recv_placement;
+
+	auto traffic = placement::classify(endpoint_types);
+	auto affinity = cfg.affinity & KeQueryGroupAffinity(0); // processors of group 0
+
+	auto cpu_cnt = affinity ? KeQueryActiveProcessorCountEx(0) : KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	auto r = placement::place(traffic, dev.port, cpu_cnt, cfg);
+
+	if (r.priority) {
+		KeSetPriorityThread(KeGetCurrentThread(), r.priority);
+	}
+
+	if (GROUP_AFFINITY ga{ .Mask = static_cast<KAFFINITY>(affinity) }; !affinity) {
+		//
+	} else if (auto err = ZwSetInformationThread(ZwCurrentThread(), ThreadGroupInformation, &ga, sizeof(ga))) {
+		Trace(TRACE_LEVEL_ERROR, "dev %04x, ThreadGroupInformation %!STATUS!", ptr04x(device), err);
+	}
+
+	PROCESSOR_NUMBER num{};
+
+	if (auto err = KeGetProcessorNumberFromIndex(r.ideal, &num)) {
+		Trace(TRACE_LEVEL_ERROR, "dev %04x, KeGetProcessorNumberFromIndex(%u) %!STATUS!", ptr04x(device), r.ideal, err);
+	} else if (auto err = ZwSetInformationThread(ZwCurrentThread(), ThreadIdealProcessorEx, &num, sizeof(num))) {
+		Trace(TRACE_LEVEL_ERROR, "dev %04x, ThreadIdealProcessorEx %!STATUS!", ptr04x(device), err);
+	}
+
+	Trace(TRACE_LEVEL_INFORMATION, "dev %04x, endpoint types %#lx, traffic %d, priority %d, ideal processor %u:%u",
+		ptr04x(device), endpoint_types, static_cast<int>(traffic), KeQueryPriorityThread(KeGetCurrentThread()),
+		num.Group, num.Number);
+}
+
+/*
+ * Endpoints are added after the thread has started and when an interface setting is selected.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void update_placement(_In_ device_ctx &dev, _Inout_ LONG &placed)
+{
+	PAGED_CODE();
+
+	if (auto types = InterlockedCompareExchange(&dev.endpoint_types, 0, 0); types != placed) {
+		placed = types;
+		apply_placement(dev, types);
+	}
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void recv_loop(_Inout_ device_ctx &dev, _Inout_ wsk_context &ctx)
 {
 	PAGED_CODE();
 
-	for (NTSTATUS status{}; !(status || get_flag(dev.unplugged) || recv_usbip_header(ctx)); ) {
+	LONG placed = -1; // endpoint types of the last apply_placement
+	update_placement(dev, placed);
+
+	capture_recv cap{};
+
+	for (NTSTATUS status{}; !(status || get_flag(dev.unplugged) || recv_usbip_header(ctx, cap)); ) {
 
 		NT_ASSERT(!ctx.request); // must be completed and zeroed on every loop
 		ctx.request = ret_command(ctx);
 
-		if (auto sz = get_payload_size(ctx.hdr); !sz) {
+		if (auto sz = receive::get_payload_size(ctx.hdr); !sz) {
 			//
 		} else if (get_flag(dev.unplugged)) {
 			status = STATUS_CANCELLED; // do not receive payload
 		} else {
-			auto f = ctx.request ? recv_payload : drain_payload;
+			auto f = is_packed(dev, ctx.hdr) ? recv_packed : ctx.request ? recv_payload : drain_payload;
 			status = f(ctx, sz);
 		}
 
+		if (cap.ctx) [[unlikely]] { // before the request is completed
+			capture_received(cap, ctx, receive::get_payload_size(ctx.hdr), ctx.request && !status);
+		}
+
 		if (auto &req = ctx.request) {
 			auto st = status ? status : ret_submit(ctx);
-			complete_and_set_null(req, st);
+			if (auto l = dev.latency) [[unlikely]] {
+				latency_complete(*l, *get_request_ctx(req));
+			}
+			if (auto j = dev.jitter; j && jitter_hold(dev, *j, req, st)) [[unlikely]] {
+				req = WDF_NO_HANDLE; // will be completed in its frame
+			} else {
+				complete_and_set_null(req, st);
+			}
 		}
+
+		update_placement(dev, placed);
 	}
 }
 
 } // namespace
 
 
+/*
+ * @see .inf, ReceiveThreadBulkPriority, ReceiveThreadInterruptPriority, ReceiveThreadIsochPriority,
+ *      ReceiveThreadAffinity
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::init_recv_thread_placement(_Inout_ vhci_ctx &vhci)
+{
+	PAGED_CODE();
+
+	using placement::traffic;
+
+	ULONG bulk = 0; // see .inf
+	ULONG intr = 12;
+	ULONG isoch = LOW_REALTIME_PRIORITY;
+	ULONG affinity = 0;
+
+	auto &cfg = vhci.recv_placement;
+	auto &prio = cfg.priority;
+
+	struct {
+		const wchar_t *name;
+		ULONG &value;
+	} const v[] {
+		{ L"ReceiveThreadBulkPriority", bulk },
+		{ L"ReceiveThreadInterruptPriority", intr },
+		{ L"ReceiveThreadIsochPriority", isoch },
+		{ L"ReceiveThreadAffinity", affinity },
+	};
+
+	if (Registry key; NT_SUCCESS(open(key, DriverRegKeyParameters))) {
+		for (auto& [name, value]: v) {
+
+			UNICODE_STRING value_name;
+			RtlUnicodeStringInit(&value_name, name);
+
+			if (ULONG val = 0; auto err = WdfRegistryQueryULong(key.get<WDFKEY>(), &value_name, &val)) {
+				Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+			} else {
+				value = val;
+			}
+		}
+	}
+
+	prio[int(traffic::bulk)] = static_cast<int>(bulk);
+	prio[int(traffic::interrupt)] = static_cast<int>(intr);
+	prio[int(traffic::isoch)] = static_cast<int>(isoch);
+
+	for (auto &p: prio) {
+		if (p < 0 || p >= HIGH_PRIORITY) {
+			p = 0; // keep the default
+		}
+	}
+
+	cfg.affinity = affinity;
+
+	TraceDbg("priority{bulk %d, interrupt %d, isoch %d}, affinity %#lx",
+		  prio[int(traffic::bulk)], prio[int(traffic::interrupt)], prio[int(traffic::isoch)], affinity);
+}
+
+
 _IRQL_requires_same_
 _Function_class_(KSTART_ROUTINE)
 PAGED void usbip::recv_thread_function(_In_ void *context)
@@ -10,6 +10,12 @@
 namespace usbip
 {
 
+struct vhci_ctx;
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_recv_thread_placement(_Inout_ vhci_ctx &vhci);
+
 _IRQL_requires_same_
 _Function_class_(KSTART_ROUTINE)
 PAGED void recv_thread_function(_In_ void *context);
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Order of attaching persistent devices at boot.
+ *
+ * The history is an array of location keys of successfully attached devices, the most recent first.
+ * Devices that were attached recently are attached first, devices that were never attached go last
+ * in their original order. The concurrency is limited by reattach::scheduler.
+ *
+ * It is used by the driver, so it does not allocate memory.
+ */
+namespace usbip::attach_plan
+{
+
+/*
+ * @return position in the history or cnt if the key is not found
+ */
+inline size_t rank(const unsigned long long *history, size_t cnt, unsigned long long key) noexcept
+{
+        size_t i = 0;
+        for ( ; i < cnt && history[i] != key; ++i);
+        return i;
+}
+
+/*
+ * Move the key to the front of the history, the oldest one is dropped if the history is full.
+ * @return new number of keys in the history
+ */
+inline size_t remember(unsigned long long *history, size_t cnt, size_t max_cnt, unsigned long long key) noexcept
+{
+        if (!max_cnt) {
+                return 0;
+        }
+
+        auto pos = rank(history, cnt, key);
+
+        if (pos == cnt) { // not found
+                if (cnt < max_cnt) {
+                        ++cnt;
+                }
+                pos = cnt - 1;
+        }
+
+        for ( ; pos; --pos) {
+                history[pos] = history[pos - 1];
+        }
+
+        history[0] = key;
+        return cnt;
+}
+
+/*
+ * Stable sort by rank in the history.
+ * @param order receives indices of keys[cnt] in the order of attaching
+ * @param ranks scratch array[cnt]
+ */
+inline void order(size_t *order, size_t *ranks, const unsigned long long *keys, size_t cnt,
+                  const unsigned long long *history, size_t history_cnt) noexcept
+{
+        for (size_t i = 0; i < cnt; ++i) {
+
+                auto r = ranks[i] = rank(history, history_cnt, keys[i]);
+                auto j = i;
+
+                for ( ; j && ranks[order[j - 1]] > r; --j) {
+                        order[j] = order[j - 1];
+                }
+
+                order[j] = i;
+        }
+}
+
+} // namespace usbip::attach_plan
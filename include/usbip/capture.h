@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Binary capture of USB/IP PDUs of a device.
+ *
+ * The driver records a PDU as it is on the wire: the header in network byte order
+ * followed by the payload, both truncated to a snapshot length.
+ * Records are drained by vhci::ioctl::read_capture and converted to pcapng, @see usbip/pcapng.h
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::capture
+{
+
+enum direction : unsigned char { out, in }; // out is to a server
+
+/*
+ * Records are aligned to eight bytes, data follows the record.
+ */
+struct record
+{
+        unsigned int size; // of the record, data and padding
+        int flags; // for internal use by ring
+
+        unsigned long long time; // 100-nanosecond intervals since January 1, 1601 (UTC)
+
+        unsigned int pdu_len; // on the wire
+        unsigned int data_len; // captured bytes, no more than pdu_len
+
+        direction dir;
+        unsigned char reserved[7];
+};
+static_assert(sizeof(record) == 32);
+
+constexpr size_t alignment = 8;
+
+constexpr size_t record_size(size_t data_len) noexcept
+{
+        return (sizeof(record) + data_len + alignment - 1) & ~(alignment - 1);
+}
+
+inline auto data(record &r) noexcept { return reinterpret_cast<unsigned char*>(&r + 1); }
+inline auto data(const record &r) noexcept { return reinterpret_cast<const unsigned char*>(&r + 1); }
+
+/*
+ * Byte ring of records with any number of writers and one reader, writers never wait.
+ * A record that does not fit is dropped and counted, the reader is never overwritten.
+ *
+ * A writer reserves space by compare-exchange of the head and publishes the record by its flags.
+ * If a record does not fit at the end of the storage, the remainder is skipped by a padding record.
+ * The reader zeroes consumed bytes, so flags of a reserved record are zero until it is published.
+ *
+ * The object must be zero-initialized.
+ *
+ * @param Atomic provides static member functions
+ *        long long load(const volatile long long&), int load(const volatile int&) with acquire semantics,
+ *        void store(volatile long long&, long long), void store(volatile int&, int) with release semantics,
+ *        bool compare_exchange(volatile long long &target, long long expected, long long desired),
+ *        void increment(volatile long long&)
+ */
+template<typename Atomic>
+class ring
+{
+public:
+        /*
+         * @param storage is zeroed, the ring does not own it
+         * @param capacity in bytes, must be a power of two that is not less than alignment
+         */
+        void init(void *storage, size_t capacity) noexcept
+        {
+                m_data = static_cast<unsigned char*>(storage);
+                m_capacity = capacity;
+
+                for (size_t i = 0; i < capacity; ++i) {
+                        m_data[i] = 0;
+                }
+        }
+
+        explicit operator bool() const noexcept { return m_data; }
+
+        auto capacity() const noexcept { return m_capacity; }
+        auto dropped() const noexcept { return Atomic::load(m_dropped); }
+
+        /*
+         * Fill the record and its data in place, then call commit().
+         * @return nullptr if there is no room, the record is dropped
+         */
+        record* reserve(size_t data_len) noexcept
+        {
+                auto size = static_cast<long long>(record_size(data_len));
+                auto cap = static_cast<long long>(m_capacity);
+
+                if (size > cap) {
+                        Atomic::increment(m_dropped);
+                        return nullptr;
+                }
+
+                for (auto head = Atomic::load(m_head); ; head = Atomic::load(m_head)) {
+
+                        auto offset = head & (cap - 1);
+                        auto pad = offset + size > cap ? cap - offset : 0;
+
+                        if (head + pad + size - Atomic::load(m_tail) > cap) {
+                                Atomic::increment(m_dropped);
+                                return nullptr;
+                        }
+
+                        if (!Atomic::compare_exchange(m_head, head, head + pad + size)) {
+                                continue;
+                        }
+
+                        if (pad) {
+                                auto &p = at(offset);
+                                p.size = static_cast<unsigned int>(pad);
+                                Atomic::store(p.flags, PADDING);
+                        }
+
+                        auto &r = at((head + pad) & (cap - 1));
+                        r.size = static_cast<unsigned int>(size);
+                        r.data_len = static_cast<unsigned int>(data_len);
+
+                        return &r;
+                }
+        }
+
+        void commit(record &r) noexcept { Atomic::store(r.flags, COMMITTED); }
+
+        /*
+         * Copy whole records in order, stop at a record that is not published yet.
+         * The caller must serialize calls.
+         * @return number of copied bytes
+         */
+        size_t read(void *dst, size_t len) noexcept
+        {
+                auto out = static_cast<unsigned char*>(dst);
+                size_t copied = 0;
+
+                auto tail = m_tail; // the reader is the only writer of it
+
+                for (auto head = Atomic::load(m_head); tail < head; ) {
+
+                        auto &r = at(tail & static_cast<long long>(m_capacity - 1));
+
+                        auto flags = Atomic::load(r.flags);
+                        if (!flags) {
+                                break; // is being written
+                        }
+
+                        auto size = r.size;
+
+                        if (flags != COMMITTED) {
+                                // padding
+                        } else if (copied + size > len) {
+                                break;
+                        } else {
+                                copy(out + copied, &r, size);
+                                copied += size;
+                        }
+
+                        zero(&r, size);
+                        tail += size;
+                        Atomic::store(m_tail, tail);
+                }
+
+                return copied;
+        }
+
+private:
+        enum { COMMITTED = 1, PADDING };
+
+        unsigned char *m_data;
+        size_t m_capacity;
+
+        volatile long long m_head; // reserved by writers
+        volatile long long m_tail; // consumed by the reader
+        volatile long long m_dropped;
+
+        record& at(long long offset) noexcept { return *reinterpret_cast<record*>(m_data + offset); }
+
+        static void copy(unsigned char *dst, const record *src, size_t len) noexcept
+        {
+                auto s = reinterpret_cast<const unsigned char*>(src);
+                for (size_t i = 0; i < len; ++i) {
+                        dst[i] = s[i];
+                }
+        }
+
+        static void zero(record *r, size_t len) noexcept
+        {
+                auto p = reinterpret_cast<unsigned char*>(r);
+                for (size_t i = 0; i < len; ++i) {
+                        p[i] = 0;
+                }
+        }
+};
+
+} // namespace usbip::capture
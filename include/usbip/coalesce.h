@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Coalescing of interrupt IN resubmits of a device.
+ *
+ * An idle HID device always has an interrupt IN URB outstanding, every completion is followed by a resubmit
+ * that would be sent as its own TCP segment. A resubmit that opens a window is held, the resubmits that
+ * come within the window join it, the window is closed by its timer, by the size limit or by any other PDU
+ * of the device (held PDUs go first, the order is kept). Headers of PDUs that are sent together are gathered
+ * into one WskSend.
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::coalesce
+{
+
+enum : unsigned int
+{
+        max_batch_limit = 64, // PDUs of a window
+        default_max_batch = 16,
+};
+
+enum class action
+{
+        send, // the PDU is sent right now
+        hold, // the PDU joins the open window
+        open, // the PDU opens a window, the timer must be started for deadline()
+        flush, // the held PDUs and then this one are sent right now, the timer can be stopped
+};
+
+enum class closed_by { timer, size, traffic, count_ };
+
+/*
+ * The caller serializes the calls.
+ * Time is in arbitrary units of a monotonic clock, the window is in the same units.
+ */
+class window
+{
+public:
+        /*
+         * @param length zero disables coalescing
+         * @param max_batch PDUs of a window, default_max_batch if zero
+         */
+        void configure(long long length, unsigned int max_batch)
+        {
+                m_length = length > 0 ? length : 0;
+                m_max_batch = !max_batch ? default_max_batch : max_batch < max_batch_limit ? max_batch : max_batch_limit;
+        }
+
+        bool enabled() const { return m_length; }
+        auto length() const { return m_length; }
+        auto max_batch() const { return m_max_batch; }
+
+        auto held() const { return m_held; }
+        auto deadline() const { return m_deadline; }
+
+        /*
+         * @param coalescible interrupt IN CMD_SUBMIT
+         */
+        action add(long long now, bool coalescible)
+        {
+                if (!coalescible) {
+                        return m_held ? close(closed_by::traffic) : action::send;
+                }
+
+                if (!m_held) {
+                        if (!m_length) {
+                                return action::send;
+                        }
+                        m_held = 1;
+                        m_deadline = now + m_length;
+                        ++m_windows;
+                        return action::open;
+                }
+
+                if (++m_held >= m_max_batch) {
+                        --m_held; // this PDU is not held
+                        return close(closed_by::size);
+                }
+
+                if (now >= m_deadline) { // the timer is late
+                        --m_held;
+                        return close(closed_by::timer);
+                }
+
+                return action::hold;
+        }
+
+        /*
+         * Is called by the timer.
+         * @return number of held PDUs to send, zero if the window is not expired
+         */
+        unsigned int expire(long long now)
+        {
+                if (!m_held || now < m_deadline) {
+                        return 0;
+                }
+
+                auto n = m_held;
+                close(closed_by::timer);
+                return n;
+        }
+
+        /*
+         * Closes the window regardless of the deadline, when coalescing is disabled or the device is gone.
+         * @return number of held PDUs to send
+         */
+        unsigned int take()
+        {
+                auto n = m_held;
+                m_held = 0;
+                return n;
+        }
+
+        auto windows() const { return m_windows; }
+        auto closed(closed_by r) const { return m_closed[static_cast<int>(r)]; }
+
+        void reset_stats()
+        {
+                m_windows = 0;
+                for (auto &n: m_closed) {
+                        n = 0;
+                }
+        }
+
+private:
+        long long m_length{};
+        long long m_deadline{};
+        unsigned int m_max_batch = default_max_batch;
+        unsigned int m_held{};
+
+        unsigned long long m_windows{};
+        unsigned long long m_closed[static_cast<int>(closed_by::count_)]{};
+
+        action close(closed_by r)
+        {
+                ++m_closed[static_cast<int>(r)];
+                m_held = 0;
+                return action::flush;
+        }
+};
+
+/*
+ * PDUs that consist of a header only and follow each other are sent together,
+ * up to max_batch_limit of them, @see device_ioctl.cpp, gather.
+ *
+ * @param first the PDU that is sent, nothing is gathered if it is not header only
+ * @param next the PDU that follows it, a forward list linked through Node::Next
+ * @param header_only(const Node&)
+ * @param join(Node &last, Node &pdu) appends pdu to the send of first, pdu.Next can be overwritten
+ * @return the PDU after the gathered ones
+ */
+template<typename Node, typename HeaderOnly, typename Join>
+Node* gather(Node &first, Node *next, HeaderOnly &&header_only, Join &&join)
+{
+        if (!header_only(first)) {
+                return next;
+        }
+
+        for (auto last = &first, n = 1U; next && n < max_batch_limit && header_only(*next); ++n) {
+                auto &pdu = *next;
+                next = pdu.Next;
+
+                join(*last, pdu);
+                last = &pdu;
+        }
+
+        return next;
+}
+
+/*
+ * Per-device overhead, they are counted whether coalescing is enabled or not.
+ * Send counters are updated by the sender that drains device_ctx::pending_sends, receive counters by the receive thread.
+ */
+struct counters
+{
+        unsigned long long pdus_sent;
+        unsigned long long sends; // WskSend calls, pdus_sent/sends is the gathering ratio
+        unsigned long long interrupt_submits; // CMD_SUBMIT of interrupt IN endpoints
+        unsigned long long ret_submits;
+        unsigned long long interrupt_rets; // RET_SUBMIT of interrupt IN endpoints
+};
+
+/*
+ * vhci::ioctl::get_coalesce returns it.
+ */
+struct stats
+{
+        counters overhead;
+
+        unsigned long long windows; // opened
+        unsigned long long closed_by_timer;
+        unsigned long long closed_by_size;
+        unsigned long long closed_by_traffic;
+
+        unsigned int window; // microseconds, zero if coalescing is disabled
+        unsigned int max_batch;
+};
+static_assert(sizeof(counters) == 40);
+static_assert(sizeof(stats) == 80);
+
+} // namespace usbip::coalesce
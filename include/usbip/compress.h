@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "consts.h"
+#include "lz4.h"
+
+#include <basetsd.h>
+
+/*
+ * Optional compression of transfer buffers, the extension of USB/IP that is negotiated with a cooperating server.
+ *
+ * The client offers it in OP_REQ_IMPORT, extension is placed into the tail of op_import_request::busid
+ * after its terminating zero. usbipd compares busid as a string and zero-fills usbip_usb_device::path
+ * of the reply, so a server that does not know the extension ignores the offer and plain USB/IP is used.
+ * A cooperating server puts the accepted extension into the tail of op_import_reply::udev.path.
+ *
+ * After that the payload of CMD_SUBMIT OUT or RET_SUBMIT IN of a non-isochronous transfer that is not shorter
+ * than the threshold of its endpoint type can be sent as a frame: big-endian UINT32 size of LZ4 block and the block.
+ * Such PDU has submit_flag in cmd_submit.transfer_flags or ret_flag in ret_submit.ext_flags.
+ * The size of uncompressed data is transfer_buffer_length or actual_length as usual.
+ * A payload that does not shrink is sent as is, without the flag.
+ *
+ * It is used by the driver, so it does not allocate memory.
+ */
+namespace usbip::compress
+{
+
+enum : UINT8 { codec_lz4 = 1 }; // extension::codecs
+
+enum : UINT32
+{
+        submit_flag = 0x4000'0000, // header_cmd_submit::transfer_flags, URB_* of Linux do not use it
+        ret_flag = 1, // header_ret_submit::ext_flags
+
+        frame_hdr = sizeof(UINT32),
+        max_shift = 20, // the highest threshold is 1 MiB
+};
+
+enum class ep_type { control, bulk, interrupt, count_ }; // isochronous transfers are not compressed
+
+#include <PSHPACK1.H>
+struct extension
+{
+        char magic[4];
+        UINT8 codecs; // bit mask in the offer, the chosen one in the reply
+        UINT8 min_shift[static_cast<int>(ep_type::count_)]; // threshold is 1 << min_shift bytes, zero disables the type
+};
+#include <POPPACK.H>
+static_assert(sizeof(extension) == 8);
+
+inline constexpr char magic[sizeof(extension::magic)]{ 'u', 'i', 'p', 'z' };
+
+/*
+ * @param usb_type bmAttributes & 3 of endpoint descriptor, USBD_PIPE_TYPE has the same values
+ * @return zero if payloads of such endpoints are not compressed
+ */
+constexpr size_t threshold(const extension &ext, unsigned int usb_type) noexcept
+{
+        auto t = usb_type == 0 ? ep_type::control :
+                 usb_type == 2 ? ep_type::bulk :
+                 usb_type == 3 ? ep_type::interrupt : ep_type::count_;
+
+        if (!ext.codecs || t == ep_type::count_) {
+                return 0;
+        }
+
+        auto shift = ext.min_shift[static_cast<int>(t)];
+        return shift && shift <= max_shift ? size_t(1) << shift : 0;
+}
+
+/*
+ * @param bytes threshold, it is rounded up to a power of two
+ * @return extension::min_shift, zero if bytes is zero or too big
+ */
+constexpr UINT8 to_shift(unsigned long bytes) noexcept
+{
+        for (UINT8 shift = 1; shift <= max_shift; ++shift) {
+                if (bytes <= 1UL << shift) {
+                        return bytes ? shift : 0;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ * Places the extension after the terminating zero of a string field.
+ * @return false if the string is too long
+ */
+template<size_t N>
+inline bool put(char (&field)[N], const extension &ext) noexcept
+{
+        static_assert(N > sizeof(ext));
+        constexpr auto off = N - sizeof(ext);
+
+        if (!memchr(field, '\0', off)) {
+                return false;
+        }
+
+        memcpy(field + off, &ext, sizeof(ext));
+        return true;
+}
+
+/*
+ * @return false if the string field does not have the extension
+ */
+template<size_t N>
+inline bool get(extension &ext, const char (&field)[N]) noexcept
+{
+        static_assert(N > sizeof(ext));
+        constexpr auto off = N - sizeof(ext);
+
+        if (!memchr(field, '\0', off)) {
+                return false;
+        }
+
+        memcpy(&ext, field + off, sizeof(ext));
+        return !memcmp(ext.magic, magic, sizeof(magic));
+}
+
+/*
+ * Is used by a server.
+ * @param codecs supported by the server
+ * @return the reply, codecs is zero if the offer is declined
+ */
+constexpr extension accept(const extension &offer, UINT8 codecs) noexcept
+{
+        auto ext = offer;
+        ext.codecs &= codecs & codec_lz4;
+        return ext;
+}
+
+/*
+ * Is used by the client.
+ * @param path op_import_reply::udev.path
+ * @return the negotiated extension, codecs is zero if plain USB/IP must be used
+ */
+inline extension accepted(const extension &offer, const char (&path)[DEV_PATH_MAX]) noexcept
+{
+        if (extension ext; get(ext, path) && ext.codecs == codec_lz4 && (offer.codecs & codec_lz4)) {
+                return ext;
+        }
+
+        return {};
+}
+
+/*
+ * @param dst len bytes, a frame that is not shorter than the payload is useless
+ * @param table lz4::hash_size entries
+ * @return frame size, zero if the payload does not shrink
+ */
+inline size_t pack(const void *src, size_t len, void *dst, unsigned int *table) noexcept
+{
+        if (len <= frame_hdr + 1) {
+                return 0;
+        }
+
+        auto frame = static_cast<unsigned char*>(dst);
+
+        auto n = lz4::compress(static_cast<const unsigned char*>(src), len, frame + frame_hdr, len - frame_hdr - 1, table);
+        if (!n) {
+                return 0;
+        }
+
+        for (unsigned int i = 0; i < frame_hdr; ++i) {
+                frame[i] = static_cast<unsigned char>(n >> 8*(frame_hdr - 1 - i));
+        }
+
+        return frame_hdr + n;
+}
+
+/*
+ * @param frame frame_hdr bytes
+ * @return size of LZ4 block that follows them
+ */
+constexpr size_t block_size(const unsigned char *frame) noexcept
+{
+        size_t n = 0;
+
+        for (unsigned int i = 0; i < frame_hdr; ++i) {
+                n = n << 8 | frame[i];
+        }
+
+        return n;
+}
+
+/*
+ * @param len of uncompressed data, the frame must be shorter
+ */
+constexpr bool is_valid_block_size(size_t block, size_t len) noexcept
+{
+        return block && frame_hdr + block < len;
+}
+
+/*
+ * @param len of uncompressed data from the header
+ * @return false if the block is malformed
+ */
+inline bool unpack(const void *block, size_t block_len, void *dst, size_t len) noexcept
+{
+        return is_valid_block_size(block_len, len) &&
+               lz4::decompress(static_cast<const unsigned char*>(block), block_len, static_cast<unsigned char*>(dst), len);
+}
+
+} // namespace usbip::compress
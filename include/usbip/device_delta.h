@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Compact encoding of imported devices for vhci::ioctl::get_imported_devices_delta.
+ *
+ * It is used by the driver and by libusbip, so it does not allocate memory.
+ * Records are variable-length, integers are unsigned LEB128, strings are length-prefixed without '\0'.
+ *
+ * removed: kind, port
+ * present: kind, port, devid, speed, vendor, product, host, service, busid, serial
+ */
+namespace usbip::delta
+{
+
+enum class kind : unsigned char { removed = 1, present };
+
+enum class reply { unchanged, changes, full };
+
+/*
+ * Only the generations of this instance of the driver are known, the changes since any other one are not.
+ * The client that has nothing passes zero.
+ *
+ * @param since generation of the client
+ * @param first generation of this instance of the driver
+ * @param current generation of the last change of the ports
+ */
+constexpr reply make_reply(unsigned long long since, unsigned long long first, unsigned long long current) noexcept
+{
+        if (since < first || since > current) {
+                return reply::full;
+        }
+
+        return since == current ? reply::unchanged : reply::changes;
+}
+
+struct string_ref
+{
+        const char *data;
+        size_t len;
+};
+
+/*
+ * @return length of a string that may not be null-terminated
+ */
+inline size_t length(const char *s, size_t maxlen) noexcept
+{
+        size_t n = 0;
+        for ( ; n < maxlen && s[n]; ++n);
+        return n;
+}
+
+struct device
+{
+        unsigned int port;
+        unsigned int devid;
+        unsigned int speed;
+        unsigned short vendor;
+        unsigned short product;
+
+        string_ref host;
+        string_ref service;
+        string_ref busid;
+        string_ref serial;
+};
+
+class writer
+{
+public:
+        writer(void *buf, size_t size) noexcept : m_buf(static_cast<unsigned char*>(buf)), m_size(size) {}
+
+        void removed(unsigned int port) noexcept
+        {
+                put_byte(static_cast<unsigned char>(kind::removed));
+                put_uint(port);
+        }
+
+        void present(const device &d) noexcept
+        {
+                put_byte(static_cast<unsigned char>(kind::present));
+
+                put_uint(d.port);
+                put_uint(d.devid);
+                put_uint(d.speed);
+                put_uint(d.vendor);
+                put_uint(d.product);
+
+                put_str(d.host);
+                put_str(d.service);
+                put_str(d.busid);
+                put_str(d.serial);
+        }
+
+        /*
+         * @return bytes written, or would be written if the buffer was large enough
+         */
+        auto size() const noexcept { return m_pos; }
+        auto overflow() const noexcept { return m_pos > m_size; }
+
+private:
+        unsigned char *m_buf;
+        size_t m_size;
+        size_t m_pos{};
+
+        void put_byte(unsigned char c) noexcept
+        {
+                if (m_pos < m_size) {
+                        m_buf[m_pos] = c;
+                }
+                ++m_pos;
+        }
+
+        void put_uint(unsigned long long v) noexcept
+        {
+                for ( ; v >= 0x80; v >>= 7) {
+                        put_byte(static_cast<unsigned char>(v | 0x80));
+                }
+                put_byte(static_cast<unsigned char>(v));
+        }
+
+        void put_str(const string_ref &s) noexcept
+        {
+                put_uint(s.len);
+
+                for (size_t i = 0; i < s.len; ++i) {
+                        put_byte(static_cast<unsigned char>(s.data[i]));
+                }
+        }
+};
+
+class reader
+{
+public:
+        reader(const void *buf, size_t size) noexcept : m_buf(static_cast<const unsigned char*>(buf)), m_size(size) {}
+
+        /*
+         * Strings of the device point into the buffer.
+         * @return false if there are no more records or the data is malformed, see error()
+         */
+        bool next(kind &k, device &d) noexcept
+        {
+                if (m_error || m_pos == m_size) {
+                        return false;
+                }
+
+                d = device{};
+
+                switch (k = static_cast<kind>(get_byte())) {
+                case kind::removed:
+                        d.port = get_uint32();
+                        break;
+                case kind::present:
+                        d.port = get_uint32();
+                        d.devid = get_uint32();
+                        d.speed = get_uint32();
+                        d.vendor = get_uint16();
+                        d.product = get_uint16();
+
+                        d.host = get_str();
+                        d.service = get_str();
+                        d.busid = get_str();
+                        d.serial = get_str();
+                        break;
+                default:
+                        m_error = true;
+                }
+
+                return !m_error;
+        }
+
+        auto error() const noexcept { return m_error; }
+
+private:
+        const unsigned char *m_buf;
+        size_t m_size;
+        size_t m_pos{};
+        bool m_error{};
+
+        unsigned char get_byte() noexcept
+        {
+                if (m_pos < m_size) {
+                        return m_buf[m_pos++];
+                }
+
+                m_error = true;
+                return 0;
+        }
+
+        unsigned long long get_uint(unsigned long long max) noexcept
+        {
+                unsigned long long v = 0;
+
+                for (int shift = 0; !m_error; shift += 7) {
+
+                        auto c = get_byte();
+                        if (shift > 63) {
+                                break;
+                        }
+
+                        v |= static_cast<unsigned long long>(c & 0x7F) << shift;
+
+                        if (!(c & 0x80)) {
+                                if (v <= max) {
+                                        return v;
+                                }
+                                break;
+                        }
+                }
+
+                m_error = true;
+                return 0;
+        }
+
+        unsigned int get_uint32() noexcept { return static_cast<unsigned int>(get_uint(0xFFFF'FFFF)); }
+        unsigned short get_uint16() noexcept { return static_cast<unsigned short>(get_uint(0xFFFF)); }
+
+        string_ref get_str() noexcept
+        {
+                string_ref s{};
+
+                if (auto len = get_uint(m_size); m_error) {
+                        //
+                } else if (len > m_size - m_pos) {
+                        m_error = true;
+                } else {
+                        s.data = reinterpret_cast<const char*>(m_buf + m_pos);
+                        s.len = static_cast<size_t>(len);
+                        m_pos += s.len;
+                }
+
+                return s;
+        }
+};
+
+} // namespace usbip::delta
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "event_ring.h"
+
+namespace usbip
+{
+
+/*
+ * Flags of an event that event_journal::read emits.
+ */
+inline constexpr unsigned int event_resync = 1; // earlier events of this source were dropped, this is its latest state
+inline constexpr unsigned int event_lost = 2; // the latest states of some sources were dropped, reread all of them
+
+/*
+ * State changes of event sources (devices) for any number of readers.
+ *
+ * The ring keeps compact records, the description of a source (a device location is above 1 KB)
+ * is kept once in the table of sources and is shared by its records. A record refers to the table slot
+ * by its index and generation, a slot is reused for a new source if the table is full.
+ *
+ * If a reader is too slow, the oldest records are overwritten. The reader does not need to reread everything:
+ * for every source whose latest record was dropped, read() emits its current state with event_resync.
+ * Only if a source was evicted from the table before the reader saw its latest state, event_lost is set.
+ *
+ * It is used by the driver, so it does not lock or allocate memory, the caller must serialize calls.
+ * The object must be zero-initialized, it is trivially constructible to be placed into a context space.
+ *
+ * @param Info description of a source, it is copied into emitted events
+ * @param State of a source
+ */
+template<typename Info, typename State>
+class event_journal
+{
+public:
+        using seqnum_t = typename event_ring<int>::seqnum_t;
+        using source_id_t = unsigned int;
+
+        struct record
+        {
+                source_id_t source_id;
+                int port;
+                State state;
+                unsigned short slot; // index in the table of sources
+                unsigned short gen; // of the slot
+        };
+
+        struct source
+        {
+                Info info;
+                seqnum_t last; // seqnum of the latest record, zero if the slot is free
+                source_id_t id;
+                int port;
+                State state;
+                unsigned short gen; // is incremented when the slot is reused
+        };
+
+        /*
+         * @param sources zero-initialized array of source_cnt entries, up to 64K
+         * @param records array of record_cnt entries
+         */
+        void init(source *sources, size_t source_cnt, record *records, size_t record_cnt) noexcept
+        {
+                m_sources = sources;
+                m_source_cnt = source_cnt;
+                m_ring.init(records, record_cnt);
+                m_evicted = 0;
+                m_pending = nullptr;
+        }
+
+        explicit operator bool() const noexcept { return m_sources; }
+
+        auto sources() const noexcept { return m_sources; }
+        auto records() const noexcept { return m_ring.data(); }
+
+        auto source_count() const noexcept { return m_source_cnt; }
+        auto capacity() const noexcept { return m_ring.capacity(); }
+        auto size() const noexcept { return m_ring.size(); }
+
+        /*
+         * A new reader starts from it.
+         */
+        auto next_seqnum() const noexcept { return m_ring.next_seqnum(); }
+
+        bool available(seqnum_t cursor) const noexcept { return cursor < m_ring.next_seqnum(); }
+
+        /*
+         * @return number of records that were overwritten before the reader read them
+         */
+        auto lost(seqnum_t cursor) const noexcept { return m_ring.lost(cursor); }
+
+        /*
+         * The caller fills in the description of the source and calls commit() or discard().
+         * If the source is new and the table is full, the slot of the source that changed its state
+         * least recently is reused.
+         *
+         * @return description of the source, the previous one if the source is known
+         */
+        Info& prepare(source_id_t source_id) noexcept
+        {
+                auto s = find(source_id);
+
+                if (!s) {
+                        s = evict();
+                        s->id = source_id;
+                }
+
+                m_pending = s;
+                return s->info;
+        }
+
+        /*
+         * @return sequence number of the added record
+         */
+        seqnum_t commit(int port, State state) noexcept
+        {
+                auto &s = *m_pending;
+                m_pending = nullptr;
+
+                m_ring.prepare() = record {
+                        .source_id = s.id,
+                        .port = port,
+                        .state = state,
+                        .slot = static_cast<unsigned short>(&s - m_sources),
+                        .gen = s.gen,
+                };
+
+                s.port = port;
+                s.state = state;
+
+                return s.last = m_ring.commit();
+        }
+
+        /*
+         * The description of the source was not filled in, the source is forgotten.
+         */
+        void discard() noexcept
+        {
+                release(*m_pending);
+                m_pending = nullptr;
+        }
+
+        /*
+         * @param cursor of the reader, seqnum of the next record to read, it is advanced
+         * @param emit is called for every event as
+         *        emit(const Info&, source_id_t, int port, State, seqnum_t seqnum, unsigned int flags)
+         * @return number of emitted events
+         */
+        template<typename F>
+        size_t read(seqnum_t &cursor, size_t max_cnt, F &&emit) const
+        {
+                size_t cnt = 0;
+                unsigned int flags = cursor <= m_evicted ? event_lost : 0;
+
+                for (auto first = m_ring.first_seqnum(); cnt < max_cnt && cursor < first; ++cnt) {
+
+                        auto s = oldest_dropped(cursor, first);
+                        if (!s) {
+                                cursor = first;
+                                break;
+                        }
+
+                        emit(s->info, s->id, s->port, s->state, s->last, flags | event_resync);
+                        flags = 0;
+
+                        cursor = s->last + 1;
+                }
+
+                for ( ; cnt < max_cnt && cursor < m_ring.next_seqnum(); ++cursor) {
+
+                        auto &r = *m_ring.get(cursor);
+                        auto &s = m_sources[r.slot];
+
+                        if (s.gen == r.gen) { // otherwise the source was evicted, event_lost is set
+                                emit(s.info, r.source_id, r.port, r.state, cursor, flags);
+                                flags = 0;
+                                ++cnt;
+                        }
+                }
+
+                return cnt;
+        }
+
+private:
+        source *m_sources;
+        size_t m_source_cnt;
+
+        event_ring<record> m_ring;
+        seqnum_t m_evicted; // the highest seqnum of the latest record of an evicted source, see read()
+
+        source *m_pending; // between prepare() and commit()
+
+        source* find(source_id_t source_id) const noexcept
+        {
+                for (auto s = m_sources, end = s + m_source_cnt; s != end; ++s) {
+                        if (s->last && s->id == source_id) {
+                                return s;
+                        }
+                }
+
+                return nullptr;
+        }
+
+        /*
+         * A free slot has the lowest "last".
+         */
+        source* evict() noexcept
+        {
+                auto victim = m_sources;
+
+                for (auto s = m_sources, end = s + m_source_cnt; s != end; ++s) {
+                        if (s->last < victim->last) {
+                                victim = s;
+                        }
+                }
+
+                release(*victim);
+                return victim;
+        }
+
+        /*
+         * The records of the source are skipped by read().
+         * A reader whose cursor does not exceed the latest of them has not seen the state of the source.
+         */
+        void release(source &s) noexcept
+        {
+                if (!s.last) {
+                        return;
+                }
+
+                ++s.gen;
+
+                if (s.last > m_evicted) {
+                        m_evicted = s.last;
+                }
+
+                s.last = 0;
+        }
+
+        /*
+         * @return the source with the lowest seqnum of the latest record in [cursor, first)
+         */
+        const source* oldest_dropped(seqnum_t cursor, seqnum_t first) const noexcept
+        {
+                const source *found{};
+
+                for (auto s = m_sources, end = s + m_source_cnt; s != end; ++s) {
+                        if (s->last >= cursor && s->last < first && (!found || s->last < found->last)) {
+                                found = s;
+                        }
+                }
+
+                return found;
+        }
+};
+
+} // namespace usbip
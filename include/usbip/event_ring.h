@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace usbip
+{
+
+/*
+ * Fixed-size ring of records numbered by a monotonically increasing sequence number.
+ *
+ * There is one writer and any number of readers. Each reader has its own cursor,
+ * that is the sequence number of the next record it wants to read.
+ * The writer never waits for readers, it overwrites the oldest record if the ring is full.
+ * A reader detects overwritten records (a gap) by comparing its cursor with first_seqnum(),
+ * or by a jump of sequence numbers of the records it reads.
+ *
+ * It is used by the driver, so it does not lock or allocate memory, the caller must serialize calls.
+ * The object must be zero-initialized, it is trivially constructible to be placed into a context space.
+ *
+ * @param T type of a record
+ */
+template<typename T>
+class event_ring
+{
+public:
+        using seqnum_t = unsigned long long; // zero is never assigned to a record
+
+        /*
+         * @param storage array of capacity records, the ring does not own it
+         */
+        void init(T *storage, size_t capacity) noexcept
+        {
+                m_storage = storage;
+                m_capacity = capacity;
+                m_first = m_next = 1;
+        }
+
+        explicit operator bool() const noexcept { return m_storage; }
+
+        auto data() const noexcept { return m_storage; }
+        auto capacity() const noexcept { return m_capacity; }
+
+        auto size() const noexcept { return static_cast<size_t>(m_next - m_first); }
+
+        /*
+         * The sequence number of the oldest record in the ring.
+         */
+        auto first_seqnum() const noexcept { return m_first; }
+
+        /*
+         * The sequence number that the next committed record will have, a new reader starts from it.
+         */
+        auto next_seqnum() const noexcept { return m_next; }
+
+        /*
+         * The record is filled in place, call commit() to publish it.
+         * If the ring is full, the oldest record is dropped even if commit() will not be called.
+         * @return storage for the record with sequence number next_seqnum()
+         */
+        T& prepare() noexcept
+        {
+                if (size() == m_capacity) {
+                        ++m_first;
+                }
+
+                return m_storage[m_next % m_capacity];
+        }
+
+        /*
+         * @return sequence number of the published record
+         */
+        seqnum_t commit() noexcept { return m_next++; }
+
+        /*
+         * @return nullptr if the record was not published yet or was overwritten
+         */
+        const T* get(seqnum_t seqnum) const noexcept
+        {
+                return seqnum >= m_first && seqnum < m_next ? &m_storage[seqnum % m_capacity] : nullptr;
+        }
+
+        /*
+         * @return number of records that were overwritten before the reader read them
+         */
+        seqnum_t lost(seqnum_t cursor) const noexcept
+        {
+                return cursor < m_first ? m_first - cursor : 0;
+        }
+
+        /*
+         * @return number of records that the reader can read, overwritten records are not counted
+         */
+        seqnum_t available(seqnum_t cursor) const noexcept
+        {
+                if (cursor < m_first) {
+                        cursor = m_first;
+                }
+
+                return cursor < m_next ? m_next - cursor : 0;
+        }
+
+        /*
+         * Copy records starting from the cursor, the overwritten ones are skipped.
+         * @param cursor is advanced past the copied records
+         * @return number of copied records
+         */
+        size_t read(seqnum_t &cursor, T *dst, size_t max_cnt) const noexcept
+        {
+                if (cursor < m_first) {
+                        cursor = m_first;
+                }
+
+                size_t cnt = 0;
+
+                for ( ; cnt < max_cnt && cursor < m_next; ++cnt, ++cursor) {
+                        dst[cnt] = m_storage[cursor % m_capacity];
+                }
+
+                return cnt;
+        }
+
+private:
+        T *m_storage;
+        size_t m_capacity;
+
+        seqnum_t m_first; // the oldest record
+        seqnum_t m_next;
+};
+
+} // namespace usbip
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Pacing of isochronous IN URBs by a virtual frame clock.
+ *
+ * A server completes isochronous URBs in its own frames, the network adds jitter to their delivery,
+ * so class drivers see bursts of completions and late URBs. An endpoint with a jitter buffer schedules
+ * every URB "depth" frames ahead of the clock and its completion is held until the frame it ends in,
+ * a late URB is an underrun, a URB that came earlier than the buffer can hold is an overrun.
+ *
+ * URB_FUNCTION_GET_CURRENT_FRAME_NUMBER is served by the same clock, so StartFrame-s of paced URBs
+ * and the frame number that a class driver reads are consistent.
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::isoch
+{
+
+/*
+ * USB frames of one millisecond since the epoch, for all speeds.
+ */
+struct frame_clock
+{
+        long long epoch; // ticks of a monotonic counter
+        long long frequency; // ticks per second
+
+        constexpr unsigned long long frame(long long now) const
+        {
+                if (now <= epoch) {
+                        return 0;
+                }
+
+                auto d = static_cast<unsigned long long>(now - epoch); // d*1000 overflows in days
+                auto f = static_cast<unsigned long long>(frequency);
+
+                return d/f*1000 + d % f*1000/f;
+        }
+
+        // the first tick of the frame
+        constexpr long long ticks(unsigned long long frame) const
+        {
+                return epoch + static_cast<long long>((frame*frequency + 999)/1000);
+        }
+};
+
+/*
+ * @param bInterval of the endpoint descriptor, in frames for full speed, 2^(bInterval-1) (micro)frames for others
+ * @return number of frames that the packets of a URB take
+ */
+constexpr unsigned int urb_frames(unsigned int packets, unsigned char bInterval, bool high_speed)
+{
+        auto exp = bInterval ? bInterval - 1 : 0;
+        if (exp > 15) {
+                exp = 15;
+        }
+
+        auto interval = 1U << exp;
+
+        if (!high_speed) { // full speed isochronous endpoint has bInterval 1, one packet per frame
+                return packets*interval;
+        }
+
+        return (packets*interval + 7)/8; // microframes
+}
+
+static_assert(urb_frames(10, 1, false) == 10);
+static_assert(urb_frames(80, 1, true) == 10);
+static_assert(urb_frames(10, 4, true) == 10);
+static_assert(urb_frames(1, 1, true) == 1);
+
+enum : unsigned int
+{
+        depth_auto = ~0U, // the depth is adjusted to the observed jitter
+        depth_min = 1, // of depth_auto
+        depth_max = 64, // frames
+
+        auto_grow = 2, // frames to add on underrun
+        auto_window = 4096, // URBs without underruns to shrink the depth by one frame
+
+        endpoint_count = 16, // by endpoint number, only isochronous IN endpoints are paced
+};
+
+/*
+ * Counters of an endpoint, vhci::ioctl::get_jitter_buffer returns them.
+ */
+struct stats
+{
+        unsigned long long urbs; // paced
+        unsigned long long underruns; // URBs that were received after the frame they end in
+        unsigned long long overruns; // URBs that were received earlier than the depth allows to hold them
+        unsigned long long late_frames; // sum of lateness of underruns
+        unsigned int depth; // frames, current
+        unsigned int max_held; // frames, the longest a URB was held
+};
+static_assert(sizeof(stats) == 40);
+
+/*
+ * Frames of a scheduled URB.
+ */
+struct slot
+{
+        unsigned long long start; // StartFrame of the URB
+        unsigned long long end; // the frame after the last one
+        unsigned long long prev; // the schedule before the URB
+};
+
+class jitter_buffer
+{
+public:
+        /*
+         * @param depth frames, zero disables pacing, depth_auto
+         */
+        void configure(unsigned int depth)
+        {
+                m_auto = depth == depth_auto;
+                m_depth = m_auto ? depth_min + auto_grow : depth < depth_max ? depth : depth_max;
+
+                m_ontime = 0;
+                m_min_slack = ~0U;
+                m_stats.depth = depth ? m_depth : 0;
+        }
+
+        bool enabled() const { return m_stats.depth; }
+
+        /*
+         * Is called when a URB is submitted, its frames are reserved until commit or cancel.
+         * URBs that are submitted concurrently get successive frames.
+         * @param start StartFrame of the URB, nullptr if USBD_START_ISO_TRANSFER_ASAP
+         */
+        slot schedule(unsigned long long now, unsigned int frames, const unsigned long long *start)
+        {
+                auto earliest = now + m_depth;
+                auto s = start ? *start : m_next > earliest ? m_next : earliest;
+
+                slot r{ s, s + frames, m_next };
+                m_next = r.end;
+
+                return r;
+        }
+
+        /*
+         * The URB was sent.
+         */
+        void commit() { ++m_stats.urbs; }
+
+        /*
+         * The URB was not sent, its frames are returned if the schedule was not changed after it.
+         * Otherwise the frames of the later URBs are kept and the hole remains.
+         */
+        void cancel(const slot &s)
+        {
+                if (m_next == s.end) {
+                        m_next = s.prev;
+                }
+        }
+
+        /*
+         * Is called when a URB is received.
+         * @param end the frame after the last frame of the URB, StartFrame + urb_frames()
+         * @return frame to complete the URB at, now if it must be completed immediately
+         */
+        unsigned long long release(unsigned long long now, unsigned long long end)
+        {
+                if (now >= end) {
+                        if (now > end) {
+                                underrun(now - end);
+                        } else {
+                                ontime(0);
+                        }
+                        return now;
+                }
+
+                auto wait = end - now;
+
+                if (wait > 2ULL*m_depth + 1) { // the clock of the server is faster, the schedule lags behind
+                        ++m_stats.overruns;
+                        m_next -= wait - m_depth;
+                        wait = m_depth;
+                }
+
+                ontime(static_cast<unsigned int>(wait));
+                return now + wait;
+        }
+
+        auto& get_stats() const { return m_stats; }
+
+        void reset_stats()
+        {
+                auto depth = m_stats.depth;
+                m_stats = {};
+                m_stats.depth = depth;
+        }
+
+private:
+        unsigned long long m_next{}; // frame after the last scheduled URB
+        unsigned int m_depth{}; // frames, the lead of the schedule
+        bool m_auto{};
+
+        unsigned int m_ontime{}; // URBs since the last underrun
+        unsigned int m_min_slack = ~0U; // frames, of those URBs
+
+        stats m_stats{};
+
+        void underrun(unsigned long long lateness)
+        {
+                ++m_stats.underruns;
+                m_stats.late_frames += lateness;
+
+                m_next += lateness; // the following URBs would be late as well
+                m_ontime = 0;
+                m_min_slack = ~0U;
+
+                if (m_auto && m_depth < depth_max) {
+                        m_depth = m_depth + auto_grow < depth_max ? m_depth + auto_grow : depth_max;
+                        m_stats.depth = m_depth;
+                }
+        }
+
+        void ontime(unsigned int slack)
+        {
+                if (slack > m_stats.max_held) {
+                        m_stats.max_held = slack;
+                }
+
+                if (slack < m_min_slack) {
+                        m_min_slack = slack;
+                }
+
+                if (!m_auto || ++m_ontime < auto_window) {
+                        return;
+                }
+
+                if (m_min_slack > 1 && m_depth > depth_min) { // the depth was never used entirely
+                        m_stats.depth = --m_depth;
+                }
+
+                m_ontime = 0;
+                m_min_slack = ~0U;
+        }
+};
+
+} // namespace usbip::isoch
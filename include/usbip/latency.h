@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Per-URB latency breakdown.
+ *
+ * The driver timestamps a sampled request at every point of its path, the intervals between the points
+ * (stages) are folded into histograms of the endpoint when the request is completed by the receive thread.
+ * The histograms are read by vhci::ioctl::read_latency, "usbip latency" prints them.
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::latency
+{
+
+/*
+ * Timestamps of a request, zero if a point was not passed.
+ */
+enum point : unsigned char
+{
+        arrive, // the driver got the URB, @see device::internal_control
+        queued, // CMD_SUBMIT is pushed to device_ctx::pending_sends
+        sent, // WskSend is called
+        send_done, // WskSend is completed
+        received, // RET_SUBMIT header is received
+        complete, // the URB is about to be completed
+        point_count
+};
+
+enum stage : unsigned char
+{
+        prepare, // arrive -> queued, URB to CMD_SUBMIT
+        queue, // queued -> sent, waiting in device_ctx::pending_sends
+        send, // sent -> send_done
+        server, // send_done -> received, network and server round trip (from sent if send_done is later)
+        receive, // received -> complete, reading of the payload and completion
+        total, // arrive -> complete
+        stage_count
+};
+
+constexpr auto stage_mask(stage s) { return 1U << s; }
+constexpr auto all_stages = (1U << stage_count) - 1;
+
+constexpr const char* str(stage s)
+{
+        const char* v[] { "prepare", "queue", "send", "server", "receive", "total" };
+        return s < stage_count ? v[s] : "?";
+}
+
+/*
+ * Log-linear buckets of microseconds: values 0-3 have own buckets, every next power of two is split into four.
+ * The relative error is less than 25%, the last bucket also counts all values that exceed its range.
+ */
+enum { sub_bits = 2, sub_count = 1 << sub_bits, bucket_count = 96 };
+
+constexpr unsigned int msb(unsigned long long v) // v != 0
+{
+        unsigned int n = 0;
+        for ( ; v >>= 1; ++n);
+        return n;
+}
+
+constexpr unsigned int bucket(unsigned long long usec)
+{
+        if (usec < sub_count) {
+                return static_cast<unsigned int>(usec);
+        }
+
+        auto n = msb(usec);
+        auto i = (n - sub_bits + 1)*sub_count + static_cast<unsigned int>((usec >> (n - sub_bits)) & (sub_count - 1));
+
+        return i < bucket_count ? i : bucket_count - 1;
+}
+
+/*
+ * @return the smallest value of the bucket
+ */
+constexpr unsigned long long lower_bound(unsigned int i)
+{
+        if (i < sub_count) {
+                return i;
+        }
+
+        auto n = i/sub_count + sub_bits - 1;
+        return static_cast<unsigned long long>(sub_count + i % sub_count) << (n - sub_bits);
+}
+
+static_assert(bucket(3) == 3 && bucket(4) == 4 && bucket(7) == 7 && bucket(8) == 8 && bucket(15) == 11);
+static_assert(lower_bound(bucket(1000)) <= 1000 && 1000 < lower_bound(bucket(1000) + 1));
+static_assert(bucket(~0ULL) == bucket_count - 1);
+
+/*
+ * Has one writer, the receive thread of the device.
+ * A reader can see a histogram that is being updated, count and buckets can differ by a few samples.
+ */
+struct histogram
+{
+        unsigned long long count;
+        unsigned long long sum; // microseconds
+        unsigned int max; // microseconds
+        unsigned int reserved;
+        unsigned int buckets[bucket_count];
+};
+static_assert(sizeof(histogram) == 24 + 4*bucket_count);
+
+inline void add(histogram &h, unsigned long long usec)
+{
+        ++h.count;
+        h.sum += usec;
+
+        if (usec > h.max) {
+                h.max = usec < ~0U ? static_cast<unsigned int>(usec) : ~0U;
+        }
+
+        ++h.buckets[bucket(usec)];
+}
+
+inline void merge(histogram &dst, const histogram &src)
+{
+        dst.count += src.count;
+        dst.sum += src.sum;
+
+        if (src.max > dst.max) {
+                dst.max = src.max;
+        }
+
+        for (int i = 0; i < bucket_count; ++i) {
+                dst.buckets[i] += src.buckets[i];
+        }
+}
+
+/*
+ * @param q quantile, 0.5 for median
+ * @return upper bound of the bucket that contains the quantile, but not more than histogram::max
+ */
+inline unsigned long long percentile(const histogram &h, double q)
+{
+        unsigned long long total = 0;
+        for (auto n: h.buckets) {
+                total += n;
+        }
+
+        if (!total) {
+                return 0;
+        }
+
+        auto rank = static_cast<unsigned long long>(q*total);
+        if (rank >= total) {
+                rank = total - 1;
+        }
+
+        unsigned long long seen = 0;
+
+        for (unsigned int i = 0; i < bucket_count; ++i) {
+                if (seen += h.buckets[i]; seen > rank) {
+                        auto hi = i + 1 < bucket_count ? lower_bound(i + 1) - 1 : h.max;
+                        return hi < h.max ? hi : h.max;
+                }
+        }
+
+        return h.max;
+}
+
+/*
+ * Endpoint address with USB_DIR_IN bit, 0x00-0x0F, 0x80-0x8F.
+ */
+enum : unsigned char { dir_in = 0x80, endpoint_count = 32 };
+
+constexpr unsigned int endpoint_index(unsigned char addr) { return (addr & 0x0F) | (addr & dir_in ? 0x10 : 0); }
+constexpr unsigned char endpoint_address(unsigned int idx) { return static_cast<unsigned char>((idx & 0x0F) | (idx & 0x10 ? dir_in : 0)); }
+
+static_assert(endpoint_address(endpoint_index(0x81)) == 0x81);
+
+/*
+ * vhci::ioctl::read_latency returns a sequence of them, for endpoints that have samples.
+ */
+struct endpoint_stats
+{
+        unsigned char address; // @see endpoint_address
+        unsigned char reserved[7];
+        histogram stages[stage_count];
+};
+static_assert(!(sizeof(endpoint_stats) % 8));
+
+/*
+ * Folds the stages of a completed request.
+ *
+ * @param t timestamps of the request, t[arrive] must not be zero
+ * @param stages bit mask of stage_mask-s to fold
+ * @param to_usec converts the difference of two timestamps to microseconds
+ */
+template<typename ToUsec>
+void fold(histogram (&h)[stage_count], const long long (&t)[point_count], unsigned int stages, ToUsec &&to_usec)
+{
+        auto sample = [&h, &t, stages, &to_usec] (stage s, point from, point to)
+        {
+                if ((stages & stage_mask(s)) && t[from] && t[to] >= t[from]) {
+                        add(h[s], to_usec(t[to] - t[from]));
+                }
+        };
+
+        // WskSend can be completed after the response is received
+        auto send_ok = t[send_done] && t[send_done] <= t[received];
+
+        sample(prepare, arrive, queued);
+        sample(queue, queued, sent);
+
+        if (send_ok) {
+                sample(send, sent, send_done);
+        }
+
+        sample(server, send_ok ? send_done : sent, received);
+        sample(receive, received, complete);
+        sample(total, arrive, complete);
+}
+
+} // namespace usbip::latency
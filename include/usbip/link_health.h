@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Detection of a dead server that is faster than TCP keepalive.
+ *
+ * Round trips of URBs that a server must answer promptly (control, isochronous, OUT transfers)
+ * feed rtt_estimator. The connection is stalled if such URBs are outstanding and nothing was
+ * received for a period that is long relative to the retransmission timeout (RFC 6298).
+ * A stalled connection is degraded only if the server does not answer a ping, see probe.
+ *
+ * It is used by the driver, so it does not lock, allocate memory or read a clock.
+ * Time is in any units, the driver uses microseconds. The objects must be zero-initialized.
+ */
+namespace usbip::link
+{
+
+using time_t = unsigned long long;
+
+/*
+ * There is one writer, readers can get inconsistent values only if time_t is not written atomically.
+ */
+class rtt_estimator
+{
+public:
+        void sample(time_t rtt) noexcept
+        {
+                if (!rtt) {
+                        rtt = 1;
+                }
+
+                if (!m_samples++) {
+                        m_srtt = rtt;
+                        m_rttvar = rtt/2;
+                        return;
+                }
+
+                auto delta = rtt > m_srtt ? rtt - m_srtt : m_srtt - rtt;
+
+                m_rttvar = (3*m_rttvar + delta)/4;
+                m_srtt = (7*m_srtt + rtt)/8;
+
+                if (!m_srtt) {
+                        m_srtt = 1;
+                }
+        }
+
+        auto srtt() const noexcept { return m_srtt; }
+        auto rttvar() const noexcept { return m_rttvar; }
+        auto samples() const noexcept { return m_samples; }
+
+        /*
+         * @return min_rto if there are no samples
+         */
+        time_t rto(time_t min_rto, time_t max_rto) const noexcept
+        {
+                if (!m_samples) {
+                        return min_rto;
+                }
+
+                auto rto = m_srtt + 4*m_rttvar;
+                return rto < min_rto ? min_rto : rto > max_rto ? max_rto : rto;
+        }
+
+private:
+        time_t m_srtt; // smoothed
+        time_t m_rttvar; // variation
+        unsigned long long m_samples;
+};
+
+enum class health { healthy, degraded, dead };
+
+struct stall_policy
+{
+        time_t min_rto;
+        time_t max_rto;
+
+        unsigned int degraded_rto; // stall of this number of RTO-s
+        time_t degraded_min; // but not shorter
+
+        unsigned int dead_rto;
+        time_t dead_min; // zero disables dead state
+};
+
+/*
+ * @return cnt RTO-s, but not less than min_val
+ */
+inline time_t threshold(const rtt_estimator &rtt, const stall_policy &p, unsigned int cnt, time_t min_val) noexcept
+{
+        auto val = cnt*rtt.rto(p.min_rto, p.max_rto);
+        return val > min_val ? val : min_val;
+}
+
+/*
+ * @param stall time since the last received message while prompt URBs are outstanding, zero otherwise
+ */
+inline health classify(time_t stall, const rtt_estimator &rtt, const stall_policy &p) noexcept
+{
+        if (!stall) {
+                return health::healthy;
+        }
+
+        if (p.dead_min && stall >= threshold(rtt, p, p.dead_rto, p.dead_min)) {
+                return health::dead;
+        }
+
+        return stall >= threshold(rtt, p, p.degraded_rto, p.degraded_min) ? health::degraded : health::healthy;
+}
+
+/*
+ * A stall alone does not mean that the server does not respond, a device can hold a transfer for long,
+ * e.g. a printer that is out of paper holds bulk OUT. If the stall is long, the server is pinged,
+ * it must answer at once. Any received message ends the stall, so the link is degraded only if the ping
+ * is not answered within the same threshold. The object must be zero-initialized.
+ */
+class probe
+{
+public:
+        /*
+         * @param now current time
+         * @param stall see classify
+         * @return health to report, ping() tells whether the server must be pinged
+         */
+        health update(time_t now, time_t stall, const rtt_estimator &rtt, const stall_policy &p) noexcept
+        {
+                m_send = false;
+                auto h = classify(stall, rtt, p);
+
+                if (h == health::healthy) {
+                        m_ping = 0;
+                } else if (!m_ping) {
+                        m_ping = now ? now : 1;
+                        m_send = true;
+                        h = health::healthy;
+                } else if (now - m_ping < threshold(rtt, p, p.degraded_rto, p.degraded_min)) {
+                        h = health::healthy; // waiting for the answer
+                }
+
+                return h;
+        }
+
+        bool ping() const noexcept { return m_send; }
+
+private:
+        time_t m_ping; // when the server was pinged, zero if it was not
+        bool m_send;
+};
+
+} // namespace usbip::link
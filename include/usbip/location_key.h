@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * 64-bit key of a device location (host, service, busid) for comparison without string operations.
+ *
+ * The key is FNV-1a over the canonical UTF-8 form of the location, fields are separated by 0xFF
+ * that never occurs in UTF-8:
+ * host    - lowercased, enclosing brackets of IPv6 address and trailing dot are removed
+ * service - leading zeros of a port number are removed, a service name is lowercased
+ * busid   - as is
+ *
+ * Only ASCII letters are lowercased, strings are UTF-8 (char) or UTF-16 (wchar_t on Windows, char16_t).
+ * It is used by the driver, so it does not allocate memory.
+ */
+namespace usbip::location
+{
+
+using key_t = unsigned long long; // zero is never returned
+
+class hasher
+{
+public:
+        template<typename CharT>
+        hasher& host(const CharT *s, size_t len) noexcept
+        {
+                if (len >= 2 && s[0] == '[' && s[len - 1] == ']') {
+                        ++s;
+                        len -= 2;
+                }
+
+                if (len && s[len - 1] == '.') {
+                        --len;
+                }
+
+                put(s, len, true);
+                return separator();
+        }
+
+        template<typename CharT>
+        hasher& service(const CharT *s, size_t len) noexcept
+        {
+                if (is_number(s, len)) {
+                        for ( ; len > 1 && *s == '0'; ++s, --len);
+                }
+
+                put(s, len, true);
+                return separator();
+        }
+
+        template<typename CharT>
+        hasher& busid(const CharT *s, size_t len) noexcept
+        {
+                put(s, len, false);
+                return separator();
+        }
+
+        key_t key() const noexcept { return m_hash ? m_hash : 1; }
+
+private:
+        key_t m_hash = 0xCBF2'9CE4'8422'2325ULL; // FNV offset basis
+
+        void put_byte(unsigned char c) noexcept
+        {
+                m_hash ^= c;
+                m_hash *= 0x100'0000'01B3ULL; // FNV prime
+        }
+
+        hasher& separator() noexcept
+        {
+                put_byte(0xFF);
+                return *this;
+        }
+
+        template<typename CharT>
+        static bool is_number(const CharT *s, size_t len) noexcept
+        {
+                for (size_t i = 0; i < len; ++i) {
+                        if (!(s[i] >= '0' && s[i] <= '9')) {
+                                return false;
+                        }
+                }
+                return len != 0;
+        }
+
+        template<typename CharT>
+        void put(const CharT *s, size_t len, bool lower) noexcept
+        {
+                for (size_t i = 0; i < len; ) {
+                        unsigned long cp = static_cast<unsigned long>(s[i++]);
+
+                        if constexpr (sizeof(CharT) == 1) {
+                                cp &= 0xFF;
+                        } else if constexpr (sizeof(CharT) == 2) {
+                                cp &= 0xFFFF;
+                                if (cp >= 0xD800 && cp < 0xDC00 && i < len) { // high surrogate
+                                        if (unsigned long lo = s[i] & 0xFFFF; lo >= 0xDC00 && lo < 0xE000) {
+                                                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                                                ++i;
+                                        }
+                                }
+                        }
+
+                        if (lower && cp >= 'A' && cp <= 'Z') {
+                                cp += 'a' - 'A';
+                        }
+
+                        if constexpr (sizeof(CharT) == 1) {
+                                put_byte(static_cast<unsigned char>(cp));
+                        } else {
+                                put_utf8(cp);
+                        }
+                }
+        }
+
+        void put_utf8(unsigned long cp) noexcept
+        {
+                if (cp < 0x80) {
+                        put_byte(static_cast<unsigned char>(cp));
+                } else if (cp < 0x800) {
+                        put_byte(static_cast<unsigned char>(0xC0 | (cp >> 6)));
+                        put_byte(static_cast<unsigned char>(0x80 | (cp & 0x3F)));
+                } else if (cp < 0x10000) {
+                        put_byte(static_cast<unsigned char>(0xE0 | (cp >> 12)));
+                        put_byte(static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F)));
+                        put_byte(static_cast<unsigned char>(0x80 | (cp & 0x3F)));
+                } else {
+                        put_byte(static_cast<unsigned char>(0xF0 | (cp >> 18)));
+                        put_byte(static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F)));
+                        put_byte(static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F)));
+                        put_byte(static_cast<unsigned char>(0x80 | (cp & 0x3F)));
+                }
+        }
+};
+
+/*
+ * @param len lengths are in characters
+ */
+template<typename CharT>
+inline key_t make_key(
+        const CharT *host, size_t host_len,
+        const CharT *service, size_t service_len,
+        const CharT *busid, size_t busid_len) noexcept
+{
+        return hasher().host(host, host_len).service(service, service_len).busid(busid, busid_len).key();
+}
+
+/*
+ * The key of a server, devices of the same server have equal keys.
+ */
+template<typename CharT>
+inline key_t make_server_key(const CharT *host, size_t host_len, const CharT *service, size_t service_len) noexcept
+{
+        return hasher().host(host, host_len).service(service, service_len).key();
+}
+
+} // namespace usbip::location
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * LZ4 block format, https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * The compressor is greedy with a single hash table, its output is decoded by LZ4_decompress_safe,
+ * the decoder accepts any valid block. Neither allocates memory, the hash table is provided by the caller,
+ * so it is used by the driver as is.
+ */
+namespace usbip::lz4
+{
+
+enum : unsigned int
+{
+        min_match = 4,
+        last_literals = 5, // the last bytes of a block are always literals
+        mf_limit = 12, // the last match starts at least this far from the end of a block
+        max_distance = 0xFFFF,
+
+        hash_log = 12,
+        hash_size = 1U << hash_log, // entries of the table of compress()
+};
+
+/*
+ * @return the size of the output buffer of compress() that is enough for incompressible data
+ */
+constexpr size_t bound(size_t len) noexcept
+{
+        return len + len/255 + 16;
+}
+
+namespace detail
+{
+
+inline unsigned int read32(const unsigned char *p) noexcept
+{
+        unsigned int v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+constexpr unsigned int hash(unsigned int seq) noexcept
+{
+        return (seq*2654435761U) >> (32 - hash_log);
+}
+
+/*
+ * @return false if there is no room
+ */
+inline bool put_length(unsigned char* &op, const unsigned char *oend, size_t len) noexcept
+{
+        for ( ; len >= 255; len -= 255) {
+                if (op == oend) {
+                        return false;
+                }
+                *op++ = 255;
+        }
+
+        if (op == oend) {
+                return false;
+        }
+
+        *op++ = static_cast<unsigned char>(len);
+        return true;
+}
+
+inline bool get_length(const unsigned char* &ip, const unsigned char *iend, size_t &len) noexcept
+{
+        for (unsigned int b = 255; b == 255; len += b) {
+                if (ip == iend) {
+                        return false;
+                }
+                b = *ip++;
+        }
+
+        return true;
+}
+
+/*
+ * @param match zero for the last sequence that has literals only
+ */
+inline bool put_sequence(
+        unsigned char* &op, const unsigned char *oend,
+        const unsigned char *literals, size_t literals_len, size_t offset, size_t match) noexcept
+{
+        if (op == oend) {
+                return false;
+        }
+
+        auto &token = *op++;
+        token = static_cast<unsigned char>((literals_len < 15 ? literals_len : 15) << 4);
+
+        if (literals_len >= 15 && !put_length(op, oend, literals_len - 15)) {
+                return false;
+        }
+
+        if (literals_len > static_cast<size_t>(oend - op)) {
+                return false;
+        }
+
+        if (literals_len) { // literals can be nullptr
+                memcpy(op, literals, literals_len);
+                op += literals_len;
+        }
+
+        if (!match) {
+                return true;
+        }
+
+        if (oend - op < 2) {
+                return false;
+        }
+
+        *op++ = static_cast<unsigned char>(offset);
+        *op++ = static_cast<unsigned char>(offset >> 8);
+
+        auto m = match - min_match;
+        token |= static_cast<unsigned char>(m < 15 ? m : 15);
+
+        return m < 15 || put_length(op, oend, m - 15);
+}
+
+} // namespace detail
+
+/*
+ * @param table hash_size entries, is overwritten
+ * @return compressed size, zero if it does not fit into cap bytes
+ */
+inline size_t compress(
+        const unsigned char *src, size_t len, unsigned char *dst, size_t cap, unsigned int *table) noexcept
+{
+        using namespace detail;
+
+        auto op = dst;
+        auto oend = dst + cap;
+
+        auto anchor = src;
+        auto end = src + len;
+
+        if (len > mf_limit) {
+                for (unsigned int i = 0; i < hash_size; ++i) {
+                        table[i] = 0;
+                }
+
+                auto match_end = end - last_literals;
+
+                for (auto ip = src; ip < end - mf_limit; ) {
+
+                        auto seq = read32(ip);
+                        auto &slot = table[hash(seq)];
+
+                        auto ref = src + slot;
+                        slot = static_cast<unsigned int>(ip - src);
+
+                        if (ref >= ip || ip - ref > max_distance || read32(ref) != seq) {
+                                ++ip;
+                                continue;
+                        }
+
+                        for ( ; ip > anchor && ref > src && ip[-1] == ref[-1]; --ip, --ref);
+
+                        size_t match = min_match;
+                        for ( ; ip + match < match_end && ip[match] == ref[match]; ++match);
+
+                        if (!put_sequence(op, oend, anchor, ip - anchor, ip - ref, match)) {
+                                return 0;
+                        }
+
+                        ip += match;
+                        anchor = ip;
+                }
+        }
+
+        return put_sequence(op, oend, anchor, end - anchor, 0, 0) ? op - dst : 0;
+}
+
+/*
+ * @param len the size of decompressed data, it is known from the USB/IP header
+ * @return false if the block is malformed or its decompressed size is not len
+ */
+inline bool decompress(const unsigned char *src, size_t src_len, unsigned char *dst, size_t len) noexcept
+{
+        using namespace detail;
+
+        auto ip = src;
+        auto iend = src + src_len;
+
+        auto op = dst;
+        auto oend = dst + len;
+
+        while (ip != iend) {
+
+                unsigned int token = *ip++;
+
+                size_t literals = token >> 4;
+                if (literals == 15 && !get_length(ip, iend, literals)) {
+                        return false;
+                }
+
+                if (literals > static_cast<size_t>(iend - ip) || literals > static_cast<size_t>(oend - op)) {
+                        return false;
+                }
+
+                if (literals) {
+                        memcpy(op, ip, literals);
+                        op += literals;
+                        ip += literals;
+                }
+
+                if (ip == iend) { // the last sequence
+                        break;
+                }
+
+                if (iend - ip < 2) {
+                        return false;
+                }
+
+                size_t offset = ip[0] | ip[1] << 8;
+                ip += 2;
+
+                if (!offset || offset > static_cast<size_t>(op - dst)) {
+                        return false;
+                }
+
+                size_t match = token & 15;
+                if (match == 15 && !get_length(ip, iend, match)) {
+                        return false;
+                }
+
+                match += min_match;
+                if (match > static_cast<size_t>(oend - op)) {
+                        return false;
+                }
+
+                for (auto ref = op - offset, mend = op + match; op != mend; *op++ = *ref++); // can overlap
+        }
+
+        return op == oend;
+}
+
+} // namespace usbip::lz4
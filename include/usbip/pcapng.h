@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "capture.h"
+
+/*
+ * Conversion of capture::record-s to pcapng.
+ *
+ * USB/IP has no link-layer type, Wireshark dissects it in TCP streams of port 3240.
+ * Every PDU is wrapped into synthetic IPv4 and TCP headers (LINKTYPE_IPV4) of a stream per device,
+ * sequence numbers advance by the length of PDUs on the wire. If a PDU was truncated,
+ * the packet is truncated too and its original length is reported.
+ *
+ * Blocks are little-endian, pcapng readers detect that by the byte-order magic.
+ * It does not allocate memory, the caller provides buffers.
+ */
+namespace usbip::pcapng
+{
+
+enum : unsigned int { LINKTYPE_IPV4 = 228 };
+enum : unsigned short { USBIP_PORT = 3240 };
+
+constexpr size_t ip_tcp_hdr_len = 40;
+
+constexpr size_t pad4(size_t len) noexcept { return (len + 3) & ~size_t(3); }
+
+namespace detail
+{
+
+class writer
+{
+public:
+        writer(void *buf, size_t len) noexcept : m_buf(static_cast<unsigned char*>(buf)), m_len(len) {}
+
+        auto size() const noexcept { return m_pos; }
+        auto overflow() const noexcept { return m_pos > m_len; }
+
+        void u8(unsigned int v) noexcept
+        {
+                if (m_pos < m_len) {
+                        m_buf[m_pos] = static_cast<unsigned char>(v);
+                }
+                ++m_pos;
+        }
+
+        void u16(unsigned int v) noexcept { u8(v); u8(v >> 8); }
+        void u32(unsigned int v) noexcept { u16(v); u16(v >> 16); }
+        void u64(unsigned long long v) noexcept { u32(static_cast<unsigned int>(v)); u32(static_cast<unsigned int>(v >> 32)); }
+
+        void u16_be(unsigned int v) noexcept { u8(v >> 8); u8(v); }
+        void u32_be(unsigned int v) noexcept { u16_be(v >> 16); u16_be(v); }
+
+        void bytes(const void *p, size_t len) noexcept
+        {
+                auto s = static_cast<const unsigned char*>(p);
+                for (size_t i = 0; i < len; ++i) {
+                        u8(s[i]);
+                }
+        }
+
+        void align4() noexcept
+        {
+                while (m_pos & 3) {
+                        u8(0);
+                }
+        }
+
+private:
+        unsigned char *m_buf;
+        size_t m_len;
+        size_t m_pos{};
+};
+
+} // namespace detail
+
+/*
+ * TCP stream of a device.
+ */
+struct stream
+{
+        unsigned int client_addr; // IPv4 in host byte order
+        unsigned int server_addr;
+        unsigned short client_port;
+        unsigned short server_port;
+        unsigned int seq[2]; // next sequence number by capture::direction
+};
+
+/*
+ * @param port of the hub, streams of devices differ by client's address and port
+ */
+constexpr stream make_stream(int port) noexcept
+{
+        return stream {
+                .client_addr = 0x7F000001, // 127.0.0.1
+                .server_addr = 0x7F000002,
+                .client_port = static_cast<unsigned short>(49152 + (port & 0x3FFF)),
+                .server_port = USBIP_PORT,
+                .seq{ 1, 1 },
+        };
+}
+
+/*
+ * Section Header Block and Interface Description Block with timestamps in 100-nanosecond units.
+ * @return length of the blocks, greater than len if the buffer is too small
+ */
+inline size_t file_header(void *buf, size_t len, unsigned int snaplen) noexcept
+{
+        detail::writer w(buf, len);
+
+        w.u32(0x0A0D0D0A); // SHB
+        w.u32(28);
+        w.u32(0x1A2B3C4D); // byte-order magic
+        w.u16(1); // major version
+        w.u16(0);
+        w.u64(~0ULL); // section length is not specified
+        w.u32(28);
+
+        w.u32(1); // IDB
+        w.u32(32);
+        w.u16(LINKTYPE_IPV4);
+        w.u16(0);
+        w.u32(snaplen ? snaplen + ip_tcp_hdr_len : 0);
+        w.u16(9); // if_tsresol
+        w.u16(1);
+        w.u8(7); // 10^-7 s
+        w.align4();
+        w.u32(0); // opt_endofopt
+        w.u32(32);
+
+        return w.size();
+}
+
+/*
+ * Enhanced Packet Block of the record.
+ * @param s is advanced
+ * @return length of the block, greater than len if the buffer is too small, s is not changed then
+ */
+inline size_t packet(void *buf, size_t len, stream &s, const capture::record &r) noexcept
+{
+        constexpr unsigned long long epoch_diff = 116'444'736'000'000'000ULL; // 1601 to 1970 in 100ns
+
+        auto ts = r.time > epoch_diff ? r.time - epoch_diff : 0;
+
+        auto caplen = ip_tcp_hdr_len + r.data_len;
+        auto origlen = ip_tcp_hdr_len + r.pdu_len;
+        auto total = static_cast<unsigned int>(32 + pad4(caplen));
+
+        detail::writer w(buf, len);
+
+        w.u32(6); // EPB
+        w.u32(total);
+        w.u32(0); // interface id
+        w.u32(static_cast<unsigned int>(ts >> 32));
+        w.u32(static_cast<unsigned int>(ts));
+        w.u32(static_cast<unsigned int>(caplen));
+        w.u32(static_cast<unsigned int>(origlen));
+
+        auto out = r.dir == capture::out;
+
+        w.u8(0x45); // IPv4, IHL 5
+        w.u8(0);
+        w.u16_be(origlen <= 0xFFFF ? static_cast<unsigned int>(origlen) : 0); // zero as for TCP segmentation offload
+        w.u16_be(0); // identification
+        w.u16_be(0x4000); // don't fragment
+        w.u8(64); // TTL
+        w.u8(6); // TCP
+        w.u16_be(0); // checksum is not calculated
+        w.u32_be(out ? s.client_addr : s.server_addr);
+        w.u32_be(out ? s.server_addr : s.client_addr);
+
+        w.u16_be(out ? s.client_port : s.server_port);
+        w.u16_be(out ? s.server_port : s.client_port);
+        w.u32_be(s.seq[r.dir]);
+        w.u32_be(s.seq[!r.dir]); // ack
+        w.u8(5 << 4); // data offset
+        w.u8(0x18); // PSH, ACK
+        w.u16_be(0xFFFF); // window
+        w.u16_be(0); // checksum
+        w.u16_be(0); // urgent pointer
+
+        w.bytes(capture::data(r), r.data_len);
+        w.align4();
+        w.u32(total);
+
+        if (!w.overflow()) {
+                s.seq[r.dir] += r.pdu_len;
+        }
+
+        return w.size();
+}
+
+} // namespace usbip::pcapng
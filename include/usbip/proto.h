@@ -32,6 +32,13 @@ constexpr auto is_valid_number_of_packets(int number_of_packets)
 	return number_of_packets >= 0 && number_of_packets <= max_iso_packets;
 }
 
+/*
+ * Seqnum of a request keeps its direction in the least significant bit, zero is never assigned.
+ */
+constexpr auto extract_num(seqnum_t seqnum) { return seqnum >> 1; }
+constexpr auto extract_dir(seqnum_t seqnum) { return direction(seqnum & 1); }
+constexpr bool is_valid_seqnum(seqnum_t seqnum) { return extract_num(seqnum); }
+
 #include <PSHPACK1.H>
 
 struct header_basic 
@@ -66,6 +73,7 @@ struct header_ret_submit
 	INT32 start_frame;
 	INT32 number_of_packets;
 	INT32 error_count;
+	UINT32 ext_flags; // zero for plain USB/IP, @see compress.h
 };
 
 /*
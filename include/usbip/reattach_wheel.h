@@ -0,0 +1,735 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Scheduler of attach attempts of persistent devices.
+ *
+ * All schedules are kept in one hierarchical timer wheel, a tick is a unit of the caller (a second in the driver).
+ * A delay after a failed attempt uses decorrelated jitter: next = min(max_delay, random(first_delay, 3*prev)),
+ * so devices that failed together do not retry in lockstep.
+ *
+ * Devices of the same server (host and service) form a group. While the server is not known to be reachable,
+ * only one device of the group (a probe) is attempted, others that became due are parked.
+ * When the probe reaches the server, the parked devices are attempted at once, otherwise each of them
+ * is charged with a failed attempt and rescheduled.
+ *
+ * Ready entries are attempted in FIFO order, no more than config::max_inflight at once.
+ * Entries are looked up by location key, at most one entry per key.
+ *
+ * It is used by the driver, so it does not lock or allocate memory, the caller must serialize calls.
+ * The object must be zero-initialized, it is trivially constructible to be placed into a context space.
+ */
+namespace usbip::reattach
+{
+
+/*
+ * Intrusive list node, zeroed node is not linked.
+ */
+struct link
+{
+        link *next;
+        link **pprev;
+};
+
+struct list
+{
+        link *first;
+};
+
+/*
+ * FIFO list, zeroed queue is empty.
+ */
+struct queue
+{
+        link *first;
+        link **last; // next of the last node
+};
+
+inline void push(list &l, link &n) noexcept
+{
+        if ((n.next = l.first)) {
+                n.next->pprev = &n.next;
+        }
+
+        l.first = &n;
+        n.pprev = &l.first;
+}
+
+inline void unlink(link &n) noexcept
+{
+        if (n.pprev) {
+                if ((*n.pprev = n.next)) {
+                        n.next->pprev = n.pprev;
+                }
+                n = link{};
+        }
+}
+
+inline link* pop(list &l) noexcept
+{
+        auto n = l.first;
+        if (n) {
+                unlink(*n);
+        }
+        return n;
+}
+
+inline void push_back(queue &q, link &n) noexcept
+{
+        if (!q.last) {
+                q.last = &q.first;
+        }
+
+        n.next = nullptr;
+        n.pprev = q.last;
+
+        *q.last = &n;
+        q.last = &n.next;
+}
+
+inline void unlink(queue &q, link &n) noexcept
+{
+        if (q.last == &n.next) {
+                q.last = n.pprev;
+        }
+        unlink(n);
+}
+
+inline link* pop(queue &q) noexcept
+{
+        auto n = q.first;
+        if (n) {
+                unlink(q, *n);
+        }
+        return n;
+}
+
+enum class state : unsigned char
+{
+        idle, // was not added or was removed
+        scheduled, // in the wheel
+        parked, // waits for the probe of its group
+        ready, // must be attempted, see pop_ready()
+        inflight, // is being attempted, see complete()
+        canceled, // was canceled while in flight
+        finished // must be destroyed, see pop_finished()
+};
+
+struct group;
+
+/*
+ * Attach attempts of a device, it must be zeroed before add().
+ */
+struct entry
+{
+        link node; // wheel slot, parked list of the group, ready or finished list
+        link hash; // bucket by location key
+        link member; // of the group
+        group *grp; // not null while the entry belongs to the scheduler
+
+        unsigned long long expires; // tick
+        unsigned long long location_key;
+
+        unsigned int delay; // previous delay, for decorrelated jitter
+        unsigned int retries;
+
+        state st;
+        bool sending; // returned by pop_ready(), the attempt was not started yet, see started()
+};
+
+/*
+ * Devices of the same server.
+ */
+struct group
+{
+        link hash; // bucket by server key or the list of free groups
+        list members;
+        queue parked;
+        entry *probe; // the attempt that tells whether the server is reachable
+
+        unsigned long long server_key;
+        unsigned int refcnt; // entries of this server
+        bool up; // the last attempt has reached the server
+};
+
+enum class outcome
+{
+        success,
+        failed, // the server was reached, the attempt can be repeated
+        unreachable, // the server was not reached, the attempt can be repeated
+        aborted // must not be repeated
+};
+
+enum class add_result { added, duplicate, full };
+
+struct config
+{
+        unsigned int first_delay; // ticks
+        unsigned int max_delay;
+        unsigned int max_retries;
+        unsigned int max_inflight; // unlimited if zero
+};
+
+class scheduler
+{
+public:
+        using tick_t = unsigned long long;
+
+        enum { SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS, LEVELS = 4 };
+
+        /*
+         * @return bytes of the storage for init()
+         */
+        static size_t storage_size(size_t capacity) noexcept
+        {
+                return 2*buckets(capacity)*sizeof(list) + capacity*sizeof(group);
+        }
+
+        /*
+         * @param storage zeroed memory of storage_size(capacity) bytes, the scheduler does not own it
+         * @param capacity max number of entries
+         * @param now current tick
+         * @param seed of random delays
+         */
+        void init(void *storage, size_t capacity, const config &cfg, tick_t now, unsigned long long seed) noexcept
+        {
+                auto nb = buckets(capacity);
+
+                m_storage = storage;
+                m_entries = static_cast<list*>(storage);
+                m_groups = m_entries + nb;
+                m_mask = nb - 1;
+                m_capacity = capacity;
+
+                m_cfg = cfg;
+                if (!m_cfg.first_delay) {
+                        m_cfg.first_delay = 1;
+                }
+                if (m_cfg.max_delay < m_cfg.first_delay) {
+                        m_cfg.max_delay = m_cfg.first_delay;
+                }
+
+                m_now = now;
+                m_rand = seed ? seed : 0x9E37'79B9'7F4A'7C15ULL;
+
+                for (auto g = reinterpret_cast<group*>(m_groups + nb), end = g + capacity; g != end; ++g) {
+                        push(m_free, g->hash);
+                }
+        }
+
+        explicit operator bool() const noexcept { return m_storage; }
+
+        auto storage() const noexcept { return m_storage; }
+        auto capacity() const noexcept { return m_capacity; }
+        auto size() const noexcept { return m_count; }
+        auto inflight() const noexcept { return m_inflight; }
+        auto now() const noexcept { return m_now; }
+
+        /*
+         * @param e is owned by the scheduler if added, it will be returned by pop_finished()
+         * @param delay of the first attempt, it is charged as a retry, zero means attempt now
+         */
+        add_result add(entry &e, unsigned long long location_key, unsigned long long server_key,
+                       unsigned int delay, tick_t now) noexcept
+        {
+                if (find(location_key)) {
+                        return add_result::duplicate;
+                } else if (m_count == m_capacity) {
+                        return add_result::full;
+                }
+
+                auto &g = get_group(server_key);
+                ++g.refcnt;
+                ++m_count;
+
+                e = entry{};
+                e.grp = &g;
+                e.location_key = location_key;
+                e.delay = m_cfg.first_delay;
+
+                push(m_entries[bucket(location_key)], e.hash);
+                push(g.members, e.member);
+
+                advance(now);
+
+                if (delay) {
+                        ++e.retries;
+                        schedule(e, m_now + delay);
+                } else {
+                        expire(e);
+                }
+
+                return add_result::added;
+        }
+
+        entry* find(unsigned long long location_key) const noexcept
+        {
+                for (auto n = m_entries[bucket(location_key)].first; n; n = n->next) {
+                        if (auto e = from_hash(n); e->location_key == location_key) {
+                                return e;
+                        }
+                }
+
+                return nullptr;
+        }
+
+        /*
+         * An entry in flight is marked as canceled, complete() will finish it.
+         * Others are moved to the finished list at once.
+         * If the canceled entry is still sending, the caller of pop_ready() must cancel the attempt, see started().
+         *
+         * @param location_key cancel any entry if zero
+         * @return canceled entry, do not access it after pop_finished() or if it is not state::canceled
+         */
+        entry* cancel(unsigned long long location_key) noexcept
+        {
+                auto e = location_key ? find(location_key) : any();
+                if (!e) {
+                        return e;
+                }
+
+                unlink(e->hash); // a new entry can be added for this location
+
+                if (e->st == state::inflight) {
+                        e->st = state::canceled;
+                } else {
+                        finish(*e);
+                }
+
+                return e;
+        }
+
+        /*
+         * Must be called for an entry returned by pop_ready().
+         * The entry is rescheduled or finished.
+         */
+        void complete(entry &e, outcome result, tick_t now) noexcept
+        {
+                --m_inflight;
+                e.sending = false;
+                advance(now);
+                auto &g = *e.grp;
+
+                if (g.probe == &e) {
+                        g.probe = nullptr;
+                        on_probe(g, result);
+                } else if (result == outcome::unreachable) {
+                        g.up = false;
+                } else if (result != outcome::aborted) {
+                        g.up = true;
+                }
+
+                if (e.st == state::canceled || result == outcome::success || result == outcome::aborted) {
+                        finish(e);
+                } else {
+                        retry(e);
+                }
+        }
+
+        /*
+         * The server is known to be reachable, e.g. other attach to it has succeeded.
+         * Scheduled and parked entries of the server are attempted at once, other servers are not visited.
+         * @return number of woken entries
+         */
+        size_t wake(unsigned long long server_key, tick_t now) noexcept
+        {
+                advance(now);
+
+                auto g = find_group(server_key);
+                if (!g) {
+                        return 0;
+                }
+
+                g->up = true;
+                size_t cnt = 0;
+
+                for ( ; auto e = from_node(pop(g->parked)); ++cnt) {
+                        make_ready(*e);
+                }
+
+                for (auto n = g->members.first; n; n = n->next) {
+                        if (auto e = from_member(n); e->st == state::scheduled) {
+                                unlink_node(*e);
+                                make_ready(*e);
+                                ++cnt;
+                        }
+                }
+
+                return cnt;
+        }
+
+        /*
+         * Detach the entry in any state, e.g. if it is being destroyed.
+         * An entry in flight (or still sending) is not counted by max_inflight anymore,
+         * complete() must not be called for it.
+         */
+        void remove(entry &e) noexcept
+        {
+                if (e.st == state::inflight || e.st == state::canceled) {
+                        --m_inflight;
+                        e.sending = false;
+                }
+
+                detach(e);
+                e.st = state::idle;
+        }
+
+        /*
+         * Run expired timers.
+         */
+        void advance(tick_t now) noexcept
+        {
+                while (m_now < now) {
+                        if (m_scheduled) {
+                                tick();
+                        } else {
+                                m_now = now;
+                        }
+                }
+        }
+
+        /*
+         * @return ticks from now() when advance() must be called, zero if there are no scheduled entries
+         */
+        tick_t next_timeout() const noexcept
+        {
+                if (!m_scheduled) {
+                        return 0;
+                }
+
+                tick_t i = 1;
+
+                for (auto t = m_now + i; !m_wheel[0][t & MASK].first && (t & MASK); t = m_now + ++i); // or cascade
+                return i;
+        }
+
+        /*
+         * @return entry to attempt, it is in flight until complete() is called;
+         *         nullptr if there are no ready entries or max_inflight is reached
+         */
+        entry* pop_ready() noexcept
+        {
+                if (m_cfg.max_inflight && m_inflight >= m_cfg.max_inflight) {
+                        return nullptr;
+                }
+
+                auto e = from_node(pop(m_ready));
+                if (e) {
+                        e->st = state::inflight;
+                        e->sending = true;
+                        ++m_inflight;
+                }
+                return e;
+        }
+
+        /*
+         * The attempt of the entry returned by pop_ready() was started, cancel() can abort it from now on.
+         * @return false if the entry was canceled while it was sending, the caller must abort the attempt
+         */
+        bool started(entry &e) noexcept
+        {
+                if (!e.sending) { // complete() was already called
+                        return true;
+                }
+
+                e.sending = false;
+                return e.st != state::canceled;
+        }
+
+        /*
+         * @return entry that does not belong to the scheduler anymore
+         */
+        entry* pop_finished() noexcept
+        {
+                return from_node(pop(m_finished));
+        }
+
+private:
+        enum : size_t { MASK = SLOTS - 1 };
+
+        void *m_storage;
+        list *m_entries; // buckets by location key
+        list *m_groups; // buckets by server key
+        size_t m_mask; // buckets - 1
+        size_t m_capacity;
+
+        size_t m_count; // entries that belong to the scheduler
+        size_t m_scheduled; // entries in the wheel
+        size_t m_inflight;
+
+        list m_wheel[LEVELS][SLOTS];
+        queue m_ready;
+        list m_finished;
+        list m_free; // groups
+
+        config m_cfg;
+        tick_t m_now;
+        unsigned long long m_rand;
+
+        static size_t buckets(size_t capacity) noexcept
+        {
+                size_t n = 1;
+                for ( ; n < capacity; n <<= 1);
+                return n;
+        }
+
+        size_t bucket(unsigned long long key) const noexcept
+        {
+                return static_cast<size_t>(key ^ (key >> 32) ^ (key >> 16)) & m_mask;
+        }
+
+        static entry* from_node(link *n) noexcept
+        {
+                return n ? reinterpret_cast<entry*>(reinterpret_cast<char*>(n) - offsetof(entry, node)) : nullptr;
+        }
+
+        static entry* from_hash(link *n) noexcept
+        {
+                return reinterpret_cast<entry*>(reinterpret_cast<char*>(n) - offsetof(entry, hash));
+        }
+
+        static entry* from_member(link *n) noexcept
+        {
+                return reinterpret_cast<entry*>(reinterpret_cast<char*>(n) - offsetof(entry, member));
+        }
+
+        static group* from_group_link(link *n) noexcept
+        {
+                return reinterpret_cast<group*>(reinterpret_cast<char*>(n) - offsetof(group, hash));
+        }
+
+        entry* any() const noexcept
+        {
+                for (size_t i = 0; i <= m_mask; ++i) {
+                        if (auto n = m_entries[i].first) {
+                                return from_hash(n);
+                        }
+                }
+
+                return nullptr;
+        }
+
+        group* find_group(unsigned long long server_key) const noexcept
+        {
+                for (auto n = m_groups[bucket(server_key)].first; n; n = n->next) {
+                        if (auto g = from_group_link(n); g->server_key == server_key) {
+                                return g;
+                        }
+                }
+
+                return nullptr;
+        }
+
+        group& get_group(unsigned long long server_key) noexcept
+        {
+                if (auto g = find_group(server_key)) {
+                        return *g;
+                }
+
+                auto &head = m_groups[bucket(server_key)];
+                auto &g = *from_group_link(pop(m_free)); // there are as many groups as entries
+                g = group{};
+                g.server_key = server_key;
+
+                push(head, g.hash);
+                return g;
+        }
+
+        void put_group(group &g) noexcept
+        {
+                unlink(g.hash);
+                g = group{};
+                push(m_free, g.hash);
+        }
+
+        unsigned long long random() noexcept // xorshift64*
+        {
+                m_rand ^= m_rand >> 12;
+                m_rand ^= m_rand << 25;
+                m_rand ^= m_rand >> 27;
+                return m_rand*0x2545'F491'4F6C'DD1DULL;
+        }
+
+        unsigned int next_delay(unsigned int prev) noexcept
+        {
+                unsigned long long lo = m_cfg.first_delay;
+                auto hi = 3ULL*prev;
+
+                if (hi < lo) {
+                        hi = lo;
+                }
+
+                auto delay = lo + random() % (hi - lo + 1);
+                return delay < m_cfg.max_delay ? static_cast<unsigned int>(delay) : m_cfg.max_delay;
+        }
+
+        static auto slot_index(tick_t t, int level) noexcept
+        {
+                return static_cast<size_t>(t >> level*SLOT_BITS) & MASK;
+        }
+
+        /*
+         * Expires is not less than m_now, an entry of the current tick is placed into the slot
+         * that will be processed by tick() after cascading.
+         */
+        void insert(entry &e) noexcept
+        {
+                auto delta = e.expires - m_now;
+                int level = 0;
+
+                for ( ; level < LEVELS - 1 && delta >= 1ULL << (level + 1)*SLOT_BITS; ++level);
+                push(m_wheel[level][slot_index(e.expires, level)], e.node);
+        }
+
+        void schedule(entry &e, tick_t expires) noexcept
+        {
+                constexpr auto max_delta = (1ULL << LEVELS*SLOT_BITS) - 1;
+
+                if (expires <= m_now) {
+                        expires = m_now + 1;
+                } else if (expires - m_now > max_delta) {
+                        expires = m_now + max_delta;
+                }
+
+                e.expires = expires;
+                e.st = state::scheduled;
+                ++m_scheduled;
+
+                insert(e);
+        }
+
+        void unlink_node(entry &e) noexcept
+        {
+                switch (e.st) {
+                case state::scheduled:
+                        --m_scheduled;
+                        unlink(e.node);
+                        break;
+                case state::parked:
+                        unlink(e.grp->parked, e.node);
+                        break;
+                case state::ready:
+                        unlink(m_ready, e.node);
+                        break;
+                default:
+                        unlink(e.node);
+                }
+        }
+
+        void cascade(int level, size_t idx) noexcept
+        {
+                for (auto &slot = m_wheel[level][idx]; auto n = pop(slot); ) {
+                        insert(*from_node(n));
+                }
+        }
+
+        void tick() noexcept
+        {
+                auto t = ++m_now;
+
+                for (int level = 1; level < LEVELS && !slot_index(t, level - 1); ++level) {
+                        cascade(level, slot_index(t, level));
+                }
+
+                for (auto &slot = m_wheel[0][slot_index(t, 0)]; auto n = pop(slot); ) {
+                        auto &e = *from_node(n);
+                        --m_scheduled;
+                        expire(e);
+                }
+        }
+
+        void make_ready(entry &e) noexcept
+        {
+                e.st = state::ready;
+                push_back(m_ready, e.node);
+        }
+
+        void expire(entry &e) noexcept
+        {
+                auto &g = *e.grp;
+
+                if (g.up) {
+                        make_ready(e);
+                } else if (g.probe) {
+                        e.st = state::parked;
+                        push_back(g.parked, e.node);
+                } else {
+                        g.probe = &e;
+                        make_ready(e);
+                }
+        }
+
+        void promote(group &g) noexcept
+        {
+                if (auto e = from_node(pop(g.parked))) {
+                        g.probe = e;
+                        make_ready(*e);
+                }
+        }
+
+        void on_probe(group &g, outcome result) noexcept
+        {
+                switch (result) {
+                case outcome::success:
+                case outcome::failed:
+                        g.up = true;
+                        while (auto e = from_node(pop(g.parked))) {
+                                make_ready(*e);
+                        }
+                        break;
+                case outcome::unreachable:
+                        g.up = false;
+                        while (auto e = from_node(pop(g.parked))) {
+                                retry(*e);
+                        }
+                        break;
+                case outcome::aborted:
+                        promote(g);
+                }
+        }
+
+        void retry(entry &e) noexcept
+        {
+                if (e.retries++ < m_cfg.max_retries) {
+                        e.delay = next_delay(e.delay);
+                        schedule(e, m_now + e.delay);
+                } else {
+                        finish(e);
+                }
+        }
+
+        void detach(entry &e) noexcept
+        {
+                unlink_node(e);
+                unlink(e.hash);
+                unlink(e.member);
+
+                if (auto g = e.grp) {
+                        e.grp = nullptr;
+                        --m_count;
+
+                        if (g->probe == &e) {
+                                g->probe = nullptr;
+                                promote(*g);
+                        }
+
+                        if (!--g->refcnt) {
+                                put_group(*g);
+                        }
+                }
+        }
+
+        void finish(entry &e) noexcept
+        {
+                detach(e);
+                e.st = state::finished;
+                push(m_finished, e.node);
+        }
+};
+
+} // namespace usbip::reattach
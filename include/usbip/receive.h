@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "proto.h"
+#include <string.h>
+
+/*
+ * Processing of server's responses that does not depend on the kernel:
+ * header validation, un-compaction of isochronous transfer buffers, patching of configuration descriptors.
+ *
+ * It is used by the driver (wsk_receive.cpp) and by the offline replay benchmark (userspace/replay),
+ * so it does not lock, allocate memory or log. Errors are returned as codes, the caller logs them.
+ */
+namespace usbip::receive
+{
+
+enum class error
+{
+        none,
+        command, // USBIP_RET_* expected
+        number_of_packets, // out of range
+        seqnum,
+        actual_length, // actual_length > length of a packet
+        offset, // src.offset != dst.Offset
+        length, // SUM(actual_length) of packets exceeds actual_length
+        buffer_overflow, // dst.Offset + actual_length > TransferBufferLength
+        gap, // dst.Offset < remaining length, the source buffer has no gaps
+        sum, // SUM(actual_length) != actual_length
+};
+
+constexpr const char* str(error err) noexcept
+{
+        const char* v[] {
+                "ok", "command", "number_of_packets", "seqnum",
+                "actual_length", "offset", "length", "buffer_overflow", "gap", "sum"
+        };
+
+        auto i = static_cast<unsigned int>(err);
+        return i < sizeof(v)/sizeof(*v) ? v[i] : "?";
+}
+
+constexpr UINT32 byteswap(UINT32 v) noexcept
+{
+        return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF'0000) | (v << 24);
+}
+
+constexpr INT32 byteswap(INT32 v) noexcept
+{
+        return static_cast<INT32>(byteswap(static_cast<UINT32>(v)));
+}
+
+inline void byteswap(iso_packet_descriptor *d, size_t cnt) noexcept
+{
+        for (auto end = d + cnt; d != end; ++d) {
+                d->offset = byteswap(d->offset);
+                d->length = byteswap(d->length);
+                d->actual_length = byteswap(d->actual_length);
+                d->status = byteswap(d->status);
+        }
+}
+
+/*
+ * Convert the header of a server's response to host byte order and validate it.
+ * hdr.direction is always zero in server's responses, it is restored from the seqnum.
+ * number_of_packets of RET_SUBMIT for non-isochronous transfers is set to zero.
+ */
+constexpr error validate_header(header &hdr) noexcept
+{
+        hdr.command = byteswap(hdr.command);
+        hdr.seqnum = byteswap(hdr.seqnum);
+        hdr.devid = byteswap(hdr.devid);
+        hdr.direction = byteswap(hdr.direction);
+        hdr.ep = byteswap(hdr.ep);
+
+        switch (hdr.command) {
+        case RET_SUBMIT:
+                if (auto &r = hdr.ret_submit; true) {
+                        r.status = byteswap(r.status);
+                        r.actual_length = byteswap(r.actual_length);
+                        r.start_frame = byteswap(r.start_frame);
+                        r.number_of_packets = byteswap(r.number_of_packets);
+                        r.error_count = byteswap(r.error_count);
+                        r.ext_flags = byteswap(r.ext_flags);
+
+                        if (r.number_of_packets == number_of_packets_non_isoch) {
+                                r.number_of_packets = 0;
+                        } else if (!is_valid_number_of_packets(r.number_of_packets)) {
+                                return error::number_of_packets;
+                        }
+                }
+                break;
+        case RET_UNLINK:
+                hdr.ret_unlink.status = byteswap(hdr.ret_unlink.status);
+                break;
+        default:
+                return error::command;
+        }
+
+        if (!is_valid_seqnum(hdr.seqnum)) {
+                return error::seqnum;
+        }
+
+        hdr.direction = extract_dir(hdr.seqnum);
+        return error::none;
+}
+
+/*
+ * @param hdr is validated, @see validate_header
+ * @return length of the transfer buffer and isochronous packet descriptors that follow the header
+ */
+constexpr size_t get_payload_size(const header &hdr) noexcept
+{
+        if (hdr.command != RET_SUBMIT) {
+                return 0;
+        }
+
+        auto &r = hdr.ret_submit;
+        size_t len = hdr.direction == direction::in ? r.actual_length : 0;
+
+        return len + r.number_of_packets*sizeof(iso_packet_descriptor);
+}
+
+/*
+ * Buffer from the server has no gaps (compacted), SUM(src->actual_length) == actual_length,
+ * src->offset is ignored for that reason.
+ *
+ * For isochronous packets: actual length is the sum of
+ * the actual length of the individual, packets, but as
+ * the packet offsets are not changed there will be
+ * padding between the packets. To optimally use the
+ * bandwidth the padding is not transmitted.
+ *
+ * See:
+ * <linux>/drivers/usb/usbip/stub_tx.c, stub_send_ret_submit
+ * <linux>/drivers/usb/usbip/usbip_common.c, usbip_pad_iso
+ *
+ * @param dst has members Offset, Length, Status like USBD_ISO_PACKET_DESCRIPTOR
+ * @param buffer transfer buffer, nullptr for OUT transfers
+ * @param src is in host byte order
+ * @param to_status converts non-zero status of a packet
+ * @param failed index of the packet that caused an error
+ */
+template<typename Packet, typename ToStatus>
+error fill_isoc_data(
+        Packet *dst, unsigned int cnt, unsigned char *buffer, unsigned int TransferBufferLength,
+        unsigned int length, const iso_packet_descriptor *src, ToStatus &&to_status, unsigned int &failed) noexcept
+{
+        auto dir_out = !buffer;
+
+        for (auto i = cnt; i--; ) { // set dd.Status and dd.Length
+
+                failed = i;
+
+                auto &sd = src[i];
+                auto &dd = dst[i];
+
+                dd.Status = sd.status ? to_status(sd.status) : 0; // USBD_STATUS_SUCCESS
+
+                if (dir_out) {
+                        continue; // dd.Length is not used for OUT transfers
+                }
+
+                if (!sd.actual_length) {
+                        dd.Length = 0;
+                        continue;
+                }
+
+                if (sd.actual_length > sd.length) {
+                        return error::actual_length;
+                }
+
+                if (sd.offset != dd.Offset) { // buffer is compacted, but offsets are intact
+                        return error::offset;
+                }
+
+                if (length >= sd.actual_length) {
+                        length -= sd.actual_length;
+                } else {
+                        return error::length;
+                }
+
+                if (dd.Offset + sd.actual_length > TransferBufferLength) {
+                        return error::buffer_overflow;
+                }
+
+                if (dd.Offset < length) { // source buffer has no gaps
+                        return error::gap;
+                }
+
+                if (dd.Offset > length) {
+                        memmove(buffer + dd.Offset, buffer + length, sd.actual_length);
+                }
+
+                dd.Length = sd.actual_length;
+        }
+
+        return length && !dir_out ? error::sum : error::none;
+}
+
+/*
+ * For LS/FS interrupt endpoint only.
+ * @param bInterval milliseconds
+ * @return 1-16, for HS interrupt endpoint
+ */
+constexpr unsigned char to_high_speed_interval(unsigned char bInterval) noexcept
+{
+        enum { MIN_INTVL = 1, MAX_INTVL = 16 }; // result
+        auto microframes = 8*bInterval;
+
+        for (unsigned char i = MIN_INTVL; i <= MAX_INTVL; ++i) {
+                if ((1 << (i - 1)) >= microframes) {
+                        return i;
+                }
+        }
+
+        return MAX_INTVL;
+}
+
+/*
+ * UDE/USBHUB3 internally treats all devices as High-Speed.
+ * Full-Speed bulk endpoints have wMaxPacketSize <= 64, but HS requires 512.
+ * USBHUB3 rejects the configuration descriptor if bulk endpoints don't match HS rules,
+ * causing repeated enumeration failures ("Invalid Configuration Descriptor").
+ *
+ * USB_SPEED_FULL audio devices do not work if ISOCH IN/OUT USB_ENDPOINT_DESCRIPTOR.bInterval = 1.
+ * ucx01000!UrbHandler_USBPORTStyle_Legacy_IsochTransfer completes IRP with USBD_STATUS_INVALID_PARAMETER,
+ * this error can be observed in the filter driver, this driver will not get ISOCH transfers at all.
+ * it always treats bInterval as 0.125ms intervals, and it doesn't care if everything else in the device
+ * descriptor or speed is correct.
+ *
+ * Isochronous transfers can only be used by full-speed and high-speed devices.
+ * For devices and host controllers that can operate at full speed, the period is measured in units of 1 millisecond frames.
+ *
+ * For devices and host controllers that can operate at high speed, the period is measured in units of microframes.
+ * There are eight microframes in each 1 millisecond frame.
+ * The period is related to the value in bInterval by the formula 2**(bInterval - 1), the result is number of microframes.
+ *
+ * 5.5.3 Control Transfer Packet Size Constraints
+ * The allowable maximum control transfer data payload sizes for full-speed devices is 8, 16, 32, or 64 bytes;
+ * for high-speed devices, it is 64 bytes and for low-speed devices, it is 8 bytes.
+ *
+ * 5.6.4 Isochronous Transfer Bus Access Constraints
+ * An isochronous endpoint must specify its required bus access period. Full-/high-speed endpoints must specify
+ * a desired period as (2**bInterval-1)*F, where bInterval is in the range 1-16 and F is 125µs for high-speed
+ * and 1ms for full-speed.
+ *
+ * 5.7.4 Interrupt Transfer Packet Size Constraints
+ * A full-speed endpoint can specify a desired period from 1 ms to 255 ms. Low-speed endpoints are limited
+ * to specifying only 10 ms to 255 ms. High-speed endpoints can specify a desired period (2**bInterval-1)*125µs,
+ * where bInterval is in the range 1-16.
+ *
+ * 5.8.3 Bulk Transfer Packet Size Constraints
+ * An endpoint for bulk transfers specifies the maximum data payload size that the endpoint can accept from
+ * or transmit to the bus. The USB defines the allowable maximum bulk data payload sizes to be only 8, 16,
+ * 32, or 64 bytes for full-speed endpoints and 512 bytes for high-speed endpoints. A low-speed device must
+ * not have bulk endpoints
+ *
+ * @param cd configuration descriptor with all its interfaces and endpoints, wTotalLength == len
+ * @param on_patch is called for every changed endpoint as
+ *        on_patch(const unsigned char *endpoint_descriptor, UINT16 old_wMaxPacketSize, unsigned char old_bInterval)
+ * @param on_control is called for a control endpoint as on_control(const unsigned char *endpoint_descriptor),
+ *        the default control pipe does not have a descriptor, so the configuration is suspicious
+ * @return number of changed endpoint descriptors
+ */
+template<typename OnPatch, typename OnControl>
+int patch_config(void *cd, size_t len, OnPatch &&on_patch, OnControl &&on_control) noexcept
+{
+        enum { ENDPOINT_DESCRIPTOR_TYPE = 5, ENDPOINT_DESCRIPTOR_LEN = 7 };
+        enum { CONTROL, ISOCHRONOUS, BULK, INTERRUPT }; // bmAttributes & 3, UsbdPipeType*
+        enum { MIN_INTVL = 1, MAX_INTVL = 16 };
+
+        auto buf = static_cast<unsigned char*>(cd);
+        int cnt = 0;
+
+        for (size_t off = 0, dsc_len; off + 2 <= len; off += dsc_len) {
+
+                auto e = buf + off;
+                dsc_len = e[0]; // bLength
+
+                if (dsc_len < 2 || off + dsc_len > len) {
+                        break; // malformed, USBD_ParseDescriptors stops too
+                }
+
+                if (e[1] != ENDPOINT_DESCRIPTOR_TYPE || dsc_len < ENDPOINT_DESCRIPTOR_LEN) {
+                        continue;
+                }
+
+                auto &pkt_lo = e[4]; // wMaxPacketSize is not aligned
+                auto &pkt_hi = e[5];
+                auto &intvl = e[6];
+
+                auto old_pkt = static_cast<UINT16>(pkt_lo | pkt_hi << 8); // maximum payload size for this endpoint
+                auto old_intvl = intvl; // polling interval, frames
+
+                switch (e[3] & 3) { // bmAttributes
+                case BULK:
+                        pkt_lo = 0; // 512 is fixed value for HS
+                        pkt_hi = 2;
+                        break;
+                case ISOCHRONOUS: // 2**(bInterval - 1) frames
+                        intvl = static_cast<unsigned char>(intvl + 3 < MAX_INTVL ? intvl + 3 : MAX_INTVL); // microframes
+                        break;
+                case INTERRUPT: // 1-255 ms
+                        intvl = to_high_speed_interval(intvl); // 2**(bInterval-1) microframes
+                        break;
+                case CONTROL:
+                        on_control(static_cast<const unsigned char*>(e));
+                        break;
+                }
+
+                if (static_cast<UINT16>(pkt_lo | pkt_hi << 8) != old_pkt || intvl != old_intvl) {
+                        on_patch(static_cast<const unsigned char*>(e), old_pkt, old_intvl);
+                        ++cnt;
+                }
+        }
+
+        return cnt;
+}
+
+} // namespace usbip::receive
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Ownership of a submitted URB between the send completion and the cancel routine.
+ *
+ * A request is put in the list of a device and marked cancelable at once, before it is sent.
+ * It can be cancelled while the transfer buffer is still being sent, the cancel routine
+ * must not complete the request until the send is completed because the buffer is in use.
+ * Whoever comes second, send completion or cancel routine, sends CMD_UNLINK and completes
+ * the request with STATUS_CANCELLED. If the send has failed, the server has not got the request,
+ * so it is completed with STATUS_CANCELLED without CMD_UNLINK.
+ *
+ * RET_SUBMIT and endpoint purge take a request from the list and unmark it cancelable,
+ * so they never compete with the cancel routine, @see remove_request.
+ *
+ * Each event happens once for a request. The caller applies transitions with compare-exchange,
+ * it is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::request_state
+{
+
+enum state : long { queued, sent, canceled, failed }; // initial state is queued
+
+enum class event { send_complete, send_failed, cancel };
+
+struct transition
+{
+        state next;
+        bool unlink_and_cancel; // the caller must send CMD_UNLINK and complete with STATUS_CANCELLED
+        bool cancel; // the caller must complete with STATUS_CANCELLED only
+};
+
+constexpr transition on(state cur, event e) noexcept
+{
+        switch (e) {
+        case event::send_complete:
+                return { sent, cur == canceled, false };
+        case event::send_failed:
+                return { failed, false, cur == canceled };
+        case event::cancel:
+                if (cur == queued) {
+                        return { canceled, false, false }; // the send completion will do that
+                } else if (cur == failed) {
+                        return { failed, false, true };
+                }
+                break;
+        }
+
+        return { cur, true, false };
+}
+
+} // namespace usbip::request_state
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace usbip
+{
+
+/*
+ * Bounded cache of name resolution results keyed by (host, service).
+ *
+ * It is used by the driver and by libusbip, so it does not lock, allocate memory or read a clock.
+ * The caller must serialize calls, "now" is any monotonic time in milliseconds.
+ *
+ * Host names are compared case-insensitively (ASCII letters only, as DNS does), services are compared as is.
+ *
+ * A failed lookup is cached as well (negative caching), usually with shorter TTL.
+ * An expired entry is refreshed in place by the first caller that finds it expired.
+ *
+ * Concurrent misses are coalesced: only the caller that got result::miss performs the lookup,
+ * others get result::pending until it calls complete() or abandon().
+ *
+ * The object must be zero-initialized, it is trivially constructible to be placed into a pool allocation.
+ *
+ * @param Value result of a lookup, must be trivially copyable
+ * @param Capacity if the cache is full, least recently used entry is evicted
+ * @param CharT character type of host and service names
+ */
+template<typename Value, int Capacity, typename CharT = char>
+class resolver_cache
+{
+public:
+        static_assert(Capacity > 0);
+
+        enum { max_host = 1025, max_service = 32 }; // NI_MAXHOST, NI_MAXSERV, including '\0'
+        using time_t = unsigned long long;
+
+        enum class result
+        {
+                hit, // value is copied
+                negative_hit, // status of the failed lookup is copied
+                miss, // the caller must do the lookup and call complete() or abandon()
+                pending, // the lookup is in progress, retry after complete() or abandon()
+        };
+
+        /*
+         * Strings are not required to be null-terminated.
+         * If names are too long, lookup() returns result::miss and complete() does nothing.
+         */
+        result lookup(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len,
+                time_t now, Value &value, long &status)
+        {
+                status = 0;
+
+                auto e = find(host, host_len, service, service_len);
+
+                if (!e) {
+                        if (e = alloc(host, host_len, service, service_len); e) {
+                                e->resolving = true;
+                                e->last_used = now;
+                        }
+                        return result::miss;
+                }
+
+                if (e->resolving) {
+                        return result::pending;
+                }
+
+                e->last_used = now;
+
+                if (now >= e->expires) { // refresh
+                        e->resolving = true;
+                        return result::miss;
+                }
+
+                if (status = e->status; status) {
+                        return result::negative_hit;
+                }
+
+                value = e->value;
+                return result::hit;
+        }
+
+        /*
+         * @param status zero if the lookup succeeded
+         * @param value must not be nullptr if status is zero
+         * @param ttl time to live of the result in milliseconds
+         */
+        void complete(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len,
+                time_t now, long status, const Value *value, time_t ttl)
+        {
+                auto e = find(host, host_len, service, service_len);
+                if (!e && !(e = alloc(host, host_len, service, service_len))) {
+                        return;
+                }
+
+                if (!status) {
+                        e->value = *value;
+                }
+
+                e->status = status;
+                e->expires = now + ttl;
+                e->last_used = now;
+                e->resolving = false;
+        }
+
+        /*
+         * The lookup was cancelled and its result must not be cached.
+         * Previous result is kept but is treated as expired.
+         */
+        void abandon(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len)
+        {
+                if (auto e = find(host, host_len, service, service_len); !e) {
+                        //
+                } else if (!e->expires) { // was never completed
+                        e->used = false;
+                        e->resolving = false;
+                } else {
+                        e->expires = 0;
+                        e->resolving = false;
+                }
+        }
+
+        void erase(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len)
+        {
+                if (auto e = find(host, host_len, service, service_len)) {
+                        e->used = false;
+                        e->resolving = false;
+                }
+        }
+
+        void clear() noexcept
+        {
+                for (auto &e: m_entries) {
+                        e.used = false;
+                        e.resolving = false;
+                }
+        }
+
+        auto size() const noexcept
+        {
+                auto cnt = 0;
+                for (auto &e: m_entries) {
+                        cnt += e.used;
+                }
+                return cnt;
+        }
+
+private:
+        struct entry
+        {
+                CharT host[max_host];
+                CharT service[max_service];
+                unsigned short host_len;
+                unsigned short service_len;
+
+                Value value;
+                long status; // of the last completed lookup
+
+                time_t expires; // zero if the lookup was never completed
+                time_t last_used;
+
+                bool used;
+                bool resolving;
+        };
+
+        entry m_entries[Capacity];
+
+        static constexpr CharT to_lower(CharT c) noexcept
+        {
+                return c >= CharT('A') && c <= CharT('Z') ? CharT(c - CharT('A') + CharT('a')) : c;
+        }
+
+        static auto equal(const CharT *a, const CharT *b, size_t len, bool nocase)
+        {
+                for (size_t i = 0; i < len; ++i) {
+                        if (a[i] != b[i] && !(nocase && to_lower(a[i]) == to_lower(b[i]))) {
+                                return false;
+                        }
+                }
+                return true;
+        }
+
+        static auto copy(CharT *dst, const CharT *src, size_t len)
+        {
+                for (size_t i = 0; i < len; ++i) {
+                        dst[i] = src[i];
+                }
+                dst[len] = CharT();
+        }
+
+        entry* find(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len)
+        {
+                for (auto &e: m_entries) {
+                        if (e.used &&
+                            e.host_len == host_len && e.service_len == service_len &&
+                            equal(e.host, host, host_len, true) && equal(e.service, service, service_len, false)) {
+                                return &e;
+                        }
+                }
+
+                return nullptr;
+        }
+
+        /*
+         * Entries with a lookup in progress are never evicted.
+         */
+        entry* alloc(
+                const CharT *host, size_t host_len,
+                const CharT *service, size_t service_len)
+        {
+                if (host_len >= max_host || service_len >= max_service) {
+                        return nullptr;
+                }
+
+                entry *victim{};
+
+                for (auto &e: m_entries) {
+                        if (!e.used) {
+                                victim = &e;
+                                break;
+                        } else if (e.resolving) {
+                                //
+                        } else if (!victim || e.last_used < victim->last_used) {
+                                victim = &e;
+                        }
+                }
+
+                if (victim) {
+                        victim->used = true;
+                        victim->resolving = false;
+
+                        victim->status = 0;
+                        victim->expires = 0;
+                        victim->last_used = 0;
+
+                        copy(victim->host, host, host_len);
+                        victim->host_len = static_cast<unsigned short>(host_len);
+
+                        copy(victim->service, service, service_len);
+                        victim->service_len = static_cast<unsigned short>(service_len);
+                }
+
+                return victim;
+        }
+};
+
+} // namespace usbip
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace usbip
+{
+
+/*
+ * Outcomes of recent connects to servers keyed by location::make_server_key, a key is never zero.
+ *
+ * A failed connect marks the server as down for a backoff window that doubles with every failure.
+ * Attempts within the window fail at once with the status of the last connect instead of waiting
+ * for TCP connect timeout. The first attempt after the window is a probe, others fail fast
+ * until the probe completes. A successful connect marks the server as up and resets the backoff.
+ *
+ * It is used by the driver, so it does not lock, allocate memory or read a clock.
+ * The caller must serialize calls, "now" is any monotonic time in milliseconds.
+ * The object must be zero-initialized, it is trivially constructible to be placed into a pool allocation.
+ *
+ * @param Capacity if the table is full, least recently used server is forgotten
+ */
+template<int Capacity>
+class server_liveness
+{
+public:
+        static_assert(Capacity > 0);
+
+        using key_t = unsigned long long;
+        using time_t = unsigned long long;
+
+        enum class verdict
+        {
+                connect, // the server is up or unknown
+                probe, // the server is down, this attempt must tell whether it is up again
+                fail_fast, // the server is down, status of the last connect is copied
+        };
+
+        struct info
+        {
+                time_t rtt; // smoothed connect time, zero if unknown
+                time_t down_until; // zero if the server is up
+                unsigned int failures; // in a row
+                long status; // of the last failed connect
+        };
+
+        /*
+         * @param min_backoff window after the first failure, it is doubled up to max_backoff
+         */
+        void init(time_t min_backoff, time_t max_backoff) noexcept
+        {
+                m_min_backoff = min_backoff ? min_backoff : 1;
+                m_max_backoff = max_backoff > m_min_backoff ? max_backoff : m_min_backoff;
+        }
+
+        /*
+         * Must be called before connect. If a probe is returned, connected(), failed() or abandon()
+         * must be called for the key, otherwise other attempts fail fast until max_backoff expires.
+         */
+        verdict check(key_t key, time_t now, long &status) noexcept
+        {
+                status = 0;
+
+                auto s = find(key);
+                if (!s || !s->down_until) {
+                        return verdict::connect;
+                }
+
+                s->last_used = now;
+
+                if (s->probing) {
+                        if (now - s->probe_start < m_max_backoff) {
+                                status = s->status;
+                                return verdict::fail_fast;
+                        }
+                } else if (now < s->down_until) {
+                        status = s->status;
+                        return verdict::fail_fast;
+                }
+
+                s->probing = true;
+                s->probe_start = now;
+                return verdict::probe;
+        }
+
+        /*
+         * @param rtt time of a successful connect
+         * @return true if the server was down, attempts that wait for it can be woken
+         */
+        bool connected(key_t key, time_t now, time_t rtt) noexcept
+        {
+                auto &s = acquire(key, now);
+                auto was_down = s.down_until != 0;
+
+                s.rtt = s.rtt ? (7*s.rtt + rtt)/8 : (rtt ? rtt : 1);
+                s.down_until = 0;
+                s.failures = 0;
+                s.status = 0;
+                s.probing = false;
+
+                return was_down;
+        }
+
+        /*
+         * The server was not reached on any of its addresses.
+         * @return backoff window
+         */
+        time_t failed(key_t key, time_t now, long status) noexcept
+        {
+                auto &s = acquire(key, now);
+
+                auto backoff = m_min_backoff;
+                for (auto i = s.failures; i && backoff < m_max_backoff; --i, backoff <<= 1);
+
+                if (backoff > m_max_backoff) {
+                        backoff = m_max_backoff;
+                }
+
+                ++s.failures;
+                s.status = status;
+                s.down_until = now + backoff;
+                s.probing = false;
+
+                return backoff;
+        }
+
+        /*
+         * The probe was canceled and did not tell anything about the server.
+         */
+        void abandon(key_t key) noexcept
+        {
+                if (auto s = find(key)) {
+                        s->probing = false;
+                }
+        }
+
+        bool get(key_t key, info &result) const noexcept
+        {
+                auto s = find(key);
+                if (s) {
+                        result = info{ s->rtt, s->down_until, s->failures, s->status };
+                }
+                return s;
+        }
+
+private:
+        struct server
+        {
+                key_t key; // zero if the slot is free
+                time_t last_used;
+                time_t rtt;
+                time_t down_until;
+                time_t probe_start;
+                unsigned int failures;
+                long status;
+                bool probing;
+        };
+
+        server m_servers[Capacity];
+        time_t m_min_backoff;
+        time_t m_max_backoff;
+
+        server* find(key_t key) const noexcept
+        {
+                for (auto &s: m_servers) {
+                        if (s.key == key) {
+                                return const_cast<server*>(&s);
+                        }
+                }
+
+                return nullptr;
+        }
+
+        server& acquire(key_t key, time_t now) noexcept
+        {
+                auto s = find(key);
+
+                if (!s) {
+                        s = m_servers;
+                        for (auto &i: m_servers) {
+                                if (!i.key) {
+                                        s = &i;
+                                        break;
+                                } else if (i.last_used < s->last_used) {
+                                        s = &i;
+                                }
+                        }
+
+                        *s = server{};
+                        s->key = key;
+                }
+
+                s->last_used = now;
+                return *s;
+        }
+};
+
+} // namespace usbip
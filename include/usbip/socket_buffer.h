@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "ch9.h"
+
+/*
+ * Sizes of SO_SNDBUF and SO_RCVBUF of a connection to a server.
+ *
+ * A connection can't transfer faster than the bus of the device, so the buffer must hold
+ * the bandwidth-delay product of the bus rate and round trip time, twice of it to tolerate jitter.
+ * The sum of all buffers is limited by a budget, a connection that does not fit keeps the buffers
+ * it has or the default ones of the stack.
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::sockbuf
+{
+
+/*
+ * @return maximal payload rate in bytes per second, line coding overhead is excluded
+ */
+constexpr unsigned long long bus_rate(usb_device_speed speed) noexcept
+{
+        switch (speed) {
+        case USB_SPEED_LOW:
+                return 1'500'000/8;
+        case USB_SPEED_FULL:
+                return 12'000'000/8;
+        case USB_SPEED_SUPER:
+                return 5'000'000'000ULL/10; // 8b/10b
+        case USB_SPEED_SUPER_PLUS:
+                return 10'000'000'000ULL/132*128/8; // 128b/132b
+        case USB_SPEED_WIRELESS:
+        case USB_SPEED_HIGH:
+        case USB_SPEED_UNKNOWN:
+        default:
+                return 480'000'000/8;
+        }
+}
+
+struct policy
+{
+        size_t min_size; // the default of the stack, smaller sizes are not set
+        size_t max_size;
+        size_t granularity; // must be a power of two
+};
+
+/*
+ * @param rtt round trip time in microseconds
+ * @return zero if the default size of the stack is enough
+ */
+constexpr size_t target_size(unsigned long long rate, unsigned long long rtt, const policy &p) noexcept
+{
+        auto bdp = rate/1000*rtt/1000; // overflow is not possible for realistic values
+        auto sz = 2*bdp;
+
+        if (sz <= p.min_size) {
+                return 0;
+        }
+
+        if (sz >= p.max_size) {
+                return p.max_size;
+        }
+
+        auto mask = p.granularity - 1;
+        return (static_cast<size_t>(sz) + mask) & ~mask;
+}
+
+/*
+ * Readjust if the size changes by a quarter at least, it is expensive for the stack.
+ */
+constexpr bool should_resize(size_t current, size_t target) noexcept
+{
+        auto delta = current > target ? current - target : target - current;
+        return 4*delta >= current;
+}
+
+/*
+ * Global limit of memory for buffers of all connections.
+ * The object must be zero-initialized, the caller must serialize calls.
+ */
+class budget
+{
+public:
+        void init(size_t total) noexcept { m_total = total; }
+
+        auto total() const noexcept { return m_total; }
+        auto used() const noexcept { return m_used; }
+
+        /*
+         * Change a reservation of a connection.
+         * @param current is reserved by the connection, zero if it has none
+         * @return size that is reserved now, less than wanted if the budget is exhausted
+         */
+        size_t reserve(size_t current, size_t wanted) noexcept
+        {
+                auto avail = (m_total > m_used ? m_total - m_used : 0) + current;
+
+                if (wanted > avail) {
+                        wanted = avail;
+                }
+
+                m_used = m_used - current + wanted;
+                return wanted;
+        }
+
+        void release(size_t current) noexcept
+        {
+                m_used = current < m_used ? m_used - current : 0;
+        }
+
+private:
+        size_t m_total;
+        size_t m_used;
+};
+
+/*
+ * Reserve both buffers of a connection, SO_SNDBUF and SO_RCVBUF have the same size.
+ * If the budget can't give the target size, the granted one is rounded down to the granularity.
+ * If it is less than min_size, the reservation is rolled back.
+ *
+ * @param current size of a buffer, zero if the defaults of the stack are used
+ * @param target see target_size
+ * @return new size of a buffer, current if it can't be changed
+ */
+inline size_t reserve(budget &b, size_t current, size_t target, const policy &p) noexcept
+{
+        auto granted = b.reserve(2*current, 2*target);
+        auto sz = granted/2 & ~(p.granularity - 1);
+
+        if (sz < p.min_size) {
+                sz = current;
+        }
+
+        b.reserve(granted, 2*sz); // does not exceed granted
+        return sz;
+}
+
+} // namespace usbip::sockbuf
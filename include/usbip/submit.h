@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "proto.h"
+
+/*
+ * Preparation of USBIP_CMD_SUBMIT that does not depend on the kernel.
+ *
+ * It is used by the driver (device_ioctl.cpp) and by the microbenchmarks (userspace/microbench),
+ * so it does not lock, allocate memory or log.
+ */
+namespace usbip::submit
+{
+
+/*
+ * Convert packets of isochronous URB to usbip descriptors.
+ * USBD_ISO_PACKET_DESCRIPTOR.Length is not used (zero) for USB_DIR_OUT transfer,
+ * the length of a packet is the distance to the offset of the next one.
+ *
+ * @param Packet USBD_ISO_PACKET_DESCRIPTOR
+ * @return index of the first packet with invalid offset, cnt if all packets are valid
+ */
+template<typename Packet>
+constexpr auto repack(iso_packet_descriptor *d, const Packet *src, unsigned int cnt, unsigned int TransferBufferLength)
+{
+        for (unsigned int i = 0; i < cnt; ++i, ++d) {
+
+                auto offset = src[i].Offset;
+                auto next_offset = i + 1 < cnt ? src[i + 1].Offset : TransferBufferLength;
+
+                if (!(next_offset >= offset && next_offset <= TransferBufferLength)) {
+                        return i;
+                }
+
+                d->offset = offset;
+                d->length = next_offset - offset;
+                d->actual_length = 0;
+                d->status = 0;
+        }
+
+        return cnt;
+}
+
+} // namespace usbip::submit
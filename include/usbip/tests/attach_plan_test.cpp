@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. attach_plan_test.cpp -o attach_plan_test
+ */
+
+#include "check.h"
+#include <usbip/attach_plan.h>
+
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::attach_plan;
+
+/*
+ * @return keys in the order of attaching
+ */
+auto plan(const std::vector<unsigned long long> &keys, const std::vector<unsigned long long> &history)
+{
+        std::vector<size_t> idx(keys.size());
+        std::vector<size_t> ranks(keys.size());
+
+        order(idx.data(), ranks.data(), keys.data(), keys.size(), history.data(), history.size());
+
+        std::vector<unsigned long long> v;
+        for (auto i: idx) {
+                v.push_back(keys[i]);
+        }
+        return v;
+}
+
+struct history
+{
+        enum { max_cnt = 4 };
+        unsigned long long keys[max_cnt]{};
+        size_t cnt{};
+
+        auto& remember(unsigned long long key)
+        {
+                cnt = usbip::attach_plan::remember(keys, cnt, max_cnt, key);
+                return *this;
+        }
+
+        auto get() const { return std::vector<unsigned long long>(keys, keys + cnt); }
+};
+
+using keys = std::vector<unsigned long long>;
+
+} // namespace
+
+
+TEST(rank_of_key)
+{
+        unsigned long long h[]{ 30, 10, 20 };
+
+        CHECK(!rank(h, 3, 30));
+        CHECK(rank(h, 3, 20) == 2);
+        CHECK(rank(h, 3, 40) == 3); // not found
+        CHECK(!rank(h, 0, 30)); // empty
+}
+
+TEST(most_recent_first)
+{
+        CHECK((plan({ 1, 2, 3, 4 }, { 3, 1 }) == keys{ 3, 1, 2, 4 }));
+        CHECK((plan({ 1, 2, 3, 4 }, { 4, 3, 2, 1 }) == keys{ 4, 3, 2, 1 }));
+        CHECK((plan({ 1, 2, 3 }, {}) == keys{ 1, 2, 3 })); // no history
+        CHECK(plan({}, { 1, 2 }).empty());
+}
+
+/*
+ * Devices that were never attached keep their order, so do the copies of the same key.
+ */
+TEST(ties_are_stable)
+{
+        CHECK((plan({ 5, 1, 6, 2, 7 }, { 2, 1 }) == keys{ 2, 1, 5, 6, 7 }));
+
+        std::vector<size_t> idx(4), ranks(4);
+        keys k{ 9, 1, 8, 1 };
+        unsigned long long h[]{ 1 };
+
+        order(idx.data(), ranks.data(), k.data(), k.size(), h, 1);
+        CHECK((idx == std::vector<size_t>{ 1, 3, 0, 2 }));
+        CHECK((ranks == std::vector<size_t>{ 1, 0, 1, 0 }));
+}
+
+/*
+ * Keys that were evicted from the full history go last.
+ */
+TEST(order_by_full_history)
+{
+        history h;
+        for (unsigned long long k = 1; k <= 6; ++k) {
+                h.remember(k);
+        }
+
+        CHECK((h.get() == keys{ 6, 5, 4, 3 }));
+        CHECK((plan({ 1, 2, 3, 4, 5, 6 }, h.get()) == keys{ 6, 5, 4, 3, 1, 2 }));
+}
+
+TEST(remember_moves_to_front)
+{
+        history h;
+
+        CHECK((h.remember(1).remember(2).remember(3).get() == keys{ 3, 2, 1 }));
+        CHECK((h.remember(1).get() == keys{ 1, 3, 2 })); // the last one
+        CHECK((h.remember(3).get() == keys{ 3, 1, 2 }));
+        CHECK((h.remember(3).get() == keys{ 3, 1, 2 })); // already the first
+}
+
+TEST(remember_evicts_oldest)
+{
+        history h;
+        h.remember(1).remember(2).remember(3).remember(4);
+        CHECK(h.cnt == history::max_cnt);
+
+        CHECK((h.remember(5).get() == keys{ 5, 4, 3, 2 }));
+        CHECK((h.remember(2).get() == keys{ 2, 5, 4, 3 })); // found, nothing is evicted
+        CHECK((h.remember(1).get() == keys{ 1, 2, 5, 4 }));
+}
+
+TEST(remember_without_capacity)
+{
+        unsigned long long h[1]{};
+
+        CHECK(!remember(h, 0, 0, 7));
+        CHECK(!h[0]);
+
+        CHECK(remember(h, 0, 1, 7) == 1 && h[0] == 7);
+        CHECK(remember(h, 1, 1, 8) == 1 && h[0] == 8);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -pthread -I../.. capture_test.cpp -o capture_test
+ */
+
+#include "check.h"
+#include <usbip/capture.h>
+#include <usbip/pcapng.h>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * The driver uses Interlocked functions and ReadAcquire/WriteRelease.
+ */
+struct gcc_atomic
+{
+        static auto load(const volatile long long &v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+        static auto load(const volatile int &v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+
+        static void store(volatile long long &v, long long val) { __atomic_store_n(&v, val, __ATOMIC_RELEASE); }
+        static void store(volatile int &v, int val) { __atomic_store_n(&v, val, __ATOMIC_RELEASE); }
+
+        static bool compare_exchange(volatile long long &target, long long expected, long long desired)
+        {
+                return __atomic_compare_exchange_n(&target, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+
+        static void increment(volatile long long &v) { __atomic_fetch_add(&v, 1, __ATOMIC_RELAXED); }
+};
+
+using ring_t = capture::ring<gcc_atomic>;
+
+struct fixture
+{
+        std::unique_ptr<ring_t> r = std::make_unique<ring_t>(); // zero-initialized
+        std::vector<unsigned long long> storage; // aligned
+
+        explicit fixture(size_t capacity) : storage(capacity/sizeof(storage[0]))
+        {
+                r->init(storage.data(), capacity);
+        }
+};
+
+/*
+ * The data of a record identifies it.
+ */
+void fill(capture::record &r, unsigned int writer, unsigned int seq)
+{
+        r.time = seq;
+        r.pdu_len = r.data_len + writer;
+        r.dir = static_cast<capture::direction>(seq & 1);
+
+        auto d = capture::data(r);
+        for (unsigned int i = 0; i < r.data_len; ++i) {
+                d[i] = static_cast<unsigned char>(writer*31 + seq + i);
+        }
+}
+
+bool valid(const capture::record &r, unsigned int writer, unsigned int seq)
+{
+        if (r.size != capture::record_size(r.data_len) || r.time != seq || r.pdu_len != r.data_len + writer) {
+                return false;
+        }
+
+        auto d = capture::data(r);
+        for (unsigned int i = 0; i < r.data_len; ++i) {
+                if (d[i] != static_cast<unsigned char>(writer*31 + seq + i)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+bool write(ring_t &r, size_t data_len, unsigned int writer, unsigned int seq)
+{
+        auto rec = r.reserve(data_len);
+        if (rec) {
+                fill(*rec, writer, seq);
+                r.commit(*rec);
+        }
+        return rec;
+}
+
+/*
+ * Calls f(record&) for each record of the buffer.
+ * @return false if the buffer is not a sequence of whole records
+ */
+template<typename F>
+bool for_each(const unsigned char *buf, size_t len, F &&f)
+{
+        for (size_t pos = 0; pos < len; ) {
+                auto &r = *reinterpret_cast<const capture::record*>(buf + pos);
+                if (r.size < sizeof(r) || pos + r.size > len || r.size % capture::alignment) {
+                        return false;
+                }
+                f(r);
+                pos += r.size;
+        }
+
+        return true;
+}
+
+/*
+ * Minimal pcapng reader.
+ * @return number of Enhanced Packet Blocks, negative if the file is malformed
+ */
+int count_packets(const unsigned char *p, size_t len)
+{
+        auto u32 = [p] (size_t off) { unsigned int v; memcpy(&v, p + off, sizeof(v)); return v; };
+
+        if (len < 28 || u32(0) != 0x0A0D0D0A || u32(8) != 0x1A2B3C4D) {
+                return -1;
+        }
+
+        int cnt = 0;
+
+        for (size_t pos = 0; pos < len; ) {
+
+                if (pos + 12 > len) {
+                        return -1;
+                }
+
+                auto type = u32(pos);
+                auto total = u32(pos + 4);
+
+                if (total < 12 || total % 4 || pos + total > len || u32(pos + total - 4) != total) {
+                        return -1;
+                }
+
+                if (type == 6) {
+                        auto caplen = u32(pos + 20);
+                        if (caplen > u32(pos + 24) || 32 + pcapng::pad4(caplen) != total) {
+                                return -1;
+                        }
+                        ++cnt;
+                }
+
+                pos += total;
+        }
+
+        return cnt;
+}
+
+} // namespace
+
+
+TEST(record_size_is_aligned)
+{
+        CHECK(capture::record_size(0) == sizeof(capture::record));
+        CHECK(capture::record_size(1) == sizeof(capture::record) + 8);
+        CHECK(capture::record_size(8) == sizeof(capture::record) + 8);
+        CHECK(capture::record_size(9) == sizeof(capture::record) + 16);
+}
+
+TEST(records_are_read_in_order)
+{
+        fixture f(4096);
+        auto &r = *f.r;
+
+        for (unsigned int i = 0; i < 10; ++i) {
+                CHECK(write(r, i*7, 0, i));
+        }
+
+        std::vector<unsigned char> buf(4096);
+        auto n = r.read(buf.data(), buf.size());
+
+        unsigned int seq = 0;
+        bool ok = for_each(buf.data(), n, [&seq] (auto &rec) { CHECK(valid(rec, 0, seq++)); });
+
+        CHECK(ok && seq == 10);
+        CHECK(!r.read(buf.data(), buf.size()));
+        CHECK(!r.dropped());
+}
+
+TEST(full_ring_drops)
+{
+        fixture f(256);
+        auto &r = *f.r;
+
+        CHECK(!r.reserve(256)); // never fits
+
+        int written = 0;
+        while (write(r, 24, 0, written)) { // 56 bytes
+                ++written;
+        }
+
+        CHECK(written == 4);
+        CHECK(r.dropped() == 2);
+
+        unsigned char buf[256];
+        CHECK(r.read(buf, sizeof(buf)) == 4*56);
+        CHECK(write(r, 24, 0, 4)); // the space is free again
+}
+
+TEST(wrap_around_with_padding)
+{
+        fixture f(512);
+        auto &r = *f.r;
+
+        unsigned char buf[512];
+        unsigned int next = 0;
+        bool ok = true;
+
+        for (unsigned int seq = 0; seq < 10'000; ++seq) {
+
+                ok = ok && write(r, seq % 97, 1, seq);
+
+                if (seq % 3 == 2) { // records of different sizes straddle the end of the storage
+                        auto n = r.read(buf, sizeof(buf));
+                        ok = ok && for_each(buf, n, [&] (auto &rec) { ok = ok && valid(rec, 1, next++); });
+                }
+        }
+
+        auto n = r.read(buf, sizeof(buf));
+        ok = ok && for_each(buf, n, [&] (auto &rec) { ok = ok && valid(rec, 1, next++); });
+
+        CHECK(ok);
+        CHECK(next == 10'000 && !r.dropped());
+}
+
+TEST(reader_stops_at_unpublished)
+{
+        fixture f(1024);
+        auto &r = *f.r;
+
+        auto a = r.reserve(10);
+        CHECK(write(r, 10, 0, 1));
+
+        unsigned char buf[1024];
+        CHECK(!r.read(buf, sizeof(buf))); // a is being written
+
+        fill(*a, 0, 0);
+        r.commit(*a);
+
+        auto n = r.read(buf, sizeof(buf));
+        CHECK(n == 2*capture::record_size(10));
+
+        unsigned int seq = 0;
+        for_each(buf, n, [&seq] (auto &rec) { CHECK(valid(rec, 0, seq++)); });
+}
+
+TEST(reader_copies_whole_records)
+{
+        fixture f(1024);
+        auto &r = *f.r;
+
+        write(r, 16, 0, 0);
+        write(r, 16, 0, 1);
+
+        auto sz = capture::record_size(16);
+        unsigned char buf[1024];
+
+        CHECK(!r.read(buf, sz - 1));
+        CHECK(r.read(buf, sz + 1) == sz);
+        CHECK(r.read(buf, sizeof(buf)) == sz && valid(*reinterpret_cast<capture::record*>(buf), 0, 1));
+}
+
+/*
+ * The reader drains concurrently, no record is corrupt or lost without being counted.
+ * A writer repeats a dropped record after a yield, so the ring is full many times.
+ */
+TEST(concurrent_writers)
+{
+        enum { writers = 4, records = 200'000 };
+
+        fixture f(64*1024);
+        auto &r = *f.r;
+
+        std::atomic<int> done{};
+        std::atomic<long long> attempts{};
+        std::vector<std::thread> v;
+
+        for (unsigned int w = 0; w < writers; ++w) {
+                v.emplace_back([&r, &done, &attempts, w]
+                {
+                        for (unsigned int seq = 0; seq < records; ++seq) {
+                                for ( ; ++attempts, !write(r, (seq*7 + w) % 200, w, seq); std::this_thread::yield());
+                        }
+                        ++done;
+                });
+        }
+
+        std::vector<unsigned char> buf(16*1024);
+
+        long long read_cnt{};
+        long long last[writers];
+        std::fill(std::begin(last), std::end(last), -1);
+
+        bool ok = true;
+
+        auto drain = [&]
+        {
+                auto n = r.read(buf.data(), buf.size());
+
+                ok = ok && for_each(buf.data(), n, [&] (auto &rec)
+                {
+                        auto w = rec.pdu_len - rec.data_len;
+                        auto seq = static_cast<unsigned int>(rec.time);
+
+                        ok = ok && w < writers && valid(rec, w, seq) && last[w] < seq; // ordered by writer
+                        if (w < writers) {
+                                last[w] = seq;
+                        }
+                        ++read_cnt;
+                });
+
+                return n;
+        };
+
+        while (done < writers) {
+                if (!drain()) {
+                        std::this_thread::yield();
+                }
+        }
+
+        for (auto &t: v) {
+                t.join();
+        }
+
+        while (drain());
+
+        CHECK(ok);
+        CHECK(read_cnt == writers*records);
+        CHECK(read_cnt + r.dropped() == attempts);
+}
+
+TEST(pcapng_file_header)
+{
+        unsigned char buf[64]{};
+
+        CHECK(pcapng::file_header(buf, 10, 128) == 60); // too small
+        CHECK(!buf[10]);
+
+        CHECK(pcapng::file_header(buf, sizeof(buf), 128) == 60);
+        CHECK(count_packets(buf, 60) == 0);
+
+        unsigned int snaplen;
+        memcpy(&snaplen, buf + 28 + 12, sizeof(snaplen));
+        CHECK(snaplen == 128 + pcapng::ip_tcp_hdr_len);
+}
+
+TEST(pcapng_packet)
+{
+        alignas(capture::record) unsigned char rec_buf[capture::record_size(10)]{};
+        auto &rec = *reinterpret_cast<capture::record*>(rec_buf);
+
+        rec.time = 116'444'736'000'000'000ULL + 0x1'0000'0002ULL;
+        rec.pdu_len = 48 + 100;
+        rec.data_len = 10; // truncated
+        rec.dir = capture::out;
+
+        auto s = pcapng::make_stream(3);
+        unsigned char buf[128];
+
+        auto n = pcapng::packet(buf, 10, s, rec);
+        CHECK(n == 32 + pcapng::pad4(pcapng::ip_tcp_hdr_len + 10));
+        CHECK(s.seq[capture::out] == 1); // is not advanced
+
+        CHECK(pcapng::packet(buf, sizeof(buf), s, rec) == n);
+        CHECK(s.seq[capture::out] == 1 + rec.pdu_len && s.seq[capture::in] == 1);
+
+        auto u32 = [&buf] (size_t off) { unsigned int v; memcpy(&v, buf + off, sizeof(v)); return v; };
+        auto u16_be = [&buf] (size_t off) { return (buf[off] << 8) | buf[off + 1]; };
+
+        CHECK(u32(0) == 6 && u32(4) == n && u32(n - 4) == n);
+        CHECK(u32(12) == 1 && u32(16) == 2); // timestamp, high and low
+        CHECK(u32(20) == pcapng::ip_tcp_hdr_len + 10);
+        CHECK(u32(24) == pcapng::ip_tcp_hdr_len + rec.pdu_len);
+
+        auto ip = 28;
+        CHECK(buf[ip] == 0x45 && buf[ip + 9] == 6);
+        CHECK(u16_be(ip + 2) == int(pcapng::ip_tcp_hdr_len + rec.pdu_len));
+
+        auto tcp = ip + 20;
+        CHECK(u16_be(tcp) == 49152 + 3 && u16_be(tcp + 2) == pcapng::USBIP_PORT);
+
+        rec.dir = capture::in;
+        CHECK(pcapng::packet(buf, sizeof(buf), s, rec) == n);
+        CHECK(u16_be(tcp) == pcapng::USBIP_PORT && u16_be(tcp + 2) == 49152 + 3);
+        CHECK(buf[tcp + 8] == 0 && buf[tcp + 11] == 1 + rec.pdu_len); // ack of the OUT stream
+}
+
+/*
+ * Records drained from the ring make a valid file.
+ */
+TEST(pcapng_from_ring)
+{
+        fixture f(16*1024);
+        auto &r = *f.r;
+
+        for (unsigned int seq = 0; seq < 50; ++seq) {
+                write(r, seq*13 % 300, 0, seq);
+        }
+
+        std::vector<unsigned char> recs(16*1024);
+        recs.resize(r.read(recs.data(), recs.size()));
+
+        std::vector<unsigned char> file(64*1024);
+        auto pos = pcapng::file_header(file.data(), file.size(), 0);
+
+        auto s = pcapng::make_stream(1);
+
+        for_each(recs.data(), recs.size(), [&] (auto &rec)
+        {
+                pos += pcapng::packet(file.data() + pos, file.size() - pos, s, rec);
+        });
+
+        CHECK(pos <= file.size());
+        CHECK(count_packets(file.data(), pos) == 50);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+/*
+ * Minimal harness of the tests of portable headers, they are built by CMakeLists.txt of the repository.
+ * Every *_test.cpp is an executable, its main() calls usbip::test::run(argc, argv).
+ * Arguments are substrings of the names of the tests to run, all tests are run without them.
+ * A failed CHECK is reported and the test goes on, the exit code is the number of failed tests.
+ */
+namespace usbip::test
+{
+
+struct test_case
+{
+        const char *name;
+        std::function<void()> fn;
+};
+
+inline auto& registry()
+{
+        static std::vector<test_case> v;
+        return v;
+}
+
+inline int& failures()
+{
+        static int cnt;
+        return cnt;
+}
+
+struct registrar
+{
+        registrar(const char *name, std::function<void()> fn) { registry().push_back({name, std::move(fn)}); }
+};
+
+inline bool check(bool ok, const char *expr, const char *file, int line)
+{
+        if (!ok) {
+                fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+                ++failures();
+        }
+        return ok;
+}
+
+inline int run(int argc, char *argv[])
+{
+        int failed = 0;
+
+        for (auto &t: registry()) {
+
+                bool selected = argc <= 1;
+                for (int i = 1; i < argc && !selected; ++i) {
+                        selected = strstr(t.name, argv[i]);
+                }
+
+                if (!selected) {
+                        continue;
+                }
+
+                failures() = 0;
+                t.fn();
+
+                printf("%s %s\n", failures() ? "FAIL" : "ok  ", t.name);
+                failed += !!failures();
+        }
+
+        return failed;
+}
+
+} // namespace usbip::test
+
+
+#define TEST(name) \
+        static void test_##name(); \
+        static const usbip::test::registrar name##_registrar(#name, test_##name); \
+        static void test_##name()
+
+#define CHECK(expr) usbip::test::check(static_cast<bool>(expr), #expr, __FILE__, __LINE__)
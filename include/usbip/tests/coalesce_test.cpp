@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. coalesce_test.cpp -o coalesce_test
+ * ./coalesce_test idle_hid prints PDUs per send and the added delay of the replay
+ */
+
+#include "check.h"
+#include <usbip/coalesce.h>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::coalesce;
+
+struct pdu
+{
+        pdu *Next;
+        bool header_only; // CMD_SUBMIT IN, CMD_UNLINK
+        int id;
+        pdu *gathered;
+};
+
+/*
+ * As device_ioctl.cpp does.
+ * @return the sends, each one is the ids of its PDUs
+ */
+auto send_all(std::vector<pdu> &v)
+{
+        for (size_t i = 0; i < v.size(); ++i) {
+                v[i].Next = i + 1 < v.size() ? &v[i + 1] : nullptr;
+        }
+
+        auto header_only = [] (auto &p) { return p.header_only; };
+
+        auto join = [] (auto &last, auto &p)
+        {
+                p.Next = nullptr;
+                last.gathered = &p;
+                p.gathered = nullptr;
+        };
+
+        std::vector<std::vector<int>> sends;
+
+        for (auto p = v.empty() ? nullptr : &v.front(); p; ) {
+                auto &first = *p;
+                first.gathered = nullptr;
+
+                p = gather(first, first.Next, header_only, join);
+
+                auto &s = sends.emplace_back();
+                for (auto g = &first; g; g = g->gathered) {
+                        s.push_back(g->id);
+                }
+        }
+
+        return sends;
+}
+
+auto make_pdus(std::initializer_list<bool> header_only)
+{
+        std::vector<pdu> v;
+        for (auto h: header_only) {
+                v.push_back({ nullptr, h, int(v.size()), nullptr });
+        }
+        return v;
+}
+
+/*
+ * An idle HID device, every event is 1-3 RET_SUBMITs of interrupt IN endpoints, each one is followed by a resubmit.
+ * Some events also cause a PDU that is not coalescible, a control transfer for example.
+ */
+struct replay
+{
+        unsigned long long pdus{};
+        unsigned long long sends{};
+        long long delay{}; // of all PDUs, usec
+        bool ordered = true;
+
+        auto pdus_per_send() const { return double(pdus)/sends; }
+        auto mean_delay() const { return double(delay)/pdus; }
+
+        replay(long long win, int events)
+        {
+                window w;
+                w.configure(win, 0);
+
+                struct item { long long arrived; int id; bool coalescible; };
+                std::vector<item> held;
+
+                int sent_id = -1;
+
+                auto send = [&] (long long now, std::vector<item> &batch)
+                {
+                        std::vector<pdu> v;
+                        for (auto &i: batch) {
+                                v.push_back({ nullptr, i.coalescible, i.id, nullptr });
+                                delay += now - i.arrived;
+                                ordered = ordered && i.id == sent_id + 1;
+                                sent_id = i.id;
+                        }
+
+                        pdus += v.size();
+                        sends += send_all(v).size();
+                        batch.clear();
+                };
+
+                std::mt19937 rnd(7);
+                std::exponential_distribution<> interval(1.0/8000); // usec
+
+                long long now = 0;
+                int id = 0;
+
+                for (int e = 0; e < events; ++e) {
+
+                        now += 100 + static_cast<long long>(interval(rnd));
+
+                        auto cnt = 1 + rnd() % 3;
+                        auto other = rnd() % 20 == 0;
+
+                        for (unsigned int i = 0; i < cnt + other; ++i, now += 50 + rnd() % 200) {
+
+                                if (w.held() && now >= w.deadline()) { // the timer fires
+                                        if (w.expire(w.deadline())) {
+                                                send(w.deadline(), held);
+                                        }
+                                }
+
+                                item it{ now, id++, i < cnt };
+
+                                switch (w.add(now, it.coalescible)) {
+                                case action::open:
+                                case action::hold:
+                                        held.push_back(it);
+                                        break;
+                                case action::flush: // held PDUs go first
+                                case action::send:
+                                        held.push_back(it);
+                                        send(now, held);
+                                }
+                        }
+                }
+
+                if (w.expire(w.deadline())) {
+                        send(w.deadline(), held);
+                }
+
+                ordered = ordered && sent_id == id - 1;
+        }
+};
+
+} // namespace
+
+
+TEST(disabled_window_sends)
+{
+        window w;
+        w.configure(0, 0);
+
+        CHECK(!w.enabled());
+        CHECK(w.add(0, true) == action::send);
+        CHECK(w.add(0, false) == action::send);
+        CHECK(!w.held() && !w.windows());
+}
+
+TEST(configure_clamps_batch)
+{
+        window w;
+
+        w.configure(-1, 0);
+        CHECK(!w.enabled() && w.max_batch() == default_max_batch);
+
+        w.configure(500, 1000);
+        CHECK(w.length() == 500 && w.max_batch() == max_batch_limit);
+}
+
+TEST(window_is_closed_by_timer)
+{
+        window w;
+        w.configure(500, 0);
+
+        CHECK(w.add(100, true) == action::open);
+        CHECK(w.deadline() == 600);
+        CHECK(w.add(200, true) == action::hold);
+        CHECK(w.held() == 2);
+
+        CHECK(!w.expire(599)); // has fired too early
+        CHECK(w.expire(600) == 2);
+        CHECK(!w.held() && !w.expire(700));
+
+        CHECK(w.windows() == 1 && w.closed(closed_by::timer) == 1);
+}
+
+TEST(late_timer_is_closed_by_add)
+{
+        window w;
+        w.configure(500, 0);
+
+        w.add(0, true);
+        CHECK(w.add(500, true) == action::flush);
+        CHECK(!w.held() && w.closed(closed_by::timer) == 1);
+}
+
+TEST(window_is_closed_by_size)
+{
+        window w;
+        w.configure(500, 4);
+
+        CHECK(w.add(0, true) == action::open);
+        CHECK(w.add(1, true) == action::hold);
+        CHECK(w.add(2, true) == action::hold);
+        CHECK(w.add(3, true) == action::flush); // three held and this one
+        CHECK(!w.held() && w.closed(closed_by::size) == 1);
+
+        CHECK(w.add(4, true) == action::open);
+        CHECK(w.windows() == 2);
+}
+
+TEST(window_is_closed_by_traffic)
+{
+        window w;
+        w.configure(500, 0);
+
+        w.add(0, true);
+        CHECK(w.add(10, false) == action::flush);
+        CHECK(w.add(20, false) == action::send);
+        CHECK(w.closed(closed_by::traffic) == 1);
+}
+
+TEST(take_closes_window)
+{
+        window w;
+        w.configure(500, 0);
+
+        w.add(0, true);
+        w.add(1, true);
+        CHECK(w.take() == 2);
+        CHECK(!w.held() && !w.take());
+
+        w.reset_stats();
+        CHECK(!w.windows() && !w.closed(closed_by::timer));
+}
+
+TEST(gather_header_only)
+{
+        auto v = make_pdus({ true, true, true, false, true, true, false, false });
+        auto s = send_all(v);
+
+        CHECK(s.size() == 5);
+        CHECK((s[0] == std::vector{0, 1, 2}));
+        CHECK((s[1] == std::vector{3})); // has a payload
+        CHECK((s[2] == std::vector{4, 5}));
+        CHECK((s[3] == std::vector{6}));
+        CHECK((s[4] == std::vector{7}));
+}
+
+TEST(gather_is_limited)
+{
+        std::vector<pdu> v;
+        for (int i = 0; i < 2*int(max_batch_limit) + 1; ++i) {
+                v.push_back({ nullptr, true, i, nullptr });
+        }
+
+        auto s = send_all(v);
+        CHECK(s.size() == 3);
+        CHECK(s[0].size() == max_batch_limit && s[1].size() == max_batch_limit && s[2].size() == 1);
+        CHECK(s[1].front() == int(max_batch_limit));
+}
+
+/*
+ * The replay of 200k idle HID events, PDUs per send is the gathering ratio.
+ */
+TEST(idle_hid)
+{
+        enum { events = 200'000 };
+
+        replay off(0, events);
+        replay w500(500, events);
+        replay w2000(2000, events);
+
+        for (auto [win, r]: { std::pair{0, &off}, {500, &w500}, {2000, &w2000} }) {
+                printf("window %4d us: %.2f PDUs/send, %.0f us mean added delay\n",
+                        win, r->pdus_per_send(), r->mean_delay());
+
+                CHECK(r->ordered);
+                CHECK(r->mean_delay() <= win);
+        }
+
+        CHECK(off.pdus == w500.pdus && off.pdus == w2000.pdus);
+        CHECK(off.pdus_per_send() == 1 && !off.delay);
+
+        CHECK(w500.pdus_per_send() > 1.5);
+        CHECK(w2000.pdus_per_send() >= w500.pdus_per_send());
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * End-to-end test of the compression extension, a raw USB/IP client talks to userspace/loopback.
+ * The target compress_loopback_test of CMakeLists.txt of the repository or
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. -I../../../userspace/posix compress_loopback_test.cpp -o compress_loopback_test
+ * ./compress_loopback_test path/to/loopback
+ */
+
+#include "check.h"
+#include "loopback.h"
+
+#include <usbip/proto.h>
+#include <usbip/proto_op.h>
+#include <usbip/compress.h>
+
+#include <cstring>
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+using bytes = std::vector<unsigned char>;
+
+const char *g_loopback = "./loopback";
+
+bool recv_all(int s, void *buf, size_t len)
+{
+        for (auto p = static_cast<char*>(buf); len; ) {
+                auto n = recv(s, p, len, 0);
+                if (n <= 0) {
+                        return false;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return true;
+}
+
+bool send_all(int s, const void *buf, size_t len)
+{
+        for (auto p = static_cast<const char*>(buf); len; ) {
+                auto n = send(s, p, len, MSG_NOSIGNAL);
+                if (n <= 0) {
+                        return false;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return true;
+}
+
+/*
+ * Thresholds of the offer, as the driver sets them from the registry.
+ */
+constexpr auto control_min = 64;
+constexpr auto bulk_min = 4096;
+
+class client
+{
+public:
+        compress::extension ext{}; // negotiated
+
+        size_t wire_out{};
+        size_t wire_in{};
+
+        explicit client(int sock) : m_sock(sock) {}
+        ~client() { if (m_sock >= 0) close(m_sock); }
+
+        client(const client&) = delete;
+        client& operator=(const client&) = delete;
+
+        /*
+         * OP_REQ_IMPORT of 1-1.
+         */
+        bool import(bool offer)
+        {
+                struct {
+                        op_common hdr;
+                        op_import_request body;
+                } __attribute__((packed)) req{};
+
+                req.hdr = { htons(USBIP_VERSION), htons(OP_REQ_IMPORT), 0 };
+                strcpy(req.body.busid, "1-1");
+
+                compress::extension o{};
+                if (offer) {
+                        memcpy(o.magic, compress::magic, sizeof(o.magic));
+                        o.codecs = compress::codec_lz4;
+                        o.min_shift[static_cast<int>(compress::ep_type::control)] = compress::to_shift(control_min);
+                        o.min_shift[static_cast<int>(compress::ep_type::bulk)] = compress::to_shift(bulk_min);
+
+                        if (!CHECK(compress::put(req.body.busid, o))) {
+                                return false;
+                        }
+                }
+
+                op_common rc{};
+                op_import_reply rep{};
+
+                if (!(CHECK(send_all(m_sock, &req, sizeof(req))) &&
+                      CHECK(recv_all(m_sock, &rc, sizeof(rc))) &&
+                      CHECK(ntohs(rc.code) == OP_REP_IMPORT && !rc.status) &&
+                      CHECK(recv_all(m_sock, &rep, sizeof(rep))))) {
+                        return false;
+                }
+
+                ext = offer ? compress::accepted(o, rep.udev.path) : compress::extension{};
+
+                return CHECK(!strcmp(rep.udev.busid, "1-1")) &&
+                       CHECK(!strncmp(rep.udev.path, "/sys/devices/", 13));
+        }
+
+        /*
+         * CMD_SUBMIT of bulk endpoint 1, loopback returns the data of the last OUT transfer to IN.
+         * @param packed is set if the payload of RET_SUBMIT was compressed
+         * @return actual_length, negative on error
+         */
+        int submit(bool out, const bytes &data, size_t len, bytes &in, bool &packed)
+        {
+                header h{};
+                h.command = htonl(CMD_SUBMIT);
+                h.seqnum = htonl(++m_seqnum);
+                h.direction = htonl(out ? direction::out : direction::in);
+                h.ep = htonl(1);
+
+                auto &cs = h.cmd_submit;
+                cs.transfer_buffer_length = htonl(static_cast<UINT32>(len));
+                cs.number_of_packets = htonl(static_cast<UINT32>(number_of_packets_non_isoch));
+
+                bytes payload = out ? data : bytes{};
+
+                if (auto t = compress::threshold(ext, 2); out && t && len >= t) { // as pack_payload does
+                        bytes frame(len);
+                        if (auto n = compress::pack(data.data(), len, frame.data(), m_table.data())) {
+                                frame.resize(n);
+                                payload = std::move(frame);
+                                cs.transfer_flags = htonl(compress::submit_flag);
+                        }
+                }
+
+                wire_out += sizeof(h) + payload.size();
+
+                header r{};
+                if (!(CHECK(send_all(m_sock, &h, sizeof(h))) &&
+                      CHECK(send_all(m_sock, payload.data(), payload.size())) &&
+                      CHECK(recv_all(m_sock, &r, sizeof(r))) &&
+                      CHECK(ntohl(r.command) == RET_SUBMIT) &&
+                      CHECK(ntohl(r.seqnum) == m_seqnum) &&
+                      CHECK(!r.ret_submit.status))) {
+                        return -1;
+                }
+
+                int actual = ntohl(r.ret_submit.actual_length);
+                packed = ntohl(r.ret_submit.ext_flags) & compress::ret_flag;
+
+                wire_in += sizeof(r);
+                in.clear();
+
+                if (out || !actual) {
+                        return CHECK(!packed) ? actual : -1;
+                }
+
+                in.resize(actual);
+
+                if (!packed) {
+                        wire_in += actual;
+                        return CHECK(recv_all(m_sock, in.data(), actual)) ? actual : -1;
+                }
+
+                unsigned char frame[compress::frame_hdr];
+                if (!(CHECK(ext.codecs) && CHECK(recv_all(m_sock, frame, sizeof(frame))))) {
+                        return -1;
+                }
+
+                auto blk_len = compress::block_size(frame);
+                if (!CHECK(compress::is_valid_block_size(blk_len, actual))) {
+                        return -1;
+                }
+
+                bytes blk(blk_len);
+                wire_in += sizeof(frame) + blk_len;
+
+                return CHECK(recv_all(m_sock, blk.data(), blk_len)) &&
+                       CHECK(compress::unpack(blk.data(), blk_len, in.data(), actual)) ? actual : -1;
+        }
+
+        /*
+         * OUT and IN of the same data.
+         * @return the payload of RET_SUBMIT IN was compressed
+         */
+        bool round_trip(const bytes &data)
+        {
+                bytes in;
+                bool packed{};
+
+                CHECK(submit(true, data, data.size(), in, packed) == int(data.size()));
+                CHECK(submit(false, {}, data.size(), in, packed) == int(data.size()));
+                CHECK(in == data);
+
+                return packed;
+        }
+
+private:
+        int m_sock;
+        unsigned int m_seqnum{};
+        std::vector<unsigned int> m_table = std::vector<unsigned int>(lz4::hash_size);
+};
+
+bytes text(size_t n)
+{
+        static const char *words[] { "scanner ", "image ", "block ", "firmware ", "0000 ", "ffff " };
+        std::mt19937 rnd(3);
+
+        bytes v;
+        while (v.size() < n) {
+                auto w = words[rnd() % std::size(words)];
+                v.insert(v.end(), w, w + strlen(w));
+        }
+
+        v.resize(n);
+        return v;
+}
+
+bytes noise(size_t n)
+{
+        std::mt19937 rnd(5);
+
+        bytes v(n);
+        for (auto &b: v) {
+                b = static_cast<unsigned char>(rnd());
+        }
+
+        return v;
+}
+
+} // namespace
+
+
+TEST(offer_is_accepted)
+{
+        test::loopback_server srv(g_loopback);
+        if (!CHECK(srv)) {
+                return;
+        }
+
+        client c(srv.connect());
+        if (!(c.import(true) && CHECK(c.ext.codecs == compress::codec_lz4))) {
+                return;
+        }
+
+        CHECK(c.round_trip(text(64*1024)));
+        CHECK(c.round_trip(text(100*1024 + 7)));
+        CHECK(!c.round_trip(noise(8192))); // does not shrink
+        CHECK(!c.round_trip(text(1000))); // below the bulk threshold
+
+        auto plain = 2*(sizeof(header) + 64*1024) + 2*(sizeof(header) + 100*1024 + 7);
+        CHECK(c.wire_out + c.wire_in < plain);
+}
+
+TEST(offer_is_declined)
+{
+        test::loopback_server srv(g_loopback, { "-z" });
+        if (!CHECK(srv)) {
+                return;
+        }
+
+        client c(srv.connect());
+        if (!(c.import(true) && CHECK(!c.ext.codecs))) {
+                return;
+        }
+
+        CHECK(!c.round_trip(text(64*1024)));
+        CHECK(c.wire_out == 2*sizeof(header) + 64*1024);
+        CHECK(c.wire_in == 2*sizeof(header) + 64*1024);
+}
+
+TEST(no_offer)
+{
+        test::loopback_server srv(g_loopback);
+        if (!CHECK(srv)) {
+                return;
+        }
+
+        client c(srv.connect());
+        if (c.import(false)) {
+                CHECK(!c.round_trip(text(64*1024)));
+                CHECK(!c.round_trip(bytes{})); // zero-length transfers
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc > 1) {
+                g_loopback = argv[1];
+                --argc;
+                ++argv;
+        }
+
+        return usbip::test::run(argc, argv);
+}
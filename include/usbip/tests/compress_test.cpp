@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O1 -g -Wall -Wextra -fsanitize=address,undefined -I../.. -I../../../userspace/posix \
+ *     compress_test.cpp -o compress_test -ldl
+ *
+ * If liblz4.so.1 is installed, the blocks are cross-checked with the reference implementation.
+ */
+
+#include "check.h"
+#include <usbip/compress.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <dlfcn.h>
+
+namespace
+{
+
+using namespace usbip;
+using bytes = std::vector<unsigned char>;
+
+/*
+ * @param kind 0 - noise, 1 - few symbols, 2 - short period, 3 - zeroes and noise, 4 - text
+ */
+bytes make_data(std::mt19937 &rnd, size_t len, unsigned int kind)
+{
+        static const char *words[] { "scanner ", "image ", "block ", "firmware ", "0000 ", "ffff " };
+        bytes v(len);
+
+        for (size_t i = 0; i < len; ) {
+                switch (kind) {
+                case 0:
+                        v[i++] = static_cast<unsigned char>(rnd());
+                        break;
+                case 1:
+                        v[i++] = static_cast<unsigned char>(rnd() % 4);
+                        break;
+                case 2:
+                        v[i] = static_cast<unsigned char>(i % 7);
+                        ++i;
+                        break;
+                case 3:
+                        v[i] = i < len/2 ? 0 : static_cast<unsigned char>(rnd() % 3);
+                        ++i;
+                        break;
+                default:
+                        for (auto w = words[rnd() % std::size(words)]; *w && i < len; v[i++] = *w++);
+                }
+        }
+
+        return v;
+}
+
+struct codec
+{
+        std::vector<unsigned int> table = std::vector<unsigned int>(lz4::hash_size);
+
+        bytes compress(const bytes &src, size_t cap)
+        {
+                bytes dst(cap);
+                dst.resize(lz4::compress(src.data(), src.size(), dst.data(), cap, table.data()));
+                return dst;
+        }
+};
+
+/*
+ * The reference implementation, it is loaded at run time, so the test does not depend on it.
+ */
+class liblz4
+{
+public:
+        liblz4() : m_lib(dlopen("liblz4.so.1", RTLD_NOW))
+        {
+                if (m_lib) {
+                        m_compress = reinterpret_cast<compress_t*>(dlsym(m_lib, "LZ4_compress_default"));
+                        m_decompress = reinterpret_cast<decompress_t*>(dlsym(m_lib, "LZ4_decompress_safe"));
+                }
+        }
+
+        ~liblz4()
+        {
+                if (m_lib) {
+                        dlclose(m_lib);
+                }
+        }
+
+        liblz4(const liblz4&) = delete;
+        liblz4& operator=(const liblz4&) = delete;
+
+        explicit operator bool() const noexcept { return m_compress && m_decompress; }
+
+        bytes compress(const bytes &src) const
+        {
+                bytes dst(lz4::bound(src.size()));
+                auto n = m_compress(reinterpret_cast<const char*>(src.data()), reinterpret_cast<char*>(dst.data()),
+                                    int(src.size()), int(dst.size()));
+                dst.resize(n > 0 ? n : 0);
+                return dst;
+        }
+
+        /*
+         * @return decompressed size, negative if the block is malformed
+         */
+        int decompress(const bytes &src, bytes &dst) const
+        {
+                return m_decompress(reinterpret_cast<const char*>(src.data()), reinterpret_cast<char*>(dst.data()),
+                                    int(src.size()), int(dst.size()));
+        }
+
+private:
+        using compress_t = int(const char*, char*, int, int);
+        using decompress_t = int(const char*, char*, int, int);
+
+        void *m_lib;
+        compress_t *m_compress{};
+        decompress_t *m_decompress{};
+};
+
+} // namespace
+
+
+TEST(lz4_round_trip_fuzz)
+{
+        std::mt19937 rnd(1);
+        codec c;
+
+        int compressed = 0;
+        bool ok = true;
+
+        for (int i = 0; i < 50'000; ++i) {
+                auto len = rnd() % 5000;
+                auto src = make_data(rnd, len, rnd() % 5);
+
+                auto cap = rnd() % 2 ? lz4::bound(len) : (len ? rnd() % len : 0); // too small sometimes
+                auto blk = c.compress(src, cap);
+                if (blk.empty()) {
+                        continue;
+                }
+
+                ++compressed;
+                ok = ok && blk.size() <= cap;
+
+                bytes dst(len);
+                ok = ok && lz4::decompress(blk.data(), blk.size(), dst.data(), dst.size()) && dst == src;
+        }
+
+        CHECK(ok);
+        CHECK(compressed > 25'000);
+}
+
+TEST(lz4_incompressible_fits_bound)
+{
+        std::mt19937 rnd(2);
+        codec c;
+
+        for (size_t len: { 0, 1, 13, 255, 256, 4096, 65'536 + 3 }) {
+                auto src = make_data(rnd, len, 0);
+                auto blk = c.compress(src, lz4::bound(len));
+
+                bytes dst(len);
+                CHECK(!blk.empty() || !len);
+                CHECK(lz4::decompress(blk.data(), blk.size(), dst.data(), len) && dst == src);
+        }
+}
+
+/*
+ * The decoder must not read or write out of bounds whatever it gets, ASan/UBSan catch that.
+ */
+TEST(lz4_malformed_blocks)
+{
+        std::mt19937 rnd(3);
+        codec c;
+
+        int rejected = 0;
+
+        for (int i = 0; i < 20'000; ++i) {
+                auto len = 16 + rnd() % 2000;
+                auto src = make_data(rnd, len, 1 + rnd() % 4);
+
+                auto blk = c.compress(src, lz4::bound(len));
+                if (blk.empty()) {
+                        continue;
+                }
+
+                switch (rnd() % 3) {
+                case 0:
+                        blk[rnd() % blk.size()] ^= static_cast<unsigned char>(1 << rnd() % 8);
+                        break;
+                case 1:
+                        blk.resize(rnd() % blk.size()); // truncated
+                        break;
+                case 2:
+                        len += rnd() % 2 ? 1 : -1; // the header has other length
+                }
+
+                bytes dst(len);
+                rejected += !lz4::decompress(blk.data(), blk.size(), dst.data(), dst.size());
+        }
+
+        CHECK(rejected > 10'000);
+
+        unsigned char dst[16];
+        const unsigned char far_offset[] { 0x10, 'a', 0xFF, 0x00 }; // before the start of the output
+        CHECK(!lz4::decompress(far_offset, sizeof(far_offset), dst, sizeof(dst)));
+
+        const unsigned char zero_offset[] { 0x10, 'a', 0x00, 0x00 };
+        CHECK(!lz4::decompress(zero_offset, sizeof(zero_offset), dst, sizeof(dst)));
+}
+
+TEST(liblz4_cross_check)
+{
+        liblz4 ref;
+        if (!ref) { // it is not installed
+                return;
+        }
+
+        std::mt19937 rnd(4);
+        codec c;
+        bool ok = true;
+
+        for (int i = 0; i < 5'000; ++i) {
+                auto len = 1 + rnd() % (rnd() % 8 ? 5000 : 300'000);
+                auto src = make_data(rnd, len, rnd() % 5);
+
+                if (auto blk = c.compress(src, lz4::bound(len)); ok) { // ours -> LZ4_decompress_safe
+                        bytes dst(len);
+                        ok = ref.decompress(blk, dst) == int(len) && dst == src;
+                }
+
+                if (auto blk = ref.compress(src); ok) { // LZ4_compress_default -> ours
+                        bytes dst(len);
+                        ok = !blk.empty() && lz4::decompress(blk.data(), blk.size(), dst.data(), len) && dst == src;
+                }
+        }
+
+        CHECK(ok);
+}
+
+TEST(frame_round_trip)
+{
+        std::mt19937 rnd(5);
+        std::vector<unsigned int> table(lz4::hash_size);
+
+        auto src = make_data(rnd, 64*1024, 4);
+        bytes frame(src.size());
+
+        auto n = compress::pack(src.data(), src.size(), frame.data(), table.data());
+        CHECK(n > compress::frame_hdr && n < src.size()/2);
+
+        auto blk = compress::block_size(frame.data());
+        CHECK(blk == n - compress::frame_hdr);
+        CHECK(compress::is_valid_block_size(blk, src.size()));
+
+        bytes dst(src.size());
+        CHECK(compress::unpack(frame.data() + compress::frame_hdr, blk, dst.data(), dst.size()) && dst == src);
+
+        CHECK(!compress::is_valid_block_size(0, src.size()));
+        CHECK(!compress::is_valid_block_size(src.size(), src.size())); // must shrink
+}
+
+TEST(frame_does_not_grow)
+{
+        std::mt19937 rnd(6);
+        std::vector<unsigned int> table(lz4::hash_size);
+
+        auto src = make_data(rnd, 8192, 0);
+        bytes frame(src.size());
+
+        CHECK(!compress::pack(src.data(), src.size(), frame.data(), table.data()));
+        CHECK(!compress::pack(src.data(), compress::frame_hdr + 1, frame.data(), table.data()));
+}
+
+TEST(thresholds)
+{
+        CHECK(compress::to_shift(0) == 0);
+        CHECK(compress::to_shift(1) == 1);
+        CHECK(compress::to_shift(64) == 6);
+        CHECK(compress::to_shift(65) == 7);
+        CHECK(compress::to_shift(1UL << compress::max_shift) == compress::max_shift);
+        CHECK(compress::to_shift((1UL << compress::max_shift) + 1) == 0);
+
+        compress::extension ext{};
+        ext.codecs = compress::codec_lz4;
+        ext.min_shift[0] = 6;
+        ext.min_shift[1] = 12;
+
+        CHECK(compress::threshold(ext, 0) == 64);
+        CHECK(compress::threshold(ext, 2) == 4096);
+        CHECK(!compress::threshold(ext, 3)); // interrupt is disabled
+        CHECK(!compress::threshold(ext, 1)); // isochronous
+
+        ext.codecs = 0;
+        CHECK(!compress::threshold(ext, 2));
+}
+
+TEST(extension_negotiation)
+{
+        compress::extension offer{};
+        memcpy(offer.magic, compress::magic, sizeof(offer.magic));
+        offer.codecs = compress::codec_lz4;
+        offer.min_shift[1] = 12;
+
+        char busid[BUS_ID_SIZE]{ "1-1" };
+        CHECK(compress::put(busid, offer));
+        CHECK(!strcmp(busid, "1-1"));
+
+        compress::extension got{};
+        CHECK(compress::get(got, busid) && !memcmp(&got, &offer, sizeof(got)));
+
+        char path[DEV_PATH_MAX]{ "/sys/devices/pci0000:00/usb1/1-1" };
+        CHECK(!compress::accepted(offer, path).codecs); // the server does not know the extension
+
+        CHECK(compress::put(path, compress::accept(got, compress::codec_lz4)));
+        CHECK(compress::accepted(offer, path).codecs == compress::codec_lz4);
+
+        CHECK(!compress::accept(got, 0).codecs); // declined
+
+        char full[BUS_ID_SIZE];
+        memset(full, 'x', sizeof(full));
+        CHECK(!compress::put(full, offer)); // no room after the terminating zero
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
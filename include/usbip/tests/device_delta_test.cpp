@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. device_delta_test.cpp -o device_delta_test
+ */
+
+#include "check.h"
+#include <usbip/device_delta.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::delta;
+
+struct imported
+{
+        unsigned int devid;
+        unsigned int speed;
+        unsigned short vendor;
+        unsigned short product;
+
+        std::string host;
+        std::string service;
+        std::string busid;
+        std::string serial;
+
+        auto operator<=>(const imported&) const = default;
+};
+
+auto ref(const std::string &s) { return string_ref{ s.data(), s.size() }; }
+auto str(const string_ref &s) { return std::string(s.data, s.len); }
+
+auto make_device(unsigned int port, const imported &i)
+{
+        return device{ port, i.devid, i.speed, i.vendor, i.product,
+                       ref(i.host), ref(i.service), ref(i.busid), ref(i.serial) };
+}
+
+auto make_imported(const device &d)
+{
+        return imported{ d.devid, d.speed, d.vendor, d.product, str(d.host), str(d.service), str(d.busid), str(d.serial) };
+}
+
+/*
+ * As get_imported_devices_delta does.
+ */
+struct driver
+{
+        unsigned long long first;
+        unsigned long long generation = first;
+
+        std::map<unsigned int, imported> ports{};
+        std::map<unsigned int, unsigned long long> port_generation{};
+
+        void plugin(unsigned int port, const imported &i) { ports[port] = i; port_generation[port] = ++generation; }
+        void plugout(unsigned int port) { ports.erase(port); port_generation[port] = ++generation; }
+
+        auto get(unsigned long long since, reply &r)
+        {
+                r = make_reply(since, first, generation);
+
+                std::vector<unsigned char> buf;
+                if (r == reply::unchanged) {
+                        return buf;
+                }
+
+                for (size_t size = 0; ; ) { // the length is reported if the buffer is too small
+                        buf.resize(size);
+                        writer w(buf.data(), buf.size());
+
+                        for (auto [port, gen]: port_generation) {
+                                if (r == reply::changes && gen <= since) {
+                                        //
+                                } else if (auto i = ports.find(port); i != ports.end()) {
+                                        w.present(make_device(port, i->second));
+                                } else if (r == reply::changes) {
+                                        w.removed(port);
+                                }
+                        }
+
+                        if (!w.overflow()) {
+                                buf.resize(w.size());
+                                return buf;
+                        }
+                        size = w.size();
+                }
+        }
+};
+
+/*
+ * As libusbip merge does.
+ */
+struct client
+{
+        unsigned long long generation{};
+        std::map<unsigned int, imported> devices{};
+
+        unsigned int added{};
+        unsigned int removed{};
+
+        bool update(driver &drv)
+        {
+                reply r;
+                auto buf = drv.get(generation, r);
+
+                if (r == reply::unchanged) {
+                        return true;
+                } else if (r == reply::full) {
+                        devices.clear();
+                }
+
+                added = removed = 0;
+
+                reader rd(buf.data(), buf.size());
+                kind k;
+                device d;
+
+                while (rd.next(k, d)) {
+                        if (k == kind::removed) {
+                                removed += static_cast<unsigned int>(devices.erase(d.port));
+                        } else {
+                                devices[d.port] = make_imported(d);
+                                ++added;
+                        }
+                }
+
+                if (rd.error()) {
+                        generation = 0;
+                        return false;
+                }
+
+                generation = drv.generation;
+                return true;
+        }
+};
+
+const imported mouse{ 1, 2, 0x046D, 0xC077, "server", "3240", "1-1", "" };
+const imported disk{ 0x10002, 5, 0x0781, 0x5581, "fe80::1%eth0", "3240", "2-3.1", "4C530001230612115471" };
+
+/*
+ * @return records in the buffer or -1 if it was rejected
+ */
+int count(const void *data, size_t len)
+{
+        reader rd(data, len);
+        kind k;
+        device d;
+
+        int cnt = 0;
+        for ( ; rd.next(k, d); ++cnt);
+
+        return rd.error() ? -1 : cnt;
+}
+
+/*
+ * The exact size on the heap, so reads past the end are caught by the sanitizers.
+ */
+int count(const std::vector<unsigned char> &v)
+{
+        auto p = std::make_unique<unsigned char[]>(v.size());
+        std::copy(v.begin(), v.end(), p.get());
+        return count(p.get(), v.size());
+}
+
+} // namespace
+
+
+TEST(round_trip)
+{
+        unsigned char buf[256];
+        writer w(buf, sizeof(buf));
+
+        w.present(make_device(3, disk));
+        w.removed(0xFFFF'FFFF);
+        w.present(make_device(1, mouse));
+
+        CHECK(!w.overflow());
+
+        reader rd(buf, w.size());
+        kind k;
+        device d;
+
+        CHECK(rd.next(k, d) && k == kind::present && d.port == 3 && make_imported(d) == disk);
+        CHECK(rd.next(k, d) && k == kind::removed && d.port == 0xFFFF'FFFF);
+        CHECK(rd.next(k, d) && k == kind::present && d.port == 1 && make_imported(d) == mouse);
+        CHECK(!rd.next(k, d) && !rd.error());
+}
+
+TEST(writer_reports_size)
+{
+        unsigned char buf[8];
+        writer w(buf, sizeof(buf));
+
+        w.present(make_device(1, disk));
+        CHECK(w.overflow() && w.size() > sizeof(buf));
+
+        auto need = w.size();
+        std::vector<unsigned char> v(need);
+
+        writer exact(v.data(), v.size());
+        exact.present(make_device(1, disk));
+        CHECK(!exact.overflow() && exact.size() == need);
+
+        writer empty(nullptr, 0);
+        CHECK(!empty.size() && !empty.overflow());
+        CHECK(!count(nullptr, 0));
+}
+
+TEST(length_of_unterminated_string)
+{
+        char s[4]{ 'a', 'b', 'c', 'd' };
+        CHECK(length(s, sizeof(s)) == 4);
+
+        s[1] = '\0';
+        CHECK(length(s, sizeof(s)) == 1);
+}
+
+TEST(make_reply)
+{
+        CHECK(make_reply(0, 100, 100) == reply::full); // the first call
+        CHECK(make_reply(99, 100, 105) == reply::full); // the previous instance of the driver
+        CHECK(make_reply(100, 100, 100) == reply::unchanged);
+        CHECK(make_reply(103, 100, 105) == reply::changes);
+        CHECK(make_reply(105, 100, 105) == reply::unchanged);
+}
+
+/*
+ * A generation the driver did not issue yet can't be a base for the changes.
+ */
+TEST(generation_gap_gets_full_snapshot)
+{
+        CHECK(make_reply(106, 100, 105) == reply::full);
+
+        driver drv{ .first = 1000 };
+        drv.plugin(1, mouse);
+        drv.plugin(2, disk);
+
+        client c{ .generation = 2000 }; // another instance of the driver was running
+        c.devices[7] = mouse; // stale
+
+        CHECK(c.update(drv));
+        CHECK(c.devices.size() == 2 && !c.devices.contains(7));
+        CHECK(c.generation == drv.generation);
+
+        driver restarted{ .first = 10 };
+        restarted.plugin(4, disk);
+
+        CHECK(c.update(restarted)); // its generations are less
+        CHECK(c.devices.size() == 1 && c.devices[4] == disk);
+}
+
+TEST(added_removed_unchanged)
+{
+        driver drv{ .first = 1000 };
+        client c;
+
+        CHECK(c.update(drv) && c.devices.empty() && c.generation == 1000);
+
+        drv.plugin(1, mouse);
+        drv.plugin(2, disk);
+        CHECK(c.update(drv) && c.added == 2 && !c.removed);
+        CHECK(c.devices[1] == mouse && c.devices[2] == disk);
+
+        auto gen = c.generation;
+        CHECK(c.update(drv) && c.generation == gen); // unchanged
+
+        drv.plugout(1);
+        drv.plugin(3, mouse);
+        CHECK(c.update(drv) && c.added == 1 && c.removed == 1); // port 2 is unchanged and is not sent
+        CHECK(c.devices.size() == 2 && c.devices[2] == disk && c.devices[3] == mouse);
+
+        drv.plugout(2);
+        drv.plugin(2, mouse); // the same port again
+        CHECK(c.update(drv) && c.added == 1 && !c.removed && c.devices[2] == mouse);
+
+        client fresh;
+        CHECK(fresh.update(drv) && fresh.devices == c.devices);
+}
+
+TEST(truncated_is_rejected)
+{
+        std::vector<unsigned char> v(256);
+
+        writer w(v.data(), v.size());
+        w.present(make_device(1, disk));
+        v.resize(w.size());
+
+        CHECK(count(v) == 1);
+
+        bool ok = true;
+        for (auto len = v.size(); ok && --len; ) {
+                ok = count(std::vector(v.begin(), v.begin() + len)) == -1;
+        }
+        CHECK(ok);
+
+        std::vector<unsigned char> removed{ static_cast<unsigned char>(kind::removed) };
+        CHECK(count(removed) == -1); // no port
+}
+
+TEST(malformed_is_rejected)
+{
+        auto present = static_cast<unsigned char>(kind::present);
+        auto removed = static_cast<unsigned char>(kind::removed);
+
+        CHECK(count({ 0 }) == -1);
+        CHECK(count({ 7 }) == -1); // unknown kind
+
+        std::vector<unsigned char> endless(64, 0x80); // the varint is not terminated
+        endless.front() = removed;
+        CHECK(count(endless) == -1);
+
+        std::vector<unsigned char> long_varint(12, 0x80); // longer than 64 bits
+        long_varint.front() = removed;
+        long_varint.back() = 0x01;
+        CHECK(count(long_varint) == -1);
+
+        CHECK(count({ removed, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F }) == 1); // 0xFFFF'FFFF
+        CHECK(count({ removed, 0x80, 0x80, 0x80, 0x80, 0x10 }) == -1); // 1 << 32
+
+        std::vector<unsigned char> vendor{ present, 1, 1, 1, 0x80, 0x80, 0x04 }; // 1 << 16
+        CHECK(count(vendor) == -1);
+
+        std::vector<unsigned char> past_end{ present, 1, 1, 1, 1, 1, 0x7F, 'a' }; // past the end
+        CHECK(count(past_end) == -1);
+
+        std::vector<unsigned char> huge{ present, 1, 1, 1, 1, 1 }; // the length does not fit size_t
+        huge.insert(huge.end(), 9, 0xFF);
+        huge.push_back(0x01);
+        CHECK(count(huge) == -1);
+}
+
+/*
+ * A record after a malformed one is not read.
+ */
+TEST(error_is_sticky)
+{
+        auto removed = static_cast<unsigned char>(kind::removed);
+        std::vector<unsigned char> v{ removed, 1, 9, removed, 2 };
+
+        reader rd(v.data(), v.size());
+        kind k;
+        device d;
+
+        CHECK(rd.next(k, d) && d.port == 1);
+        CHECK(!rd.next(k, d) && rd.error());
+        CHECK(!rd.next(k, d) && rd.error());
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
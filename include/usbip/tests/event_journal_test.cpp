@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. event_journal_test.cpp -o event_journal_test
+ */
+
+#include "check.h"
+#include <usbip/event_journal.h>
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct info
+{
+        char location[64];
+};
+
+enum class state { unplugged, connecting, plugged };
+
+using journal_t = event_journal<info, state>;
+using seqnum_t = journal_t::seqnum_t;
+
+struct event
+{
+        std::string location;
+        journal_t::source_id_t source_id;
+        int port;
+        state st;
+        seqnum_t seqnum;
+        unsigned int flags;
+};
+
+struct fixture
+{
+        std::vector<journal_t::source> sources;
+        std::vector<journal_t::record> records;
+        journal_t j{};
+
+        fixture(size_t source_cnt, size_t record_cnt) : sources(source_cnt), records(record_cnt)
+        {
+                j.init(sources.data(), sources.size(), records.data(), records.size());
+        }
+
+        seqnum_t add(journal_t::source_id_t id, int port, state st)
+        {
+                auto &i = j.prepare(id);
+                snprintf(i.location, sizeof(i.location), "host/%u", id);
+                return j.commit(port, st);
+        }
+
+        auto read(seqnum_t &cursor, size_t max_cnt = 1000) const
+        {
+                std::vector<event> v;
+
+                j.read(cursor, max_cnt, [&v] (auto &i, auto id, auto port, auto st, auto seqnum, auto flags)
+                {
+                        v.push_back({ i.location, id, port, st, seqnum, flags });
+                });
+
+                return v;
+        }
+};
+
+} // namespace
+
+
+TEST(records_are_compact)
+{
+        CHECK(sizeof(journal_t::record) <= 16);
+        CHECK(sizeof(journal_t::record) < sizeof(info)/2);
+}
+
+TEST(read_in_order)
+{
+        fixture f(4, 8);
+        auto cursor = f.j.next_seqnum();
+
+        f.add(10, 0, state::connecting);
+        f.add(10, 3, state::plugged);
+        f.add(20, 0, state::connecting);
+
+        auto v = f.read(cursor);
+        if (!CHECK(v.size() == 3)) {
+                return;
+        }
+
+        CHECK(v[0].location == "host/10" && v[0].port == 0 && v[0].st == state::connecting);
+        CHECK(v[1].location == "host/10" && v[1].port == 3 && v[1].st == state::plugged);
+        CHECK(v[2].location == "host/20" && v[2].source_id == 20);
+        CHECK(v[1].seqnum == v[0].seqnum + 1 && v[2].seqnum == v[1].seqnum + 1);
+        CHECK(!v[0].flags && !v[1].flags && !v[2].flags);
+
+        CHECK(!f.j.available(cursor));
+        CHECK(f.read(cursor).empty());
+}
+
+TEST(readers_have_own_cursors)
+{
+        fixture f(4, 8);
+        auto a = f.j.next_seqnum();
+
+        f.add(1, 1, state::plugged);
+        auto b = f.j.next_seqnum(); // a late subscriber does not see older events
+        f.add(2, 2, state::plugged);
+
+        CHECK(f.read(a).size() == 2);
+        CHECK(f.read(b).size() == 1);
+}
+
+TEST(partial_reads)
+{
+        fixture f(4, 8);
+        auto cursor = f.j.next_seqnum();
+
+        for (int i = 0; i < 5; ++i) {
+                f.add(1, 1, state(i % 3));
+        }
+
+        CHECK(f.read(cursor, 2).size() == 2);
+        CHECK(f.read(cursor, 2).size() == 2);
+        CHECK(f.read(cursor, 2).size() == 1);
+        CHECK(!f.j.available(cursor));
+}
+
+TEST(targeted_resync_of_dropped_sources)
+{
+        fixture f(8, 4);
+        auto cursor = f.j.next_seqnum();
+
+        f.add(1, 1, state::connecting);
+        f.add(1, 1, state::plugged); // the latest state of source 1 will be dropped
+        f.add(2, 2, state::connecting);
+        f.add(2, 2, state::plugged);
+        f.add(3, 3, state::connecting);
+        f.add(4, 4, state::connecting);
+        f.add(3, 3, state::plugged);
+        f.add(4, 4, state::plugged);
+
+        CHECK(f.j.lost(cursor) == 4);
+
+        auto v = f.read(cursor);
+        if (!CHECK(v.size() == 6)) {
+                return;
+        }
+
+        CHECK(v[0].source_id == 1 && v[0].st == state::plugged && v[0].flags == event_resync);
+        CHECK(v[1].source_id == 2 && v[1].st == state::plugged && v[1].flags == event_resync);
+        CHECK(v[0].location == "host/1" && v[1].location == "host/2");
+
+        for (size_t i = 2; i < v.size(); ++i) {
+                CHECK(!v[i].flags);
+        }
+
+        CHECK(v[5].seqnum == f.j.next_seqnum() - 1);
+        CHECK(!f.j.available(cursor));
+}
+
+TEST(resync_is_resumed_by_next_read)
+{
+        fixture f(8, 2);
+        auto cursor = f.j.next_seqnum();
+
+        for (journal_t::source_id_t id = 1; id <= 6; ++id) {
+                f.add(id, int(id), state::plugged);
+        }
+
+        auto v = f.read(cursor, 3);
+        CHECK(v.size() == 3);
+
+        auto w = f.read(cursor, 10);
+        CHECK(w.size() == 3);
+
+        std::vector<journal_t::source_id_t> ids;
+        for (auto &e: v) ids.push_back(e.source_id);
+        for (auto &e: w) ids.push_back(e.source_id);
+
+        CHECK((ids == std::vector<journal_t::source_id_t>{ 1, 2, 3, 4, 5, 6 }));
+        CHECK(w[0].flags == event_resync && !w[1].flags && !w[2].flags);
+}
+
+TEST(eviction_of_seen_source_is_silent)
+{
+        fixture f(2, 16);
+        auto cursor = f.j.next_seqnum();
+
+        f.add(1, 1, state::unplugged);
+        f.add(2, 2, state::plugged);
+        CHECK(f.read(cursor).size() == 2);
+
+        f.add(3, 3, state::plugged); // evicts source 1, the reader saw its latest state
+
+        auto v = f.read(cursor);
+        CHECK(v.size() == 1 && v[0].source_id == 3 && !v[0].flags);
+}
+
+TEST(eviction_of_unseen_source_sets_lost)
+{
+        fixture f(2, 16);
+        auto cursor = f.j.next_seqnum();
+
+        f.add(1, 1, state::unplugged);
+        f.add(2, 2, state::plugged);
+        f.add(3, 3, state::plugged); // the reader has not seen source 1
+
+        auto v = f.read(cursor);
+        if (!CHECK(v.size() == 2)) { // the records of the evicted source are skipped
+                return;
+        }
+
+        CHECK(v[0].source_id == 2 && v[0].flags == event_lost);
+        CHECK(v[1].source_id == 3 && !v[1].flags);
+
+        f.add(2, 2, state::unplugged);
+        v = f.read(cursor);
+        CHECK(v.size() == 1 && !v[0].flags);
+}
+
+TEST(slot_is_reused_by_least_recent_source)
+{
+        fixture f(3, 16);
+        auto cursor = f.j.next_seqnum();
+
+        f.add(1, 1, state::plugged);
+        f.add(2, 2, state::plugged);
+        f.add(3, 3, state::plugged);
+        f.add(1, 1, state::unplugged); // source 2 is the least recent now
+        f.read(cursor);
+
+        f.add(4, 4, state::plugged);
+        f.add(1, 1, state::plugged);
+        f.add(3, 3, state::unplugged);
+
+        auto v = f.read(cursor);
+        CHECK(v.size() == 3);
+        for (auto &e: v) {
+                CHECK(!e.flags);
+                CHECK(e.location == "host/" + std::to_string(e.source_id));
+        }
+}
+
+TEST(discarded_source_is_forgotten)
+{
+        fixture f(4, 16);
+        auto a = f.j.next_seqnum();
+
+        f.add(1, 1, state::connecting);
+        f.add(2, 2, state::connecting);
+        auto b = f.j.next_seqnum(); // has seen both sources
+
+        f.j.prepare(1);
+        f.j.discard(); // cannot describe source 1 anymore
+
+        auto v = f.read(a);
+        CHECK(v.size() == 1 && v[0].source_id == 2 && v[0].flags == event_lost);
+
+        f.add(1, 1, state::plugged);
+        v = f.read(b);
+        CHECK(v.size() == 1 && v[0].source_id == 1 && !v[0].flags && v[0].location == "host/1");
+
+        f.j.prepare(3); // a new source
+        f.j.discard();
+        CHECK(!f.j.available(b));
+}
+
+/*
+ * Random state changes of many sources, a slow reader must end up with the latest state of every source
+ * unless event_lost was reported.
+ */
+TEST(slow_reader_converges)
+{
+        enum { sources = 32, records = 24, rounds = 20'000 };
+
+        fixture f(2*sources, records);
+        std::mt19937 rnd(7);
+
+        auto cursor = f.j.next_seqnum();
+        std::map<journal_t::source_id_t, state> actual, seen;
+
+        for (int i = 0; i < rounds; ++i) {
+                auto id = 1 + rnd() % sources;
+                auto st = state(rnd() % 3);
+
+                f.add(id, int(id), st);
+                actual[id] = st;
+
+                if (rnd() % 16 == 0) {
+                        for (auto &e: f.read(cursor, 1 + rnd() % 8)) {
+                                seen[e.source_id] = e.st;
+                                CHECK(!(e.flags & event_lost));
+                        }
+                }
+        }
+
+        while (f.j.available(cursor)) {
+                for (auto &e: f.read(cursor, 5)) {
+                        seen[e.source_id] = e.st;
+                }
+        }
+
+        CHECK(seen == actual);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
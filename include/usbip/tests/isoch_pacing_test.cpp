@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. isoch_pacing_test.cpp -o isoch_pacing_test
+ */
+
+#include "check.h"
+#include <usbip/isoch_pacing.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::isoch;
+
+/*
+ * A class driver keeps several URBs of an isochronous IN endpoint in flight and resubmits a URB
+ * when it is completed. The server streams them one after another, the network adds jitter to the delivery.
+ * Time is in frames.
+ */
+struct params
+{
+        unsigned int depth{}; // zero disables the pacing
+        double jitter{}; // the maximum delay of delivery, uniform
+        double spike_prob{}; // of the delay below
+        double spike{};
+        unsigned int calm_after = ~0U; // completions, spikes stop after them
+        double send_fail_prob{}; // the URB is completed with an error and resubmitted
+        bool cancel = true; // the frames of a URB that was not sent are returned
+};
+
+class simulation
+{
+public:
+        enum : unsigned int { frames = 8, outstanding = 4, warm_up = 100 };
+
+        unsigned long long irregular{}; // completions that do not follow the previous one by the frames of a URB
+        unsigned long long completed{};
+        unsigned int peak_depth{};
+        usbip::isoch::stats at_calm{}; // when spikes have stopped
+
+        explicit simulation(const params &p) : m_p(p) { m_jb.configure(p.depth); }
+
+        auto& stats() const { return m_jb.get_stats(); }
+
+        void run(unsigned int urbs, unsigned int seed = 1)
+        {
+                struct urb { unsigned long long end; double received; };
+
+                auto &p = m_p;
+                auto &jb = m_jb;
+                auto depth = p.depth;
+
+                std::mt19937 rnd(seed);
+                std::uniform_real_distribution<> unit;
+
+                std::vector<urb> inflight; // in the order of submission
+                std::vector<std::pair<unsigned long long, unsigned long long>> held; // release, end
+
+                double server_free = 0;
+                long long last_completion = -1;
+
+                auto submit = [&] (unsigned long long now)
+                {
+                        slot s{ now, now + frames, 0 };
+
+                        if (depth) {
+                                for (s = jb.schedule(now, frames, nullptr); unit(rnd) < p.send_fail_prob; ) {
+                                        if (p.cancel) {
+                                                jb.cancel(s);
+                                        } else {
+                                                jb.commit(); // the frames are kept, a hole remains
+                                        }
+                                        s = jb.schedule(now, frames, nullptr);
+                                }
+                                jb.commit();
+                        }
+
+                        auto done = std::max(server_free, now + 1.0) + double(frames); // one frame to the server
+                        server_free = done;
+
+                        auto spike = completed < p.calm_after && unit(rnd) < p.spike_prob;
+                        auto delay = unit(rnd)*p.jitter + (spike ? p.spike : 0);
+                        inflight.push_back({ s.end, done + delay });
+                };
+
+                auto complete = [&] (unsigned long long now)
+                {
+                        if (++completed > warm_up && last_completion >= 0 && now - last_completion != frames) {
+                                ++irregular;
+                        }
+                        last_completion = now;
+                        peak_depth = std::max(peak_depth, stats().depth);
+
+                        if (completed == p.calm_after) {
+                                at_calm = stats();
+                        }
+
+                        submit(now);
+                };
+
+                for (unsigned int i = 0; i < outstanding; ++i) {
+                        submit(0);
+                }
+
+                for (unsigned long long now = 0; completed < urbs; ++now) {
+
+                        // TCP delivers in order, a delayed URB delays the ones after it
+                        while (!inflight.empty() && inflight.front().received <= now) {
+                                auto u = inflight.front();
+                                inflight.erase(inflight.begin());
+
+                                if (!depth) {
+                                        complete(now);
+                                } else if (auto release = jb.release(now, u.end); release <= now) {
+                                        complete(now);
+                                } else {
+                                        held.emplace_back(release, u.end);
+                                }
+                        }
+
+                        std::stable_sort(held.begin(), held.end());
+
+                        while (!held.empty() && held.front().first <= now) {
+                                held.erase(held.begin());
+                                complete(now);
+                        }
+                }
+        }
+
+private:
+        params m_p;
+        jitter_buffer m_jb;
+};
+
+} // namespace
+
+
+TEST(frame_clock)
+{
+        frame_clock c{ 1000, 10'000'000 }; // 100 ns ticks
+
+        CHECK(c.frame(0) == 0 && c.frame(1000) == 0);
+        CHECK(c.frame(1000 + 9'999) == 0 && c.frame(1000 + 10'000) == 1);
+        CHECK(c.ticks(1) == 1000 + 10'000 && c.frame(c.ticks(12345)) == 12345);
+
+        frame_clock odd{ 0, 3'579'545 }; // ACPI PM timer
+        bool ok = true;
+
+        for (unsigned long long f = 0; f < 100'000; f += 7) {
+                ok = ok && odd.frame(odd.ticks(f)) == f && odd.frame(odd.ticks(f) - 1) == f - !!f;
+        }
+
+        CHECK(ok);
+        CHECK(odd.frame(odd.ticks(86'400'000ULL*30)) == 86'400'000ULL*30); // a month does not overflow
+}
+
+TEST(schedule_is_contiguous)
+{
+        jitter_buffer jb;
+        jb.configure(4);
+
+        auto a = jb.schedule(100, 8, nullptr);
+        jb.commit();
+        CHECK(a.start == 104 && a.end == 112);
+
+        auto b = jb.schedule(101, 8, nullptr);
+        jb.commit();
+        CHECK(b.start == 112 && b.end == 120);
+
+        auto c = jb.schedule(200, 8, nullptr); // the stream was interrupted
+        CHECK(c.start == 204);
+
+        unsigned long long start = 300;
+        auto d = jb.schedule(200, 8, &start);
+        CHECK(d.start == 300 && d.end == 308 && d.prev == c.end);
+
+        jb.commit();
+        jb.commit();
+        CHECK(jb.get_stats().urbs == 4);
+}
+
+TEST(cancel_returns_frames)
+{
+        jitter_buffer jb;
+        jb.configure(4);
+
+        auto a = jb.schedule(100, 8, nullptr);
+        jb.commit();
+
+        auto b = jb.schedule(100, 8, nullptr);
+        jb.cancel(b);
+        CHECK(jb.get_stats().urbs == 1);
+
+        auto c = jb.schedule(100, 8, nullptr);
+        CHECK(c.start == a.end); // no hole
+
+        auto d = jb.schedule(100, 8, nullptr); // is sent concurrently
+        jb.cancel(c);
+        jb.commit();
+
+        CHECK(jb.schedule(100, 8, nullptr).start == d.end); // c is a hole, d keeps its frames
+}
+
+TEST(release)
+{
+        jitter_buffer jb;
+        jb.configure(4);
+
+        CHECK(jb.release(100, 100) == 100); // just in time
+        CHECK(jb.release(100, 103) == 103);
+        CHECK(jb.release(110, 100) == 110 && jb.get_stats().underruns == 1 && jb.get_stats().late_frames == 10);
+
+        CHECK(jb.release(100, 110) == 104); // the server is ahead, wait > 2*depth + 1
+        CHECK(jb.get_stats().overruns == 1 && jb.get_stats().max_held == 4);
+
+        jb.reset_stats();
+        CHECK(!jb.get_stats().underruns && jb.get_stats().depth == 4);
+}
+
+TEST(configure)
+{
+        jitter_buffer jb;
+
+        jb.configure(0);
+        CHECK(!jb.enabled());
+
+        jb.configure(1000);
+        CHECK(jb.get_stats().depth == depth_max);
+
+        jb.configure(depth_auto);
+        CHECK(jb.enabled() && jb.get_stats().depth == depth_min + auto_grow);
+}
+
+TEST(auto_depth_grows_on_underrun_and_shrinks)
+{
+        jitter_buffer jb;
+        jb.configure(depth_auto);
+
+        auto depth = jb.get_stats().depth;
+
+        jb.release(110, 100);
+        CHECK(jb.get_stats().depth == depth + auto_grow);
+
+        for (unsigned int i = 0; i < auto_window; ++i) {
+                jb.release(100, 102); // slack is 2
+        }
+        CHECK(jb.get_stats().depth == depth + auto_grow - 1);
+
+        for (unsigned int i = 0; i < auto_window; ++i) {
+                jb.release(100, 101); // slack is 1, the depth is used entirely
+        }
+        CHECK(jb.get_stats().depth == depth + auto_grow - 1);
+}
+
+/*
+ * Without pacing the jitter reaches class drivers as irregular completions.
+ */
+TEST(simulation_without_pacing)
+{
+        simulation s({ .depth = 0, .jitter = 3 });
+        s.run(20'000);
+
+        CHECK(s.irregular > s.completed/4);
+}
+
+TEST(simulation_fixed_depth_absorbs_jitter)
+{
+        simulation s({ .depth = 8, .jitter = 3 });
+        s.run(20'000);
+
+        CHECK(!s.irregular);
+        CHECK(!s.stats().underruns && !s.stats().overruns);
+        CHECK(s.stats().urbs == s.completed + simulation::outstanding);
+}
+
+TEST(simulation_auto_depth_adapts_to_spikes)
+{
+        simulation s({ .depth = depth_auto, .jitter = 2, .spike_prob = 0.01, .spike = 20, .calm_after = 50'000 });
+        s.run(100'000); // spikes stop in the middle, the depth goes back then
+
+        auto &spiky = s.at_calm;
+        auto &st = s.stats();
+
+        printf("spikes: underruns %llu, depth %u; calm: underruns %llu, depth %u\n",
+                spiky.underruns, spiky.depth, st.underruns - spiky.underruns, st.depth);
+
+        CHECK(spiky.underruns && spiky.underruns < 50);
+        CHECK(spiky.depth > 20 && spiky.depth == s.peak_depth);
+
+        CHECK(st.underruns == spiky.underruns);
+        CHECK(st.depth < spiky.depth);
+}
+
+/*
+ * The frames of URBs that were not sent are returned, so failed sends do not leave holes
+ * in the schedule and the completions stay regular.
+ */
+TEST(simulation_failed_sends)
+{
+        simulation s({ .depth = 8, .jitter = 3, .send_fail_prob = 0.05 });
+        s.run(20'000);
+
+        CHECK(!s.irregular && !s.stats().underruns);
+        CHECK(s.stats().urbs == s.completed + simulation::outstanding);
+
+        simulation hole({ .depth = 8, .jitter = 3, .send_fail_prob = 0.05, .cancel = false });
+        hole.run(20'000);
+
+        CHECK(hole.irregular > 500);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. latency_test.cpp -o latency_test
+ */
+
+#include "check.h"
+#include <usbip/latency.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::latency;
+
+auto identity = [] (long long v) { return static_cast<unsigned long long>(v); };
+
+struct stamps
+{
+        long long t[point_count]{ 100, 110, 130, 160, 1160, 1200 };
+        histogram h[stage_count]{};
+
+        void fold(unsigned int stages = all_stages) { usbip::latency::fold(h, t, stages, identity); }
+};
+
+} // namespace
+
+
+TEST(bucket_contains_value)
+{
+        bool ok = true;
+
+        auto check = [&ok] (unsigned long long v)
+        {
+                auto i = bucket(v);
+                ok = ok && lower_bound(i) <= v;
+
+                if (i + 1 < bucket_count) {
+                        ok = ok && v < lower_bound(i + 1);
+                        ok = ok && 4*(v - lower_bound(i)) < v + (v < sub_count); // the relative error is less than 25%
+                }
+        };
+
+        for (unsigned long long v = 0; v < 1 << 20; ++v) {
+                check(v);
+        }
+
+        std::mt19937_64 rnd(1);
+        for (int i = 0; i < 100'000; ++i) {
+                check(rnd() >> rnd() % 64);
+        }
+
+        CHECK(ok);
+}
+
+TEST(buckets_are_ordered)
+{
+        bool ok = true;
+
+        for (unsigned int i = 1; i < bucket_count; ++i) {
+                ok = ok && lower_bound(i - 1) < lower_bound(i) && bucket(lower_bound(i)) == i;
+        }
+
+        CHECK(ok);
+        CHECK(bucket(lower_bound(bucket_count - 1) << 4) == bucket_count - 1); // is saturated
+}
+
+TEST(add_and_merge)
+{
+        histogram a{}, b{};
+
+        add(a, 10);
+        add(a, 1000);
+        add(b, 5);
+        add(b, 1ULL << 40); // does not fit max
+
+        CHECK(a.count == 2 && a.sum == 1010 && a.max == 1000);
+        CHECK(b.max == ~0U);
+
+        merge(a, b);
+        CHECK(a.count == 4 && a.sum == 1015 + (1ULL << 40) && a.max == ~0U);
+        CHECK(a.buckets[bucket(10)] == 1 && a.buckets[bucket(5)] == 1 && a.buckets[bucket_count - 1] == 1);
+}
+
+TEST(percentile_of_empty_and_constant)
+{
+        histogram h{};
+        CHECK(!percentile(h, 0.5));
+
+        for (int i = 0; i < 100; ++i) {
+                add(h, 1000);
+        }
+
+        CHECK(percentile(h, 0) == 1000);
+        CHECK(percentile(h, 0.99) == 1000); // is limited by max
+        CHECK(percentile(h, 1) == 1000);
+}
+
+/*
+ * The percentile is the upper bound of a bucket, it is not less than the exact one and exceeds it by less than 25%.
+ */
+TEST(percentile_of_lognormal)
+{
+        std::mt19937 rnd(2);
+        std::lognormal_distribution<> dist(6, 1.2); // median is about 400 usec
+
+        histogram h{};
+        std::vector<unsigned long long> v(200'000);
+
+        for (auto &x: v) {
+                x = static_cast<unsigned long long>(dist(rnd));
+                add(h, x);
+        }
+
+        std::sort(v.begin(), v.end());
+
+        for (auto q: { 0.5, 0.9, 0.99, 0.999 }) {
+                auto exact = v[static_cast<size_t>(q*v.size())];
+                auto p = percentile(h, q);
+
+                CHECK(exact <= p);
+                CHECK(4*(p - exact) < exact);
+        }
+
+        CHECK(percentile(h, 1) == v.back() && h.max == v.back());
+}
+
+TEST(endpoint_index_round_trip)
+{
+        bool ok = true;
+
+        for (unsigned int i = 0; i < endpoint_count; ++i) {
+                ok = ok && endpoint_index(endpoint_address(i)) == i;
+        }
+
+        CHECK(ok);
+        CHECK(endpoint_index(0x00) == 0 && endpoint_index(0x8F) == endpoint_count - 1);
+}
+
+TEST(fold_all_stages)
+{
+        stamps s;
+        s.fold();
+
+        CHECK(s.h[prepare].sum == 10 && s.h[queue].sum == 20 && s.h[send].sum == 30);
+        CHECK(s.h[server].sum == 1000 && s.h[receive].sum == 40 && s.h[total].sum == 1100);
+
+        for (auto &h: s.h) {
+                CHECK(h.count == 1);
+        }
+}
+
+TEST(fold_selected_stages)
+{
+        stamps s;
+        s.fold(stage_mask(server) | stage_mask(total));
+
+        CHECK(!s.h[prepare].count && !s.h[queue].count && !s.h[send].count && !s.h[receive].count);
+        CHECK(s.h[server].count == 1 && s.h[total].count == 1);
+}
+
+/*
+ * WskSend is completed after RET_SUBMIT, the server stage starts at the send.
+ */
+TEST(fold_late_send_completion)
+{
+        stamps s;
+        s.t[send_done] = 1170;
+        s.fold();
+
+        CHECK(!s.h[send].count);
+        CHECK(s.h[server].sum == 1030);
+}
+
+TEST(fold_missing_points)
+{
+        stamps s;
+        s.t[queued] = 0; // the request was not queued
+        s.t[send_done] = 0;
+        s.fold();
+
+        CHECK(!s.h[prepare].count && !s.h[queue].count && !s.h[send].count);
+        CHECK(s.h[server].sum == 1030);
+        CHECK(s.h[total].count == 1);
+
+        stamps r;
+        r.t[complete] = 0; // is being completed
+        r.fold();
+        CHECK(!r.h[receive].count && !r.h[total].count);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. link_health_test.cpp -o link_health_test
+ */
+
+#include "check.h"
+#include <usbip/link_health.h>
+
+#include <random>
+
+namespace
+{
+
+using namespace usbip::link;
+using usec = usbip::link::time_t; // ::time_t is visible as well
+
+enum : usec { MSEC = 1000, SEC = 1000*MSEC, TICK = 500*MSEC }; // see link_monitor.cpp
+
+constexpr stall_policy policy { MSEC, SEC, 8, SEC, 16, 10*SEC };
+
+/*
+ * The server and on_link_timer of the driver. A device holds a prompt transfer,
+ * the server answers pings after net_rtt if it is alive.
+ */
+struct link_sim
+{
+        rtt_estimator rtt{};
+        probe pr{};
+
+        usec now = 100*SEC;
+        usec last_recv = now;
+        usec held_since{}; // send time of the oldest prompt transfer, zero if none
+
+        bool alive = true;
+        usec net_rtt = 2*MSEC;
+        usec answer_at{}; // of the ping
+
+        int pings{};
+
+        health tick()
+        {
+                now += TICK;
+
+                if (answer_at && now >= answer_at) {
+                        last_recv = answer_at;
+                        answer_at = 0;
+                }
+
+                usec stall{};
+                if (held_since) {
+                        auto since = held_since > last_recv ? held_since : last_recv;
+                        stall = now > since ? now - since : 1;
+                }
+
+                auto h = pr.update(now, stall, rtt, policy);
+
+                if (pr.ping()) {
+                        ++pings;
+                        if (alive) {
+                                answer_at = now + net_rtt;
+                        }
+                }
+
+                return h;
+        }
+};
+
+} // namespace
+
+
+TEST(estimator_converges_on_constant_rtt)
+{
+        rtt_estimator e{};
+
+        for (int i = 0; i < 200; ++i) {
+                e.sample(2*MSEC);
+        }
+
+        CHECK(e.samples() == 200);
+        CHECK(e.srtt() == 2*MSEC);
+        CHECK(e.rttvar() < 10);
+        CHECK(e.rto(MSEC, SEC) == e.srtt() + 4*e.rttvar());
+}
+
+TEST(estimator_follows_step)
+{
+        rtt_estimator e{};
+
+        for (int i = 0; i < 100; ++i) {
+                e.sample(MSEC);
+        }
+
+        int n = 0;
+        for ( ; e.srtt() < 95*10*MSEC/100; ++n) {
+                e.sample(10*MSEC);
+        }
+
+        CHECK(n <= 25);
+        CHECK(e.rto(0, SEC) >= 10*MSEC);
+}
+
+/*
+ * Uniform jitter, the RTO must be above almost all samples.
+ */
+TEST(estimator_rto_covers_jitter)
+{
+        rtt_estimator e{};
+        std::mt19937 rnd(1);
+        std::uniform_int_distribution<usec> d(500, 1500);
+
+        for (int i = 0; i < 100; ++i) {
+                e.sample(d(rnd));
+        }
+
+        int above = 0;
+        enum { cnt = 10'000 };
+
+        for (int i = 0; i < cnt; ++i) {
+                auto rtt = d(rnd);
+                above += rtt > e.rto(0, SEC);
+                e.sample(rtt);
+        }
+
+        CHECK(above < cnt/100);
+        CHECK(e.srtt() > 900 && e.srtt() < 1100);
+}
+
+TEST(estimator_zero_sample)
+{
+        rtt_estimator e{};
+        e.sample(0);
+
+        CHECK(e.srtt() == 1);
+        CHECK(e.rto(5, 100) == 5);
+}
+
+TEST(rto_is_clamped)
+{
+        rtt_estimator e{};
+        CHECK(e.rto(MSEC, SEC) == MSEC); // no samples
+
+        e.sample(10*SEC);
+        CHECK(e.rto(MSEC, SEC) == SEC);
+}
+
+TEST(classify_thresholds)
+{
+        rtt_estimator e{};
+        e.sample(200); // rto is min_rto
+
+        CHECK(classify(0, e, policy) == health::healthy);
+        CHECK(classify(SEC - 1, e, policy) == health::healthy); // degraded_min
+        CHECK(classify(SEC, e, policy) == health::degraded);
+        CHECK(classify(10*SEC, e, policy) == health::dead); // dead_min
+
+        auto p = policy;
+        p.dead_min = 0;
+        CHECK(classify(1000*SEC, e, p) == health::degraded);
+
+        rtt_estimator slow{};
+        slow.sample(400*MSEC); // rto is max_rto
+        CHECK(classify(7*SEC, slow, policy) == health::healthy);
+        CHECK(classify(8*SEC, slow, policy) == health::degraded);
+        CHECK(classify(15*SEC, slow, policy) == health::degraded);
+        CHECK(classify(16*SEC, slow, policy) == health::dead);
+}
+
+TEST(no_stall_no_ping)
+{
+        link_sim s;
+
+        for (int i = 0; i < 100; ++i) {
+                CHECK(s.tick() == health::healthy);
+        }
+
+        CHECK(!s.pings);
+}
+
+/*
+ * A device holds a transfer for a minute, the server answers pings. The health must not flap.
+ */
+TEST(held_transfer_is_healthy)
+{
+        link_sim s;
+        s.rtt.sample(2*MSEC);
+        s.held_since = s.now;
+
+        for (int i = 0; i < 120; ++i) {
+                CHECK(s.tick() == health::healthy);
+        }
+
+        CHECK(s.pings >= 20);
+        CHECK(s.pings <= 60);
+}
+
+TEST(unanswered_ping_degrades_then_dead)
+{
+        link_sim s;
+        s.rtt.sample(2*MSEC);
+        s.held_since = s.now;
+        s.alive = false;
+
+        usec degraded{};
+        usec dead{};
+        auto start = s.now;
+
+        for (int i = 0; i < 60 && !dead; ++i) {
+                switch (s.tick()) {
+                case health::healthy:
+                        CHECK(!degraded);
+                        break;
+                case health::degraded:
+                        if (!degraded) {
+                                degraded = s.now;
+                        }
+                        break;
+                case health::dead:
+                        dead = s.now;
+                }
+        }
+
+        CHECK(s.pings == 1);
+        CHECK(degraded - start >= 2*SEC); // stall threshold, then the ping threshold
+        CHECK(degraded - start <= 3*SEC);
+        CHECK(dead - start >= 10*SEC);
+        CHECK(dead - start <= 11*SEC);
+}
+
+TEST(message_restores_health)
+{
+        link_sim s;
+        s.rtt.sample(2*MSEC);
+        s.held_since = s.now;
+        s.alive = false;
+
+        for (int i = 0; i < 8; ++i) {
+                s.tick();
+        }
+        CHECK(s.tick() == health::degraded);
+
+        s.last_recv = s.now; // the server is back
+        s.alive = true;
+        CHECK(s.tick() == health::healthy);
+
+        s.held_since = 0;
+        CHECK(s.tick() == health::healthy);
+
+        auto pings = s.pings;
+        s.held_since = s.now;
+
+        for (int i = 0; i < 4; ++i) { // a new stall is probed again
+                CHECK(s.tick() == health::healthy);
+        }
+        CHECK(s.pings == pings + 1);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
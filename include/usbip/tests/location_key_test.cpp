@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. location_key_test.cpp -o location_key_test
+ */
+
+#include "check.h"
+#include <usbip/location_key.h>
+
+#include <string_view>
+
+namespace
+{
+
+using namespace usbip::location;
+
+template<typename CharT>
+auto key(std::basic_string_view<CharT> host, std::basic_string_view<CharT> service, std::basic_string_view<CharT> busid)
+{
+        return make_key(host.data(), host.size(), service.data(), service.size(), busid.data(), busid.size());
+}
+
+auto key(std::string_view host, std::string_view service, std::string_view busid)
+{
+        return key<char>(host, service, busid);
+}
+
+auto key(std::u16string_view host, std::u16string_view service, std::u16string_view busid)
+{
+        return key<char16_t>(host, service, busid);
+}
+
+auto server_key(std::string_view host, std::string_view service)
+{
+        return make_server_key(host.data(), host.size(), service.data(), service.size());
+}
+
+} // namespace
+
+
+TEST(host_is_lowercased)
+{
+        auto k = key("server.lan", "3240", "1-1");
+
+        CHECK(key("SERVER.LAN", "3240", "1-1") == k);
+        CHECK(key("Server.Lan", "3240", "1-1") == k);
+        CHECK(key("server.lam", "3240", "1-1") != k);
+
+        CHECK(key("host", "USBIP", "1-1") == key("host", "usbip", "1-1")); // a service name
+}
+
+TEST(busid_is_as_is)
+{
+        CHECK(key("host", "3240", "1-1.A") != key("host", "3240", "1-1.a"));
+        CHECK(key("host", "3240", "1-1") != key("host", "3240", "1-2"));
+}
+
+TEST(ipv6_brackets)
+{
+        auto k = key("fe80::1", "3240", "1-1");
+
+        CHECK(key("[fe80::1]", "3240", "1-1") == k);
+        CHECK(key("[FE80::1]", "3240", "1-1") == k);
+        CHECK(key("[fe80::1", "3240", "1-1") != k); // unbalanced
+        CHECK(key("fe80::1]", "3240", "1-1") != k);
+
+        CHECK(key("[]", "3240", "1-1") == key("", "3240", "1-1"));
+        CHECK(key("[", "3240", "1-1") != key("", "3240", "1-1"));
+}
+
+TEST(trailing_dot)
+{
+        auto k = key("server.lan", "3240", "1-1");
+
+        CHECK(key("server.lan.", "3240", "1-1") == k);
+        CHECK(key("SERVER.LAN.", "3240", "1-1") == k);
+        CHECK(key("server.lan..", "3240", "1-1") != k); // only one is removed
+        CHECK(key(".server.lan", "3240", "1-1") != k);
+
+        CHECK(key("[::1].", "3240", "1-1") != key("::1", "3240", "1-1")); // brackets are removed first
+}
+
+TEST(leading_zeros_of_port)
+{
+        auto k = key("host", "3240", "1-1");
+
+        CHECK(key("host", "03240", "1-1") == k);
+        CHECK(key("host", "0003240", "1-1") == k);
+        CHECK(key("host", "32400", "1-1") != k);
+
+        CHECK(key("host", "000", "1-1") == key("host", "0", "1-1"));
+        CHECK(key("host", "0x3240", "1-1") != key("host", "x3240", "1-1")); // not a number
+        CHECK(key("host", "", "1-1") != key("host", "0", "1-1"));
+}
+
+/*
+ * Fields are separated, a character can't move from one to another.
+ */
+TEST(fields_are_separated)
+{
+        CHECK(key("ab", "1", "2") != key("a", "b1", "2"));
+        CHECK(key("a", "12", "3") != key("a", "1", "23"));
+        CHECK(key("", "", "") != key("", "", "x"));
+        CHECK(key("", "", ""));
+}
+
+TEST(server_key)
+{
+        auto k = server_key("server", "3240");
+
+        CHECK(server_key("[SERVER.]", "03240") == k);
+        CHECK(server_key("server", "3241") != k);
+        CHECK(key("server", "3240", "") != k); // has the separator of busid
+}
+
+TEST(utf8_and_utf16_are_equal)
+{
+        CHECK(key(u"Server.LAN.", u"03240", u"1-1") == key("server.lan", "3240", "1-1"));
+        CHECK(key(u"[FE80::1]", u"USBIP", u"1-1.2") == key("fe80::1", "usbip", "1-1.2"));
+
+        CHECK(key(u"сервер", u"3240", u"1-1") == key("сервер", "3240", "1-1")); // two bytes
+        CHECK(key(u"例え.テスト", u"3240", u"1-1") == key("例え.テスト", "3240", "1-1")); // three bytes
+        CHECK(key(u"host\U0001F600", u"3240", u"1-1") == key("host\U0001F600", "3240", "1-1")); // surrogate pair
+
+        CHECK(key(u"СЕРВЕР", u"3240", u"1-1") != key(u"сервер", u"3240", u"1-1")); // only ASCII is lowercased
+}
+
+TEST(wchar_is_utf16)
+{
+        if constexpr (sizeof(wchar_t) == 2) {
+                std::wstring_view h = L"Host";
+                CHECK(key<wchar_t>(h, L"3240", L"1-1") == key("host", "3240", "1-1"));
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
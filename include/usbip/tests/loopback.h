@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * userspace/loopback server in a child process for the tests that talk to a server, POSIX only.
+ * The path of the executable is passed to a test as an argument, see CMakeLists.txt.
+ */
+namespace usbip::test
+{
+
+inline int connect_loopback(unsigned short port)
+{
+        auto s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s < 0) {
+                return s;
+        }
+
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(port);
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (connect(s, reinterpret_cast<sockaddr*>(&a), sizeof(a))) {
+                close(s);
+                return -1;
+        }
+
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        return s;
+}
+
+class loopback_server
+{
+public:
+        /*
+         * @param args options of loopback except -p
+         */
+        loopback_server(const char *path, std::vector<std::string> args = {}) : m_port(free_port())
+        {
+                args.insert(args.begin(), { path, "-p", std::to_string(m_port) });
+
+                if (m_pid = fork(); !m_pid) {
+                        std::vector<char*> argv;
+                        for (auto &a: args) {
+                                argv.push_back(a.data());
+                        }
+                        argv.push_back(nullptr);
+
+                        if (auto fd = open("/dev/null", O_WRONLY); fd >= 0) {
+                                dup2(fd, STDOUT_FILENO);
+                        }
+
+                        execv(path, argv.data());
+                        _exit(127);
+                }
+
+                for (int i = 0; i < 500 && m_pid > 0; ++i) { // 5 s
+                        if (auto s = connect_loopback(m_port); s >= 0) {
+                                close(s);
+                                m_ready = true;
+                                break;
+                        }
+                        usleep(10'000);
+                }
+        }
+
+        ~loopback_server()
+        {
+                if (m_pid > 0) {
+                        kill(m_pid, SIGTERM);
+                        waitpid(m_pid, nullptr, 0);
+                }
+        }
+
+        loopback_server(const loopback_server&) = delete;
+        loopback_server& operator=(const loopback_server&) = delete;
+
+        explicit operator bool() const noexcept { return m_ready; }
+        auto port() const noexcept { return m_port; }
+
+        int connect() const { return connect_loopback(m_port); }
+
+private:
+        unsigned short m_port;
+        pid_t m_pid{};
+        bool m_ready{};
+
+        static unsigned short free_port()
+        {
+                unsigned short port{};
+
+                if (auto s = socket(AF_INET, SOCK_STREAM, 0); s >= 0) {
+                        sockaddr_in a{};
+                        a.sin_family = AF_INET;
+                        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                        socklen_t len = sizeof(a);
+
+                        if (!bind(s, reinterpret_cast<sockaddr*>(&a), len) &&
+                            !getsockname(s, reinterpret_cast<sockaddr*>(&a), &len)) {
+                                port = ntohs(a.sin_port);
+                        }
+                        close(s);
+                }
+
+                return port;
+        }
+};
+
+} // namespace usbip::test
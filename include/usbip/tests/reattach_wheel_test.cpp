@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. reattach_wheel_test.cpp -o reattach_wheel_test
+ */
+
+#include "check.h"
+#include <usbip/reattach_wheel.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::reattach;
+using tick_t = scheduler::tick_t;
+
+struct fixture
+{
+        std::vector<char> storage;
+        std::unique_ptr<scheduler> sched = std::make_unique<scheduler>(); // zero-initialized
+        std::vector<entry> entries;
+
+        fixture(size_t capacity, const config &cfg, tick_t now = 1000) :
+                storage(scheduler::storage_size(capacity)),
+                entries(capacity)
+        {
+                sched->init(storage.data(), capacity, cfg, now, 1);
+        }
+
+        auto& s() { return *sched; }
+        auto index(const entry &e) const { return size_t(&e - entries.data()); }
+};
+
+constexpr config cfg { .first_delay = 1, .max_delay = 60, .max_retries = 1000, .max_inflight = 0 };
+constexpr config driver_cfg { .first_delay = 30, .max_delay = 480, .max_retries = 20, .max_inflight = 0 }; // see .inf
+
+/*
+ * A server is down until up_at, it is reachable after that.
+ */
+struct server
+{
+        tick_t up_at;
+        int unreachable; // attempts
+        int inflight_while_down;
+        int max_inflight_while_down;
+};
+
+struct device
+{
+        size_t server;
+        bool bad; // the server refuses to export it
+        bool canceled;
+
+        int attempts;
+        int successes;
+        tick_t reached_at; // the first attempt after the server came up
+        bool finished;
+
+        tick_t complete_at; // of the attempt in flight, zero if none
+        outcome result;
+};
+
+/*
+ * 1000 persistent devices of 50 servers are added at boot, the servers come up within ten minutes.
+ * An attempt takes 1..3 seconds, some devices are canceled by the user at random times.
+ */
+struct simulation
+{
+        enum { device_cnt = 1000, server_cnt = 50 };
+
+        tick_t now = 1000;
+        fixture f;
+        std::mt19937 rnd{11};
+
+        std::vector<server> servers = std::vector<server>(server_cnt);
+        std::vector<device> devices = std::vector<device>(device_cnt);
+
+        size_t max_inflight{};
+
+        explicit simulation(const config &c) : f(4*device_cnt, c, now)
+        {
+                for (auto &s: servers) {
+                        s.up_at = now + rnd() % 600;
+                }
+
+                for (size_t i = 0; i < device_cnt; ++i) {
+                        auto &d = devices[i];
+                        d.server = rnd() % server_cnt;
+                        d.bad = rnd() % 20 == 0;
+
+                        CHECK(f.s().add(f.entries[i], 1 + i, 100'000 + d.server, 0, now) == add_result::added);
+                }
+
+                CHECK(f.s().add(f.entries[device_cnt], 1, 100'000, 0, now) == add_result::duplicate);
+        }
+
+        void start(entry &e)
+        {
+                auto &d = devices[f.index(e)];
+                auto &srv = servers[d.server];
+
+                ++d.attempts;
+                d.complete_at = now + 1 + rnd() % 3;
+
+                if (now < srv.up_at) {
+                        d.result = outcome::unreachable;
+                        ++srv.unreachable;
+                        if (++srv.inflight_while_down > srv.max_inflight_while_down) {
+                                srv.max_inflight_while_down = srv.inflight_while_down;
+                        }
+                } else {
+                        if (!d.reached_at) {
+                                d.reached_at = now;
+                        }
+                        d.result = !d.bad && rnd() % 8 ? outcome::success : outcome::failed;
+                }
+
+                if (rnd() % 500 == 0) { // between pop_ready() and the send
+                        cancel(d);
+                }
+
+                if (!f.s().started(e)) {
+                        if (d.result == outcome::unreachable) {
+                                --srv.inflight_while_down;
+                        }
+                        d.result = outcome::aborted;
+                        d.complete_at = now;
+                }
+        }
+
+        void cancel(device &d)
+        {
+                if (!d.finished && !d.canceled) {
+                        d.canceled = true;
+                        f.s().cancel(1 + size_t(&d - devices.data()));
+                }
+        }
+
+        void step()
+        {
+                ++now;
+
+                for (auto &d: devices) {
+                        if (!d.complete_at || d.complete_at > now) {
+                                continue;
+                        }
+
+                        auto &srv = servers[d.server];
+                        if (d.result == outcome::unreachable) {
+                                --srv.inflight_while_down;
+                        }
+
+                        d.successes += d.result == outcome::success;
+
+                        d.complete_at = 0;
+                        f.s().complete(f.entries[size_t(&d - devices.data())], d.result, now);
+                }
+
+                if (rnd() % 4 == 0) {
+                        cancel(devices[rnd() % device_cnt]);
+                }
+
+                f.s().advance(now);
+
+                for (size_t i = 0; i < server_cnt; ++i) {
+                        if (servers[i].up_at == now && rnd() % 2) { // an attach of the user has succeeded
+                                f.s().wake(100'000 + i, now);
+                        }
+                }
+
+                while (auto e = f.s().pop_ready()) {
+                        start(*e);
+                }
+
+                if (f.s().inflight() > max_inflight) {
+                        max_inflight = f.s().inflight();
+                }
+
+                while (auto e = f.s().pop_finished()) {
+                        auto &d = devices[f.index(*e)];
+                        CHECK(!d.finished);
+                        CHECK(e->st == state::finished);
+                        d.finished = true;
+                }
+        }
+
+        void run(tick_t max_ticks)
+        {
+                for (auto end = now + max_ticks; f.s().size() && now < end; step());
+        }
+};
+
+} // namespace
+
+
+TEST(first_attempt_and_retries)
+{
+        fixture f(4, cfg);
+        auto &s = f.s();
+        auto &e = f.entries[0];
+
+        CHECK(s.add(e, 1, 10, 0, 1000) == add_result::added);
+        CHECK(s.find(1) == &e);
+
+        CHECK(s.pop_ready() == &e);
+        CHECK(s.started(e));
+        CHECK(s.inflight() == 1);
+
+        s.complete(e, outcome::failed, 1000);
+        CHECK(e.st == state::scheduled && e.retries == 1);
+        CHECK(s.next_timeout() == e.expires - 1000);
+        CHECK(!s.pop_ready());
+
+        s.advance(e.expires);
+        CHECK(s.pop_ready() == &e);
+
+        s.complete(e, outcome::success, s.now());
+        CHECK(s.pop_finished() == &e);
+        CHECK(!s.size() && !s.find(1));
+}
+
+TEST(retries_are_limited)
+{
+        auto c = cfg;
+        c.max_retries = 3;
+
+        fixture f(4, c);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 0, 1000);
+
+        int attempts = 0;
+        for (tick_t now = 1000; !s.pop_finished(); s.advance(++now)) {
+                if (auto e = s.pop_ready()) {
+                        ++attempts;
+                        s.complete(*e, outcome::failed, now);
+                }
+        }
+
+        CHECK(attempts == 4);
+}
+
+TEST(delays_are_jittered_and_bounded)
+{
+        fixture f(64, cfg);
+        auto &s = f.s();
+
+        for (size_t i = 0; i < 64; ++i) {
+                s.add(f.entries[i], 1 + i, 10, 0, 1000);
+        }
+
+        while (auto e = s.pop_ready()) {
+                s.complete(*e, outcome::failed, 1000); // the server is reachable, every device is ready
+        }
+
+        tick_t lo = ~0ULL;
+        tick_t hi = 0;
+
+        for (auto &e: f.entries) {
+                CHECK(e.st == state::scheduled);
+                CHECK(e.expires > 1000 && e.expires <= 1000 + cfg.max_delay);
+                lo = std::min(lo, e.expires);
+                hi = std::max(hi, e.expires);
+        }
+
+        CHECK(hi > lo); // not in lockstep
+}
+
+TEST(devices_of_unreachable_server_are_parked)
+{
+        fixture f(8, cfg);
+        auto &s = f.s();
+
+        for (size_t i = 0; i < 4; ++i) {
+                s.add(f.entries[i], 1 + i, 10, 0, 1000);
+        }
+
+        auto probe = s.pop_ready();
+        CHECK(probe == &f.entries[0]);
+        CHECK(!s.pop_ready());
+
+        for (size_t i = 1; i < 4; ++i) {
+                CHECK(f.entries[i].st == state::parked);
+        }
+
+        s.complete(*probe, outcome::unreachable, 1000);
+
+        for (auto &e: f.entries) {
+                CHECK(e.st == state::scheduled || &e >= &f.entries[4]);
+        }
+        CHECK(f.entries[3].retries == 1); // parked devices are charged
+}
+
+TEST(probe_success_releases_parked)
+{
+        fixture f(8, cfg);
+        auto &s = f.s();
+
+        for (size_t i = 0; i < 4; ++i) {
+                s.add(f.entries[i], 1 + i, 10, 0, 1000);
+        }
+
+        auto probe = s.pop_ready();
+        s.complete(*probe, outcome::success, 1000);
+
+        int cnt = 0;
+        while (auto e = s.pop_ready()) {
+                CHECK(!e->retries);
+                ++cnt;
+        }
+        CHECK(cnt == 3);
+}
+
+TEST(wake_makes_scheduled_ready)
+{
+        fixture f(8, cfg);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 30, 1000);
+        s.add(f.entries[1], 2, 10, 30, 1000);
+        s.add(f.entries[2], 3, 20, 30, 1000);
+
+        CHECK(!s.pop_ready());
+        CHECK(s.wake(10, 1001) == 2);
+
+        CHECK(s.pop_ready() && s.pop_ready());
+        CHECK(!s.pop_ready());
+        CHECK(f.entries[2].st == state::scheduled);
+        CHECK(!s.wake(30, 1001));
+}
+
+TEST(wake_skips_removed_entries)
+{
+        fixture f(8, cfg);
+        auto &s = f.s();
+
+        for (size_t i = 0; i < 4; ++i) {
+                s.add(f.entries[i], 1 + i, 10, 30, 1000);
+        }
+
+        s.cancel(2);
+        s.remove(f.entries[3]);
+        CHECK(s.pop_finished() == &f.entries[1]);
+
+        CHECK(s.wake(10, 1000) == 2);
+        CHECK(s.pop_ready() && s.pop_ready() && !s.pop_ready());
+}
+
+TEST(max_inflight)
+{
+        auto c = cfg;
+        c.max_inflight = 1;
+
+        fixture f(4, c);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 0, 1000);
+        s.add(f.entries[1], 2, 20, 0, 1000);
+
+        auto e = s.pop_ready();
+        CHECK(e && !s.pop_ready());
+
+        s.complete(*e, outcome::success, 1000);
+        CHECK(s.pop_ready());
+}
+
+/*
+ * The attach request is destroyed after pop_ready(), complete() is not called for it.
+ */
+TEST(remove_while_sending)
+{
+        auto c = cfg;
+        c.max_inflight = 1;
+
+        fixture f(4, c);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 0, 1000);
+        s.add(f.entries[1], 2, 20, 0, 1000);
+
+        auto e = s.pop_ready();
+        CHECK(e->sending && s.inflight() == 1 && !s.pop_ready());
+
+        s.remove(*e);
+        CHECK(e->st == state::idle && !e->sending);
+        CHECK(!s.inflight() && s.size() == 1);
+
+        auto next = s.pop_ready(); // the slot is not leaked
+        CHECK(next == &f.entries[1]);
+        CHECK(s.started(*next));
+
+        CHECK(s.cancel(2) == next && next->st == state::canceled);
+        s.remove(*next);
+        CHECK(!s.inflight() && !s.size() && !s.pop_finished());
+}
+
+TEST(cancel_of_scheduled_and_inflight)
+{
+        fixture f(4, cfg);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 30, 1000);
+        CHECK(s.cancel(1) == &f.entries[0]);
+        CHECK(s.pop_finished() == &f.entries[0]);
+
+        s.add(f.entries[1], 2, 10, 0, 1000);
+        auto e = s.pop_ready();
+        CHECK(s.started(*e));
+
+        CHECK(s.cancel(2) == e);
+        CHECK(e->st == state::canceled && !e->sending);
+        CHECK(!s.find(2));
+        CHECK(!s.pop_finished());
+
+        s.complete(*e, outcome::failed, 1000); // is not retried
+        CHECK(s.pop_finished() == e);
+        CHECK(!s.size());
+}
+
+/*
+ * stop_attach_attempts cancels the entry after pop_ready() but before the request was sent.
+ */
+TEST(cancel_while_sending)
+{
+        fixture f(4, cfg);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 0, 1000);
+
+        auto e = s.pop_ready();
+        CHECK(e->sending);
+
+        CHECK(s.cancel(1) == e);
+        CHECK(e->st == state::canceled && e->sending); // the caller of cancel() must not abort the attempt
+
+        CHECK(!s.started(*e)); // the caller of pop_ready() must
+        CHECK(!e->sending);
+
+        s.complete(*e, outcome::aborted, 1000);
+        CHECK(s.pop_finished() == e);
+}
+
+TEST(started_after_complete)
+{
+        fixture f(4, cfg);
+        auto &s = f.s();
+
+        s.add(f.entries[0], 1, 10, 0, 1000);
+
+        auto e = s.pop_ready();
+        s.complete(*e, outcome::failed, 1000); // sent and completed before started() was called
+        CHECK(s.started(*e));
+        CHECK(e->st == state::scheduled);
+}
+
+/*
+ * The load on unreachable servers is one attempt at a time, every good device is attached once
+ * soon after its server came up, bad devices exhaust their retries, every entry is finished.
+ */
+TEST(simulation_1000_devices_50_servers)
+{
+        auto &c = driver_cfg;
+
+        simulation sim(c);
+        sim.run(100'000);
+
+        CHECK(!sim.f.s().size());
+        CHECK(!sim.f.s().inflight());
+
+        for (auto &srv: sim.servers) {
+                CHECK(srv.max_inflight_while_down <= 1);
+                CHECK(srv.unreachable <= int(srv.up_at - 1000) + 1);
+        }
+
+        int attached = 0;
+
+        for (auto &d: sim.devices) {
+                CHECK(d.finished);
+                CHECK(d.successes <= 1);
+
+                if (d.canceled) {
+                        continue;
+                } else if (d.bad) {
+                        CHECK(!d.successes);
+                } else if (CHECK(d.successes == 1)) {
+                        ++attached;
+                }
+
+                if (d.reached_at) { // the pending delay and the probe that was sent before the server came up
+                        CHECK(d.reached_at <= sim.servers[d.server].up_at + 2*(c.max_delay + 3));
+                }
+        }
+
+        CHECK(attached > simulation::device_cnt/2);
+}
+
+/*
+ * As the driver does, one attempt at a time.
+ */
+TEST(simulation_sequential)
+{
+        auto c = driver_cfg;
+        c.max_inflight = 1;
+
+        simulation sim(c);
+        sim.run(100'000);
+
+        CHECK(sim.max_inflight == 1);
+        CHECK(!sim.f.s().size());
+
+        for (auto &d: sim.devices) {
+                CHECK(d.finished);
+                CHECK(d.canceled ? d.successes <= 1 : d.successes == !d.bad);
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
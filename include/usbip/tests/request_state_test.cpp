@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -pthread -I../.. request_state_test.cpp -o request_state_test
+ */
+
+#include "check.h"
+#include <usbip/request_state.h>
+
+#include <atomic>
+#include <barrier>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::request_state;
+
+struct request
+{
+        std::atomic<long> state{queued};
+        std::atomic<int> unlinks{};
+        std::atomic<int> cancels{}; // without CMD_UNLINK
+        std::atomic<int> cas_failures{};
+        bool canceled; // the cancel routine is called for it
+        bool failed; // the send has failed
+};
+
+/*
+ * As request_list.cpp does.
+ */
+auto advance(request &r, event e)
+{
+        for (auto cur = r.state.load(std::memory_order_relaxed); ; ) {
+
+                auto t = on(static_cast<state>(cur), e);
+
+                if (r.state.compare_exchange_strong(cur, t.next)) {
+                        return t;
+                }
+
+                ++r.cas_failures; // cur was updated
+        }
+}
+
+void apply(request &r, event e)
+{
+        if (auto t = advance(r, e); t.unlink_and_cancel) {
+                ++r.unlinks;
+        } else if (t.cancel) {
+                ++r.cancels;
+        }
+}
+
+} // namespace
+
+
+TEST(send_complete_only)
+{
+        auto t = on(queued, event::send_complete);
+        CHECK(t.next == sent && !t.unlink_and_cancel);
+}
+
+TEST(cancel_while_sending)
+{
+        auto t = on(queued, event::cancel);
+        CHECK(t.next == canceled && !t.unlink_and_cancel);
+
+        t = on(t.next, event::send_complete);
+        CHECK(t.next == sent && t.unlink_and_cancel);
+}
+
+TEST(cancel_after_send)
+{
+        auto t = on(on(queued, event::send_complete).next, event::cancel);
+        CHECK(t.next == sent && t.unlink_and_cancel);
+}
+
+/*
+ * The server has not got the request, CMD_UNLINK is never sent.
+ */
+TEST(send_failed_only)
+{
+        auto t = on(queued, event::send_failed);
+        CHECK(t.next == failed && !t.unlink_and_cancel && !t.cancel); // the send completion completes it
+}
+
+TEST(cancel_while_failing_send)
+{
+        auto t = on(on(queued, event::cancel).next, event::send_failed);
+        CHECK(t.next == failed && !t.unlink_and_cancel && t.cancel);
+}
+
+TEST(cancel_after_failed_send)
+{
+        auto t = on(on(queued, event::send_failed).next, event::cancel);
+        CHECK(t.next == failed && !t.unlink_and_cancel && t.cancel);
+}
+
+/*
+ * The send completion and the cancel routine of the same requests run on two threads at once.
+ * Whatever the interleaving, a canceled request is unlinked exactly once, others are never unlinked,
+ * a canceled request whose send has failed is cancelled once without CMD_UNLINK,
+ * and compare-exchange fails once at most. The threads race only if several CPUs are available.
+ */
+TEST(concurrent_send_complete_and_cancel)
+{
+        enum { batch = 1024, rounds = 2'000 };
+
+        std::vector<request> v(batch);
+        std::mt19937 rnd(5);
+        std::barrier sync(2);
+
+        long long unlinks{};
+        long long cancels{};
+        long long local_cancels{};
+        long long failed_cancels{};
+        bool ok = true;
+
+        auto sender = [&]
+        {
+                for (int i = 0; i < rounds; ++i) {
+                        sync.arrive_and_wait(); // the batch is ready
+
+                        for (auto &r: v) {
+                                apply(r, r.failed ? event::send_failed : event::send_complete);
+                        }
+
+                        sync.arrive_and_wait(); // the batch is done
+                        sync.arrive_and_wait(); // the batch is checked
+                }
+        };
+
+        std::thread th(sender);
+
+        for (int i = 0; i < rounds; ++i) {
+
+                auto skip = rnd() % batch; // shifts the cancel routine against the send completions
+
+                for (auto &r: v) {
+                        r.state = queued;
+                        r.unlinks = 0;
+                        r.cancels = 0;
+                        r.cas_failures = 0;
+                        r.canceled = rnd() % 2;
+                        r.failed = rnd() % 8 == 0;
+                }
+
+                sync.arrive_and_wait();
+
+                for (size_t j = 0; j < batch; ++j) {
+                        if (auto &r = v[(j + skip) % batch]; r.canceled) {
+                                apply(r, event::cancel);
+                        }
+                }
+
+                sync.arrive_and_wait();
+
+                for (auto &r: v) {
+                        auto canceled = int(r.canceled);
+
+                        if (r.failed) {
+                                ok = ok && r.state == failed && !r.unlinks && r.cancels == canceled;
+                                failed_cancels += canceled;
+                        } else {
+                                ok = ok && r.state == sent && r.unlinks == canceled && !r.cancels;
+                                cancels += canceled;
+                        }
+
+                        ok = ok && r.cas_failures <= 1;
+                        unlinks += r.unlinks;
+                        local_cancels += r.cancels;
+                }
+
+                sync.arrive_and_wait();
+        }
+
+        th.join();
+
+        CHECK(ok);
+        CHECK(unlinks == cancels);
+        CHECK(local_cancels == failed_cancels && failed_cancels);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. resolver_cache_test.cpp -o resolver_cache_test
+ */
+
+#include "check.h"
+#include <usbip/resolver_cache.h>
+
+#include <memory>
+#include <string>
+
+namespace
+{
+
+using cache_t = usbip::resolver_cache<int, 4>;
+using result = cache_t::result;
+
+auto make_cache()
+{
+        return std::make_unique<cache_t>(); // zero-initialized
+}
+
+auto lookup(cache_t &c, const std::string &host, cache_t::time_t now, int &value, long &status,
+            const std::string &service = "3240")
+{
+        return c.lookup(host.data(), host.size(), service.data(), service.size(), now, value, status);
+}
+
+void complete(cache_t &c, const std::string &host, cache_t::time_t now, long status, int value, cache_t::time_t ttl,
+              const std::string &service = "3240")
+{
+        c.complete(host.data(), host.size(), service.data(), service.size(), now, status, &value, ttl);
+}
+
+void abandon(cache_t &c, const std::string &host)
+{
+        c.abandon(host.data(), host.size(), "3240", 4);
+}
+
+} // namespace
+
+
+TEST(miss_complete_hit)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        CHECK(lookup(*c, "host", 0, v, st) == result::miss);
+        complete(*c, "host", 10, 0, 42, 100);
+
+        CHECK(lookup(*c, "host", 20, v, st) == result::hit);
+        CHECK(v == 42);
+        CHECK(!st);
+        CHECK(c->size() == 1);
+}
+
+TEST(host_is_case_insensitive)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        CHECK(lookup(*c, "Server.Example.COM", 0, v, st) == result::miss);
+        complete(*c, "Server.Example.COM", 0, 0, 7, 100);
+
+        CHECK(lookup(*c, "server.example.com", 1, v, st) == result::hit);
+        CHECK(v == 7);
+        CHECK(lookup(*c, "SERVER.EXAMPLE.COM", 1, v, st) == result::hit);
+        CHECK(c->size() == 1);
+
+        CHECK(lookup(*c, "server.example.org", 1, v, st) == result::miss);
+        CHECK(lookup(*c, "server.example.com", 1, v, st, "usbip") == result::miss); // other service
+}
+
+TEST(service_is_case_sensitive)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        CHECK(lookup(*c, "h", 0, v, st, "usbip") == result::miss);
+        complete(*c, "h", 0, 0, 1, 100, "usbip");
+        CHECK(lookup(*c, "h", 0, v, st, "USBIP") == result::miss);
+}
+
+TEST(wide_host_is_case_insensitive)
+{
+        auto c = std::make_unique<usbip::resolver_cache<int, 2, wchar_t>>();
+        int v = 5;
+        long st{};
+
+        c->lookup(L"PC", 2, L"3240", 4, 0, v, st);
+        c->complete(L"PC", 2, L"3240", 4, 0, 0, &v, 100);
+
+        v = 0;
+        CHECK(c->lookup(L"pc", 2, L"3240", 4, 1, v, st) == decltype(c)::element_type::result::hit);
+        CHECK(v == 5);
+}
+
+TEST(concurrent_misses_are_coalesced)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        CHECK(lookup(*c, "h", 0, v, st) == result::miss);
+        CHECK(lookup(*c, "H", 1, v, st) == result::pending);
+        complete(*c, "h", 2, 0, 3, 100);
+        CHECK(lookup(*c, "H", 3, v, st) == result::hit);
+}
+
+TEST(expired_entry_is_refreshed_once)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        lookup(*c, "h", 0, v, st);
+        complete(*c, "h", 0, 0, 1, 100);
+
+        CHECK(lookup(*c, "h", 100, v, st) == result::miss);
+        CHECK(lookup(*c, "h", 101, v, st) == result::pending);
+        complete(*c, "h", 102, 0, 2, 100);
+        CHECK(lookup(*c, "h", 103, v, st) == result::hit);
+        CHECK(v == 2);
+}
+
+TEST(negative_caching)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        lookup(*c, "nx", 0, v, st);
+        complete(*c, "nx", 0, -11, 0, 10);
+
+        CHECK(lookup(*c, "nx", 5, v, st) == result::negative_hit);
+        CHECK(st == -11);
+        CHECK(lookup(*c, "nx", 10, v, st) == result::miss);
+}
+
+TEST(abandon)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        lookup(*c, "new", 0, v, st);
+        abandon(*c, "new");
+        CHECK(!c->size()); // never completed
+        CHECK(lookup(*c, "new", 1, v, st) == result::miss);
+
+        complete(*c, "new", 1, 0, 9, 100);
+        CHECK(lookup(*c, "new", 2, v, st) == result::hit);
+
+        abandon(*c, "new"); // previous result is kept as expired
+        CHECK(c->size() == 1);
+        CHECK(lookup(*c, "new", 3, v, st) == result::miss);
+}
+
+TEST(lru_eviction_skips_resolving)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        for (int i = 0; i < 4; ++i) {
+                auto h = "h" + std::to_string(i);
+                lookup(*c, h, i, v, st);
+                if (i) {
+                        complete(*c, h, i, 0, i, 1000);
+                }
+        }
+
+        CHECK(c->size() == 4);
+        CHECK(lookup(*c, "h2", 10, v, st) == result::hit);
+
+        CHECK(lookup(*c, "h4", 11, v, st) == result::miss); // evicts h1, h0 is resolving
+        CHECK(c->size() == 4);
+        CHECK(lookup(*c, "h0", 12, v, st) == result::pending);
+        CHECK(lookup(*c, "h2", 12, v, st) == result::hit);
+        CHECK(lookup(*c, "h1", 13, v, st) == result::miss);
+}
+
+TEST(too_long_names_are_not_cached)
+{
+        auto c = make_cache();
+        int v{};
+        long st{};
+
+        std::string host(cache_t::max_host, 'a');
+
+        CHECK(lookup(*c, host, 0, v, st) == result::miss);
+        complete(*c, host, 0, 0, 1, 100);
+        CHECK(!c->size());
+        CHECK(lookup(*c, host, 1, v, st) == result::miss);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
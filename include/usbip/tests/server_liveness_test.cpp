@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. server_liveness_test.cpp -o server_liveness_test
+ */
+
+#include "check.h"
+#include <usbip/server_liveness.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+
+using table_t = usbip::server_liveness<4>;
+using verdict = table_t::verdict;
+using msec = table_t::time_t;
+
+enum : msec { SEC = 1000, MIN_BACKOFF = 2*SEC, MAX_BACKOFF = 60*SEC };
+enum : long { STATUS_TIMEOUT = -1, STATUS_REFUSED = -2 };
+
+auto make_table()
+{
+        auto t = std::make_unique<table_t>(); // zero-initialized
+        t->init(MIN_BACKOFF, MAX_BACKOFF);
+        return t;
+}
+
+} // namespace
+
+
+TEST(unknown_server_is_connected)
+{
+        auto t = make_table();
+        long st = 1;
+
+        CHECK(t->check(1, 0, st) == verdict::connect);
+        CHECK(!st);
+
+        table_t::info i{};
+        CHECK(!t->get(1, i));
+}
+
+TEST(failed_server_fails_fast)
+{
+        auto t = make_table();
+        long st{};
+
+        CHECK(t->failed(1, 0, STATUS_TIMEOUT) == MIN_BACKOFF);
+
+        CHECK(t->check(1, 1, st) == verdict::fail_fast);
+        CHECK(st == STATUS_TIMEOUT);
+
+        CHECK(t->check(1, MIN_BACKOFF - 1, st) == verdict::fail_fast);
+        CHECK(t->check(2, 1, st) == verdict::connect); // other server
+}
+
+TEST(one_probe_after_window)
+{
+        auto t = make_table();
+        long st{};
+
+        t->failed(1, 0, STATUS_TIMEOUT);
+
+        CHECK(t->check(1, MIN_BACKOFF, st) == verdict::probe);
+        CHECK(t->check(1, MIN_BACKOFF, st) == verdict::fail_fast); // while the probe is in flight
+        CHECK(t->check(1, MIN_BACKOFF + 10*SEC, st) == verdict::fail_fast);
+}
+
+TEST(backoff_doubles_up_to_max)
+{
+        auto t = make_table();
+
+        msec expected = MIN_BACKOFF;
+        msec now{};
+
+        for (int i = 0; i < 10; ++i) {
+                auto backoff = t->failed(1, now, STATUS_TIMEOUT);
+                CHECK(backoff == expected);
+
+                expected = std::min<msec>(2*expected, MAX_BACKOFF);
+                now += backoff;
+        }
+
+        table_t::info i{};
+        CHECK(t->get(1, i) && i.failures == 10 && i.down_until == now);
+}
+
+TEST(connected_resets_backoff)
+{
+        auto t = make_table();
+        long st{};
+
+        t->failed(1, 0, STATUS_TIMEOUT);
+        t->failed(1, 0, STATUS_REFUSED);
+
+        CHECK(t->check(1, 4*SEC, st) == verdict::probe);
+        CHECK(t->connected(1, 4*SEC, 30)); // was down
+        CHECK(!t->connected(1, 5*SEC, 30));
+
+        CHECK(t->check(1, 5*SEC, st) == verdict::connect);
+        CHECK(t->failed(1, 6*SEC, STATUS_TIMEOUT) == MIN_BACKOFF);
+}
+
+TEST(rtt_is_smoothed)
+{
+        auto t = make_table();
+        table_t::info i{};
+
+        t->connected(1, 0, 80);
+        CHECK(t->get(1, i) && i.rtt == 80);
+
+        t->connected(1, 0, 160);
+        CHECK(t->get(1, i) && i.rtt == 90);
+
+        t->connected(2, 0, 0);
+        CHECK(t->get(2, i) && i.rtt == 1); // zero means unknown
+}
+
+TEST(abandoned_probe_is_repeated)
+{
+        auto t = make_table();
+        long st{};
+
+        t->failed(1, 0, STATUS_TIMEOUT);
+        CHECK(t->check(1, MIN_BACKOFF, st) == verdict::probe);
+
+        t->abandon(1);
+        CHECK(t->check(1, MIN_BACKOFF + 1, st) == verdict::probe);
+}
+
+/*
+ * If the probe is never completed, fail fast ends after max_backoff.
+ */
+TEST(lost_probe_expires)
+{
+        auto t = make_table();
+        long st{};
+
+        t->failed(1, 0, STATUS_TIMEOUT);
+        CHECK(t->check(1, MIN_BACKOFF, st) == verdict::probe);
+
+        CHECK(t->check(1, MIN_BACKOFF + MAX_BACKOFF - 1, st) == verdict::fail_fast);
+        CHECK(t->check(1, MIN_BACKOFF + MAX_BACKOFF, st) == verdict::probe);
+}
+
+TEST(least_recently_used_is_forgotten)
+{
+        auto t = make_table();
+        long st{};
+
+        for (table_t::key_t key = 1; key <= 4; ++key) {
+                t->failed(key, key, STATUS_TIMEOUT);
+        }
+
+        CHECK(t->check(1, 10, st) == verdict::fail_fast); // server 2 is the least recent now
+
+        t->failed(5, 11, STATUS_REFUSED);
+
+        table_t::info i{};
+        CHECK(!t->get(2, i));
+        CHECK(t->get(1, i) && t->get(3, i) && t->get(4, i) && t->get(5, i));
+        CHECK(t->check(2, 12, st) == verdict::connect);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. -I../../../userspace/posix socket_buffer_test.cpp -o socket_buffer_test
+ */
+
+#include "check.h"
+#include <usbip/socket_buffer.h>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::sockbuf;
+
+enum : size_t { KB = 1024, MB = 1024*KB };
+
+constexpr policy pol { 64*KB, 8*MB, 64*KB }; // see link_monitor.cpp
+
+} // namespace
+
+
+TEST(bus_rates)
+{
+        CHECK(bus_rate(USB_SPEED_FULL) == 1'500'000);
+        CHECK(bus_rate(USB_SPEED_HIGH) == 60'000'000);
+        CHECK(bus_rate(USB_SPEED_SUPER) == 500'000'000);
+        CHECK(bus_rate(USB_SPEED_SUPER_PLUS) > bus_rate(USB_SPEED_SUPER));
+        CHECK(bus_rate(USB_SPEED_UNKNOWN) == bus_rate(USB_SPEED_HIGH));
+}
+
+TEST(target_is_zero_on_lan)
+{
+        CHECK(!target_size(bus_rate(USB_SPEED_HIGH), 200, pol)); // 24 KB
+        CHECK(!target_size(bus_rate(USB_SPEED_FULL), 10'000, pol)); // 30 KB
+}
+
+TEST(target_is_rounded_and_clamped)
+{
+        auto sz = target_size(bus_rate(USB_SPEED_HIGH), 5'000, pol); // 2*300 KB
+        CHECK(sz >= 600'000 && sz < 600'000 + 64*KB);
+        CHECK(sz % (64*KB) == 0);
+
+        CHECK(target_size(bus_rate(USB_SPEED_SUPER), 100'000, pol) == pol.max_size);
+}
+
+TEST(resize_by_a_quarter)
+{
+        CHECK(should_resize(0, 64*KB));
+        CHECK(!should_resize(1*MB, 1*MB + 128*KB));
+        CHECK(should_resize(1*MB, 1*MB + 256*KB));
+        CHECK(should_resize(1*MB, 768*KB));
+}
+
+TEST(budget_reserve_release)
+{
+        budget b{};
+        b.init(1*MB);
+
+        CHECK(b.reserve(0, 256*KB) == 256*KB);
+        CHECK(b.reserve(0, 1*MB) == 768*KB); // the rest
+        CHECK(b.used() == 1*MB);
+
+        CHECK(b.reserve(768*KB, 512*KB) == 512*KB); // shrink
+        CHECK(b.used() == 768*KB);
+
+        b.release(256*KB);
+        CHECK(b.used() == 512*KB);
+
+        b.release(4*MB);
+        CHECK(!b.used());
+}
+
+TEST(reserve_fits)
+{
+        budget b{};
+        b.init(4*MB);
+
+        CHECK(reserve(b, 0, 1*MB, pol) == 1*MB);
+        CHECK(b.used() == 2*MB);
+
+        CHECK(reserve(b, 1*MB, 512*KB, pol) == 512*KB);
+        CHECK(b.used() == 1*MB);
+}
+
+/*
+ * A partial grant is rounded down to the granularity, the remainder is returned to the budget.
+ */
+TEST(reserve_rounds_down)
+{
+        budget b{};
+        b.init(1*MB + 100*KB);
+
+        auto sz = reserve(b, 0, 1*MB, pol);
+        CHECK(sz == 512*KB);
+        CHECK(b.used() == 2*sz);
+}
+
+TEST(reserve_below_min_is_rolled_back)
+{
+        budget b{};
+        b.init(960*KB);
+
+        CHECK(reserve(b, 0, 448*KB, pol) == 448*KB);
+        CHECK(b.used() == 896*KB);
+
+        CHECK(!reserve(b, 0, 256*KB, pol)); // 64 KB are left, 32 KB per buffer
+        CHECK(b.used() == 896*KB);
+
+        CHECK(reserve(b, 448*KB, 1*MB, pol) == 448*KB); // 480 KB is not a multiple of the granularity
+        CHECK(b.used() == 896*KB);
+
+        b.init(1*MB);
+        CHECK(reserve(b, 448*KB, 1*MB, pol) == 512*KB); // grows by the rest
+        CHECK(b.used() == 1*MB);
+}
+
+TEST(exhausted_budget_keeps_current)
+{
+        budget b{};
+        b.init(256*KB);
+
+        CHECK(reserve(b, 0, 128*KB, pol) == 128*KB);
+        CHECK(reserve(b, 128*KB, 1*MB, pol) == 128*KB);
+        CHECK(b.used() == 256*KB);
+}
+
+/*
+ * Random resizes of many connections, the budget is never exceeded and the accounting matches.
+ */
+TEST(many_connections)
+{
+        enum { conn_cnt = 100, rounds = 100'000 };
+
+        budget b{};
+        b.init(64*MB);
+
+        std::vector<size_t> cur(conn_cnt);
+        std::mt19937 rnd(3);
+
+        for (int i = 0; i < rounds; ++i) {
+                auto &c = cur[rnd() % conn_cnt];
+
+                if (rnd() % 8 == 0) {
+                        b.release(2*c);
+                        c = 0;
+                        continue;
+                }
+
+                auto target = target_size(bus_rate(USB_SPEED_SUPER), rnd() % 20'000, pol);
+                if (!target && c) {
+                        target = pol.min_size;
+                }
+
+                if (target != c && should_resize(c, target)) {
+                        auto sz = reserve(b, c, target, pol);
+                        CHECK(sz == c || (sz >= pol.min_size && sz % pol.granularity == 0));
+                        CHECK(sz <= target || sz == c);
+                        c = sz;
+                }
+
+                CHECK(b.used() <= b.total());
+        }
+
+        size_t sum = 0;
+        for (auto c: cur) {
+                sum += 2*c;
+        }
+        CHECK(sum == b.used());
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * g++ -std=c++20 -O2 -Wall -Wextra -I../.. thread_placement_test.cpp -o thread_placement_test
+ */
+
+#include "check.h"
+#include <usbip/thread_placement.h>
+
+#include <set>
+
+namespace
+{
+
+using namespace usbip::placement;
+
+enum { CONTROL = 1 << 0, ISOCH = 1 << 1, BULK = 1 << 2, INTERRUPT = 1 << 3 }; // 1 << USB_ENDPOINT_TYPE_XXX
+
+constexpr config defaults{ {0, 12, 16}, 0 }; // as .inf sets
+
+static_assert(classify(CONTROL) == traffic::bulk);
+static_assert(place(traffic::isoch, 0, 4, defaults).ideal == 3);
+
+} // namespace
+
+
+TEST(classify_by_most_sensitive_endpoint)
+{
+        CHECK(classify(0) == traffic::bulk);
+        CHECK(classify(CONTROL | BULK) == traffic::bulk);
+        CHECK(classify(CONTROL | BULK | INTERRUPT) == traffic::interrupt);
+        CHECK(classify(CONTROL | INTERRUPT | ISOCH) == traffic::isoch);
+        CHECK(classify(ISOCH) == traffic::isoch);
+}
+
+TEST(priority_by_traffic)
+{
+        CHECK(!place(traffic::bulk, 0, 4, defaults).priority); // is kept
+        CHECK(place(traffic::interrupt, 0, 4, defaults).priority == 12);
+        CHECK(place(traffic::isoch, 0, 4, defaults).priority == 16);
+}
+
+TEST(bulk_from_first_others_from_last)
+{
+        for (unsigned int port = 0; port < 8; ++port) {
+                CHECK(place(traffic::bulk, port, 4, defaults).ideal == port % 4);
+                CHECK(place(traffic::interrupt, port, 4, defaults).ideal == 3 - port % 4);
+                CHECK(place(traffic::isoch, port, 4, defaults).ideal == 3 - port % 4);
+        }
+}
+
+/*
+ * Isochronous and bulk devices do not share processors while there are no more devices than processors.
+ */
+TEST(classes_do_not_share_processors)
+{
+        enum { cpu_cnt = 8 };
+
+        std::set<unsigned int> used;
+
+        for (unsigned int port = 0; port < 3; ++port) {
+                used.insert(place(traffic::isoch, port, cpu_cnt, defaults).ideal);
+        }
+
+        for (unsigned int port = 0; port < cpu_cnt - 3; ++port) {
+                CHECK(used.insert(place(traffic::bulk, port, cpu_cnt, defaults).ideal).second);
+        }
+}
+
+TEST(affinity_restricts_processors)
+{
+        config cfg = defaults;
+        cfg.affinity = 0b1010; // processors 1 and 3
+
+        CHECK(place(traffic::bulk, 0, 4, cfg).ideal == 1);
+        CHECK(place(traffic::bulk, 1, 4, cfg).ideal == 3);
+        CHECK(place(traffic::bulk, 2, 4, cfg).ideal == 1);
+        CHECK(place(traffic::isoch, 0, 4, cfg).ideal == 3);
+        CHECK(place(traffic::isoch, 1, 4, cfg).ideal == 1);
+}
+
+TEST(affinity_does_not_match)
+{
+        config cfg = defaults;
+        cfg.affinity = 1ULL << 10;
+
+        auto r = place(traffic::isoch, 5, 4, cfg);
+        CHECK(!r.ideal && r.priority == 16);
+
+        CHECK(!place(traffic::bulk, 5, 0, defaults).ideal); // no processors
+}
+
+/*
+ * The affinity mask covers the first 64 processors only.
+ */
+TEST(ideal_is_allowed_processor)
+{
+        bool ok = true;
+
+        for (auto affinity: { 0ULL, 1ULL, 0x8000'0000'0000'0001ULL, 0xF0F0ULL, ~0ULL }) {
+                config cfg = defaults;
+                cfg.affinity = affinity;
+
+                for (unsigned int cpu_cnt: { 1, 2, 7, 64, 80 }) {
+                        for (unsigned int port = 0; port < 200; ++port) {
+                                for (auto t: { traffic::bulk, traffic::interrupt, traffic::isoch }) {
+
+                                        auto i = place(t, port, cpu_cnt, cfg).ideal;
+                                        ok = ok && i < cpu_cnt;
+
+                                        bool any = false;
+                                        for (unsigned int j = 0; j < cpu_cnt && j < 64; ++j) {
+                                                any = any || (affinity >> j) & 1;
+                                        }
+
+                                        if (affinity && any) {
+                                                ok = ok && i < 64 && (affinity >> i) & 1;
+                                        }
+                                }
+                        }
+                }
+        }
+
+        CHECK(ok);
+}
+
+int main(int argc, char *argv[])
+{
+        return usbip::test::run(argc, argv);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Priority and ideal processor of a receive thread of a device.
+ *
+ * A device is classified by the most latency sensitive type of its endpoints.
+ * Receive threads are spread over processors by port number. Isochronous and interrupt devices
+ * count processors from the last one, bulk devices from the first one, so they share processors
+ * only if there are more devices than processors.
+ *
+ * It is used by the driver, so it does not allocate memory.
+ */
+namespace usbip::placement
+{
+
+enum class traffic { bulk, interrupt, isoch }; // ascending sensitivity to latency, control is bulk
+
+/*
+ * @param endpoint_types bit mask of (1 << type), type is bmAttributes & 3 of an endpoint descriptor
+ */
+constexpr traffic classify(unsigned int endpoint_types) noexcept
+{
+        enum { CONTROL, ISOCH, BULK, INTERRUPT }; // USB_ENDPOINT_TYPE_XXX
+
+        if (endpoint_types & (1U << ISOCH)) {
+                return traffic::isoch;
+        }
+
+        return endpoint_types & (1U << INTERRUPT) ? traffic::interrupt : traffic::bulk;
+}
+
+struct config
+{
+        int priority[3]; // by traffic, zero keeps the priority of a thread
+        unsigned long long affinity; // bit mask of processors, zero means all processors
+};
+
+struct result
+{
+        int priority; // zero if it must not be changed
+        unsigned int ideal; // processor index
+};
+
+/*
+ * @param port of the device, any number that distinguishes devices
+ * @param cpu_cnt number of processors, indices are [0, cpu_cnt)
+ */
+constexpr result place(traffic t, unsigned int port, unsigned int cpu_cnt, const config &cfg) noexcept
+{
+        auto allowed = [&cfg, cpu_cnt] (unsigned int i)
+        {
+                return !cfg.affinity || (i < 64 && (cfg.affinity >> i) & 1);
+        };
+
+        unsigned int cnt = 0;
+        for (unsigned int i = 0; i < cpu_cnt; ++i) {
+                cnt += allowed(i);
+        }
+
+        result r{ cfg.priority[static_cast<int>(t)], 0 };
+
+        if (!cnt) { // affinity does not match any processor
+                return r;
+        }
+
+        auto k = port % cnt;
+        if (t != traffic::bulk) {
+                k = cnt - 1 - k;
+        }
+
+        for (unsigned int i = 0; i < cpu_cnt; ++i) {
+                if (allowed(i) && !k--) {
+                        r.ideal = i;
+                        break;
+                }
+        }
+
+        return r;
+}
+
+} // namespace usbip::placement
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Binary trace of USB/IP commands and replies of all devices.
+ *
+ * The driver writes a fixed-size record per PDU into a ring of the current processor,
+ * nothing is formatted on the hot path. The rings are drained by vhci::ioctl::read_urb_trace,
+ * "usbip trace" saves them into a file that is decoded offline by userspace/urbtrace.
+ *
+ * It is used by the driver, so it does not lock or allocate memory.
+ */
+namespace usbip::urb_trace
+{
+
+enum event : unsigned char { cmd_submit, cmd_unlink, ret_submit, ret_unlink };
+
+enum : unsigned char { dir_in = 0x80 }; // record::ep
+
+struct record
+{
+        unsigned long long time; // ticks of the performance counter, @see file_header::frequency
+
+        unsigned int request; // WDFREQUEST, zero if there is no request
+        unsigned int seqnum;
+
+        unsigned short port;
+        event type;
+        unsigned char ep; // number and dir_in, zero for replies because the protocol does not send them
+
+        unsigned int transfer_flags; // cmd_submit
+        int length; // transfer_buffer_length of cmd_submit, actual_length of ret_submit
+        int status; // of ret_submit, ret_unlink
+        int number_of_packets; // cmd_submit, ret_submit
+        int extra; // interval of cmd_submit, error_count of ret_submit, unlink_seqnum of cmd_unlink
+
+        unsigned char setup[8]; // cmd_submit
+};
+static_assert(sizeof(record) == 48);
+
+/*
+ * vhci::ioctl::read_urb_trace returns a sequence of chunks, one per processor that has records.
+ */
+struct chunk
+{
+        unsigned int processor;
+        unsigned int count; // of records that follow the chunk
+        unsigned long long dropped; // total number of records that did not fit into the ring of the processor
+};
+static_assert(sizeof(chunk) == 16);
+
+/*
+ * A file written by "usbip trace" starts with this header, chunks follow it.
+ */
+struct file_header
+{
+        char magic[8]; // file_magic
+        unsigned int version; // file_version
+        unsigned int record_size; // sizeof(record)
+        unsigned long long frequency; // of the performance counter, ticks per second
+};
+static_assert(sizeof(file_header) == 24);
+
+constexpr char file_magic[sizeof(file_header::magic)] { 'U', 'S', 'B', 'I', 'P', 'U', 'R', 'B' };
+constexpr unsigned int file_version = 1;
+
+/*
+ * Ring of records with one writer and one reader, the writer never waits.
+ * A record that does not fit is dropped and counted, the reader is never overwritten.
+ *
+ * The driver has a ring per processor and raises IRQL to DISPATCH_LEVEL while it writes a record,
+ * so a writer can't be preempted by another one.
+ *
+ * The object must be zero-initialized.
+ *
+ * @param Atomic provides static member functions
+ *        long long load(const volatile long long&) with acquire semantics,
+ *        void store(volatile long long&, long long) with release semantics,
+ *        void increment(volatile long long&)
+ */
+template<typename Atomic>
+class ring
+{
+public:
+        /*
+         * @param storage the ring does not own it
+         * @param capacity in records, must be a power of two
+         */
+        void init(record *storage, size_t capacity) noexcept
+        {
+                m_data = storage;
+                m_capacity = capacity;
+        }
+
+        explicit operator bool() const noexcept { return m_data; }
+
+        auto capacity() const noexcept { return m_capacity; }
+        auto dropped() const noexcept { return Atomic::load(m_dropped); }
+
+        auto size() const noexcept { return static_cast<size_t>(Atomic::load(m_head) - Atomic::load(m_tail)); }
+
+        /*
+         * Fill the record in place, then call commit().
+         * @return nullptr if the ring is full, the record is dropped
+         */
+        record* prepare() noexcept
+        {
+                auto head = m_head; // the writer is the only writer of it
+
+                if (head - Atomic::load(m_tail) == static_cast<long long>(m_capacity)) {
+                        Atomic::increment(m_dropped);
+                        return nullptr;
+                }
+
+                return &at(head);
+        }
+
+        void commit() noexcept { Atomic::store(m_head, m_head + 1); }
+
+        /*
+         * The caller must serialize calls.
+         * @return number of copied records
+         */
+        size_t read(record *dst, size_t max_cnt) noexcept
+        {
+                auto tail = m_tail; // the reader is the only writer of it
+                auto head = Atomic::load(m_head);
+
+                size_t cnt = 0;
+
+                for ( ; cnt < max_cnt && tail < head; ++cnt, ++tail) {
+                        dst[cnt] = at(tail);
+                }
+
+                Atomic::store(m_tail, tail);
+                return cnt;
+        }
+
+private:
+        record *m_data;
+        size_t m_capacity;
+
+        volatile long long m_head; // written by the writer
+        volatile long long m_tail; // consumed by the reader
+        volatile long long m_dropped;
+
+        record& at(long long idx) noexcept { return m_data[idx & static_cast<long long>(m_capacity - 1)]; }
+};
+
+} // namespace usbip::urb_trace
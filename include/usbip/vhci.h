@@ -17,6 +17,8 @@
 
 #include "ch9.h"
 #include "consts.h"
+#include "isoch_pacing.h"
+#include "coalesce.h"
 
 /*
  * Strings encoding is UTF8. 
@@ -81,18 +83,43 @@ struct imported_device_properties
 
 struct imported_device : imported_device_location, imported_device_properties {};
 
-enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging };
+enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging,
+                   degraded }; // plugged, but the server does not respond timely
 
 /*
- * There can be multiple event sources for one device,
- * each of them emits events with a unique source_id.
+ * The layout before seqnum and flags were added, it is returned unless the reader selects another one,
+ * see ioctl::set_device_state_version.
  */
-struct device_state : base, imported_device
+struct device_state_v1 : base, imported_device
 {
         state state;
         ULONG source_id;
 };
 
+enum : UINT32 // device_state::flags
+{
+        state_resync = 1, // earlier states of this device were dropped, this is its latest one
+        state_lost = 2, // the states of some devices were dropped, see ioctl::get_imported_devices
+};
+
+/*
+ * There can be multiple event sources for one device,
+ * each of them emits events with a unique source_id.
+ *
+ * IRP_MJ_READ returns as many pending events as fit into the buffer, its length must be a multiple
+ * of the size of the layout that was selected for the handle by ioctl::set_device_state_version.
+ * The driver sets base::size of every event to the size of the layout, a reader must check it.
+ *
+ * Events are numbered consecutively. If a reader is too slow, the oldest events are dropped.
+ * For every device whose latest state was dropped, the driver returns its latest state with state_resync
+ * before the remaining events, so the reader does not need to reread all devices.
+ */
+struct device_state : device_state_v1
+{
+        UINT64 seqnum;
+        UINT32 flags;
+};
+
 } // namespace usbip::vhci
 
 
@@ -108,6 +135,18 @@ enum class function { // 12 bit
         stop_attach_attempts,
         plugin_hardware_once,
         plugout_hardware_and_reattach,
+        get_imported_devices_delta,
+        set_capture,
+        read_capture,
+        set_urb_trace,
+        read_urb_trace,
+        set_latency,
+        read_latency,
+        set_jitter_buffer,
+        get_jitter_buffer,
+        set_coalesce,
+        get_coalesce,
+        set_device_state_version,
 };
 
 constexpr auto make(function id)
@@ -124,6 +163,18 @@ enum {
         STOP_ATTACH_ATTEMPTS = make(function::stop_attach_attempts),
         PLUGIN_HARDWARE_ONCE = make(function::plugin_hardware_once),
         PLUGOUT_HARDWARE_AND_REATTACH = make(function::plugout_hardware_and_reattach), // for internal use only
+        GET_IMPORTED_DEVICES_DELTA = make(function::get_imported_devices_delta),
+        SET_CAPTURE = make(function::set_capture),
+        READ_CAPTURE = make(function::read_capture),
+        SET_URB_TRACE = make(function::set_urb_trace),
+        READ_URB_TRACE = make(function::read_urb_trace),
+        SET_LATENCY = make(function::set_latency),
+        READ_LATENCY = make(function::read_latency),
+        SET_JITTER_BUFFER = make(function::set_jitter_buffer),
+        GET_JITTER_BUFFER = make(function::get_jitter_buffer),
+        SET_COALESCE = make(function::set_coalesce),
+        GET_COALESCE = make(function::get_coalesce),
+        SET_DEVICE_STATE_VERSION = make(function::set_device_state_version),
 };
 
 struct plugin_hardware : base, imported_device_location
@@ -153,6 +204,137 @@ constexpr auto get_imported_devices_size(_In_ ULONG n)
         return offsetof(get_imported_devices, devices) + n*sizeof(*get_imported_devices::devices);
 }
 
+enum { // get_imported_devices_delta::flags
+        DELTA_UNCHANGED = 1, // data is empty
+        DELTA_FULL = 2, // data contains all devices, the caller must discard its view
+};
+
+/*
+ * The driver increments the generation every time a port is claimed or released.
+ * Only ports that were changed since the caller's generation are returned, see usbip/device_delta.h.
+ *
+ * If the buffer is too small, STATUS_BUFFER_OVERFLOW is returned and the header is filled,
+ * length contains required length of data.
+ */
+struct get_imported_devices_delta : base
+{
+        UINT64 generation; // IN: of the caller's view, zero to get all devices; OUT: current
+        ULONG flags; // OUT
+        ULONG length; // OUT, of data
+        UCHAR data[ANYSIZE_ARRAY]; // OUT
+};
+
+/*
+ * Capture of USB/IP PDUs of a device, see usbip/capture.h
+ * The ring is allocated when the capture is enabled first time and lives as long as the device.
+ */
+struct set_capture : base
+{
+        int port;
+        ULONG snaplen; // bytes of a PDU to record, zero disables the capture
+        ULONG ring_size; // bytes, zero for the default, is ignored if the ring already exists
+};
+
+/*
+ * Records that fit into the buffer are returned, the capture can be disabled.
+ */
+struct read_capture : base
+{
+        int port; // IN
+        ULONG length; // OUT, of data
+        UINT64 dropped; // OUT, total number of records that did not fit into the ring
+        UCHAR data[ANYSIZE_ARRAY]; // OUT, capture::record-s
+};
+
+/*
+ * Binary trace of USB/IP PDUs of all devices, see usbip/urb_trace.h
+ * The rings are allocated when the trace is enabled first time and live as long as the driver.
+ */
+struct set_urb_trace : base
+{
+        ULONG capacity; // records per processor, zero disables the trace, is ignored if the rings already exist
+};
+
+/*
+ * Records that fit into the buffer are returned, the trace can be disabled.
+ */
+struct read_urb_trace : base
+{
+        ULONG length; // OUT, of data
+        UINT64 frequency; // OUT, of the performance counter that timestamps records
+        UCHAR data[ANYSIZE_ARRAY]; // OUT, urb_trace::chunk-s followed by their records
+};
+
+/*
+ * Latency breakdown of URBs of a device, see usbip/latency.h
+ * The histograms are allocated when the sampling is enabled first time and live as long as the device.
+ */
+struct set_latency : base
+{
+        int port;
+        ULONG period; // every Nth URB is sampled, zero disables the sampling
+        ULONG stages; // bit mask of latency::stage_mask-s to record, zero for all
+};
+
+/*
+ * Histograms of endpoints that fit into the buffer are returned, the sampling can be disabled.
+ */
+struct read_latency : base
+{
+        int port; // IN
+        ULONG reset; // IN, non-zero to zero the histograms after they are read
+        ULONG length; // OUT, of data
+        UCHAR data[ANYSIZE_ARRAY]; // OUT, latency::endpoint_stats-s
+};
+
+/*
+ * Pacing of isochronous IN endpoints of a device by its virtual frame clock, see usbip/isoch_pacing.h
+ * The held URBs are completed when the pacing is disabled.
+ */
+struct set_jitter_buffer : base
+{
+        int port;
+        ULONG endpoint; // number, zero for all
+        ULONG depth; // frames, zero disables the pacing, isoch::depth_auto adjusts it to the jitter
+};
+
+struct get_jitter_buffer : base
+{
+        int port; // IN
+        ULONG reset; // IN, non-zero to zero the counters after they are read
+        UINT64 current_frame; // OUT, of the virtual frame clock of the device
+        isoch::stats stats[isoch::endpoint_count]; // OUT, by endpoint number, stats::depth is zero if it is not paced
+};
+
+/*
+ * Coalescing of interrupt IN resubmits of a device, see usbip/coalesce.h
+ * The held PDUs are sent when it is disabled.
+ */
+struct set_coalesce : base
+{
+        int port;
+        ULONG window; // microseconds, zero disables coalescing
+        ULONG max_batch; // PDUs of a window, zero for coalesce::default_max_batch
+};
+
+struct get_coalesce : base
+{
+        int port; // IN
+        ULONG reset; // IN, non-zero to zero the counters after they are read
+        coalesce::stats stats; // OUT, the overhead is counted even if coalescing is disabled
+};
+
+enum : ULONG { DEVICE_STATE_V1 = 1, DEVICE_STATE_V2 }; // device_state_v1, device_state
+
+/*
+ * Selects the layout of events that IRP_MJ_READ returns for this handle, DEVICE_STATE_V1 is the default.
+ * It must be issued before the first read.
+ */
+struct set_device_state_version : base
+{
+        ULONG version;
+};
+
 } // namespace usbip::vhci::ioctl
 
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Asynchronous API, C++20 is required.
+ *
+ * Every function returns a lazy task that can be co_await-ed or passed to usbip::start()
+ * with a completion callback. Operations are completed on thread pool threads,
+ * so a few threads can drive many concurrent operations.
+ *
+ * Operations are canceled through std::stop_token instead of APC,
+ * ERROR_OPERATION_ABORTED is returned in such case.
+ */
+
+#include "remote.h"
+#include "vhci.h"
+#include "task.h"
+
+#include <expected>
+#include <stop_token>
+
+namespace usbip::async
+{
+
+template<typename T>
+using result = std::expected<T, DWORD>; // GetLastError() codes
+
+struct exportable_device
+{
+        usb_device device;
+        std::vector<usb_interface> interfaces;
+};
+
+/**
+ * @param hostname name or IP address of a host to connect to
+ * @param service TCP/IP port number of symbolic name
+ * @param stop cancellation token
+ * @return connected socket
+ * @see usbip::connect
+ */
+USBIP_API task<result<Socket>> connect(_In_ std::string hostname, _In_ std::string service, _In_ std::stop_token stop = {});
+
+/**
+ * @param s socket handle that must be valid until the task is completed
+ * @param stop cancellation token
+ * @return exportable devices
+ * @see usbip::enum_exportable_devices
+ */
+USBIP_API task<result<std::vector<exportable_device>>> enum_exportable_devices(_In_ SOCKET s, _In_ std::stop_token stop = {});
+
+} // namespace usbip::async
+
+
+/*
+ * The handle of the driver device must be opened for asynchronous I/O, see vhci::open(true).
+ * It must be valid until the task is completed.
+ */
+namespace usbip::vhci::async
+{
+
+using usbip::async::result;
+
+/**
+ * The driver completes the request after the connection is established and the device is plugged in,
+ * cancellation does not abort this, call stop_attach_attempts() if required.
+ * @return hub port number, >= 1
+ * @see vhci::attach
+ */
+USBIP_API task<result<int>> attach(_In_ HANDLE dev, _In_ attach_args args, _In_ std::stop_token stop = {});
+
+/**
+ * @return port
+ * @see vhci::detach
+ */
+USBIP_API task<result<int>> detach(_In_ HANDLE dev, _In_ int port, _In_ std::stop_token stop = {});
+
+/**
+ * The handle must not be used for other reads concurrently.
+ * @see vhci::read_device_state
+ */
+USBIP_API task<result<usbip::device_state>> read_device_state(_In_ HANDLE dev, _In_ std::stop_token stop = {});
+
+} // namespace usbip::vhci::async
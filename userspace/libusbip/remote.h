@@ -72,6 +72,9 @@ enum connect_flags_t : unsigned long {
  *      after which the call will be canceled. This is possible due to using alertable wait functions. 
  *      In such case, GetLastError() will return WSA_E_CANCELLED if GetAddrInfoEx is canceled
  *      or ERROR_CANCELLED if connect is canceled.
+ *
+ * Resolved addresses and resolution errors are cached for a while, concurrent calls 
+ * for the same hostname and service wait for the first name resolution.
  * @return call GetLastError() if returned handle is invalid
  * @see Asynchronous Procedure Calls, QueueUserAPC
  */
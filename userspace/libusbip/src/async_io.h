@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "..\task.h"
+#include "..\win_handle.h"
+
+#include "protocol.h"
+#include "op_common.h"
+
+#include <atomic>
+#include <stop_token>
+#include <optional>
+#include <cassert>
+
+#include <WinSock2.h>
+
+namespace usbip
+{
+
+struct io_result
+{
+        DWORD error;
+        DWORD transferred;
+};
+
+/*
+ * Awaitable overlapped I/O, the coroutine is resumed on a thread pool thread.
+ * A stop request cancels I/O by CancelIoEx.
+ *
+ * @param F DWORD(OVERLAPPED&), starts I/O and returns ERROR_SUCCESS, ERROR_IO_PENDING or an error
+ */
+template<typename F>
+class overlapped_io
+{
+public:
+        overlapped_io(HANDLE handle, std::stop_token stop, F start, bool socket = false) :
+                m_handle(handle), m_stop(std::move(stop)), m_start(std::move(start)), m_socket(socket) {}
+
+        ~overlapped_io()
+        {
+                if (m_wait) {
+                        CloseThreadpoolWait(m_wait);
+                }
+        }
+
+        overlapped_io(const overlapped_io&) = delete;
+        overlapped_io& operator=(const overlapped_io&) = delete;
+
+        bool await_ready() const noexcept { return false; }
+        auto await_resume() const noexcept { return m_result; }
+
+        bool await_suspend(std::coroutine_handle<> coro)
+        {
+                m_coro = coro;
+
+                if (m_stop.stop_requested()) {
+                        m_result.error = ERROR_OPERATION_ABORTED;
+                        return false;
+                }
+
+                if (m_event.reset(CreateEvent(nullptr, true, false, nullptr)); !m_event) {
+                        m_result.error = GetLastError();
+                        return false;
+                }
+
+                if (m_wait = CreateThreadpoolWait(on_wait, this, nullptr); !m_wait) {
+                        m_result.error = GetLastError();
+                        return false;
+                }
+
+                m_ovlp.hEvent = m_event.get();
+                SetThreadpoolWait(m_wait, m_event.get(), nullptr);
+
+                m_on_stop.emplace(m_stop, canceler{ m_handle, &m_ovlp });
+
+                if (auto err = m_start(m_ovlp); err && err != ERROR_IO_PENDING) {
+                        SetThreadpoolWait(m_wait, nullptr, nullptr);
+                        WaitForThreadpoolWaitCallbacks(m_wait, true);
+                        m_on_stop.reset();
+                        m_result.error = err;
+                        return false;
+                }
+
+                if (m_stop.stop_requested()) { // canceler could be called before I/O was started
+                        CancelIoEx(m_handle, &m_ovlp);
+                }
+
+                return m_state.exchange(SUSPENDED) != COMPLETED; // resume now if I/O is already completed
+        }
+
+private:
+        enum { STARTED, SUSPENDED, COMPLETED };
+
+        struct canceler
+        {
+                HANDLE handle;
+                OVERLAPPED *ovlp;
+
+                void operator()() const noexcept { CancelIoEx(handle, ovlp); }
+        };
+
+        HANDLE m_handle;
+        std::stop_token m_stop;
+        F m_start;
+        bool m_socket;
+
+        OVERLAPPED m_ovlp{};
+        NullableHandle m_event;
+        PTP_WAIT m_wait{};
+
+        std::optional<std::stop_callback<canceler>> m_on_stop;
+        std::atomic<int> m_state{ STARTED };
+
+        std::coroutine_handle<> m_coro;
+        io_result m_result{};
+
+        static void CALLBACK on_wait(PTP_CALLBACK_INSTANCE, void *context, PTP_WAIT, TP_WAIT_RESULT)
+        {
+                auto &self = *static_cast<overlapped_io*>(context);
+                self.on_complete();
+        }
+
+        void on_complete() noexcept
+        {
+                auto &r = m_result;
+
+                if (m_socket) {
+                        DWORD flags{};
+                        auto s = reinterpret_cast<SOCKET>(m_handle);
+                        if (!WSAGetOverlappedResult(s, &m_ovlp, &r.transferred, false, &flags)) {
+                                r.error = WSAGetLastError();
+                        }
+                } else if (!GetOverlappedResult(m_handle, &m_ovlp, &r.transferred, false)) {
+                        r.error = GetLastError();
+                }
+
+                m_on_stop.reset(); // waits if canceler is running
+
+                if (m_state.exchange(COMPLETED) == SUSPENDED) {
+                        m_coro.resume(); // can destroy this object
+                }
+        }
+};
+
+/*
+ * Resume the coroutine on a thread pool thread, use it before blocking calls.
+ */
+struct resume_background
+{
+        DWORD error{};
+
+        bool await_ready() const noexcept { return false; }
+        auto await_resume() const noexcept { return error; }
+
+        bool await_suspend(std::coroutine_handle<> coro)
+        {
+                auto f = [] (PTP_CALLBACK_INSTANCE, void *context)
+                {
+                        std::coroutine_handle<>::from_address(context).resume();
+                };
+
+                if (TrySubmitThreadpoolCallback(f, coro.address(), nullptr)) {
+                        return true;
+                }
+
+                error = GetLastError();
+                return false;
+        }
+};
+
+/*
+ * Satisfies protocol_stream.
+ */
+class socket_stream
+{
+public:
+        socket_stream(SOCKET s, std::stop_token stop) : m_sock(s), m_stop(std::move(stop)) {}
+
+        task<int> send(const void *buf, size_t len);
+        task<int> recv(void *buf, size_t len);
+
+        static int error(protocol_error err) noexcept
+        {
+                return static_cast<int>(err == protocol_error::version ? USBIP_ERROR_VERSION : USBIP_ERROR_PROTOCOL);
+        }
+
+        static int error(op_status_t st) noexcept { return static_cast<int>(op_status_error(st)); }
+
+private:
+        SOCKET m_sock;
+        std::stop_token m_stop;
+};
+
+} // namespace usbip
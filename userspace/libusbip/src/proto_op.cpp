@@ -2,22 +2,36 @@
  * Copyright (c) 2022-2025 Vadym Hrynchyshyn <vadimgrn@gmail.com>
  */
 
-#include <usbip\proto_op.h>
-#include <intrin.h>
+#include <usbip/proto_op.h>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
 
 namespace
 {
 
-inline void bswap(UINT16 &val)
+/*
+ * The fields of packed structs can be misaligned, they must not be bound to references.
+ */
+inline UINT16 bswap(UINT16 val)
 {
+#ifdef _MSC_VER
         static_assert(sizeof(val) == sizeof(unsigned short));
-        val = _byteswap_ushort(val);
+        return _byteswap_ushort(val);
+#else
+        return __builtin_bswap16(val);
+#endif
 }
 
-inline void bswap(UINT32 &val)
+inline UINT32 bswap(UINT32 val)
 {
+#ifdef _MSC_VER
         static_assert(sizeof(val) == sizeof(unsigned long));
-        val = _byteswap_ulong(val);
+        return _byteswap_ulong(val);
+#else
+        return __builtin_bswap32(val);
+#endif
 }
 
 } // namespace
@@ -25,23 +39,23 @@ inline void bswap(UINT32 &val)
 
 void usbip::byteswap(usbip_usb_device &d)
 {
-        bswap(d.busnum);
-        bswap(d.devnum);
-        bswap(d.speed);
+        d.busnum = bswap(d.busnum);
+        d.devnum = bswap(d.devnum);
+        d.speed = bswap(d.speed);
 
-        bswap(d.idVendor);
-        bswap(d.idProduct);
-        bswap(d.bcdDevice);
+        d.idVendor = bswap(d.idVendor);
+        d.idProduct = bswap(d.idProduct);
+        d.bcdDevice = bswap(d.bcdDevice);
 }
 
 void usbip::byteswap(op_common &c)
 {
-        bswap(c.version);
-        bswap(c.code);
-        bswap(c.status);
+        c.version = bswap(c.version);
+        c.code = bswap(c.code);
+        c.status = bswap(c.status);
 }
 
 void usbip::byteswap(op_devlist_reply &r)
 {
-        bswap(r.ndev);
+        r.ndev = bswap(r.ndev);
 }
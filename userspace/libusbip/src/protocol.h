@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Coroutines of the usbip protocol that do not depend on a transport.
+ * A stream completes send/recv of all bytes or returns an error code.
+ * It does not depend on Windows, @see userspace/libusbip/tests.
+ */
+
+#include "../task.h"
+
+#include <usbip/consts.h>
+#include <usbip/proto_op.h>
+
+#include <vector>
+#include <expected>
+#include <concepts>
+#include <cstddef>
+
+namespace usbip
+{
+
+/*
+ * Violations of the protocol by a server.
+ */
+enum class protocol_error
+{
+        version, // of the protocol
+        code, // unexpected op_common.code
+};
+
+/*
+ * A stream maps protocol_error and op_status_t other than ST_OK to its error codes.
+ */
+template<typename S>
+concept protocol_stream = requires(S &s, void *buf, const void *cbuf, size_t len)
+{
+        { s.send(cbuf, len) } -> std::same_as<task<int>>;
+        { s.recv(buf, len) } -> std::same_as<task<int>>;
+        { s.error(protocol_error::version) } -> std::same_as<int>;
+        { s.error(ST_ERROR) } -> std::same_as<int>;
+};
+
+struct devlist_entry
+{
+        usbip_usb_device udev; // byteswapped
+        std::vector<usbip_usb_interface> interfaces;
+};
+
+template<protocol_stream S>
+task<int> send_op_common(S &s, UINT16 code)
+{
+        op_common r {
+                .version = USBIP_VERSION,
+                .code = code,
+                .status = ST_OK
+        };
+
+        byteswap(r);
+        co_return co_await s.send(&r, sizeof(r));
+}
+
+template<protocol_stream S>
+task<int> recv_op_common(S &s, UINT16 expected_code)
+{
+        op_common r{};
+
+        if (auto err = co_await s.recv(&r, sizeof(r))) {
+                co_return err;
+        }
+
+        byteswap(r);
+
+        if (r.version != USBIP_VERSION) {
+                co_return s.error(protocol_error::version);
+        }
+
+        if (r.code != expected_code) {
+                co_return s.error(protocol_error::code);
+        }
+
+        co_return r.status == ST_OK ? 0 : s.error(static_cast<op_status_t>(r.status));
+}
+
+/**
+ * OP_REQ_DEVLIST
+ * @return exportable devices or an error code
+ */
+template<protocol_stream S>
+task<std::expected<std::vector<devlist_entry>, int>> enum_exportable_devices(S &s)
+{
+        using result = std::expected<std::vector<devlist_entry>, int>;
+
+        if (auto err = co_await send_op_common(s, OP_REQ_DEVLIST)) {
+                co_return result(std::unexpect, err);
+        }
+
+        if (auto err = co_await recv_op_common(s, OP_REP_DEVLIST)) {
+                co_return result(std::unexpect, err);
+        }
+
+        op_devlist_reply reply{};
+
+        if (auto err = co_await s.recv(&reply, sizeof(reply))) {
+                co_return result(std::unexpect, err);
+        }
+
+        byteswap(reply);
+        result devices(std::in_place);
+
+        for (UINT32 i = 0; i < reply.ndev; ++i) {
+
+                op_devlist_reply_extra extra{};
+
+                if (auto err = co_await s.recv(&extra, sizeof(extra))) {
+                        co_return result(std::unexpect, err);
+                }
+
+                byteswap(extra);
+
+                auto &d = devices->emplace_back(extra.udev);
+                d.interfaces.resize(d.udev.bNumInterfaces);
+
+                auto len = d.interfaces.size()*sizeof(d.interfaces.front()); // byteswap is not required
+                if (auto err = len ? co_await s.recv(d.interfaces.data(), len) : 0) {
+                        co_return result(std::unexpect, err);
+                }
+        }
+
+        co_return devices;
+}
+
+} // namespace usbip
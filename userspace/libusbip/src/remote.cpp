@@ -3,9 +3,13 @@
  */
 
 #include "..\remote.h"
+#include "..\async.h"
 #include "..\win_handle.h"
 
 #include "device_speed.h"
+#include "resolver.h"
+#include "async_io.h"
+#include "protocol.h"
 #include "op_common.h"
 #include "last_error.h"
 #include "strconv.h"
@@ -14,6 +18,7 @@
 #include <usbip\proto_op.h>
 
 #include <chrono>
+#include <span>
 
 #include <ws2tcpip.h>
 #include <mstcpip.h>
@@ -293,81 +298,35 @@ auto try_connect(_In_ SOCKET s, _In_ WSAEVENT evt, _In_ const sockaddr &addr, _I
 	return err;
 }
 
-INT wait_for_resolve(_Inout_ OVERLAPPED &ovlp, _In_opt_ HANDLE cancel, _In_ bool alertable)
+auto get_connect_ex(_Inout_ set_last_error &last, _In_ SOCKET s)
 {
-	INT err;
-
-	switch (auto ret = WaitForSingleObjectEx(ovlp.hEvent, INFINITE, alertable)) {
-	case WAIT_OBJECT_0:
-		if (err = GetAddrInfoExOverlappedResult(&ovlp); err) {
-			libusbip::output("GetAddrInfoExOverlappedResult error {}", err);
-		}
-		break;
-	case WAIT_IO_COMPLETION: // see QueueUserAPC
-		libusbip::output("GetAddrInfoEx cancelled by APC");
-		if (err = GetAddrInfoExCancel(&cancel); err) {
-			libusbip::output("GetAddrInfoExOverlappedResult error {}", err);
-		} else {
-			err = wait_for_resolve(ovlp, HANDLE(), false); // see WSA_E_CANCELLED
-		}
-		break;
-	default:
-		assert(ret == WAIT_FAILED);
-		err = GetLastError();
-		libusbip::output("WaitForSingleObjectEx(alertable={}) -> {}, error {}", alertable, ret, err);
-	}
+        LPFN_CONNECTEX f{};
+        GUID guid = WSAID_CONNECTEX;
+
+        if (DWORD BytesReturned{};
+            WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &f, sizeof(f), &BytesReturned, nullptr, nullptr)) {
+                last.error = WSAGetLastError();
+                libusbip::output("WSAIoctl(SIO_GET_EXTENSION_FUNCTION_POINTER) error {}", last.error);
+                f = nullptr;
+        }
 
-	return err;
+        return f;
 }
 
 /*
- * Numeric IP addresses like "XXX.XXX.XXX.XXX" are resolved instantly. 
+ * ConnectEx requires a bound socket.
  */
-auto resolve(_Inout_ set_last_error &last, _In_ const char *hostname, _In_ const char *service)
+auto prepare_connect_ex(_Inout_ set_last_error &last, _In_ SOCKET s, _In_ const address &r)
 {
-	std::unique_ptr<ADDRINFOEX, decltype(FreeAddrInfoEx)&> ptr(nullptr, FreeAddrInfoEx);
-
-        auto host = utf8_to_wchar(hostname);
-        auto svc = utf8_to_wchar(service);
+        SOCKADDR_STORAGE any{ .ss_family = static_cast<ADDRESS_FAMILY>(r.family) }; // INADDR_ANY, IN6ADDR_ANY
 
-        if (!(host && svc)) {
-                last.error = host.error_or(svc.error());
-                libusbip::output("utf8_to_wchar('{}','{}') error {}", hostname, service, last.error);
-                return ptr; 
+        if (bind(s, reinterpret_cast<const sockaddr*>(&any), r.addrlen)) {
+                last.error = WSAGetLastError();
+                libusbip::output("bind(family={}) error {}", r.family, last.error);
+                return LPFN_CONNECTEX();
         }
 
-        NullableHandle evt(CreateEvent(nullptr, true, false, nullptr));
-	if (!evt) {
-		last.error = WSAGetLastError();
-		libusbip::output("CreateEvent error {}", last.error);
-		return ptr;
-	}
-
-	OVERLAPPED ovlp { .hEvent = evt.get() };
-
-	const ADDRINFOEX hints{ .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
-	ADDRINFOEX *result{};
-	HANDLE cancel{};
-
-	libusbip::output("resolving {}:{}", hostname, service);
-
-	last.error = GetAddrInfoEx(host->c_str(), svc->c_str(), NS_ALL, nullptr, 
-				   &hints, &result, nullptr, &ovlp, nullptr, &cancel);
-
-	switch (last.error) {
-	case WSA_IO_PENDING:
-		if (last.error = wait_for_resolve(ovlp, cancel, true); last.error) {
-			break;
-		}
-		[[fallthrough]];
-	case NO_ERROR:
-		ptr.reset(result);
-		break;
-	default:
-		libusbip::output("GetAddrInfoEx error {}", last.error);
-	}
-
-	return ptr;
+        return set_options(last, s) ? get_connect_ex(last, s) : nullptr;
 }
 
 inline auto connect_by_name(_In_ SOCKET s, _In_ LPCWSTR hostname, _In_ _In_ LPCWSTR service) noexcept
@@ -440,8 +399,8 @@ auto usbip::connect(_In_ const char *hostname, _In_ const char *service, _In_ un
 		return sock;
 	}
 
-	auto ai = resolve(last, hostname, service);
-	if (!ai) {
+	address_list addrs;
+	if (last.error = resolve(addrs, hostname, service, true); last.error) {
 		return sock;
 	}
 
@@ -452,16 +411,16 @@ auto usbip::connect(_In_ const char *hostname, _In_ const char *service, _In_ un
 		return sock;
 	}
 
-	for (auto r = ai.get(); r; r = r->ai_next) {
+	for (auto &r: std::span(addrs.v, addrs.cnt)) {
 
-		sock.reset(socket(r->ai_family, r->ai_socktype, r->ai_protocol));
+		sock.reset(socket(r.family, r.socktype, r.protocol));
 
 		if (!sock) {
 			last.error = WSAGetLastError();
-			libusbip::output("socket(family={}) error {}", r->ai_family, last.error);
+			libusbip::output("socket(family={}) error {}", r.family, last.error);
 		} else if (auto ok = set_options(last, sock.get()) && prepare_event(last, sock.get(), evt.get()); !ok) {
 			//
-		} else if (auto err = try_connect(sock.get(), evt.get(), *r->ai_addr, static_cast<DWORD>(r->ai_addrlen))) {
+		} else if (auto err = try_connect(sock.get(), evt.get(), reinterpret_cast<const sockaddr&>(r.addr), r.addrlen)) {
 			if (last.error = err; err == ERROR_CANCELLED) {
 				break;
 			}
@@ -539,3 +498,141 @@ bool usbip::enum_exportable_devices(
 
 	return true;
 }
+
+auto usbip::socket_stream::send(_In_ const void *buf, _In_ size_t len) -> task<int>
+{
+        auto addr = static_cast<const char*>(buf);
+
+        while (len) {
+                WSABUF b{ .len = static_cast<ULONG>(len), .buf = const_cast<char*>(addr) };
+
+                auto start = [s = m_sock, &b] (auto &ovlp) -> DWORD
+                {
+                        return WSASend(s, &b, 1, nullptr, 0, &ovlp, nullptr) ? WSAGetLastError() : ERROR_SUCCESS;
+                };
+
+                auto [err, n] = co_await overlapped_io(reinterpret_cast<HANDLE>(m_sock), m_stop, start, true);
+                if (err) {
+                        libusbip::output("WSASend error {}", err);
+                        co_return err;
+                }
+
+                addr += n;
+                len -= n;
+        }
+
+        co_return 0;
+}
+
+auto usbip::socket_stream::recv(_In_ void *buf, _In_ size_t len) -> task<int>
+{
+        auto addr = static_cast<char*>(buf);
+
+        while (len) {
+                WSABUF b{ .len = static_cast<ULONG>(len), .buf = addr };
+
+                auto start = [s = m_sock, &b] (auto &ovlp) -> DWORD
+                {
+                        DWORD flags{};
+                        return WSARecv(s, &b, 1, nullptr, &flags, &ovlp, nullptr) ? WSAGetLastError() : ERROR_SUCCESS;
+                };
+
+                auto [err, n] = co_await overlapped_io(reinterpret_cast<HANDLE>(m_sock), m_stop, start, true);
+                if (err) {
+                        libusbip::output("WSARecv error {}", err);
+                        co_return err;
+                } else if (!n) { // connection has been gracefully closed
+                        libusbip::output("recv EOF");
+                        co_return ERROR_HANDLE_EOF;
+                }
+
+                addr += n;
+                len -= n;
+        }
+
+        co_return 0;
+}
+
+auto usbip::async::connect(_In_ std::string hostname, _In_ std::string service, _In_ std::stop_token stop) 
+        -> task<result<Socket>>
+{
+        if (auto err = co_await resume_background()) { // resolve() is blocking
+                co_return std::unexpected(err);
+        }
+
+        address_list addrs;
+        if (DWORD err = resolve(addrs, hostname.c_str(), service.c_str(), stop)) {
+                co_return std::unexpected(err == WSA_E_CANCELLED ? ERROR_OPERATION_ABORTED : err);
+        }
+
+        DWORD error = WSAHOST_NOT_FOUND;
+
+        for (auto &r: std::span(addrs.v, addrs.cnt)) {
+
+                if (stop.stop_requested()) {
+                        error = ERROR_OPERATION_ABORTED;
+                        break;
+                }
+
+                Socket sock(socket(r.family, r.socktype, r.protocol));
+                set_last_error last(NO_ERROR);
+
+                if (!sock) {
+                        last.error = WSAGetLastError();
+                        libusbip::output("socket(family={}) error {}", r.family, last.error);
+                } else if (auto connect_ex = prepare_connect_ex(last, sock.get(), r)) {
+
+                        libusbip::output(L"connecting to {}", address_to_string(reinterpret_cast<const SOCKADDR&>(r.addr), r.addrlen));
+
+                        auto start = [s = sock.get(), connect_ex, &r] (auto &ovlp) -> DWORD
+                        {
+                                auto ok = connect_ex(s, reinterpret_cast<const sockaddr*>(&r.addr), r.addrlen, nullptr, 0, nullptr, &ovlp);
+                                return ok ? ERROR_SUCCESS : WSAGetLastError();
+                        };
+
+                        if (auto [err, n] = co_await overlapped_io(reinterpret_cast<HANDLE>(sock.get()), stop, start, true); err) {
+                                last.error = err;
+                                libusbip::output("ConnectEx error {}", err);
+                        } else if (setsockopt(sock.get(), SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0)) {
+                                last.error = WSAGetLastError();
+                                libusbip::output("setsockopt(SO_UPDATE_CONNECT_CONTEXT) error {}", last.error);
+                        } else {
+                                co_return std::move(sock);
+                        }
+                }
+
+                if (error = last.error; error == ERROR_OPERATION_ABORTED) {
+                        break;
+                }
+        }
+
+        co_return std::unexpected(error);
+}
+
+auto usbip::async::enum_exportable_devices(_In_ SOCKET s, _In_ std::stop_token stop) 
+        -> task<result<std::vector<exportable_device>>>
+{
+        assert(s != INVALID_SOCKET);
+        socket_stream stream(s, std::move(stop));
+
+        auto devices = co_await usbip::enum_exportable_devices(stream);
+        if (!devices) {
+                co_return std::unexpected(static_cast<DWORD>(devices.error()));
+        }
+
+        libusbip::output("{} exportable device(s)", devices->size());
+
+        std::vector<exportable_device> v;
+        v.reserve(devices->size());
+
+        for (auto &d: *devices) {
+                auto &dev = v.emplace_back(as_usb_device(d.udev));
+
+                static_assert(sizeof(usbip_usb_interface) == sizeof(usb_interface));
+                auto intf = reinterpret_cast<const usb_interface*>(d.interfaces.data());
+
+                dev.interfaces.assign(intf, intf + d.interfaces.size());
+        }
+
+        co_return v;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "resolver.h"
+#include "..\win_handle.h"
+
+#include "strconv.h"
+#include "output.h"
+
+#include <usbip\resolver_cache.h>
+
+#include <cassert>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <ws2tcpip.h>
+
+namespace
+{
+
+using namespace usbip;
+
+using cache_t = resolver_cache<address_list, 16>;
+
+/*
+ * GetAddrInfoEx does not return TTL of DNS records.
+ */
+enum : cache_t::time_t { // milliseconds
+        POSITIVE_TTL = 60*1000,
+        NEGATIVE_TTL = 5*1000,
+};
+
+auto& get_cache() noexcept
+{
+        static struct {
+                std::mutex mtx;
+                std::condition_variable cv;
+                cache_t cache; // zero-initialized
+        } v;
+
+        return v;
+}
+
+inline auto is_cancelled(_In_ int err) noexcept
+{
+        return err == WSA_E_CANCELLED || err == ERROR_CANCELLED;
+}
+
+/*
+ * A lookup is canceled by APC if alertable, or by a stop request.
+ */
+struct cancellation
+{
+        bool alertable;
+        std::stop_token stop;
+};
+
+INT wait_for_resolve(_Inout_ OVERLAPPED &ovlp, _In_opt_ HANDLE cancel, _In_ bool alertable)
+{
+	INT err;
+
+	switch (auto ret = WaitForSingleObjectEx(ovlp.hEvent, INFINITE, alertable)) {
+	case WAIT_OBJECT_0:
+		if (err = GetAddrInfoExOverlappedResult(&ovlp); err) {
+			libusbip::output("GetAddrInfoExOverlappedResult error {}", err);
+		}
+		break;
+	case WAIT_IO_COMPLETION: // see QueueUserAPC
+		libusbip::output("GetAddrInfoEx cancelled by APC");
+		if (err = GetAddrInfoExCancel(&cancel); err) {
+			libusbip::output("GetAddrInfoExOverlappedResult error {}", err);
+		} else {
+			err = wait_for_resolve(ovlp, HANDLE(), false); // see WSA_E_CANCELLED
+		}
+		break;
+	default:
+		assert(ret == WAIT_FAILED);
+		err = GetLastError();
+		libusbip::output("WaitForSingleObjectEx(alertable={}) -> {}, error {}", alertable, ret, err);
+	}
+
+	return err;
+}
+
+auto copy(_Out_ address_list &result, _In_ const ADDRINFOEX *head) noexcept
+{
+        result.cnt = 0;
+
+        for (auto ai = head; ai && result.cnt < result.MAX_CNT; ai = ai->ai_next) {
+
+                if (ai->ai_addrlen > sizeof(address::addr)) {
+                        continue;
+                }
+
+                auto &a = result.v[result.cnt++];
+
+                a.family = ai->ai_family;
+                a.socktype = ai->ai_socktype;
+                a.protocol = ai->ai_protocol;
+                a.addrlen = static_cast<int>(ai->ai_addrlen);
+
+                memcpy(&a.addr, ai->ai_addr, ai->ai_addrlen);
+        }
+
+        return result.cnt ? 0 : WSANO_DATA;
+}
+
+int getaddrinfo(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ const cancellation &c)
+{
+        result.cnt = 0;
+
+        auto host = utf8_to_wchar(hostname);
+        auto svc = utf8_to_wchar(service);
+
+        if (!(host && svc)) {
+                auto err = host.error_or(svc.error());
+                libusbip::output("utf8_to_wchar('{}','{}') error {}", hostname, service, err);
+                return err;
+        }
+
+        NullableHandle evt(CreateEvent(nullptr, true, false, nullptr));
+        if (!evt) {
+                auto err = GetLastError();
+                libusbip::output("CreateEvent error {}", err);
+                return err;
+        }
+
+        OVERLAPPED ovlp { .hEvent = evt.get() };
+
+        const ADDRINFOEX hints{ .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        ADDRINFOEX *ai{};
+        HANDLE cancel{};
+
+        libusbip::output("resolving {}:{}", hostname, service);
+
+        auto err = GetAddrInfoEx(host->c_str(), svc->c_str(), NS_ALL, nullptr,
+                                 &hints, &ai, nullptr, &ovlp, nullptr, &cancel);
+
+        switch (err) {
+        case WSA_IO_PENDING:
+                if (std::stop_callback on_stop(c.stop, [&cancel] { GetAddrInfoExCancel(&cancel); });
+                    (err = wait_for_resolve(ovlp, cancel, c.alertable))) {
+                        break;
+                }
+                [[fallthrough]];
+        case NO_ERROR:
+                err = copy(result, ai);
+                FreeAddrInfoEx(ai);
+                break;
+        default:
+                libusbip::output("GetAddrInfoEx error {}", err);
+        }
+
+        return err;
+}
+
+/*
+ * @return true if APC was executed or stop was requested
+ */
+auto wait_for_other(_Inout_ std::unique_lock<std::mutex> &lck, _In_ const cancellation &c)
+{
+        using namespace std::chrono_literals;
+        auto &cv = get_cache().cv;
+
+        if (!(c.alertable || c.stop.stop_possible())) {
+                cv.wait(lck);
+                return false;
+        }
+
+        cv.wait_for(lck, 100ms);
+
+        if (c.stop.stop_requested()) {
+                return true;
+        } else if (!c.alertable) {
+                return false;
+        }
+
+        lck.unlock();
+        auto apc = SleepEx(0, true) == WAIT_IO_COMPLETION; // see QueueUserAPC
+        lck.lock();
+
+        return apc;
+}
+
+int do_resolve(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ const cancellation &c)
+{
+        auto &[mtx, cv, cache] = get_cache();
+
+        auto host_len = strlen(hostname);
+        auto svc_len = strlen(service);
+
+        std::unique_lock lck(mtx);
+
+        for (long status; ; ) {
+                switch (cache.lookup(hostname, host_len, service, svc_len, GetTickCount64(), result, status)) {
+                case cache_t::result::hit:
+                        return 0;
+                case cache_t::result::negative_hit:
+                        libusbip::output("{}:{} cached error {}", hostname, service, status);
+                        return status;
+                case cache_t::result::pending:
+                        if (wait_for_other(lck, c)) {
+                                libusbip::output("waiting for resolving {}:{} cancelled", hostname, service);
+                                return WSA_E_CANCELLED;
+                        }
+                        continue;
+                }
+
+                break; // miss
+        }
+
+        lck.unlock();
+        auto err = getaddrinfo(result, hostname, service, c);
+        lck.lock();
+
+        if (is_cancelled(err)) {
+                cache.abandon(hostname, host_len, service, svc_len);
+        } else {
+                cache.complete(hostname, host_len, service, svc_len, GetTickCount64(),
+                               err, &result, err ? NEGATIVE_TTL : POSITIVE_TTL);
+        }
+
+        lck.unlock();
+        cv.notify_all();
+
+        return err;
+}
+
+} // namespace
+
+
+int usbip::resolve(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ bool alertable)
+{
+        return do_resolve(result, hostname, service, cancellation{ .alertable = alertable });
+}
+
+int usbip::resolve(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ std::stop_token stop)
+{
+        return do_resolve(result, hostname, service, cancellation{ .stop = std::move(stop) });
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <WinSock2.h>
+#include <stop_token>
+
+namespace usbip
+{
+
+struct address
+{
+        int family;
+        int socktype;
+        int protocol;
+        int addrlen;
+        SOCKADDR_STORAGE addr;
+};
+
+struct address_list
+{
+        enum { MAX_CNT = 8 };
+
+        int cnt;
+        address v[MAX_CNT];
+};
+
+/*
+ * GetAddrInfoEx through the process-wide cache with TTL.
+ * Concurrent calls for the same (hostname, service) wait for the result of the first one.
+ * Numeric IP addresses like "XXX.XXX.XXX.XXX" are resolved instantly.
+ *
+ * @param alertable the call can be canceled by APC, WSA_E_CANCELLED will be returned
+ * @return Winsock error code
+ */
+int resolve(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ bool alertable);
+
+/*
+ * The same, but the call is canceled by a stop request, WSA_E_CANCELLED will be returned.
+ */
+int resolve(_Out_ address_list &result, _In_ const char *hostname, _In_ const char *service, _In_ std::stop_token stop);
+
+} // namespace usbip
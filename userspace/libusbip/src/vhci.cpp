@@ -3,8 +3,10 @@
  */
 
 #include "..\vhci.h"
+#include "..\async.h"
 
 #include "device_speed.h"
+#include "async_io.h"
 #include "output.h"
 
 #include <resources\messages.h>
@@ -12,8 +14,10 @@
 
 #include <initguid.h>
 #include <usbip\vhci.h>
+#include <usbip\device_delta.h>
 
 #include <span>
+#include <algorithm>
 #include <random>
 
 namespace
@@ -127,6 +131,62 @@ auto make_imported_device(_In_ const vhci::imported_device &d)
         };
 }
 
+auto make_string(_In_ const delta::string_ref &s)
+{
+        return std::string(s.data, s.len);
+}
+
+auto make_imported_device(_In_ const delta::device &d)
+{
+        return imported_device {
+                .location {
+                        .hostname = make_string(d.host),
+                        .service = make_string(d.service),
+                        .busid = make_string(d.busid)
+                },
+                .port = static_cast<int>(d.port),
+                .devid = d.devid,
+                .speed = win_speed(static_cast<usb_device_speed>(d.speed)),
+                .vendor = d.vendor,
+                .product = d.product,
+                .serial = make_string(d.serial)
+        };
+}
+
+/*
+ * @return error code
+ */
+auto merge(_Inout_ std::vector<imported_device> &devices, _In_ const void *data, _In_ size_t length)
+{
+        delta::reader rd(data, length);
+        delta::kind kind;
+        delta::device d;
+
+        while (rd.next(kind, d)) {
+                auto port = static_cast<int>(d.port);
+
+                auto i = std::ranges::lower_bound(devices, port, {}, &imported_device::port);
+                auto found = i != devices.end() && i->port == port;
+
+                if (kind == delta::kind::removed) {
+                        if (found) {
+                                devices.erase(i);
+                        }
+                } else if (found) {
+                        *i = make_imported_device(d);
+                } else {
+                        devices.insert(i, make_imported_device(d));
+                }
+        }
+
+        if (!rd.error()) {
+                return 0;
+        }
+
+        libusbip::output("{}: malformed data", __func__);
+        return USBIP_ERROR_DRIVER_RESPONSE;
+}
+
 auto make_imported_devices(_In_ const std::span<const vhci::imported_device> devices)
 {
         std::vector<imported_device> v;
@@ -144,7 +204,9 @@ auto make_device_state(_In_ const vhci::device_state &r)
         return device_state {
                 .device = make_imported_device(r),
                 .state = static_cast<state>(r.state),
-                .source_id = r.source_id
+                .source_id = r.source_id,
+                .seqnum = r.seqnum,
+                .flags = r.flags
         };
 }
 
@@ -192,6 +254,27 @@ auto get_path()
         }
 }
 
+/*
+ * The driver returns vhci::device_state_v1 to readers that do not select the layout.
+ * The handle can be opened for asynchronous I/O.
+ */
+auto set_device_state_version(_In_ HANDLE dev)
+{
+        NullableHandle evt(CreateEvent(nullptr, true, false, nullptr));
+        if (!evt) {
+                return false;
+        }
+
+        OVERLAPPED ovlp { .hEvent = evt.get() };
+
+        vhci::ioctl::set_device_state_version r {{ .size = sizeof(r) }, vhci::ioctl::DEVICE_STATE_V2 };
+        DWORD BytesReturned{};
+
+        return DeviceIoControl(dev, vhci::ioctl::SET_DEVICE_STATE_VERSION, &r, sizeof(r), nullptr, 0, 
+                               &BytesReturned, &ovlp) ||
+               (GetLastError() == ERROR_IO_PENDING && GetOverlappedResult(dev, &ovlp, &BytesReturned, true));
+}
+
 } // namespace
 
 
@@ -244,6 +327,7 @@ const char* usbip::vhci::get_state_str(_In_ usbip::state state) noexcept
         static_assert(int(state::plugged) == int(vhci::state::plugged));
         static_assert(int(state::disconnected) == int(vhci::state::disconnected));
         static_assert(int(state::unplugging) == int(vhci::state::unplugging));
+        static_assert(int(state::degraded) == int(vhci::state::degraded));
 
         static_assert(int(state::unplugged) == 0);
         static_assert(int(state::connecting) == 1);
@@ -251,8 +335,10 @@ const char* usbip::vhci::get_state_str(_In_ usbip::state state) noexcept
         static_assert(int(state::plugged) == 3);
         static_assert(int(state::disconnected) == 4);
         static_assert(int(state::unplugging) == 5);
+        static_assert(int(state::degraded) == 6);
 
-        const char* v[] = { "unplugged", "connecting", "connected", "plugged", "disconnected", "unplugging" };
+        const char* v[] = { "unplugged", "connecting", "connected", "plugged", "disconnected", "unplugging",
+                            "degraded" };
 
         auto idx = static_cast<int>(state);
         return idx >= 0 && idx < std::size(v) ? v[idx] : "";
@@ -277,6 +363,10 @@ auto usbip::vhci::open(_In_ bool overlapped) -> Handle
                                 nullptr)); // hTemplateFile
         }
 
+        if (h && !set_device_state_version(h.get())) {
+                libusbip::output("set_device_state_version error {}", GetLastError()); // reads will fail
+        }
+
         return h;
 }
 
@@ -324,6 +414,70 @@ std::optional<std::vector<usbip::imported_device>> usbip::vhci::get_imported_dev
         return devices;
 }
 
+/*
+ * The driver reports required length of data if the buffer is too small.
+ */
+bool usbip::vhci::update_imported_devices(
+        _In_ HANDLE dev, _Inout_ imported_devices_view &view, _Out_opt_ bool *changed)
+{
+        if (changed) {
+                *changed = false;
+        }
+
+        constexpr auto hdr_sz = offsetof(ioctl::get_imported_devices_delta, data);
+
+        std::vector<char> buf(hdr_sz + 1024);
+        ioctl::get_imported_devices_delta *r{};
+
+        while (true) {
+                r = reinterpret_cast<ioctl::get_imported_devices_delta*>(buf.data());
+                r->size = sizeof(*r);
+                r->generation = view.generation;
+
+                if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+                    DeviceIoControl(dev, ioctl::GET_IMPORTED_DEVICES_DELTA, r, hdr_sz, 
+                                    buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+
+                        if (BytesReturned < hdr_sz || BytesReturned - hdr_sz != r->length) [[unlikely]] {
+                                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                                return false;
+                        }
+                        break;
+
+                } else if (GetLastError() != ERROR_MORE_DATA) {
+                        return false;
+                } else if (auto len = hdr_sz + r->length; len <= buf.size()) [[unlikely]] {
+                        SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                        return false;
+                } else {
+                        buf.resize(len); // ports can be changed, the length can be greater next time
+                }
+        }
+
+        if (r->flags & ioctl::DELTA_UNCHANGED) {
+                assert(r->generation == view.generation);
+                return true;
+        }
+
+        if (r->flags & ioctl::DELTA_FULL) {
+                view.devices.clear();
+        }
+
+        if (auto err = merge(view.devices, r->data, r->length)) {
+                view.generation = 0; // request all devices next time
+                SetLastError(err);
+                return false;
+        }
+
+        view.generation = r->generation;
+
+        if (changed) {
+                *changed = true;
+        }
+
+        return true;
+}
+
 int usbip::vhci::attach(_In_ HANDLE dev, _In_ const attach_args &args)
 {
         ioctl::plugin_hardware r {{ .size = sizeof(r) }};
@@ -385,6 +539,161 @@ bool usbip::vhci::detach(_In_ HANDLE dev, _In_ int port)
         return DeviceIoControl(dev, ioctl::PLUGOUT_HARDWARE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
 }
 
+bool usbip::vhci::set_capture(_In_ HANDLE dev, _In_ int port, _In_ ULONG snaplen, _In_ ULONG ring_size)
+{
+        ioctl::set_capture r { .port = port, .snaplen = snaplen, .ring_size = ring_size };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_CAPTURE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::read_capture(_In_ HANDLE dev, _In_ int port, _Inout_ std::vector<char> &data, _Out_ UINT64 &dropped)
+{
+        dropped = 0;
+        constexpr auto hdr_sz = offsetof(ioctl::read_capture, data);
+
+        std::vector<char> buf(hdr_sz + data.size());
+
+        auto r = reinterpret_cast<ioctl::read_capture*>(buf.data());
+        r->size = sizeof(*r);
+        r->port = port;
+
+        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::READ_CAPTURE, r, hdr_sz, buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned < hdr_sz || BytesReturned - hdr_sz != r->length) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        data.assign(r->data, r->data + r->length);
+        dropped = r->dropped;
+
+        return true;
+}
+
+bool usbip::vhci::set_urb_trace(_In_ HANDLE dev, _In_ ULONG capacity)
+{
+        ioctl::set_urb_trace r { .capacity = capacity };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_URB_TRACE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::read_urb_trace(_In_ HANDLE dev, _Inout_ std::vector<char> &data, _Out_ UINT64 &frequency)
+{
+        frequency = 0;
+        constexpr auto hdr_sz = offsetof(ioctl::read_urb_trace, data);
+
+        std::vector<char> buf(hdr_sz + data.size());
+
+        auto r = reinterpret_cast<ioctl::read_urb_trace*>(buf.data());
+        r->size = sizeof(*r);
+
+        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::READ_URB_TRACE, r, hdr_sz, buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned < hdr_sz || BytesReturned - hdr_sz != r->length) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        data.assign(r->data, r->data + r->length);
+        frequency = r->frequency;
+
+        return true;
+}
+
+bool usbip::vhci::set_latency(_In_ HANDLE dev, _In_ int port, _In_ ULONG period, _In_ ULONG stages)
+{
+        ioctl::set_latency r { .port = port, .period = period, .stages = stages };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_LATENCY, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::read_latency(_In_ HANDLE dev, _In_ int port, _Inout_ std::vector<char> &data, _In_ bool reset)
+{
+        constexpr auto hdr_sz = offsetof(ioctl::read_latency, data);
+
+        std::vector<char> buf(hdr_sz + data.size());
+
+        auto r = reinterpret_cast<ioctl::read_latency*>(buf.data());
+        r->size = sizeof(*r);
+        r->port = port;
+        r->reset = reset;
+
+        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::READ_LATENCY, r, hdr_sz, buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned < hdr_sz || BytesReturned - hdr_sz != r->length) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        data.assign(r->data, r->data + r->length);
+        return true;
+}
+
+bool usbip::vhci::set_jitter_buffer(_In_ HANDLE dev, _In_ int port, _In_ ULONG endpoint, _In_ ULONG depth)
+{
+        ioctl::set_jitter_buffer r { .port = port, .endpoint = endpoint, .depth = depth };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_JITTER_BUFFER, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::get_jitter_buffer(
+        _In_ HANDLE dev, _In_ int port, _Out_ UINT64 &current_frame,
+        _Out_ isoch::stats (&stats)[isoch::endpoint_count], _In_ bool reset)
+{
+        ioctl::get_jitter_buffer r { .port = port, .reset = reset };
+        r.size = sizeof(r);
+
+        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::GET_JITTER_BUFFER, &r, sizeof(r), &r, sizeof(r), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned != sizeof(r)) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        current_frame = r.current_frame;
+        std::ranges::copy(r.stats, stats);
+
+        return true;
+}
+
+bool usbip::vhci::set_coalesce(_In_ HANDLE dev, _In_ int port, _In_ ULONG window, _In_ ULONG max_batch)
+{
+        ioctl::set_coalesce r { .port = port, .window = window, .max_batch = max_batch };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_COALESCE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::get_coalesce(_In_ HANDLE dev, _In_ int port, _Out_ coalesce::stats &stats, _In_ bool reset)
+{
+        ioctl::get_coalesce r { .port = port, .reset = reset };
+        r.size = sizeof(r);
+
+        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::GET_COALESCE, &r, sizeof(r), &r, sizeof(r), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned != sizeof(r)) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        stats = r.stats;
+        return true;
+}
+
 DWORD usbip::vhci::get_device_state_size() noexcept
 {
         return sizeof(vhci::device_state);
@@ -427,3 +736,109 @@ std::optional<usbip::device_state> usbip::vhci::read_device_state(_In_ HANDLE de
 
         return state;
 }
+
+std::optional<std::vector<usbip::device_state>> usbip::vhci::read_device_states(_In_ HANDLE dev, _In_ int max_cnt)
+{
+        std::optional<std::vector<usbip::device_state>> result;
+
+        if (max_cnt <= 0) {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return result;
+        }
+
+        std::vector<vhci::device_state> v(max_cnt);
+        auto len = static_cast<DWORD>(v.size()*sizeof(v.front()));
+
+        DWORD actual;
+        if (!ReadFile(dev, v.data(), len, &actual, nullptr)) {
+                return result;
+        } else if (!actual) { // see read_device_state
+                SetLastError(ERROR_HANDLE_EOF);
+                return result;
+        } else if (actual % sizeof(v.front())) {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return result;
+        }
+
+        auto cnt = actual/sizeof(v.front());
+
+        auto &states = result.emplace();
+        states.reserve(cnt);
+
+        for (auto &r: std::span(v.data(), cnt)) {
+                if (auto st = get_device_state(&r, sizeof(r))) {
+                        states.push_back(std::move(*st));
+                } else {
+                        result.reset();
+                        break;
+                }
+        }
+
+        return result;
+}
+
+auto usbip::vhci::async::attach(_In_ HANDLE dev, _In_ attach_args args, _In_ std::stop_token stop) -> task<result<int>>
+{
+        ioctl::plugin_hardware r {{ .size = sizeof(r) }};
+
+        if (auto err = assign(r, args)) {
+                co_return std::unexpected(err);
+        }
+
+        auto ctl = args.once ? ioctl::PLUGIN_HARDWARE_ONCE : ioctl::PLUGIN_HARDWARE;
+        constexpr auto outlen = offsetof(ioctl::plugin_hardware, port) + sizeof(r.port);
+
+        auto start = [dev, ctl, &r] (auto &ovlp) -> DWORD
+        {
+                return DeviceIoControl(dev, ctl, &r, sizeof(r), &r, outlen, nullptr, &ovlp) ? ERROR_SUCCESS : GetLastError();
+        };
+
+        if (auto [err, BytesReturned] = co_await overlapped_io(dev, std::move(stop), start); err) {
+                co_return std::unexpected(map_attach_error(err));
+        } else if (BytesReturned != outlen) [[unlikely]] {
+                co_return std::unexpected(static_cast<DWORD>(USBIP_ERROR_DRIVER_RESPONSE));
+        }
+
+        assert(r.port > 0);
+        co_return r.port;
+}
+
+auto usbip::vhci::async::detach(_In_ HANDLE dev, _In_ int port, _In_ std::stop_token stop) -> task<result<int>>
+{
+        ioctl::plugout_hardware r { .port = port };
+        r.size = sizeof(r);
+
+        auto start = [dev, &r] (auto &ovlp) -> DWORD
+        {
+                auto ok = DeviceIoControl(dev, ioctl::PLUGOUT_HARDWARE, &r, sizeof(r), nullptr, 0, nullptr, &ovlp);
+                return ok ? ERROR_SUCCESS : GetLastError();
+        };
+
+        if (auto [err, n] = co_await overlapped_io(dev, std::move(stop), start); err) {
+                co_return std::unexpected(err);
+        }
+
+        co_return port;
+}
+
+auto usbip::vhci::async::read_device_state(_In_ HANDLE dev, _In_ std::stop_token stop) -> task<result<usbip::device_state>>
+{
+        vhci::device_state r;
+
+        auto start = [dev, &r] (auto &ovlp) -> DWORD
+        {
+                return ReadFile(dev, &r, sizeof(r), nullptr, &ovlp) ? ERROR_SUCCESS : GetLastError();
+        };
+
+        auto [err, actual] = co_await overlapped_io(dev, std::move(stop), start);
+
+        if (err) {
+                co_return std::unexpected(err);
+        } else if (!actual) { // see read_device_state
+                co_return std::unexpected(static_cast<DWORD>(ERROR_HANDLE_EOF));
+        } else if (auto st = get_device_state(&r, actual)) {
+                co_return std::move(*st);
+        }
+
+        co_return std::unexpected(GetLastError());
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * This header does not depend on Windows headers.
+ * C++20 is required.
+ */
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <semaphore>
+#include <type_traits>
+
+namespace usbip
+{
+
+/**
+ * Lazy coroutine, it starts when it is awaited or passed to start().
+ * The coroutine that awaits it is resumed on the thread that completed it.
+ * @param T type of the result, void is not supported
+ */
+template<typename T>
+class [[nodiscard]] task
+{
+public:
+        struct promise_type
+        {
+                std::optional<T> value;
+                std::exception_ptr error;
+                std::coroutine_handle<> continuation;
+
+                auto get_return_object() noexcept
+                {
+                        return task(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                auto initial_suspend() noexcept { return std::suspend_always(); }
+
+                auto final_suspend() noexcept
+                {
+                        struct awaiter
+                        {
+                                bool await_ready() const noexcept { return false; }
+                                void await_resume() const noexcept {}
+
+                                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                                {
+                                        auto &cont = h.promise().continuation;
+                                        return cont ? cont : std::noop_coroutine();
+                                }
+                        };
+
+                        return awaiter();
+                }
+
+                template<typename U>
+                void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+
+                void unhandled_exception() noexcept { error = std::current_exception(); }
+        };
+
+        task() = default;
+
+        task(task &&t) noexcept : m_coro(std::exchange(t.m_coro, nullptr)) {}
+
+        task& operator=(task &&t) noexcept
+        {
+                if (this != &t) {
+                        reset();
+                        m_coro = std::exchange(t.m_coro, nullptr);
+                }
+                return *this;
+        }
+
+        ~task() { reset(); }
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+
+        explicit operator bool() const noexcept { return bool(m_coro); }
+
+        auto operator co_await() && noexcept
+        {
+                struct awaiter
+                {
+                        std::coroutine_handle<promise_type> coro;
+
+                        bool await_ready() const noexcept { return !coro || coro.done(); }
+
+                        auto await_suspend(std::coroutine_handle<> cont) noexcept
+                        {
+                                coro.promise().continuation = cont;
+                                return coro;
+                        }
+
+                        T await_resume()
+                        {
+                                auto &p = coro.promise();
+                                if (p.error) {
+                                        std::rethrow_exception(p.error);
+                                }
+                                return std::move(*p.value);
+                        }
+                };
+
+                return awaiter{m_coro};
+        }
+
+private:
+        static_assert(!std::is_void_v<T>);
+        std::coroutine_handle<promise_type> m_coro;
+
+        explicit task(std::coroutine_handle<promise_type> h) noexcept : m_coro(h) {}
+
+        void reset() noexcept
+        {
+                if (auto h = std::exchange(m_coro, nullptr)) {
+                        h.destroy();
+                }
+        }
+};
+
+
+namespace detail
+{
+
+struct detached_task
+{
+        struct promise_type
+        {
+                auto get_return_object() noexcept { return detached_task(); }
+                auto initial_suspend() noexcept { return std::suspend_never(); }
+                auto final_suspend() noexcept { return std::suspend_never(); }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+        };
+};
+
+template<typename T, typename F>
+detached_task run(task<T> t, F on_complete)
+{
+        on_complete(co_await std::move(t));
+}
+
+} // namespace detail
+
+
+/**
+ * Completion callback style.
+ * @param t task to run, it is started on the calling thread
+ * @param on_complete will be called with the result of the task on the thread that completed it,
+ *        an exception that escapes the task terminates the process
+ */
+template<typename T, typename F>
+inline void start(task<T> t, F on_complete)
+{
+        detail::run(std::move(t), std::move(on_complete));
+}
+
+/**
+ * Block the calling thread until the task is completed.
+ * @return the result of the task
+ */
+template<typename T>
+T sync_wait(task<T> t)
+{
+        std::optional<T> result;
+        std::binary_semaphore done(0);
+
+        start(std::move(t), [&result, &done] (T v)
+        {
+                result.emplace(std::move(v));
+                done.release();
+        });
+
+        done.acquire();
+        return std::move(*result);
+}
+
+} // namespace usbip
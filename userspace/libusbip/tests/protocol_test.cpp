@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * Tests of src/protocol.h on Linux, OP_REQ_DEVLIST is sent to userspace/loopback.
+ * The target protocol_test of CMakeLists.txt of the repository or
+ * g++ -std=c++23 -O2 -Wall -Wextra -I../../../include -I../../posix protocol_test.cpp ../src/proto_op.cpp -o protocol_test
+ * ./protocol_test path/to/loopback
+ */
+
+#include "../src/protocol.h"
+#include <usbip/tests/check.h>
+#include <usbip/tests/loopback.h>
+
+#include <arpa/inet.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+
+using namespace usbip;
+
+const char *g_loopback = "./loopback";
+
+/*
+ * Satisfies protocol_stream, errno values are returned.
+ */
+class posix_stream
+{
+public:
+        explicit posix_stream(int s) : m_sock(s) {}
+        ~posix_stream() { if (m_sock >= 0) close(m_sock); }
+
+        task<int> send(const void *buf, size_t len)
+        {
+                for (auto p = static_cast<const char*>(buf); len; ) {
+                        auto n = ::send(m_sock, p, len, MSG_NOSIGNAL);
+                        if (n < 0) {
+                                co_return errno;
+                        }
+                        p += n;
+                        len -= n;
+                }
+                co_return 0;
+        }
+
+        task<int> recv(void *buf, size_t len)
+        {
+                for (auto p = static_cast<char*>(buf); len; ) {
+                        auto n = ::recv(m_sock, p, len, 0);
+                        if (n <= 0) {
+                                co_return n ? errno : ECONNRESET;
+                        }
+                        p += n;
+                        len -= n;
+                }
+                co_return 0;
+        }
+
+        static int error(protocol_error err) noexcept { return err == protocol_error::version ? EPROTONOSUPPORT : EPROTO; }
+        static int error(op_status_t st) noexcept { return 1000 + st; }
+
+private:
+        int m_sock;
+};
+
+/*
+ * Replays the bytes of a server, records the bytes of a client.
+ */
+class scripted_stream
+{
+public:
+        std::vector<unsigned char> in;
+        std::vector<unsigned char> out;
+        int recv_error = ECONNRESET; // when in is exhausted
+
+        task<int> send(const void *buf, size_t len)
+        {
+                auto p = static_cast<const unsigned char*>(buf);
+                out.insert(out.end(), p, p + len);
+                co_return 0;
+        }
+
+        task<int> recv(void *buf, size_t len)
+        {
+                if (m_off + len > in.size()) {
+                        co_return recv_error;
+                }
+                memcpy(buf, in.data() + m_off, len);
+                m_off += len;
+                co_return 0;
+        }
+
+        static int error(protocol_error err) noexcept { return posix_stream::error(err); }
+        static int error(op_status_t st) noexcept { return posix_stream::error(st); }
+
+        template<typename T>
+        void reply(T v)
+        {
+                byteswap(v);
+                auto p = reinterpret_cast<const unsigned char*>(&v);
+                in.insert(in.end(), p, p + sizeof(v));
+        }
+
+private:
+        size_t m_off{};
+};
+
+static_assert(protocol_stream<posix_stream>);
+static_assert(protocol_stream<scripted_stream>);
+
+auto devlist(scripted_stream &s)
+{
+        return sync_wait(enum_exportable_devices(s));
+}
+
+} // namespace
+
+
+TEST(request_is_op_req_devlist)
+{
+        scripted_stream s;
+        devlist(s);
+
+        CHECK(s.out.size() == sizeof(op_common));
+        op_common r{};
+        memcpy(&r, s.out.data(), sizeof(r));
+        CHECK(ntohs(r.version) == USBIP_VERSION);
+        CHECK(ntohs(r.code) == OP_REQ_DEVLIST);
+        CHECK(!r.status);
+}
+
+TEST(empty_list)
+{
+        scripted_stream s;
+        s.reply(op_common{ USBIP_VERSION, OP_REP_DEVLIST, ST_OK });
+        s.reply(op_devlist_reply{ .ndev = 0 });
+
+        auto r = devlist(s);
+        CHECK(r && r->empty());
+}
+
+TEST(devices_with_interfaces)
+{
+        scripted_stream s;
+        s.reply(op_common{ USBIP_VERSION, OP_REP_DEVLIST, ST_OK });
+        s.reply(op_devlist_reply{ .ndev = 2 });
+
+        op_devlist_reply_extra a{};
+        strcpy(a.udev.busid, "3-1");
+        a.udev.idVendor = 0x1234;
+        a.udev.bNumInterfaces = 2;
+        s.reply(a);
+        s.reply(usbip_usb_interface{ 3, 1, 2, 0 });
+        s.reply(usbip_usb_interface{ 8, 6, 0x50, 0 });
+
+        op_devlist_reply_extra b{};
+        strcpy(b.udev.busid, "3-2");
+        s.reply(b); // no interfaces
+
+        auto r = devlist(s);
+        if (!CHECK(r && r->size() == 2)) {
+                return;
+        }
+
+        auto &d = r->front();
+        CHECK(!strcmp(d.udev.busid, "3-1"));
+        CHECK(d.udev.idVendor == 0x1234);
+        CHECK(d.interfaces.size() == 2);
+        CHECK(d.interfaces[1].bInterfaceClass == 8 && d.interfaces[1].bInterfaceProtocol == 0x50);
+
+        CHECK(!strcmp(r->back().udev.busid, "3-2"));
+        CHECK(r->back().interfaces.empty());
+}
+
+TEST(wrong_version)
+{
+        scripted_stream s;
+        s.reply(op_common{ USBIP_VERSION + 1, OP_REP_DEVLIST, ST_OK });
+
+        auto r = devlist(s);
+        CHECK(!r && r.error() == EPROTONOSUPPORT);
+}
+
+TEST(wrong_code)
+{
+        scripted_stream s;
+        s.reply(op_common{ USBIP_VERSION, OP_REP_IMPORT, ST_OK });
+
+        auto r = devlist(s);
+        CHECK(!r && r.error() == EPROTO);
+}
+
+TEST(status_is_mapped_by_stream)
+{
+        scripted_stream s;
+        s.reply(op_common{ USBIP_VERSION, OP_REP_DEVLIST, ST_NA });
+
+        auto r = devlist(s);
+        CHECK(!r && r.error() == 1000 + ST_NA);
+}
+
+TEST(truncated_reply)
+{
+        scripted_stream s;
+        s.recv_error = EPIPE;
+        s.reply(op_common{ USBIP_VERSION, OP_REP_DEVLIST, ST_OK });
+        s.reply(op_devlist_reply{ .ndev = 1 });
+
+        auto r = devlist(s);
+        CHECK(!r && r.error() == EPIPE);
+}
+
+TEST(loopback_devlist)
+{
+        test::loopback_server srv(g_loopback);
+        if (!CHECK(srv)) {
+                return;
+        }
+
+        posix_stream s(srv.connect());
+
+        auto r = sync_wait(enum_exportable_devices(s));
+        if (!CHECK(r && r->size() == 3)) {
+                return;
+        }
+
+        const char *busids[] { "1-1", "1-2", "1-3" };
+
+        for (size_t i = 0; i < r->size(); ++i) {
+                auto &d = (*r)[i];
+                CHECK(!strcmp(d.udev.busid, busids[i]));
+                CHECK(!strncmp(d.udev.path, "/sys/devices/", 13));
+                CHECK(d.udev.bNumInterfaces >= 1);
+                CHECK(d.interfaces.size() == d.udev.bNumInterfaces);
+        }
+}
+
+TEST(loopback_is_gone)
+{
+        unsigned short port{};
+        {
+                test::loopback_server srv(g_loopback);
+                port = srv.port();
+        }
+
+        CHECK(test::connect_loopback(port) < 0);
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc > 1) {
+                g_loopback = argv[1];
+                --argc;
+                ++argv;
+        }
+
+        return test::run(argc, argv);
+}
@@ -7,6 +7,7 @@
 #include "dllspec.h"
 #include "win_handle.h"
 #include <usbspec.h>
+#include <usbip\isoch_pacing.h>
 
 #include <string>
 #include <vector>
@@ -46,17 +47,29 @@ struct imported_device
         std::string serial; // only filled if you set it in attach_args
 };
 
-enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging };
+enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging,
+                   degraded }; // plugged, but the server does not respond timely
+
+enum : UINT32 // device_state::flags
+{
+        state_resync = 1, // earlier states of this device were dropped, this is its latest one
+        state_lost = 2, // states of other devices were dropped as well, call get_imported_devices()
+};
 
 /**
  * There can be multiple event sources for the same device,
  * each of them emits events with a unique source_id.
+ *
+ * States are numbered consecutively, the driver drops the oldest ones if the reader is too slow.
+ * Then it returns the latest state of every device whose states were dropped with state_resync.
  */
 struct device_state
 {
         imported_device device;
         state state = state::unplugged;
         ULONG source_id;
+        UINT64 seqnum;
+        UINT32 flags;
 };
 
 /**
@@ -97,6 +110,25 @@ USBIP_API Handle open(_In_ bool overlapped = false);
  */
 USBIP_API std::optional<std::vector<imported_device>> get_imported_devices(_In_ HANDLE dev);
 
+/**
+ * Cached view of imported devices, see update_imported_devices().
+ */
+struct imported_devices_view
+{
+        UINT64 generation{}; // of the driver's ports, zero if the view was not updated yet
+        std::vector<imported_device> devices; // sorted by port
+};
+
+/**
+ * Bring the view up to date, only ports that were changed since its generation are transferred.
+ * Use it instead of get_imported_devices() if the devices are polled periodically.
+ * @param dev handle of the driver device
+ * @param view to update
+ * @param changed is set to true if the view was changed
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool update_imported_devices(_In_ HANDLE dev, _Inout_ imported_devices_view &view, _Out_opt_ bool *changed = nullptr);
+
 
 /**
  * @see generate_device_serial
@@ -136,6 +168,102 @@ enum { port_all_closeonly = -2, port_all };
  */
 USBIP_API bool detach(_In_ HANDLE dev, _In_ int port);
 
+/**
+ * Enable or disable capture of USB/IP traffic of the device, see usbip/capture.h
+ * @param dev handle of the driver device
+ * @param port hub port number starting from 1
+ * @param snaplen bytes of every PDU to record, zero disables the capture
+ * @param ring_size of the driver's buffer in bytes, zero for the default.
+ *        The buffer is allocated when the capture is enabled first time and lives as long as the device.
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_capture(_In_ HANDLE dev, _In_ int port, _In_ ULONG snaplen, _In_ ULONG ring_size = 0);
+
+/**
+ * Drain captured PDUs of the device.
+ * @param data its size is the maximum number of bytes to read, it is resized to the number of read bytes.
+ *        It contains capture::record-s aligned to capture::alignment.
+ * @param dropped total number of records that the driver has dropped because its buffer was full
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool read_capture(_In_ HANDLE dev, _In_ int port, _Inout_ std::vector<char> &data, _Out_ UINT64 &dropped);
+
+/**
+ * Enable or disable binary trace of USB/IP PDUs of all devices, see usbip/urb_trace.h
+ * @param dev handle of the driver device
+ * @param capacity records per processor, zero disables the trace.
+ *        The buffers are allocated when the trace is enabled first time and live as long as the driver.
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_urb_trace(_In_ HANDLE dev, _In_ ULONG capacity);
+
+/**
+ * Drain trace records.
+ * @param data its size is the maximum number of bytes to read, it is resized to the number of read bytes.
+ *        It contains urb_trace::chunk-s followed by their records.
+ * @param frequency of the performance counter that timestamps records
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool read_urb_trace(_In_ HANDLE dev, _Inout_ std::vector<char> &data, _Out_ UINT64 &frequency);
+
+/**
+ * Enable or disable latency breakdown of URBs of the device, see usbip/latency.h
+ * @param dev handle of the driver device
+ * @param port hub port number starting from 1
+ * @param period every Nth URB is sampled, zero disables the sampling
+ * @param stages bit mask of latency::stage_mask-s to record, zero for all.
+ *        The histograms are allocated when the sampling is enabled first time and live as long as the device.
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_latency(_In_ HANDLE dev, _In_ int port, _In_ ULONG period, _In_ ULONG stages = 0);
+
+/**
+ * Read latency histograms of the device.
+ * @param data its size is the maximum number of bytes to read, it is resized to the number of read bytes.
+ *        It contains latency::endpoint_stats-s of endpoints that have samples.
+ * @param reset zero the histograms after they are read
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool read_latency(_In_ HANDLE dev, _In_ int port, _Inout_ std::vector<char> &data, _In_ bool reset);
+
+/**
+ * Pace isochronous IN endpoints of the device by its virtual frame clock, see usbip/isoch_pacing.h
+ * @param dev handle of the driver device
+ * @param port hub port number starting from 1
+ * @param endpoint number, zero for all
+ * @param depth frames, zero disables the pacing, isoch::depth_auto adjusts it to the jitter
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_jitter_buffer(_In_ HANDLE dev, _In_ int port, _In_ ULONG endpoint, _In_ ULONG depth);
+
+/**
+ * Read the counters of the jitter buffer of the device.
+ * @param current_frame of the virtual frame clock of the device
+ * @param stats by endpoint number, stats::depth is zero if the endpoint is not paced
+ * @param reset zero the counters after they are read
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool get_jitter_buffer(
+        _In_ HANDLE dev, _In_ int port, _Out_ UINT64 &current_frame,
+        _Out_ isoch::stats (&stats)[isoch::endpoint_count], _In_ bool reset);
+
+/**
+ * Coalesce interrupt IN resubmits of the device, see usbip/coalesce.h
+ * @param dev handle of the driver device
+ * @param port hub port number starting from 1
+ * @param window microseconds, zero disables coalescing
+ * @param max_batch PDUs of a window, zero for coalesce::default_max_batch
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_coalesce(_In_ HANDLE dev, _In_ int port, _In_ ULONG window, _In_ ULONG max_batch);
+
+/**
+ * Read the overhead counters of the device and the counters of its coalescing windows.
+ * @param reset zero the counters after they are read
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool get_coalesce(_In_ HANDLE dev, _In_ int port, _Out_ coalesce::stats &stats, _In_ bool reset);
+
 /**
  * @return textual representation of the given constant
  */
@@ -161,4 +289,13 @@ USBIP_API std::optional<device_state> get_device_state(_In_ const void *data, _I
  */
 USBIP_API std::optional<device_state> read_device_state(_In_ HANDLE dev);
 
+/**
+ * Read pending states by one read operation, blocks if there are no pending states.
+ * @param dev handle of the driver device that must be opened for serialized I/O
+ * @param max_cnt maximum number of states to read, must be greater than zero
+ * @return states in the order they were emitted by the driver
+           if the result contains a value, otherwise call GetLastError()
+ */
+USBIP_API std::optional<std::vector<device_state>> read_device_states(_In_ HANDLE dev, _In_ int max_cnt);
+
 } // namespace usbip::vhci
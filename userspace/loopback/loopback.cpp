@@ -0,0 +1,1065 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * User-mode USB/IP server with synthetic devices, a peer for tests and benchmarks of the client.
+ *
+ * It answers OP_REQ_DEVLIST and OP_REQ_IMPORT and exports devices that do not need hardware:
+ * 1-1 bulk loopback, IN transfers return data of OUT transfers or a pattern if there is no data (sink/source)
+ * 1-2 HID-like interrupt IN endpoint, a report every interval
+ * 1-3 isochronous audio-like stream, 48 kHz 16-bit stereo IN and OUT, a frame per millisecond
+ *
+ * Latency, bandwidth and errors are injected by options. A device can be imported by one client at a time,
+ * a connection is served by its own thread. Responses are scheduled by their due time, so they can be
+ * sent out of order as a real server does.
+ *
+ * It accepts the compression extension if the client offers it, @see usbip/compress.h.
+ *
+ * It does not depend on Windows, build it on Linux or other POSIX system by CMakeLists.txt of the repository or
+ * g++ -std=c++20 -O2 -pthread -I../../include -I../posix loopback.cpp -o loopback
+ */
+
+#include <usbip/proto.h>
+#include <usbip/proto_op.h>
+#include <usbip/ch9.h>
+#include <usbip/compress.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+using namespace std::chrono_literals;
+
+using bytes = std::vector<unsigned char>;
+using clock_type = std::chrono::steady_clock;
+
+struct options
+{
+        unsigned short port = 3240;
+        clock_type::duration latency{}; // added to every response
+        double bandwidth{}; // bytes per second of a connection, zero is unlimited
+        double error_rate{}; // probability of a failed transfer or isochronous packet
+        unsigned int hid_interval = 8; // milliseconds
+        unsigned int seed = 1;
+        bool verbose{};
+        bool plain{}; // decline the compression extension as usbipd does
+};
+options g_opts;
+
+enum class kind { bulk, hid, audio };
+
+enum : unsigned char { // bmAttributes & 3 of endpoint descriptor
+        EP_ISOCH = 1,
+        EP_BULK,
+        EP_INTR
+};
+
+enum { AUDIO_FRAME = 192 }; // 48000 Hz * 2 channels * 2 bytes / 1000 frames
+enum { BULK_FIFO_MAX = 64*1024*1024 };
+
+struct device
+{
+        kind type;
+        const char *busid;
+        UINT32 devnum;
+        usb_device_speed speed;
+        const char *product;
+
+        bytes dev_dsc;
+        bytes cfg_dsc;
+        bytes report_dsc; // HID
+
+        std::atomic<bool> busy;
+};
+
+void put16(bytes &v, unsigned int val)
+{
+        v.push_back(static_cast<unsigned char>(val));
+        v.push_back(static_cast<unsigned char>(val >> 8));
+}
+
+auto device_descriptor(UINT16 bcdUSB, UINT8 bMaxPacketSize0, UINT16 idProduct)
+{
+        bytes d{ 18, 1 }; // USB_DEVICE_DESCRIPTOR_TYPE
+        put16(d, bcdUSB);
+        d.insert(d.end(), { 0, 0, 0, bMaxPacketSize0 }); // class is defined by interfaces
+        put16(d, 0x1209); // pid.codes
+        put16(d, idProduct);
+        put16(d, 0x0100); // bcdDevice
+        d.insert(d.end(), { 1, 2, 3, 1 }); // iManufacturer, iProduct, iSerialNumber, bNumConfigurations
+        return d;
+}
+
+void interface(bytes &d, UINT8 num, UINT8 alt, UINT8 eps, UINT8 cls)
+{
+        d.insert(d.end(), { 9, 4, num, alt, eps, cls, 0, 0, 0 }); // USB_INTERFACE_DESCRIPTOR_TYPE
+}
+
+void endpoint(bytes &d, UINT8 addr, UINT8 attr, UINT16 maxpkt, UINT8 interval)
+{
+        d.insert(d.end(), { 7, 5, addr, attr }); // USB_ENDPOINT_DESCRIPTOR_TYPE
+        put16(d, maxpkt);
+        d.push_back(interval);
+}
+
+auto configuration(bytes body, UINT8 interfaces)
+{
+        bytes d{ 9, 2 }; // USB_CONFIGURATION_DESCRIPTOR_TYPE
+        put16(d, static_cast<unsigned int>(9 + body.size()));
+        d.insert(d.end(), { interfaces, 1, 0, 0x80, 50 }); // bConfigurationValue, bus powered, 100mA
+        d.insert(d.end(), body.begin(), body.end());
+        return d;
+}
+
+void init_devices(device (&devs)[3])
+{
+        auto &b = devs[0];
+        b.type = kind::bulk;
+        b.busid = "1-1";
+        b.speed = USB_SPEED_HIGH;
+        b.product = "Bulk loopback";
+        b.dev_dsc = device_descriptor(bcdUSB20, 64, 0x0001);
+        {
+                bytes d;
+                interface(d, 0, 0, 2, 0xFF); // vendor specific
+                endpoint(d, 0x81, EP_BULK, 512, 0);
+                endpoint(d, 0x01, EP_BULK, 512, 0);
+                b.cfg_dsc = configuration(std::move(d), 1);
+        }
+
+        auto &h = devs[1];
+        h.type = kind::hid;
+        h.busid = "1-2";
+        h.speed = USB_SPEED_FULL;
+        h.product = "HID-like interrupt source";
+        h.dev_dsc = device_descriptor(bcdUSB11, 64, 0x0002);
+        h.report_dsc = { // vendor defined 8-byte input report
+                0x06, 0x00, 0xFF, // Usage Page (Vendor Defined)
+                0x09, 0x01, // Usage (1)
+                0xA1, 0x01, // Collection (Application)
+                0x15, 0x00, // Logical Minimum (0)
+                0x26, 0xFF, 0x00, // Logical Maximum (255)
+                0x75, 0x08, // Report Size (8)
+                0x95, 0x08, // Report Count (8)
+                0x09, 0x01, // Usage (1)
+                0x81, 0x02, // Input (Data, Var, Abs)
+                0xC0, // End Collection
+        };
+        {
+                bytes d;
+                interface(d, 0, 0, 1, 3); // HID
+                d.insert(d.end(), { 9, 0x21, 0x11, 0x01, 0, 1, 0x22 }); // HID descriptor, one report descriptor
+                put16(d, static_cast<unsigned int>(h.report_dsc.size()));
+                auto intvl = static_cast<UINT8>(std::clamp(g_opts.hid_interval, 1U, 255U));
+                endpoint(d, 0x81, EP_INTR, 8, intvl);
+                h.cfg_dsc = configuration(std::move(d), 1);
+        }
+
+        auto &a = devs[2];
+        a.type = kind::audio;
+        a.busid = "1-3";
+        a.speed = USB_SPEED_FULL;
+        a.product = "Isochronous audio-like stream";
+        a.dev_dsc = device_descriptor(bcdUSB11, 64, 0x0003);
+        {
+                bytes d;
+                interface(d, 0, 0, 0, 0xFF); // zero bandwidth
+                interface(d, 0, 1, 2, 0xFF);
+                endpoint(d, 0x81, EP_ISOCH | 0x04, AUDIO_FRAME, 1); // asynchronous
+                endpoint(d, 0x02, EP_ISOCH | 0x04, AUDIO_FRAME, 1);
+                a.cfg_dsc = configuration(std::move(d), 1);
+        }
+
+        for (UINT32 i = 0; i < std::size(devs); ++i) {
+                devs[i].devnum = i + 2;
+        }
+}
+
+auto make_udev(const device &d)
+{
+        usbip_usb_device u{};
+
+        snprintf(u.path, sizeof(u.path), "/sys/devices/platform/usbip-loopback/usb1/%s", d.busid);
+        snprintf(u.busid, sizeof(u.busid), "%s", d.busid);
+
+        u.busnum = htonl(1);
+        u.devnum = htonl(d.devnum);
+        u.speed = htonl(d.speed);
+
+        auto &dd = d.dev_dsc;
+        u.idVendor = htons(static_cast<UINT16>(dd[8] | dd[9] << 8));
+        u.idProduct = htons(static_cast<UINT16>(dd[10] | dd[11] << 8));
+        u.bcdDevice = htons(static_cast<UINT16>(dd[12] | dd[13] << 8));
+
+        u.bDeviceClass = dd[4];
+        u.bDeviceSubClass = dd[5];
+        u.bDeviceProtocol = dd[6];
+
+        u.bConfigurationValue = d.cfg_dsc[5];
+        u.bNumConfigurations = dd[17];
+        u.bNumInterfaces = d.cfg_dsc[4];
+
+        return u;
+}
+
+auto make_interfaces(const device &d)
+{
+        std::vector<usbip_usb_interface> v;
+
+        for (size_t i = 0; i + 9 <= d.cfg_dsc.size(); i += d.cfg_dsc[i]) {
+                if (auto p = &d.cfg_dsc[i]; p[1] == 4 && !p[3]) { // interface, alternate setting 0
+                        v.push_back({ .bInterfaceClass = p[5], .bInterfaceSubClass = p[6], .bInterfaceProtocol = p[7], .padding = 0 });
+                }
+        }
+
+        return v;
+}
+
+bool recv_all(int s, void *buf, size_t len)
+{
+        for (auto p = static_cast<char*>(buf); len; ) {
+                auto n = recv(s, p, len, 0);
+                if (n <= 0) {
+                        return false;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return true;
+}
+
+bool send_all(int s, const void *buf, size_t len)
+{
+        for (auto p = static_cast<const char*>(buf); len; ) {
+                auto n = send(s, p, len, MSG_NOSIGNAL);
+                if (n <= 0) {
+                        return false;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return true;
+}
+
+bool send_op_common(int s, UINT16 code, UINT32 status)
+{
+        op_common r{ .version = htons(USBIP_VERSION), .code = htons(code), .status = htonl(status) };
+        return send_all(s, &r, sizeof(r));
+}
+
+/*
+ * A response that waits for its due time.
+ */
+struct response
+{
+        clock_type::time_point due;
+        UINT64 order; // of submission, for equal due time
+        seqnum_t seqnum;
+        bytes pdu; // in network byte order
+
+        bool operator >(const response &r) const { return due != r.due ? due > r.due : order > r.order; }
+};
+
+struct stats
+{
+        clock_type::time_point start = clock_type::now();
+        UINT64 pdus;
+        UINT64 bytes_in; // payload of CMD_SUBMIT
+        UINT64 bytes_out; // payload of RET_SUBMIT
+        UINT64 errors; // injected
+        UINT64 unlinked;
+
+        UINT64 packed; // payloads that were compressed
+        UINT64 packed_raw; // their size
+        UINT64 packed_wire; // size of their frames
+};
+
+/*
+ * USB/IP session of an imported device.
+ */
+class session
+{
+public:
+        session(int sock, device &dev, const compress::extension &ext) :
+                m_sock(sock), m_dev(dev), m_ext(ext), m_rng(g_opts.seed) {}
+
+        void run();
+
+private:
+        int m_sock;
+        device &m_dev;
+
+        compress::extension m_ext; // negotiated, codecs is zero for plain USB/IP
+        std::vector<unsigned int> m_table; // of compress::pack
+        bytes m_block; // received LZ4 block
+        size_t m_payload_in{}; // of the last CMD_SUBMIT as it was received
+
+        std::vector<response> m_queue; // min-heap
+        UINT64 m_order{};
+
+        clock_type::time_point m_link_free{}; // bandwidth limit
+        clock_type::time_point m_hid_next{};
+        clock_type::time_point m_iso_next{};
+
+        std::deque<unsigned char> m_fifo; // bulk loopback
+        UINT32 m_pattern{};
+
+        std::mt19937 m_rng;
+        std::bernoulli_distribution m_fail{ g_opts.error_rate };
+
+        stats m_stats{};
+
+        bool read_pdu(header &hdr, bytes &data, std::vector<iso_packet_descriptor> &isoc);
+        bool recv_packed(bytes &data);
+        bool pack(const bytes &in, bytes &frame, unsigned int usb_type);
+        void submit(const header &hdr, bytes &data, std::vector<iso_packet_descriptor> &isoc, clock_type::time_point now);
+        void unlink(const header &hdr, clock_type::time_point now);
+
+        INT32 control(const header &hdr, const bytes &out, bytes &in);
+        INT32 bulk(const header &hdr, const bytes &out, bytes &in);
+        INT32 isoch(const header &hdr, std::vector<iso_packet_descriptor> &isoc, bytes &in, INT32 &error_count);
+
+        void schedule(clock_type::time_point due, seqnum_t seqnum, bytes pdu);
+        bool send_due(clock_type::time_point now);
+
+        unsigned int endpoint_type(const header &hdr) const
+        {
+                return !hdr.ep ? 0 : m_dev.type == kind::hid ? EP_INTR : m_dev.type == kind::audio ? EP_ISOCH : EP_BULK;
+        }
+
+        auto frame_number(clock_type::time_point t) const
+        {
+                return static_cast<INT32>(std::chrono::duration_cast<std::chrono::milliseconds>(t - m_stats.start).count() & 0x7FF);
+        }
+};
+
+void session::run()
+{
+        header hdr;
+        bytes data;
+        std::vector<iso_packet_descriptor> isoc;
+
+        for (;;) {
+                auto now = clock_type::now();
+                if (!send_due(now)) {
+                        break;
+                }
+
+                timespec ts{};
+                auto timeout = &ts;
+
+                if (m_queue.empty()) {
+                        timeout = nullptr;
+                } else {
+                        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(m_queue.front().due - now).count();
+                        ts.tv_sec = ns/1'000'000'000;
+                        ts.tv_nsec = ns%1'000'000'000;
+                }
+
+                pollfd fd{ .fd = m_sock, .events = POLLIN, .revents = 0 };
+
+                if (auto n = ppoll(&fd, 1, timeout, nullptr); n < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        perror("ppoll");
+                        break;
+                } else if (!n) {
+                        continue;
+                }
+
+                if (!read_pdu(hdr, data, isoc)) {
+                        break;
+                }
+
+                now = clock_type::now();
+                ++m_stats.pdus;
+
+                switch (hdr.command) {
+                case CMD_SUBMIT:
+                        submit(hdr, data, isoc, now);
+                        break;
+                case CMD_UNLINK:
+                        unlink(hdr, now);
+                        break;
+                }
+        }
+
+        auto secs = std::chrono::duration<double>(clock_type::now() - m_stats.start).count();
+        auto &s = m_stats;
+
+        printf("%s: %llu PDU(s), in %llu byte(s), out %llu byte(s), %llu error(s) injected, %llu unlinked, "
+               "%.2f s, %.2f MB/s\n", m_dev.busid, (unsigned long long)s.pdus, (unsigned long long)s.bytes_in,
+               (unsigned long long)s.bytes_out, (unsigned long long)s.errors, (unsigned long long)s.unlinked,
+               secs, secs ? (s.bytes_in + s.bytes_out)/secs/1e6 : 0);
+
+        if (s.packed) {
+                printf("%s: %llu payload(s) compressed, %llu -> %llu byte(s)\n", m_dev.busid,
+                       (unsigned long long)s.packed, (unsigned long long)s.packed_raw, (unsigned long long)s.packed_wire);
+        }
+}
+
+/*
+ * Converts the header to host byte order.
+ */
+bool session::read_pdu(header &hdr, bytes &data, std::vector<iso_packet_descriptor> &isoc)
+{
+        if (!recv_all(m_sock, &hdr, sizeof(hdr))) {
+                return false;
+        }
+
+        for (auto v: { &hdr.command, &hdr.seqnum, &hdr.devid, &hdr.direction, &hdr.ep }) {
+                *v = ntohl(*v);
+        }
+
+        data.clear();
+        isoc.clear();
+
+        switch (hdr.command) {
+        case CMD_SUBMIT:
+                if (auto &r = hdr.cmd_submit; true) {
+                        r.transfer_flags = ntohl(r.transfer_flags);
+                        for (auto v: { &r.transfer_buffer_length, &r.start_frame, &r.number_of_packets, &r.interval }) {
+                                *v = static_cast<INT32>(ntohl(static_cast<UINT32>(*v)));
+                        }
+
+                        if (r.transfer_buffer_length < 0 || (r.number_of_packets != number_of_packets_non_isoch &&
+                                                            !is_valid_number_of_packets(r.number_of_packets))) {
+                                fprintf(stderr, "%s: invalid CMD_SUBMIT, seqnum %u\n", m_dev.busid, hdr.seqnum);
+                                return false;
+                        }
+
+                        if (hdr.direction == direction::out) {
+                                data.resize(r.transfer_buffer_length);
+                        }
+
+                        if (r.number_of_packets > 0) {
+                                isoc.resize(r.number_of_packets);
+                        }
+                }
+                break;
+        case CMD_UNLINK:
+                hdr.cmd_unlink.seqnum = ntohl(hdr.cmd_unlink.seqnum);
+                break;
+        default:
+                fprintf(stderr, "%s: unexpected command %u\n", m_dev.busid, hdr.command);
+                return false;
+        }
+
+        auto packed = hdr.command == CMD_SUBMIT && (hdr.cmd_submit.transfer_flags & compress::submit_flag);
+
+        if (packed) {
+                hdr.cmd_submit.transfer_flags &= ~compress::submit_flag;
+                if (!m_ext.codecs || data.empty() || !isoc.empty()) {
+                        fprintf(stderr, "%s: unexpected compressed payload, seqnum %u\n", m_dev.busid, hdr.seqnum);
+                        return false;
+                }
+        } else {
+                m_payload_in = data.size();
+        }
+
+        if (!((packed ? recv_packed(data) : recv_all(m_sock, data.data(), data.size())) &&
+              recv_all(m_sock, isoc.data(), isoc.size()*sizeof(isoc[0])))) {
+                return false;
+        }
+
+        for (auto &d: isoc) {
+                for (auto v: { &d.offset, &d.length, &d.actual_length, &d.status }) {
+                        *v = ntohl(*v);
+                }
+        }
+
+        m_stats.bytes_in += data.size();
+        return true;
+}
+
+/*
+ * @param data has the size of uncompressed payload
+ */
+bool session::recv_packed(bytes &data)
+{
+        unsigned char frame[compress::frame_hdr];
+        if (!recv_all(m_sock, frame, sizeof(frame))) {
+                return false;
+        }
+
+        auto len = compress::block_size(frame);
+        if (!compress::is_valid_block_size(len, data.size())) {
+                fprintf(stderr, "%s: LZ4 block of %zu byte(s) for %zu byte(s)\n", m_dev.busid, len, data.size());
+                return false;
+        }
+
+        m_block.resize(len);
+        if (!recv_all(m_sock, m_block.data(), len)) {
+                return false;
+        }
+
+        if (!compress::unpack(m_block.data(), len, data.data(), data.size())) {
+                fprintf(stderr, "%s: malformed LZ4 block\n", m_dev.busid);
+                return false;
+        }
+
+        m_payload_in = sizeof(frame) + len;
+
+        ++m_stats.packed;
+        m_stats.packed_raw += data.size();
+        m_stats.packed_wire += m_payload_in;
+
+        return true;
+}
+
+/*
+ * @return false if the payload is sent as is
+ */
+bool session::pack(const bytes &in, bytes &frame, unsigned int usb_type)
+{
+        if (auto t = compress::threshold(m_ext, usb_type); !t || in.size() < t) {
+                return false;
+        }
+
+        frame.resize(in.size());
+        m_table.resize(lz4::hash_size);
+
+        frame.resize(compress::pack(in.data(), in.size(), frame.data(), m_table.data()));
+        if (frame.empty()) {
+                return false;
+        }
+
+        ++m_stats.packed;
+        m_stats.packed_raw += in.size();
+        m_stats.packed_wire += frame.size();
+
+        return true;
+}
+
+void session::submit(const header &hdr, bytes &data, std::vector<iso_packet_descriptor> &isoc, clock_type::time_point now)
+{
+        auto &cmd = hdr.cmd_submit;
+
+        bytes in;
+        INT32 status{};
+        INT32 error_count{};
+        INT32 start_frame{};
+
+        auto due = now + g_opts.latency;
+
+        if (!hdr.ep) {
+                status = control(hdr, data, in);
+        } else if (!isoc.empty()) {
+                auto start = std::max(now, m_iso_next);
+                m_iso_next = start + isoc.size()*1ms; // a frame per packet, completed after the last one
+                due = std::max(due, m_iso_next);
+                start_frame = frame_number(start);
+                status = isoch(hdr, isoc, in, error_count);
+        } else if (m_dev.type == kind::hid) {
+                if (hdr.ep == 1 && hdr.direction == direction::in) {
+                        due = std::max(due, m_hid_next);
+                        m_hid_next = due + g_opts.hid_interval*1ms;
+                        in.resize(std::min(cmd.transfer_buffer_length, 8));
+                        for (auto &b: in) {
+                                b = static_cast<unsigned char>(m_pattern++);
+                        }
+                } else {
+                        status = -EPIPE;
+                }
+        } else {
+                status = bulk(hdr, data, in);
+        }
+
+        if (hdr.ep && isoc.empty() && !status && m_fail(m_rng)) {
+                status = -EPROTO;
+                in.clear();
+                ++m_stats.errors;
+        }
+
+        auto actual_length = hdr.direction == direction::in ? static_cast<INT32>(in.size()) :
+                             status ? 0 : cmd.transfer_buffer_length;
+
+        if (!isoc.empty()) {
+                actual_length = 0;
+                for (auto &d: isoc) {
+                        actual_length += d.actual_length;
+                }
+        }
+
+        bytes frame;
+        auto packed = hdr.direction == direction::in && isoc.empty() && pack(in, frame, endpoint_type(hdr));
+        auto &payload = packed ? frame : in; // as it is sent
+
+        if (g_opts.bandwidth > 0) {
+                auto len = sizeof(header) + m_payload_in + payload.size() + isoc.size()*sizeof(isoc[0]);
+                auto cost = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(len/g_opts.bandwidth));
+                m_link_free = std::max(due, m_link_free) + cost;
+                due = m_link_free;
+        }
+
+        header ret{};
+        ret.command = htonl(RET_SUBMIT);
+        ret.seqnum = htonl(hdr.seqnum);
+
+        auto &r = ret.ret_submit;
+        r.status = static_cast<INT32>(htonl(static_cast<UINT32>(status)));
+        r.actual_length = static_cast<INT32>(htonl(static_cast<UINT32>(actual_length)));
+        r.start_frame = static_cast<INT32>(htonl(static_cast<UINT32>(start_frame)));
+        r.number_of_packets = static_cast<INT32>(htonl(static_cast<UINT32>(isoc.size())));
+        r.error_count = static_cast<INT32>(htonl(static_cast<UINT32>(error_count)));
+
+        if (packed) {
+                r.ext_flags = htonl(compress::ret_flag);
+        }
+
+        for (auto &d: isoc) {
+                for (auto v: { &d.offset, &d.length, &d.actual_length, &d.status }) {
+                        *v = htonl(*v);
+                }
+        }
+
+        bytes pdu(sizeof(ret) + payload.size() + isoc.size()*sizeof(isoc[0]));
+        auto p = pdu.data();
+
+        memcpy(p, &ret, sizeof(ret));
+        p += sizeof(ret);
+
+        if (!payload.empty()) { // data() can be null
+                memcpy(p, payload.data(), payload.size());
+                p += payload.size();
+        }
+
+        if (!isoc.empty()) {
+                memcpy(p, isoc.data(), isoc.size()*sizeof(isoc[0]));
+        }
+
+        m_stats.bytes_out += in.size() + isoc.size()*sizeof(isoc[0]);
+        schedule(due, hdr.seqnum, std::move(pdu));
+}
+
+/*
+ * If the request is not completed yet, it is discarded and RET_UNLINK has -ECONNRESET,
+ * otherwise RET_SUBMIT was sent and the status is zero.
+ */
+void session::unlink(const header &hdr, clock_type::time_point now)
+{
+        auto status = 0;
+
+        if (auto i = std::ranges::find(m_queue, hdr.cmd_unlink.seqnum, &response::seqnum); i != m_queue.end()) {
+                m_queue.erase(i);
+                std::ranges::make_heap(m_queue, std::greater{});
+                status = -ECONNRESET;
+                ++m_stats.unlinked;
+        }
+
+        header ret{};
+        ret.command = htonl(RET_UNLINK);
+        ret.seqnum = htonl(hdr.seqnum);
+        ret.ret_unlink.status = static_cast<INT32>(htonl(static_cast<UINT32>(status)));
+
+        bytes pdu(sizeof(ret));
+        memcpy(pdu.data(), &ret, sizeof(ret));
+
+        schedule(now + g_opts.latency, 0, std::move(pdu)); // seqnum is not used to unlink it
+}
+
+void session::schedule(clock_type::time_point due, seqnum_t seqnum, bytes pdu)
+{
+        m_queue.push_back({ .due = due, .order = m_order++, .seqnum = seqnum, .pdu = std::move(pdu) });
+        std::ranges::push_heap(m_queue, std::greater{});
+}
+
+bool session::send_due(clock_type::time_point now)
+{
+        while (!m_queue.empty() && m_queue.front().due <= now) {
+
+                std::ranges::pop_heap(m_queue, std::greater{});
+                auto &r = m_queue.back();
+
+                if (g_opts.verbose) {
+                        printf("%s: seqnum %u, %zu byte(s)\n", m_dev.busid, r.seqnum, r.pdu.size());
+                }
+
+                if (!send_all(m_sock, r.pdu.data(), r.pdu.size())) {
+                        return false;
+                }
+
+                m_queue.pop_back();
+        }
+
+        return true;
+}
+
+INT32 session::control(const header &hdr, const bytes &out, bytes &in)
+{
+        auto &s = hdr.cmd_submit.setup;
+
+        auto type = s[0] & 0x60;
+        auto req = s[1];
+        auto wValue = s[2] | s[3] << 8;
+        auto wLength = std::min(s[6] | s[7] << 8, hdr.cmd_submit.transfer_buffer_length);
+
+        auto reply = [&in, wLength] (const bytes &v)
+        {
+                in.assign(v.begin(), v.begin() + std::min(wLength, static_cast<int>(v.size())));
+                return 0;
+        };
+
+        auto string = [] (std::string_view str)
+        {
+                bytes d{ static_cast<unsigned char>(2 + 2*str.size()), 3 }; // USB_STRING_DESCRIPTOR_TYPE
+                for (auto c: str) {
+                        put16(d, static_cast<unsigned char>(c));
+                }
+                return d;
+        };
+
+        if (type == 0x40) { // vendor, no-op for benchmarks of control transfers
+                if (hdr.direction == direction::in) {
+                        in.assign(wLength, 0);
+                }
+                return 0;
+        }
+
+        if (type == 0x20) { // class
+                switch (m_dev.type == kind::hid ? req : 0) {
+                case 0x01: // GET_REPORT
+                        return reply(bytes(8));
+                case 0x0A: // SET_IDLE
+                case 0x0B: // SET_PROTOCOL
+                        return 0;
+                }
+                return -EPIPE;
+        }
+
+        switch (req) {
+        case 0: // GET_STATUS
+                return reply(bytes(2));
+        case 1: // CLEAR_FEATURE
+        case 3: // SET_FEATURE
+        case 9: // SET_CONFIGURATION
+        case 11: // SET_INTERFACE
+                return 0;
+        case 8: // GET_CONFIGURATION
+                return reply({ m_dev.cfg_dsc[5] });
+        case 10: // GET_INTERFACE
+                return reply({ 0 });
+        case 6: // GET_DESCRIPTOR
+                switch (auto idx = wValue & 0xFF; wValue >> 8) {
+                case 1:
+                        return reply(m_dev.dev_dsc);
+                case 2:
+                        return reply(m_dev.cfg_dsc);
+                case 3:
+                        switch (idx) {
+                        case 0:
+                                return reply({ 4, 3, 0x09, 0x04 }); // en-US
+                        case 1:
+                                return reply(string("usbip-win2"));
+                        case 2:
+                                return reply(string(m_dev.product));
+                        case 3:
+                                return reply(string(m_dev.busid));
+                        }
+                        break;
+                case 0x22: // HID report
+                        if (!m_dev.report_dsc.empty()) {
+                                return reply(m_dev.report_dsc);
+                        }
+                        break;
+                }
+                break;
+        }
+
+        if (g_opts.verbose) {
+                printf("%s: control request %02x %02x %04x is stalled, %zu byte(s)\n", m_dev.busid, s[0], req, wValue, out.size());
+        }
+
+        return -EPIPE;
+}
+
+/*
+ * Data of OUT transfers is queued and returned by IN transfers, if the queue is empty a pattern is returned.
+ */
+INT32 session::bulk(const header &hdr, const bytes &out, bytes &in)
+{
+        if (m_dev.type != kind::bulk || hdr.ep != 1) {
+                return -EPIPE;
+        }
+
+        if (hdr.direction == direction::out) {
+                if (m_fifo.size() + out.size() <= BULK_FIFO_MAX) {
+                        m_fifo.insert(m_fifo.end(), out.begin(), out.end());
+                }
+                return 0;
+        }
+
+        auto len = static_cast<size_t>(hdr.cmd_submit.transfer_buffer_length);
+
+        if (m_fifo.empty()) {
+                in.resize(len);
+                for (auto &b: in) {
+                        b = static_cast<unsigned char>(m_pattern++);
+                }
+        } else {
+                auto n = std::min(len, m_fifo.size());
+                in.assign(m_fifo.begin(), m_fifo.begin() + n);
+                m_fifo.erase(m_fifo.begin(), m_fifo.begin() + n);
+        }
+
+        return 0;
+}
+
+/*
+ * IN data is compacted: packets follow each other without gaps, offsets of the request are kept.
+ */
+INT32 session::isoch(const header &hdr, std::vector<iso_packet_descriptor> &isoc, bytes &in, INT32 &error_count)
+{
+        auto dir_in = hdr.direction == direction::in;
+
+        if (m_dev.type != kind::audio || hdr.ep != (dir_in ? 1U : 2U)) {
+                return -EPIPE;
+        }
+
+        for (auto &d: isoc) {
+
+                d.status = 0;
+                d.actual_length = dir_in ? std::min(d.length, UINT32(AUDIO_FRAME)) : d.length;
+
+                if (m_fail(m_rng)) {
+                        d.status = static_cast<UINT32>(-EPROTO);
+                        d.actual_length = 0;
+                        ++error_count;
+                        ++m_stats.errors;
+                }
+
+                if (dir_in) {
+                        for (UINT32 i = 0; i < d.actual_length; ++i) {
+                                in.push_back(static_cast<unsigned char>(m_pattern++));
+                        }
+                }
+        }
+
+        return 0;
+}
+
+void serve_devlist(int s, device (&devs)[3])
+{
+        bytes buf;
+
+        auto append = [&buf] (const auto &v) {
+                auto p = reinterpret_cast<const unsigned char*>(&v);
+                buf.insert(buf.end(), p, p + sizeof(v));
+        };
+
+        op_devlist_reply r{ .ndev = 0 };
+
+        for (auto &d: devs) {
+                r.ndev += !d.busy;
+        }
+
+        r.ndev = htonl(r.ndev);
+        append(r);
+
+        for (auto &d: devs) {
+                if (d.busy) {
+                        continue;
+                }
+
+                append(make_udev(d));
+                for (auto &i: make_interfaces(d)) {
+                        append(i);
+                }
+        }
+
+        if (send_op_common(s, OP_REP_DEVLIST, ST_OK)) {
+                send_all(s, buf.data(), buf.size());
+        }
+}
+
+void serve_import(int s, device (&devs)[3])
+{
+        op_import_request req{};
+        if (!recv_all(s, &req, sizeof(req))) {
+                return;
+        }
+
+        compress::extension ext{};
+
+        if (compress::get(ext, req.busid) && !g_opts.plain) { // before busid is terminated
+                ext = compress::accept(ext, compress::codec_lz4);
+        } else {
+                ext = {};
+        }
+
+        req.busid[sizeof(req.busid) - 1] = '\0';
+
+        auto dev = std::ranges::find_if(devs, [&req] (auto &d) { return !strcmp(d.busid, req.busid); });
+
+        if (dev == std::end(devs)) {
+                send_op_common(s, OP_REP_IMPORT, ST_NODEV);
+                return;
+        }
+
+        if (dev->busy.exchange(true)) {
+                send_op_common(s, OP_REP_IMPORT, ST_DEV_BUSY);
+                return;
+        }
+
+        op_import_reply r{ .udev = make_udev(*dev) };
+
+        if (ext.codecs && !compress::put(r.udev.path, ext)) {
+                ext = {};
+        }
+
+        if (send_op_common(s, OP_REP_IMPORT, ST_OK) && send_all(s, &r, sizeof(r))) {
+                printf("%s: imported%s\n", dev->busid, ext.codecs ? ", compression is accepted" : "");
+                session(s, *dev, ext).run();
+        }
+
+        dev->busy = false;
+}
+
+void serve(int s, device (&devs)[3])
+{
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        if (op_common c{}; recv_all(s, &c, sizeof(c))) {
+                switch (ntohs(c.code)) {
+                case OP_REQ_DEVLIST:
+                        serve_devlist(s, devs);
+                        break;
+                case OP_REQ_IMPORT:
+                        serve_import(s, devs);
+                        break;
+                default:
+                        fprintf(stderr, "unexpected operation %#x\n", ntohs(c.code));
+                }
+        }
+
+        close(s);
+}
+
+void usage(const char *prog)
+{
+        fprintf(stderr, "Usage: %s [options]\n"
+                "  -p port          TCP port, default is %u\n"
+                "  -l microseconds  latency of every response\n"
+                "  -b MB/s          bandwidth of a connection, unlimited by default\n"
+                "  -e rate          probability of a failed transfer or isochronous packet, 0..1\n"
+                "  -i milliseconds  interval of interrupt endpoint of HID-like device, default is %u\n"
+                "  -s seed          of error injection\n"
+                "  -v               print every response\n"
+                "  -z               decline the compression extension, plain USB/IP is used\n",
+                prog, g_opts.port, g_opts.hid_interval);
+}
+
+bool parse_options(int argc, char *argv[])
+{
+        for (int opt; (opt = getopt(argc, argv, "p:l:b:e:i:s:vzh")) != -1; ) {
+                switch (opt) {
+                case 'p':
+                        g_opts.port = static_cast<unsigned short>(atoi(optarg));
+                        break;
+                case 'l':
+                        g_opts.latency = std::chrono::microseconds(atol(optarg));
+                        break;
+                case 'b':
+                        g_opts.bandwidth = atof(optarg)*1e6;
+                        break;
+                case 'e':
+                        g_opts.error_rate = std::clamp(atof(optarg), 0.0, 1.0);
+                        break;
+                case 'i':
+                        g_opts.hid_interval = std::clamp(atoi(optarg), 1, 255);
+                        break;
+                case 's':
+                        g_opts.seed = static_cast<unsigned int>(atol(optarg));
+                        break;
+                case 'v':
+                        g_opts.verbose = true;
+                        break;
+                case 'z':
+                        g_opts.plain = true;
+                        break;
+                default:
+                        return false;
+                }
+        }
+
+        return optind == argc;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        if (!parse_options(argc, argv)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+
+        static device devs[3];
+        init_devices(devs);
+
+        auto s = socket(AF_INET6, SOCK_STREAM, 0);
+        if (s < 0) {
+                perror("socket");
+                return EXIT_FAILURE;
+        }
+
+        int on = 1, off = 0;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 too
+
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(g_opts.port);
+        addr.sin6_addr = in6addr_any;
+
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || listen(s, SOMAXCONN)) {
+                perror("bind/listen");
+                return EXIT_FAILURE;
+        }
+
+        printf("listening on port %u\n", g_opts.port);
+
+        for (auto &d: devs) {
+                printf("%s: %s\n", d.busid, d.product);
+        }
+
+        for (;;) {
+                if (auto c = accept(s, nullptr, nullptr); c >= 0) {
+                        std::thread(serve, c, std::ref(devs)).detach();
+                } else if (errno != EINTR) {
+                        perror("accept");
+                        return EXIT_FAILURE;
+                }
+        }
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * The helpers of drivers/libdrv that are benchmarked, compiled against the shim of WDK, @see wdk/.
+ * wdm.h goes first because the WDK build force-includes it.
+ */
+
+#include <wdm.h>
+
+#include <libdrv/pdu.cpp>
+#include <libdrv/usbd_helper.cpp>
+#include <libdrv/usbdsc.cpp>
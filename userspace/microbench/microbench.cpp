@@ -0,0 +1,566 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * Microbenchmarks of the per-URB protocol helpers of the driver:
+ * byte swapping of headers and isochronous descriptors, PDU size, status and flags conversion,
+ * descriptors walking, repacking of isochronous packets for CMD_SUBMIT, the receive path helpers,
+ * folding of latency samples and the layout of wsk_context.
+ *
+ * libdrv is compiled against a thin shim of WDK (wdk/), usbip/submit.h and usbip/receive.h are portable.
+ * Linux: target microbench of CMakeLists.txt or
+ * g++ -std=c++20 -O2 -fshort-wchar -I../../include -I../../drivers -I../posix -Iwdk microbench.cpp libdrv.cpp -o microbench
+ *
+ * Every case is calibrated to run at least 10 ms per sample, the median and the minimum of samples are reported.
+ * Option -o writes the medians as a baseline, -b compares with a baseline and fails if a case is slower
+ * than the threshold. Baselines are specific to a machine and a compiler, do not compare them across.
+ */
+
+#include <wdm.h>
+#include <usb.h>
+
+#include <libdrv/pdu.h>
+#include <libdrv/usbd_helper.h>
+#include <libdrv/usbdsc.h>
+
+#include <usbip/latency.h>
+#include <usbip/receive.h>
+#include <usbip/submit.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+const auto SAMPLE_MIN = std::chrono::milliseconds(10);
+
+unsigned int g_samples = 15;
+double g_threshold = 10; // percent
+
+/*
+ * Prevents the compiler from removing a computation whose result is not used.
+ */
+template<typename T>
+inline void do_not_optimize(T &&v)
+{
+        asm volatile("" : : "g"(&v) : "memory");
+}
+
+inline void clobber_memory()
+{
+        asm volatile("" : : : "memory");
+}
+
+struct result
+{
+        double median; // ns per operation
+        double min;
+};
+
+/*
+ * @param f runs one operation
+ */
+result measure(const std::function<void()> &f)
+{
+        auto run = [&f] (size_t n)
+        {
+                auto start = clock_type::now();
+                for (size_t i = 0; i < n; ++i) {
+                        f();
+                }
+                return clock_type::now() - start;
+        };
+
+        size_t n = 1;
+        for (; run(n) < SAMPLE_MIN; n *= 2);
+
+        std::vector<double> v(g_samples);
+
+        for (auto &ns: v) {
+                ns = std::chrono::duration<double, std::nano>(run(n)).count()/n;
+        }
+
+        std::ranges::sort(v);
+        return { v[v.size()/2], v.front() };
+}
+
+/*
+ * Wire image of CMD_SUBMIT/RET_SUBMIT, it is swapped back and forth.
+ */
+header make_header(UINT32 command, INT32 number_of_packets)
+{
+        header h{};
+
+        h.command = command;
+        h.seqnum = 0x1234'5679;
+        h.devid = 0x0001'0002;
+        h.direction = direction::in;
+        h.ep = 1;
+
+        if (command == CMD_SUBMIT) {
+                auto &r = h.cmd_submit;
+                r.transfer_flags = 0x200;
+                r.transfer_buffer_length = 32*1024;
+                r.number_of_packets = number_of_packets;
+        } else {
+                auto &r = h.ret_submit;
+                r.actual_length = 32*1024;
+                r.number_of_packets = number_of_packets;
+        }
+
+        return h;
+}
+
+/*
+ * Configuration descriptor of a UVC-like device: interfaces with many alternate settings and endpoints.
+ */
+std::vector<UCHAR> make_config(int ifaces, int altsettings, int endpoints)
+{
+        std::vector<UCHAR> v(sizeof(USB_CONFIGURATION_DESCRIPTOR));
+
+        for (int i = 0; i < ifaces; ++i) {
+                for (int a = 0; a < altsettings; ++a) {
+
+                        USB_INTERFACE_DESCRIPTOR d{ sizeof(d), USB_INTERFACE_DESCRIPTOR_TYPE, UCHAR(i), UCHAR(a), UCHAR(endpoints), 0x0E, 2, 0, 0 };
+                        auto p = reinterpret_cast<UCHAR*>(&d);
+                        v.insert(v.end(), p, p + sizeof(d));
+
+                        for (int e = 0; e < endpoints; ++e) {
+                                USB_ENDPOINT_DESCRIPTOR ed{ sizeof(ed), USB_ENDPOINT_DESCRIPTOR_TYPE, UCHAR(0x81 + e), 1, 1024, 4 };
+                                p = reinterpret_cast<UCHAR*>(&ed);
+                                v.insert(v.end(), p, p + sizeof(ed));
+                        }
+                }
+        }
+
+        auto &cd = *reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR*>(v.data());
+        cd = { sizeof(cd), USB_CONFIGURATION_DESCRIPTOR_TYPE, USHORT(v.size()), UCHAR(ifaces), 1, 0, 0x80, 50 };
+
+        return v;
+}
+
+std::vector<USBD_ISO_PACKET_DESCRIPTOR> make_packets(unsigned int cnt, ULONG size)
+{
+        std::vector<USBD_ISO_PACKET_DESCRIPTOR> v(cnt);
+
+        for (unsigned int i = 0; i < cnt; ++i) {
+                v[i].Offset = i*size;
+        }
+
+        return v;
+}
+
+using case_t = std::pair<std::string, std::function<void()>>;
+
+void add_pdu(std::vector<case_t> &v)
+{
+        v.emplace_back("byteswap_header/cmd_submit", [h = make_header(CMD_SUBMIT, 0)] () mutable
+        {
+                byteswap_header(h, swap_dir::host2net);
+                byteswap_header(h, swap_dir::net2host);
+                do_not_optimize(h);
+        });
+
+        v.emplace_back("byteswap_header/ret_submit", [h = make_header(RET_SUBMIT, 0)] () mutable
+        {
+                byteswap_header(h, swap_dir::host2net);
+                byteswap_header(h, swap_dir::net2host);
+                do_not_optimize(h);
+        });
+
+        v.emplace_back("get_total_size/bulk", [h = make_header(CMD_SUBMIT, number_of_packets_non_isoch)] () mutable
+        {
+                do_not_optimize(h);
+                auto n = get_total_size(h);
+                do_not_optimize(n);
+        });
+
+        v.emplace_back("get_total_size/isoch", [h = make_header(RET_SUBMIT, 32)] () mutable
+        {
+                do_not_optimize(h);
+                auto n = get_total_size(h);
+                do_not_optimize(n);
+        });
+
+        for (unsigned int cnt: {32, 1024}) {
+                v.emplace_back("byteswap/iso_packet_descriptor[" + std::to_string(cnt) + "]",
+                        [d = std::vector<iso_packet_descriptor>(cnt)] () mutable
+                {
+                        byteswap(d.data(), d.size());
+                        do_not_optimize(d.data());
+                });
+        }
+}
+
+void add_usbd(std::vector<case_t> &v)
+{
+        // the mix of an isochronous stream with sporadic errors
+        static const int linux_status[] { 0, 0, 0, 0, 0, 0, -18, 0, -71, 0, 0, -32, 0, -2, 0, -104 };
+        static const USBD_STATUS usbd_status[] {
+                USBD_STATUS_SUCCESS, USBD_STATUS_SUCCESS, USBD_STATUS_STALL_PID, USBD_STATUS_CANCELED,
+                USBD_STATUS_DEV_NOT_RESPONDING, USBD_STATUS_ISO_TD_ERROR, USBD_STATUS_DATA_OVERRUN, USBD_STATUS_CRC
+        };
+
+        v.emplace_back("to_windows_status_ex", [] ()
+        {
+                for (auto st: linux_status) {
+                        do_not_optimize(st);
+                        auto r = to_windows_status_ex(st, st & 1);
+                        do_not_optimize(r);
+                }
+        });
+
+        v.emplace_back("to_linux_status", [] ()
+        {
+                for (auto st: usbd_status) {
+                        do_not_optimize(st);
+                        auto r = to_linux_status(st);
+                        do_not_optimize(r);
+                }
+        });
+
+        v.emplace_back("to_linux_flags", [flags = ULONG(USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK)] () mutable
+        {
+                do_not_optimize(flags);
+                auto r = to_linux_flags(flags, true);
+                do_not_optimize(r);
+        });
+
+        v.emplace_back("to_windows_flags", [flags = UINT32(0x0201)] () mutable
+        {
+                do_not_optimize(flags);
+                auto r = to_windows_flags(flags, true);
+                do_not_optimize(r);
+        });
+}
+
+void add_usbdsc(std::vector<case_t> &v)
+{
+        v.emplace_back("find_next/endpoints", [cfg = make_config(4, 8, 2)] () mutable
+        {
+                auto cd = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR*>(cfg.data());
+                int cnt = 0;
+
+                for (USB_COMMON_DESCRIPTOR *d{}; (d = libdrv::find_next(cd, USB_ENDPOINT_DESCRIPTOR_TYPE, d)); ++cnt);
+                do_not_optimize(cnt);
+        });
+}
+
+void add_submit(std::vector<case_t> &v)
+{
+        for (unsigned int cnt: {32, 1024}) {
+                v.emplace_back("submit::repack[" + std::to_string(cnt) + "]",
+                        [src = make_packets(cnt, 1024), d = std::vector<iso_packet_descriptor>(cnt), cnt] () mutable
+                {
+                        auto i = submit::repack(d.data(), src.data(), cnt, cnt*1024);
+                        do_not_optimize(i);
+                        clobber_memory();
+                });
+        }
+}
+
+void add_receive(std::vector<case_t> &v)
+{
+        v.emplace_back("receive::validate_header", [wire = make_header(RET_SUBMIT, 32)] () mutable
+        {
+                byteswap_header(wire, swap_dir::host2net);
+                do_not_optimize(wire);
+
+                auto h = wire;
+                auto err = receive::validate_header(h);
+                do_not_optimize(err);
+                do_not_optimize(h);
+        });
+
+        /*
+         * IN transfer where every packet has received a half of its length,
+         * the buffer is un-compacted every time.
+         */
+        for (unsigned int cnt: {32, 1024}) {
+
+                enum : unsigned int { size = 1024 };
+                std::vector<iso_packet_descriptor> src(cnt);
+
+                for (unsigned int i = 0; i < cnt; ++i) {
+                        src[i] = { i*size, size, size/2, 0 };
+                }
+
+                v.emplace_back("receive::fill_isoc_data[" + std::to_string(cnt) + "]",
+                        [dst = make_packets(cnt, size), buf = std::vector<UCHAR>(cnt*size), src, cnt] () mutable
+                {
+                        unsigned int failed;
+                        auto err = receive::fill_isoc_data(dst.data(), cnt, buf.data(), cnt*size, cnt*size/2, src.data(),
+                                                           to_windows_status_isoch, failed);
+                        do_not_optimize(err);
+                        clobber_memory();
+                });
+        }
+
+        v.emplace_back("receive::patch_config", [orig = make_config(4, 8, 2), cfg = std::vector<UCHAR>()] () mutable
+        {
+                cfg = orig; // is patched in place
+                auto n = receive::patch_config(cfg.data(), cfg.size(), [] (auto&&...) {}, [] (auto) {});
+                do_not_optimize(n);
+        });
+}
+
+/*
+ * The cost of a sampled URB for the receive thread, @see latency_complete.
+ */
+void add_latency(std::vector<case_t> &v)
+{
+        struct state
+        {
+                latency::histogram h[latency::stage_count];
+                long long t[latency::point_count];
+        };
+
+        v.emplace_back("latency::fold", [s = std::make_shared<state>(), i = 0LL] () mutable
+        {
+                i = (i + 7919) % 100'000; // ticks of 10 MHz counter
+                long long t = 1'000'000;
+
+                for (auto &p: s->t) {
+                        p = t += i;
+                }
+
+                latency::fold(s->h, s->t, latency::all_stages, [] (long long ticks) { return ticks/10ULL; });
+                do_not_optimize(s->h);
+        });
+}
+
+/*
+ * Models of wsk_context of 64-bit targets, the types have the same sizes as in the driver.
+ * unaligned is the layout before the hot members were grouped, it was allocated from NonPagedPoolNx.
+ * aligned is the current one, @see drivers/ude/wsk_context.h.
+ */
+namespace wsk
+{
+
+struct alignas(16) slist_entry { slist_entry *next; };
+struct buf { void *mdl; ULONG offset; size_t length; };
+
+struct alignas(16) unaligned
+{
+        void *dev;
+        void *request;
+        void *mdl_buf;
+        slist_entry entry;
+        buf wsk_buf;
+        void *wsk_irp;
+        void *buf_tail;
+        void *mdl_buf_tail;
+        void *mdl_hdr;
+        header hdr;
+        void *mdl_isoc;
+        void *isoc;
+        ULONG isoc_alloc_cnt;
+        bool is_isoc;
+};
+
+struct alignas(64) aligned
+{
+        slist_entry entry;
+        void *dev;
+        void *request;
+        buf wsk_buf;
+        void *wsk_irp;
+        void *mdl_buf;
+        void *mdl_hdr;
+        header hdr;
+
+        bool is_isoc; // offset 128
+        void *mdl_isoc;
+        void *isoc;
+        ULONG isoc_alloc_cnt;
+        void *buf_tail;
+        void *mdl_buf_tail;
+        void *gathered;
+        void *packed;
+        void *mdl_packed;
+};
+
+/*
+ * alloc_wsk_context, CMD_SUBMIT is prepared and sent, the send completion.
+ */
+template<typename T>
+void submit(T &c, void *dev, void *request)
+{
+        c.dev = dev;
+        c.request = request;
+        c.is_isoc = false;
+
+        c.hdr = make_header(CMD_SUBMIT, number_of_packets_non_isoch);
+        c.mdl_buf = request;
+        c.mdl_hdr = &c.hdr;
+        c.wsk_buf = { c.mdl_hdr, 0, sizeof(c.hdr) };
+        c.entry.next = nullptr;
+
+        do_not_optimize(c.wsk_irp);
+
+        if (!c.is_isoc) {
+                do_not_optimize(c.dev);
+                do_not_optimize(c.request);
+        }
+}
+
+/*
+ * Contexts are taken in random order from a pool that does not fit into the caches.
+ */
+template<typename T>
+void add(std::vector<case_t> &v, const char *name, size_t cnt)
+{
+        struct state
+        {
+                std::vector<T> ctx;
+                std::vector<unsigned int> order;
+                size_t pos;
+        };
+
+        auto s = std::make_shared<state>();
+        s->ctx.resize(cnt);
+
+        s->order.resize(cnt);
+        std::iota(s->order.begin(), s->order.end(), 0);
+        std::shuffle(s->order.begin(), s->order.end(), std::mt19937(cnt));
+
+        v.emplace_back(name, [s] 
+        {
+                auto &c = s->ctx[s->order[s->pos++ % s->order.size()]];
+                submit(c, s.get(), &c);
+        });
+}
+
+} // namespace wsk
+
+void add_wsk_context(std::vector<case_t> &v)
+{
+        enum { cnt = 128*1024 }; // 22 MB and 24 MB
+
+        wsk::add<wsk::unaligned>(v, "wsk_context/unaligned", cnt);
+        wsk::add<wsk::aligned>(v, "wsk_context/aligned", cnt);
+}
+
+using baseline_t = std::map<std::string, double>;
+
+bool load(const char *path, baseline_t &b)
+{
+        std::ifstream f(path);
+        if (!f) {
+                fprintf(stderr, "can't open '%s'\n", path);
+                return false;
+        }
+
+        std::string name;
+        for (double ns; f >> name >> ns; b[name] = ns);
+
+        return true;
+}
+
+void usage(const char *prog)
+{
+        fprintf(stderr, "Usage: %s [-f filter] [-r samples] [-o baseline] [-b baseline] [-t threshold%%]\n", prog);
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        std::string filter;
+        const char *save_path{};
+        const char *cmp_path{};
+
+        for (int i = 1; i < argc; ++i) {
+                std::string s = argv[i];
+
+                if (s.size() == 2 && s[0] == '-' && strchr("frobt", s[1]) && i + 1 < argc) {
+                        auto arg = argv[++i];
+                        switch (s[1]) {
+                        case 'f':
+                                filter = arg;
+                                break;
+                        case 'r':
+                                g_samples = std::max(1UL, strtoul(arg, nullptr, 10));
+                                break;
+                        case 'o':
+                                save_path = arg;
+                                break;
+                        case 'b':
+                                cmp_path = arg;
+                                break;
+                        case 't':
+                                g_threshold = strtod(arg, nullptr);
+                                break;
+                        }
+                } else {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        baseline_t baseline;
+        if (cmp_path && !load(cmp_path, baseline)) {
+                return EXIT_FAILURE;
+        }
+
+        std::vector<case_t> cases;
+        for (auto add: {add_pdu, add_usbd, add_usbdsc, add_submit, add_receive, add_latency, add_wsk_context}) {
+                add(cases);
+        }
+
+        std::ofstream out;
+        if (save_path && (out.open(save_path), !out)) {
+                fprintf(stderr, "can't create '%s'\n", save_path);
+                return EXIT_FAILURE;
+        }
+
+        printf("%-44s %12s %12s %10s\n", "case", "median, ns", "min, ns", "baseline");
+        int regressions = 0;
+
+        for (auto &[name, f]: cases) {
+
+                if (!filter.empty() && name.find(filter) == name.npos) {
+                        continue;
+                }
+
+                auto r = measure(f);
+                printf("%-44s %12.2f %12.2f", name.c_str(), r.median, r.min);
+
+                if (auto i = baseline.find(name); i != baseline.end()) {
+                        auto pct = (r.median/i->second - 1)*100;
+                        auto slower = pct > g_threshold;
+                        regressions += slower;
+                        printf(" %+9.1f%%%s", pct, slower ? " REGRESSION" : "");
+                }
+
+                printf("\n");
+
+                if (out) {
+                        out << name << ' ' << r.median << '\n';
+                }
+        }
+
+        if (regressions) {
+                fprintf(stderr, "%d case(s) are slower than the baseline by more than %.1f%%\n", regressions, g_threshold);
+        }
+
+        return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
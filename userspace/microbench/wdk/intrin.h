@@ -0,0 +1,9 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Compiler intrinsics are builtins of GCC and Clang, @see RtlUlongByteSwap.
+ */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Declarations from usb.h, usbspec.h and usbdi.h of WDK that are used by drivers/libdrv helpers.
+ */
+
+#include "wdm.h"
+
+using USBD_STATUS = LONG;
+
+#define USBD_SUCCESS(Status) ((USBD_STATUS)(Status) >= 0)
+#define USBD_ERROR(Status) ((USBD_STATUS)(Status) < 0)
+
+#define USBD_STATUS_SUCCESS                     ((USBD_STATUS)0x00000000L)
+#define USBD_STATUS_PORT_OPERATION_PENDING      ((USBD_STATUS)0x00000001L)
+#define USBD_STATUS_PENDING                     ((USBD_STATUS)0x40000000L)
+
+#define USBD_STATUS_CRC                         ((USBD_STATUS)0xC0000001L)
+#define USBD_STATUS_BTSTUFF                     ((USBD_STATUS)0xC0000002L)
+#define USBD_STATUS_DATA_TOGGLE_MISMATCH        ((USBD_STATUS)0xC0000003L)
+#define USBD_STATUS_STALL_PID                   ((USBD_STATUS)0xC0000004L)
+#define USBD_STATUS_DEV_NOT_RESPONDING          ((USBD_STATUS)0xC0000005L)
+#define USBD_STATUS_PID_CHECK_FAILURE           ((USBD_STATUS)0xC0000006L)
+#define USBD_STATUS_UNEXPECTED_PID              ((USBD_STATUS)0xC0000007L)
+#define USBD_STATUS_DATA_OVERRUN                ((USBD_STATUS)0xC0000008L)
+#define USBD_STATUS_DATA_UNDERRUN               ((USBD_STATUS)0xC0000009L)
+#define USBD_STATUS_BUFFER_OVERRUN              ((USBD_STATUS)0xC000000CL)
+#define USBD_STATUS_BUFFER_UNDERRUN             ((USBD_STATUS)0xC000000DL)
+#define USBD_STATUS_NOT_ACCESSED                ((USBD_STATUS)0xC000000FL)
+#define USBD_STATUS_FIFO                        ((USBD_STATUS)0xC0000010L)
+#define USBD_STATUS_XACT_ERROR                  ((USBD_STATUS)0xC0000011L)
+#define USBD_STATUS_BABBLE_DETECTED             ((USBD_STATUS)0xC0000012L)
+#define USBD_STATUS_DATA_BUFFER_ERROR           ((USBD_STATUS)0xC0000013L)
+#define USBD_STATUS_ENDPOINT_HALTED             ((USBD_STATUS)0xC0000030L)
+
+#define USBD_STATUS_INVALID_URB_FUNCTION        ((USBD_STATUS)0x80000200L)
+#define USBD_STATUS_INVALID_PARAMETER           ((USBD_STATUS)0x80000300L)
+#define USBD_STATUS_ERROR_BUSY                  ((USBD_STATUS)0x80000400L)
+#define USBD_STATUS_INVALID_PIPE_HANDLE         ((USBD_STATUS)0x80000600L)
+#define USBD_STATUS_NO_BANDWIDTH                ((USBD_STATUS)0x80000700L)
+#define USBD_STATUS_INTERNAL_HC_ERROR           ((USBD_STATUS)0x80000800L)
+#define USBD_STATUS_ERROR_SHORT_TRANSFER        ((USBD_STATUS)0x80000900L)
+#define USBD_STATUS_ISOCH_REQUEST_FAILED        ((USBD_STATUS)0x80000B00L)
+
+#define USBD_STATUS_INSUFFICIENT_RESOURCES      ((USBD_STATUS)0xC0001000L)
+#define USBD_STATUS_TIMEOUT                     ((USBD_STATUS)0xC0006000L)
+#define USBD_STATUS_DEVICE_GONE                 ((USBD_STATUS)0xC0007000L)
+#define USBD_STATUS_HUB_INTERNAL_ERROR          ((USBD_STATUS)0xC0009000L)
+#define USBD_STATUS_CANCELED                    ((USBD_STATUS)0xC0010000L)
+#define USBD_STATUS_ISO_TD_ERROR                ((USBD_STATUS)0xC0030000L)
+
+#define USBD_TRANSFER_DIRECTION                 0x00000001
+#define USBD_SHORT_TRANSFER_OK                  0x00000002
+#define USBD_START_ISO_TRANSFER_ASAP            0x00000004
+#define USBD_DEFAULT_PIPE_TRANSFER              0x00000008
+
+#define USBD_TRANSFER_DIRECTION_FLAG(flags)     ((flags) & USBD_TRANSFER_DIRECTION)
+#define USBD_TRANSFER_DIRECTION_OUT             0
+#define USBD_TRANSFER_DIRECTION_IN              1
+
+#define URB_FUNCTION_ISOCH_TRANSFER                     0x000A
+#define URB_FUNCTION_ISOCH_TRANSFER_USING_CHAINED_MDL   0x0038
+
+#define USB_DEVICE_DESCRIPTOR_TYPE              0x01
+#define USB_CONFIGURATION_DESCRIPTOR_TYPE       0x02
+#define USB_STRING_DESCRIPTOR_TYPE              0x03
+#define USB_INTERFACE_DESCRIPTOR_TYPE           0x04
+#define USB_ENDPOINT_DESCRIPTOR_TYPE            0x05
+
+#define MAXIMUM_USB_STRING_LENGTH 255
+
+#define BMREQUEST_HOST_TO_DEVICE 0
+#define BMREQUEST_DEVICE_TO_HOST 1
+
+#include <PSHPACK1.H>
+
+union BM_REQUEST_TYPE
+{
+        struct
+        {
+                UCHAR Recipient : 2;
+                UCHAR Reserved : 3;
+                UCHAR Type : 2;
+                UCHAR Dir : 1;
+        } s;
+        UCHAR B;
+};
+
+struct USB_DEFAULT_PIPE_SETUP_PACKET
+{
+        BM_REQUEST_TYPE bmRequestType;
+        UCHAR bRequest;
+
+        union
+        {
+                struct
+                {
+                        UCHAR LowByte;
+                        UCHAR HiByte;
+                } Bytes;
+                USHORT W;
+        } wValue;
+
+        union
+        {
+                struct
+                {
+                        UCHAR LowByte;
+                        UCHAR HiByte;
+                } Bytes;
+                USHORT W;
+        } wIndex;
+
+        USHORT wLength;
+};
+static_assert(sizeof(USB_DEFAULT_PIPE_SETUP_PACKET) == 8);
+
+struct USB_COMMON_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+};
+
+struct USB_DEVICE_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+        USHORT bcdUSB;
+        UCHAR bDeviceClass;
+        UCHAR bDeviceSubClass;
+        UCHAR bDeviceProtocol;
+        UCHAR bMaxPacketSize0;
+        USHORT idVendor;
+        USHORT idProduct;
+        USHORT bcdDevice;
+        UCHAR iManufacturer;
+        UCHAR iProduct;
+        UCHAR iSerialNumber;
+        UCHAR bNumConfigurations;
+};
+static_assert(sizeof(USB_DEVICE_DESCRIPTOR) == 18);
+
+struct USB_CONFIGURATION_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+        USHORT wTotalLength;
+        UCHAR bNumInterfaces;
+        UCHAR bConfigurationValue;
+        UCHAR iConfiguration;
+        UCHAR bmAttributes;
+        UCHAR MaxPower;
+};
+static_assert(sizeof(USB_CONFIGURATION_DESCRIPTOR) == 9);
+
+struct USB_INTERFACE_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+        UCHAR bInterfaceNumber;
+        UCHAR bAlternateSetting;
+        UCHAR bNumEndpoints;
+        UCHAR bInterfaceClass;
+        UCHAR bInterfaceSubClass;
+        UCHAR bInterfaceProtocol;
+        UCHAR iInterface;
+};
+static_assert(sizeof(USB_INTERFACE_DESCRIPTOR) == 9);
+
+struct USB_ENDPOINT_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+        UCHAR bEndpointAddress;
+        UCHAR bmAttributes;
+        USHORT wMaxPacketSize;
+        UCHAR bInterval;
+};
+static_assert(sizeof(USB_ENDPOINT_DESCRIPTOR) == 7);
+
+struct USB_STRING_DESCRIPTOR
+{
+        UCHAR bLength;
+        UCHAR bDescriptorType;
+        WCHAR bString[1];
+};
+
+#include <POPPACK.H>
+
+struct USBD_INTERFACE_INFORMATION
+{
+        USHORT Length;
+        UCHAR InterfaceNumber;
+        UCHAR AlternateSetting;
+        // the rest is not used
+};
+
+struct USBD_ISO_PACKET_DESCRIPTOR
+{
+        ULONG Offset;
+        ULONG Length;
+        USBD_STATUS Status;
+};
+
+struct _URB_HEADER
+{
+        USHORT Length;
+        USHORT Function;
+        USBD_STATUS Status;
+        PVOID UsbdDeviceHandle;
+        ULONG UsbdFlags;
+};
+
+struct URB
+{
+        union
+        {
+                _URB_HEADER UrbHeader;
+        };
+};
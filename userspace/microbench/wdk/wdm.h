@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * The part of WDK that is used by drivers/libdrv helpers which are benchmarked, for builds on other platforms.
+ * Build with -fshort-wchar, WCHAR must be UTF-16.
+ */
+
+#include <basetsd.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+using UCHAR = uint8_t;
+using USHORT = uint16_t;
+using ULONG = uint32_t;
+using LONG = int32_t;
+using WCHAR = wchar_t;
+using PVOID = void*;
+
+static_assert(sizeof(WCHAR) == 2, "build with -fshort-wchar");
+
+#define MAXUCHAR 0xFF
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Inout_opt_
+#define _IRQL_requires_same_
+#define _IRQL_requires_(irql)
+#define _IRQL_requires_max_(irql)
+
+#define NT_ASSERT(e) assert(e)
+
+#define RtlEqualMemory(dst, src, len) (!memcmp((dst), (src), (len)))
+
+inline ULONG RtlUlongByteSwap(ULONG v) { return __builtin_bswap32(v); }
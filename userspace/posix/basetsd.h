@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Types of Windows SDK that are used by <usbip/proto.h>, for builds on other platforms.
+ */
+
+#include <stdint.h>
+
+using INT8 = int8_t;
+using INT16 = int16_t;
+using INT32 = int32_t;
+using INT64 = int64_t;
+
+using UINT8 = uint8_t;
+using UINT16 = uint16_t;
+using UINT32 = uint32_t;
+using UINT64 = uint64_t;
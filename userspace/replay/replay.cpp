@@ -0,0 +1,805 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * Offline replay benchmark of the receive path of the driver.
+ *
+ * Reads pcap/pcapng captures of USB/IP sessions, reassembles TCP streams, pairs server's responses
+ * with the commands of a client and drives the code of usbip/receive.h that the driver runs
+ * for every RET_SUBMIT: header validation, payload size, un-compaction of isochronous transfer buffers
+ * and patching of configuration descriptors. URB transfer buffers are simulated.
+ * It reports PDUs/s, bytes/s and the cost of every stage.
+ *
+ * It does not depend on Windows, build it on any platform by CMakeLists.txt of the repository or
+ * g++ -std=c++20 -O2 -I../../include -I../posix replay.cpp -o replay
+ *
+ * Captures must have whole segments, @see usbip capture --snaplen.
+ * Supported link types: Ethernet, Linux cooked (v1, v2), raw IP, BSD loopback. IPv4 and IPv6.
+ */
+
+#include <usbip/receive.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+using bytes = std::vector<unsigned char>;
+
+enum : unsigned short { USBIP_VERSION = 0x0111, OP_REQUEST = 0x8000, OP_DEVLIST = 0x0005, OP_IMPORT = 0x0003 };
+enum { OP_COMMON_LEN = 8, BUSID_LEN = 32, USB_DEVICE_LEN = 312 }; // usbip/proto_op.h
+
+unsigned int g_iterations = 100;
+unsigned short g_server_port = 3240;
+
+constexpr UINT16 be16(const unsigned char *p) { return static_cast<UINT16>(p[0] << 8 | p[1]); }
+constexpr UINT32 be32(const unsigned char *p) { return UINT32(p[0]) << 24 | UINT32(p[1]) << 16 | UINT32(p[2]) << 8 | p[3]; }
+
+/*
+ * Integers of pcap/pcapng files in the byte order of the writer.
+ */
+struct file_order
+{
+        bool swap;
+
+        UINT16 u16(const unsigned char *p) const
+        {
+                return swap ? be16(p) : static_cast<UINT16>(p[1] << 8 | p[0]);
+        }
+
+        UINT32 u32(const unsigned char *p) const
+        {
+                auto v = UINT32(p[3]) << 24 | UINT32(p[2]) << 16 | UINT32(p[1]) << 8 | p[0];
+                return swap ? receive::byteswap(v) : v;
+        }
+};
+
+/*
+ * One direction of a TCP connection. Sequence numbers are relative, up to 4GB per direction.
+ */
+struct half_stream
+{
+        bool started;
+        bool broken; // a segment was truncated by the capture
+        UINT32 isn;
+        UINT32 next; // relative sequence number of the next byte
+        std::map<UINT32, bytes> pending; // out of order segments
+        bytes data;
+
+        void add(UINT32 seq, bool syn, const unsigned char *p, size_t len, bool truncated);
+private:
+        void append(UINT32 off, const unsigned char *p, size_t len);
+};
+
+void half_stream::add(UINT32 seq, bool syn, const unsigned char *p, size_t len, bool truncated)
+{
+        if (!started) {
+                started = true;
+                isn = syn ? seq + 1 : seq;
+        }
+
+        if (broken || !len) {
+                return;
+        } else if (truncated) {
+                broken = true;
+                return;
+        }
+
+        auto off = seq + syn - isn;
+
+        if (static_cast<INT32>(off - next) > 0) {
+                pending.emplace(off, bytes(p, p + len));
+                return;
+        }
+
+        append(off, p, len);
+
+        for (auto i = pending.begin(); i != pending.end() && i->first <= next; i = pending.erase(i)) {
+                append(i->first, i->second.data(), i->second.size());
+        }
+}
+
+void half_stream::append(UINT32 off, const unsigned char *p, size_t len)
+{
+        if (auto skip = next - off; skip < len) { // retransmission can overlap
+                data.insert(data.end(), p + skip, p + len);
+                next += static_cast<UINT32>(len - skip);
+        }
+}
+
+struct connection
+{
+        half_stream to_server;
+        half_stream from_server;
+};
+
+using connections = std::map<std::string, connection>; // by client's address and port
+
+/*
+ * CMD_SUBMIT of a client, the URB of a request.
+ */
+struct command
+{
+        direction dir;
+        UINT32 ep;
+        UINT32 TransferBufferLength;
+        INT32 number_of_packets;
+        unsigned char setup[8]{};
+        std::vector<UINT32> offsets{}; // of isochronous packets in the transfer buffer
+};
+
+/*
+ * RET_* of a server and the URB of its request.
+ */
+struct response
+{
+        bytes wire; // header and payload in network byte order
+        direction dir; // of the request
+        bool isoch;
+        bool config; // GET_DESCRIPTOR(CONFIGURATION)
+        UINT32 TransferBufferLength;
+        std::vector<UINT32> offsets;
+};
+
+struct totals
+{
+        size_t connections;
+        size_t broken; // TCP streams with truncated segments
+        size_t unmatched; // responses without commands, parsing of a stream stops
+        std::vector<response> responses;
+};
+
+/*
+ * @return length of the PDU if the buffer has it entirely
+ */
+size_t command_size(const unsigned char *p, size_t len)
+{
+        if (len < sizeof(header)) {
+                return 0;
+        }
+
+        size_t sz = sizeof(header);
+
+        switch (be32(p)) {
+        case CMD_SUBMIT:
+                if (auto np = static_cast<INT32>(be32(p + 32)); np > 0) {
+                        sz += np*sizeof(iso_packet_descriptor);
+                }
+                if (be32(p + 12) == direction::out) {
+                        sz += be32(p + 24); // transfer_buffer_length
+                }
+                break;
+        case CMD_UNLINK:
+                break;
+        default:
+                return 0;
+        }
+
+        return sz <= len ? sz : 0;
+}
+
+/*
+ * Skip OP_REQ_IMPORT/OP_REP_IMPORT that precede the PDUs.
+ * @return offset of the first PDU, ~0 if it is not a session of an imported device
+ */
+size_t skip_op(const bytes &d, bool reply)
+{
+        if (d.size() < OP_COMMON_LEN || be16(d.data()) != USBIP_VERSION) {
+                return 0; // the capture started after import
+        }
+
+        auto code = be16(d.data() + 2);
+
+        if (code != (reply ? OP_IMPORT : OP_REQUEST | OP_IMPORT)) {
+                return ~size_t();
+        }
+
+        if (!reply) {
+                return OP_COMMON_LEN + BUSID_LEN;
+        }
+
+        return be32(d.data() + 4) ? ~size_t() : OP_COMMON_LEN + USB_DEVICE_LEN; // status
+}
+
+void parse(connection &c, totals &t)
+{
+        ++t.connections;
+        t.broken += c.to_server.broken + c.from_server.broken;
+
+        auto &cmd = c.to_server.data;
+        auto &ret = c.from_server.data;
+
+        auto cmd_off = skip_op(cmd, false);
+        auto ret_off = skip_op(ret, true);
+
+        if (cmd_off > cmd.size() || ret_off > ret.size()) {
+                return;
+        }
+
+        std::unordered_map<seqnum_t, command> requests;
+
+        for (size_t sz; (sz = command_size(cmd.data() + cmd_off, cmd.size() - cmd_off)); cmd_off += sz) {
+
+                auto p = cmd.data() + cmd_off;
+                if (be32(p) != CMD_SUBMIT) {
+                        continue;
+                }
+
+                command r {
+                        .dir = static_cast<direction>(be32(p + 12)),
+                        .ep = be32(p + 16),
+                        .TransferBufferLength = be32(p + 24),
+                        .number_of_packets = static_cast<INT32>(be32(p + 32)),
+                };
+
+                memcpy(r.setup, p + 40, sizeof(r.setup));
+
+                for (auto i = 0; i < r.number_of_packets; ++i) {
+                        auto d = p + sz - (r.number_of_packets - i)*sizeof(iso_packet_descriptor);
+                        r.offsets.push_back(be32(d));
+                }
+
+                requests[be32(p + 4)] = std::move(r);
+        }
+
+        while (ret_off + sizeof(header) <= ret.size()) {
+
+                auto p = ret.data() + ret_off;
+                auto sz = sizeof(header);
+
+                response r{};
+
+                switch (be32(p)) {
+                case RET_SUBMIT:
+                        if (auto i = requests.find(be32(p + 4)); i == requests.end()) {
+                                ++t.unmatched;
+                                return;
+                        } else {
+                                auto &q = i->second;
+                                auto np = static_cast<INT32>(be32(p + 32));
+
+                                r.dir = q.dir;
+                                r.isoch = np > 0;
+                                r.TransferBufferLength = q.TransferBufferLength;
+                                r.offsets = std::move(q.offsets);
+
+                                r.config = !q.ep && q.dir == direction::in &&
+                                           q.setup[1] == 6 && q.setup[3] == 2; // GET_DESCRIPTOR, CONFIGURATION
+
+                                sz += (q.dir == direction::in ? be32(p + 24) : 0) + // actual_length
+                                      (np > 0 ? np*sizeof(iso_packet_descriptor) : 0);
+
+                                requests.erase(i);
+                        }
+                        break;
+                case RET_UNLINK:
+                        break;
+                default:
+                        ++t.unmatched;
+                        return;
+                }
+
+                if (ret_off + sz > ret.size()) {
+                        break;
+                }
+
+                r.wire.assign(p, p + sz);
+                t.responses.push_back(std::move(r));
+
+                ret_off += sz;
+        }
+}
+
+/*
+ * @param p IPv4 or IPv6 packet
+ */
+void on_ip(connections &conns, const unsigned char *p, size_t len, bool truncated)
+{
+        if (len < 20) {
+                return;
+        }
+
+        const unsigned char *src, *dst;
+        size_t addr_len;
+        size_t hdr_len;
+        size_t total;
+
+        switch (p[0] >> 4) {
+        case 4:
+                if (p[9] != 6) { // TCP
+                        return;
+                }
+                hdr_len = (p[0] & 0xF)*4;
+                total = be16(p + 2);
+                src = p + 12;
+                dst = p + 16;
+                addr_len = 4;
+                break;
+        case 6:
+                if (len < 40 || p[6] != 6) { // extension headers are not supported
+                        return;
+                }
+                hdr_len = 40;
+                total = hdr_len + be16(p + 4);
+                src = p + 8;
+                dst = p + 24;
+                addr_len = 16;
+                break;
+        default:
+                return;
+        }
+
+        if (total > len) {
+                truncated = true;
+        } else if (total) { // zero for TCP segmentation offload
+                len = total;
+        }
+
+        if (hdr_len + 20 > len) {
+                return;
+        }
+
+        auto tcp = p + hdr_len;
+        auto tcp_len = (tcp[12] >> 4)*4;
+
+        if (hdr_len + tcp_len > len) {
+                return;
+        }
+
+        auto sport = be16(tcp);
+        auto dport = be16(tcp + 2);
+
+        auto to_server = dport == g_server_port;
+        if (!to_server && sport != g_server_port) {
+                return;
+        }
+
+        auto client = to_server ? src : dst;
+        auto key = std::string(reinterpret_cast<const char*>(client), addr_len) + ':' + std::to_string(to_server ? sport : dport);
+
+        auto &c = conns[key];
+        auto &h = to_server ? c.to_server : c.from_server;
+
+        auto syn = tcp[13] & 2;
+        h.add(be32(tcp + 4), syn, tcp + tcp_len, len - hdr_len - tcp_len, truncated);
+}
+
+/*
+ * @see https://www.tcpdump.org/linktypes.html
+ */
+void on_frame(connections &conns, unsigned int linktype, const unsigned char *p, size_t caplen, size_t origlen)
+{
+        auto truncated = caplen < origlen;
+        UINT16 ethertype{};
+
+        switch (linktype) {
+        case 0: // BSD loopback
+                if (caplen < 4) {
+                        return;
+                }
+                p += 4;
+                caplen -= 4;
+                break;
+        case 1: // Ethernet
+                if (caplen < 14) {
+                        return;
+                }
+                ethertype = be16(p + 12);
+                p += 14;
+                caplen -= 14;
+                if (ethertype == 0x8100 && caplen >= 4) { // VLAN
+                        ethertype = be16(p + 2);
+                        p += 4;
+                        caplen -= 4;
+                }
+                if (ethertype != 0x0800 && ethertype != 0x86DD) {
+                        return;
+                }
+                break;
+        case 101: // raw IP
+        case 228: // IPv4
+        case 229: // IPv6
+                break;
+        case 113: // Linux cooked
+                if (caplen < 16) {
+                        return;
+                }
+                p += 16;
+                caplen -= 16;
+                break;
+        case 276: // Linux cooked v2
+                if (caplen < 20) {
+                        return;
+                }
+                p += 20;
+                caplen -= 20;
+                break;
+        default:
+                return;
+        }
+
+        on_ip(conns, p, caplen, truncated);
+}
+
+bool read_pcap(connections &conns, const bytes &f)
+{
+        auto p = f.data();
+        file_order o{ .swap = p[0] == 0xA1 };
+
+        auto linktype = o.u32(p + 20);
+
+        for (size_t off = 24; off + 16 <= f.size(); ) {
+
+                auto rec = p + off;
+                auto caplen = o.u32(rec + 8);
+                auto origlen = o.u32(rec + 12);
+
+                if (off += 16; caplen > f.size() - off) {
+                        return false;
+                }
+
+                on_frame(conns, linktype, rec + 16, caplen, origlen);
+                off += caplen;
+        }
+
+        return true;
+}
+
+bool read_pcapng(connections &conns, const bytes &f)
+{
+        enum { SHB = 0x0A0D0D0A, IDB = 1, SPB = 3, EPB = 6 };
+
+        file_order o{};
+        std::vector<unsigned int> linktypes; // by interface id of the section
+
+        for (size_t off = 0; off + 12 <= f.size(); ) {
+
+                auto b = f.data() + off;
+
+                if (be32(b) == SHB) { // palindrome
+                        o.swap = be32(b + 8) == 0x1A2B3C4D; // byte-order magic of a big-endian writer
+                        linktypes.clear();
+                }
+
+                auto type = o.u32(b);
+                auto len = o.u32(b + 4);
+
+                if (len < 12 || len > f.size() - off) {
+                        return false;
+                }
+
+                switch (type) {
+                case IDB:
+                        linktypes.push_back(o.u16(b + 8));
+                        break;
+                case EPB:
+                        if (auto id = o.u32(b + 8); id < linktypes.size() && len >= 32) {
+                                auto caplen = o.u32(b + 20);
+                                if (caplen <= len - 32) {
+                                        on_frame(conns, linktypes[id], b + 28, caplen, o.u32(b + 24));
+                                }
+                        }
+                        break;
+                case SPB:
+                        if (!linktypes.empty()) {
+                                auto origlen = o.u32(b + 8);
+                                auto caplen = origlen < len - 16 ? origlen : len - 16;
+                                on_frame(conns, linktypes[0], b + 12, caplen, origlen);
+                        }
+                        break;
+                }
+
+                off += len;
+        }
+
+        return true;
+}
+
+bool read(const char *path, totals &t)
+{
+        std::ifstream in(path, std::ios::binary);
+        bytes f(std::istreambuf_iterator<char>(in), {});
+
+        if (!in && !in.eof()) {
+                fprintf(stderr, "%s: can't read\n", path);
+                return false;
+        }
+
+        if (f.size() < 24) {
+                fprintf(stderr, "%s: not a capture\n", path);
+                return false;
+        }
+
+        connections conns;
+        auto ok = false;
+
+        switch (be32(f.data())) {
+        case 0xA1B2C3D4: case 0xD4C3B2A1: // microseconds
+        case 0xA1B23C4D: case 0x4D3CB2A1: // nanoseconds
+                ok = read_pcap(conns, f);
+                break;
+        case 0x0A0D0D0A:
+                ok = read_pcapng(conns, f);
+                break;
+        default:
+                fprintf(stderr, "%s: unknown format\n", path);
+                return false;
+        }
+
+        if (!ok) {
+                fprintf(stderr, "%s: truncated file, using packets read so far\n", path);
+        }
+
+        for (auto &[key, c]: conns) {
+                parse(c, t);
+        }
+
+        return true;
+}
+
+/*
+ * Like USBD_ISO_PACKET_DESCRIPTOR.
+ */
+struct iso_packet
+{
+        UINT32 Offset;
+        UINT32 Length{};
+        INT32 Status{};
+};
+
+auto to_status(UINT32 status)
+{
+        return static_cast<INT32>(0xC000'0000 | status); // USBD_STATUS_* is not needed to measure
+}
+
+using clock_type = std::chrono::steady_clock;
+
+struct stage
+{
+        const char *name;
+        size_t calls{}; // per iteration
+        size_t errors{}; // per iteration
+        clock_type::duration elapsed{};
+};
+
+/*
+ * The transfer buffer of an URB as the driver receives it: compacted data at the beginning.
+ */
+struct urb
+{
+        size_t response; // index
+        bytes buffer{};
+        std::vector<iso_packet> packets{};
+        std::vector<iso_packet_descriptor> isoc{};
+};
+
+template<typename F>
+void measure(stage &s, F &&f)
+{
+        auto start = clock_type::now();
+        f();
+        s.elapsed += clock_type::now() - start;
+}
+
+/*
+ * Every stage processes all responses at once. Inputs are restored before a stage, that is not measured.
+ */
+void run(const totals &t)
+{
+        auto &rs = t.responses;
+
+        std::vector<header> wire(rs.size());
+        std::vector<header> hdrs(rs.size());
+        std::vector<bool> valid(rs.size());
+
+        size_t wire_bytes = 0;
+
+        for (size_t i = 0; i < rs.size(); ++i) {
+                memcpy(&wire[i], rs[i].wire.data(), sizeof(header));
+                wire_bytes += rs[i].wire.size();
+        }
+
+        std::vector<urb> isoch;
+        std::vector<urb> configs;
+
+        stage stages[] {
+                { "validate_header" },
+                { "get_payload_size" },
+                { "fill_isoc_data" },
+                { "patch_config" },
+        };
+        auto &[st_hdr, st_size, st_isoch, st_config] = stages;
+
+        volatile size_t sink{};
+
+        for (unsigned int iter = 0; iter < g_iterations; ++iter) {
+
+                auto first = !iter;
+                memcpy(hdrs.data(), wire.data(), wire.size()*sizeof(wire[0]));
+
+                measure(st_hdr, [&] {
+                        for (size_t i = 0; i < hdrs.size(); ++i) {
+                                auto &h = hdrs[i];
+                                auto ok = receive::validate_header(h) == receive::error::none;
+                                if (first) {
+                                        valid[i] = ok;
+                                        st_hdr.errors += !ok;
+                                }
+                                h.direction = rs[i].dir; // clients other than this driver do not keep it in seqnum
+                        }
+                });
+
+                measure(st_size, [&] {
+                        size_t sum = 0;
+                        for (auto &h: hdrs) {
+                                sum += receive::get_payload_size(h);
+                        }
+                        sink = sum;
+                });
+
+                if (first) {
+                        st_hdr.calls = st_size.calls = hdrs.size();
+
+                        for (size_t i = 0; i < rs.size(); ++i) {
+
+                                auto &r = rs[i];
+                                auto &h = hdrs[i];
+
+                                if (!valid[i] || h.command != RET_SUBMIT) {
+                                        continue;
+                                }
+
+                                if (receive::get_payload_size(h) != r.wire.size() - sizeof(header)) {
+                                        ++st_size.errors;
+                                } else if (r.isoch && size_t(h.ret_submit.number_of_packets) == r.offsets.size()) {
+                                        auto &u = isoch.emplace_back(urb{ .response = i });
+                                        u.buffer.resize(r.TransferBufferLength);
+                                        for (auto off: r.offsets) {
+                                                u.packets.push_back({ .Offset = off });
+                                        }
+                                        u.isoc.resize(r.offsets.size());
+                                } else if (r.isoch) {
+                                        ++st_isoch.errors; // number_of_packets != NumberOfPackets
+                                } else if (r.config && h.ret_submit.actual_length > 9) {
+                                        configs.emplace_back(urb{ .response = i, .buffer = bytes(r.wire.begin() + sizeof(header), r.wire.end()) });
+                                }
+                        }
+
+                        st_isoch.calls = isoch.size();
+                        st_config.calls = configs.size();
+                }
+
+                for (auto &u: isoch) {
+                        auto &r = rs[u.response];
+                        auto &h = hdrs[u.response];
+
+                        auto data = r.wire.data() + sizeof(header);
+                        auto data_len = r.dir == direction::in ? size_t(h.ret_submit.actual_length) : 0;
+
+                        memcpy(u.buffer.data(), data, data_len < u.buffer.size() ? data_len : u.buffer.size());
+                        memcpy(u.isoc.data(), data + data_len, u.isoc.size()*sizeof(u.isoc[0]));
+                }
+
+                measure(st_isoch, [&] {
+                        for (auto &u: isoch) {
+                                auto &h = hdrs[u.response];
+                                auto &ret = h.ret_submit;
+                                auto n = static_cast<unsigned int>(u.isoc.size());
+
+                                receive::byteswap(u.isoc.data(), n);
+
+                                auto buf = h.direction == direction::in ? u.buffer.data() : nullptr;
+                                unsigned int failed{};
+
+                                auto err = receive::fill_isoc_data(u.packets.data(), n, buf, UINT32(u.buffer.size()),
+                                                                   ret.actual_length, u.isoc.data(), to_status, failed);
+                                if (first && err != receive::error::none) {
+                                        ++st_isoch.errors;
+                                }
+                        }
+                });
+
+                for (auto &u: configs) {
+                        auto &r = rs[u.response];
+                        memcpy(u.buffer.data(), r.wire.data() + sizeof(header), u.buffer.size());
+                }
+
+                measure(st_config, [&] {
+                        for (auto &u: configs) {
+                                auto d = u.buffer.data();
+                                if (d[0] == 9 && d[1] == 2 && (d[2] | d[3] << 8) == int(u.buffer.size())) { // @see post_control_transfer
+                                        sink = receive::patch_config(d, u.buffer.size(), [] (auto...) {}, [] (auto) {});
+                                } else if (first) {
+                                        ++st_config.errors;
+                                }
+                        }
+                });
+        }
+
+        printf("%zu connection(s), %zu PDU(s), %zu byte(s), %u iteration(s)\n", t.connections, rs.size(), wire_bytes, g_iterations);
+
+        if (t.broken || t.unmatched) {
+                printf("%zu stream(s) with truncated segments, %zu stream(s) with responses without commands\n",
+                        t.broken, t.unmatched);
+        }
+
+        clock_type::duration total{};
+        for (auto &s: stages) {
+                total += s.elapsed;
+        }
+
+        auto ns = [] (auto d) { return std::chrono::duration<double, std::nano>(d).count(); };
+        auto total_ns = ns(total);
+
+        printf("\n%-18s %10s %10s %12s %12s %7s\n", "stage", "calls", "errors", "ns/call", "ns/PDU", "share");
+
+        for (auto &s: stages) {
+                auto v = ns(s.elapsed)/g_iterations;
+                printf("%-18s %10zu %10zu %12.1f %12.1f %6.1f%%\n", s.name, s.calls, s.errors,
+                        s.calls ? v/s.calls : 0, rs.empty() ? 0 : v/rs.size(), total_ns ? 100*ns(s.elapsed)/total_ns : 0);
+        }
+
+        if (total_ns) {
+                auto secs = total_ns/1e9;
+                printf("\n%.0f PDU/s, %.1f MB/s\n", rs.size()*double(g_iterations)/secs, wire_bytes*double(g_iterations)/secs/1e6);
+        }
+}
+
+void usage(const char *prog)
+{
+        fprintf(stderr, "Usage: %s [-n iterations] [-p server_port] capture.pcap|capture.pcapng...\n", prog);
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        std::vector<const char*> files;
+
+        for (int i = 1; i < argc; ++i) {
+                std::string s = argv[i];
+
+                if ((s == "-n" || s == "-p") && i + 1 < argc) {
+                        auto v = strtoul(argv[++i], nullptr, 10);
+                        if (s == "-n") {
+                                g_iterations = v ? static_cast<unsigned int>(v) : 1;
+                        } else {
+                                g_server_port = static_cast<unsigned short>(v);
+                        }
+                } else if (s.starts_with('-')) {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                } else {
+                        files.push_back(argv[i]);
+                }
+        }
+
+        if (files.empty()) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        totals t{};
+
+        for (auto path: files) {
+                if (!read(path, t)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        run(t);
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * Decoder of files written by "usbip trace", @see usbip/urb_trace.h
+ *
+ * Records of all processors are merged by time and printed in the format of the driver's former verbose log,
+ * a reply is printed with the time passed since its command. Option -s prints latency of commands instead.
+ *
+ * It does not depend on Windows.
+ * Linux: target urbtrace of CMakeLists.txt or
+ * g++ -std=c++20 -O2 -I../../include urbtrace.cpp -o urbtrace
+ */
+
+#include <usbip/urb_trace.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::urb_trace;
+
+struct entry
+{
+        record rec;
+        unsigned int processor;
+};
+
+struct trace
+{
+        unsigned long long frequency;
+        std::vector<entry> entries;
+        std::map<unsigned int, unsigned long long> dropped; // by processor
+};
+
+bool load(const char *path, trace &t)
+{
+        std::ifstream f(path, std::ios::binary);
+        if (!f) {
+                fprintf(stderr, "can't open '%s'\n", path);
+                return false;
+        }
+
+        file_header h;
+
+        if (!f.read(reinterpret_cast<char*>(&h), sizeof(h)) || memcmp(h.magic, file_magic, sizeof(h.magic))) {
+                fprintf(stderr, "'%s' is not a trace file\n", path);
+                return false;
+        }
+
+        if (h.version != file_version || h.record_size != sizeof(record) || !h.frequency) {
+                fprintf(stderr, "unsupported version %u, record size %u, frequency %llu\n", h.version, h.record_size, h.frequency);
+                return false;
+        }
+
+        t.frequency = h.frequency;
+
+        for (chunk c; f.read(reinterpret_cast<char*>(&c), sizeof(c)); ) {
+
+                auto &d = t.dropped[c.processor];
+                d = std::max(d, c.dropped);
+
+                for (unsigned int i = 0; i < c.count; ++i) {
+                        entry e{};
+                        e.processor = c.processor;
+                        if (!f.read(reinterpret_cast<char*>(&e.rec), sizeof(e.rec))) {
+                                fprintf(stderr, "'%s' is truncated\n", path);
+                                return false;
+                        }
+                        t.entries.push_back(e);
+                }
+        }
+
+        std::ranges::stable_sort(t.entries, {}, [] (auto &e) { return e.rec.time; });
+        return true;
+}
+
+const char *brequest_str(unsigned char bRequest)
+{
+        static const char* const v[] {
+                "GET_STATUS", "CLEAR_FEATURE", "?", "SET_FEATURE", "?", "SET_ADDRESS", "GET_DESCRIPTOR", "SET_DESCRIPTOR",
+                "GET_CONFIGURATION", "SET_CONFIGURATION", "GET_INTERFACE", "SET_INTERFACE", "SYNC_FRAME"
+        };
+
+        switch (bRequest) {
+        case 48: return "SET_SEL";
+        case 49: return "ISOCH_DELAY";
+        }
+
+        return bRequest < std::size(v) ? v[bRequest] : "?";
+}
+
+/*
+ * @see usb_setup_pkt_str in libdrv/dbgcommon.cpp
+ */
+std::string setup_str(const unsigned char (&s)[8])
+{
+        static const char* const type[] { "STANDARD", "CLASS", "VENDOR", "BMREQUEST_3" };
+        static const char* const recipient[] { "DEVICE", "INTERFACE", "ENDPOINT", "OTHER" };
+
+        auto bm = s[0];
+        auto word = [&s] (int i) { return static_cast<unsigned int>(s[i] | s[i + 1] << 8); };
+
+        char buf[160];
+        snprintf(buf, sizeof(buf), "{%s|%s|%s, %s(%#02x), wValue %#04x, wIndex %#04x, wLength %#04x(%u)}",
+                 bm & 0x80 ? "IN" : "OUT", type[(bm >> 5) & 3], (bm & 0x1F) < 4 ? recipient[bm & 0x1F] : "?",
+                 brequest_str(s[1]), s[1], word(2), word(4), word(6), word(6));
+
+        return buf;
+}
+
+/*
+ * Linux URB_* flags that usbip_host accepts, @see include/linux/usb.h
+ */
+std::string flags_str(unsigned int flags)
+{
+        static const std::pair<unsigned int, const char*> v[] {
+                { 0x0001, "SHORT_NOT_OK" }, { 0x0002, "ISO_ASAP" }, { 0x0004, "NO_TRANSFER_DMA_MAP" },
+                { 0x0040, "ZERO_PACKET" }, { 0x0080, "NO_INTERRUPT" }, { 0x0200, "DIR_IN" },
+        };
+
+        std::string s;
+
+        for (auto [bit, name]: v) {
+                if (flags & bit) {
+                        s += s.empty() ? "" : "|";
+                        s += name;
+                        flags &= ~bit;
+                }
+        }
+
+        if (flags || s.empty()) {
+                char buf[16];
+                snprintf(buf, sizeof(buf), "%s%#x", s.empty() ? "" : "|", flags);
+                s += buf;
+        }
+
+        return s;
+}
+
+using key_t = std::pair<unsigned short, unsigned int>; // port, seqnum
+
+void print(const trace &t)
+{
+        std::map<key_t, unsigned long long> sent; // time of a command by its key
+
+        auto start = t.entries.empty() ? 0 : t.entries.front().rec.time;
+        auto us = [f = double(t.frequency)] (unsigned long long ticks) { return ticks*1e6/f; };
+
+        for (auto &[r, cpu]: t.entries) {
+
+                printf("%14.3f cpu%-3u port %-2u req %04x {seqnum %u, %s[%u]}, ",
+                       us(r.time - start), cpu, r.port, r.request & 0xFFFF, r.seqnum,
+                       r.ep & dir_in ? "in" : "out", r.ep & 0x0F);
+
+                switch (r.type) {
+                case cmd_submit:
+                        sent[{r.port, r.seqnum}] = r.time;
+                        printf("cmd_submit: flags %s, length %d, isoc[%d], interval %d",
+                               flags_str(r.transfer_flags).c_str(), r.length, r.number_of_packets, r.extra);
+                        if (!(r.ep & 0x0F)) {
+                                printf(", %s", setup_str(r.setup).c_str());
+                        }
+                        break;
+                case cmd_unlink:
+                        sent[{r.port, r.seqnum}] = r.time;
+                        printf("cmd_unlink: seqnum %d", r.extra);
+                        break;
+                case ret_submit:
+                        printf("ret_submit: status %d, actual_length %d, isoc[%d], error_count %d",
+                               r.status, r.length, r.number_of_packets, r.extra);
+                        break;
+                case ret_unlink:
+                        printf("ret_unlink: status %d", r.status);
+                        break;
+                default:
+                        printf("event %u", r.type);
+                }
+
+                if (r.type == ret_submit || r.type == ret_unlink) {
+                        if (auto i = sent.find({r.port, r.seqnum}); i != sent.end()) {
+                                printf(", +%.1f us", us(r.time - i->second));
+                                sent.erase(i);
+                        }
+                }
+
+                printf("\n");
+        }
+}
+
+/*
+ * Latency of commands from send to reply, by port and endpoint.
+ */
+void summary(const trace &t)
+{
+        struct pending { unsigned long long time; unsigned char ep; };
+        std::map<key_t, pending> sent;
+        std::map<std::pair<unsigned short, unsigned char>, std::vector<double>> latency; // port, ep
+
+        for (auto &[r, cpu]: t.entries) {
+                switch (r.type) {
+                case cmd_submit:
+                        sent[{r.port, r.seqnum}] = { r.time, r.ep };
+                        break;
+                case ret_submit:
+                        if (auto i = sent.find({r.port, r.seqnum}); i != sent.end()) {
+                                latency[{r.port, i->second.ep}].push_back((r.time - i->second.time)*1e6/t.frequency);
+                                sent.erase(i);
+                        }
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        printf("%-4s %-8s %10s %10s %10s %10s %10s\n", "port", "ep", "count", "p50, us", "p99, us", "p99.9, us", "max, us");
+
+        for (auto &[key, v]: latency) {
+                std::ranges::sort(v);
+                auto pct = [&v] (double q) { return v[std::min(v.size() - 1, static_cast<size_t>(q*v.size()))]; };
+
+                char ep[16];
+                snprintf(ep, sizeof(ep), "%u %s", key.second & 0x0F, key.second & dir_in ? "in" : "out");
+
+                printf("%-4u %-8s %10zu %10.1f %10.1f %10.1f %10.1f\n",
+                       key.first, ep, v.size(), pct(0.5), pct(0.99), pct(0.999), v.back());
+        }
+
+        if (!sent.empty()) {
+                printf("%zu command(s) without reply\n", sent.size());
+        }
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        auto stats = argc == 3 && !strcmp(argv[1], "-s");
+
+        if (argc != 2 + stats) {
+                fprintf(stderr, "usage: %s [-s] file\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        trace t;
+        if (!load(argv[argc - 1], t)) {
+                return EXIT_FAILURE;
+        }
+
+        stats ? summary(t) : print(t);
+
+        for (auto [cpu, cnt]: t.dropped) {
+                if (cnt) {
+                        fprintf(stderr, "processor %u: %llu record(s) dropped\n", cpu, cnt);
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
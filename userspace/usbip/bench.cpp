@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+#include "bench_engine.h"
+
+#include <spdlog\spdlog.h>
+#include <print>
+
+namespace
+{
+
+using namespace usbip;
+
+class socket_transport : public bench::transport
+{
+public:
+        explicit socket_transport(_In_ SOCKET s) : m_sock(s) {}
+
+        bool send(_In_ const void *buf, _In_ size_t len) override
+        {
+                for (auto addr = static_cast<const char*>(buf); len; ) {
+                        auto ret = ::send(m_sock, addr, static_cast<int>(len), 0);
+                        if (ret == SOCKET_ERROR) {
+                                spdlog::debug("send error {}", WSAGetLastError());
+                                return false;
+                        }
+                        addr += ret;
+                        len -= ret;
+                }
+
+                return true;
+        }
+
+        bool recv(_Out_ void *buf, _In_ size_t len) override
+        {
+                auto ret = ::recv(m_sock, static_cast<char*>(buf), static_cast<int>(len), MSG_WAITALL);
+                if (ret == SOCKET_ERROR) {
+                        spdlog::debug("recv error {}", WSAGetLastError());
+                }
+                return ret == static_cast<int>(len);
+        }
+
+private:
+        SOCKET m_sock;
+};
+
+void print(_In_ const bench_args &args, _In_ const bench::result &r)
+{
+        std::println("{}: {} URBs, {} errors, {} bytes in {:.3f} s",
+                     bench::str(args.cfg.type), r.urbs, r.errors, r.bytes, r.seconds);
+
+        std::println("{:.1f} URB/s, {:.2f} MB/s", r.urb_per_sec(), r.mb_per_sec());
+
+        std::println("latency, us: min {:.1f}, p50 {:.1f}, p99 {:.1f}, p99.9 {:.1f}, max {:.1f}",
+                     r.min_us, r.p50_us, r.p99_us, r.p999_us, r.max_us);
+}
+
+} // namespace
+
+
+bool usbip::cmd_bench(void *p)
+{
+        auto &args = *reinterpret_cast<bench_args*>(p);
+
+        auto sock = connect(args.remote.c_str(), global_args.tcp_port.c_str());
+        if (!sock) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        spdlog::debug("connected to {}:{}", args.remote, global_args.tcp_port);
+
+        socket_transport t(sock.get());
+        usbip_usb_device udev;
+        std::string error;
+
+        if (!bench::import(t, args.busid, udev, error)) {
+                spdlog::error("{}/{}: {}", args.remote, args.busid, error);
+                return false;
+        }
+
+        spdlog::debug("imported {}, devid {:#x}", args.busid, udev.busnum << 16 | udev.devnum);
+
+        if (bench::result r; !bench::run(t, udev, args.cfg, r, error)) {
+                spdlog::error(error);
+                return false;
+        } else {
+                print(args, r);
+        }
+
+        return true;
+}
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "bench_engine.h"
+#include <usbip/proto.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::bench;
+
+using bytes = std::vector<unsigned char>;
+using clock_type = std::chrono::steady_clock;
+
+const char* const workload_names[] { "control", "bulk-in", "bulk-out", "bulk-loop", "interrupt" };
+
+/*
+ * USB/IP is big-endian, hosts of Windows and Linux this command runs on are little-endian.
+ */
+constexpr UINT16 bswap(UINT16 v) { return static_cast<UINT16>(v << 8 | v >> 8); }
+constexpr UINT32 bswap(UINT32 v) { return v << 24 | (v & 0xFF00) << 8 | (v >> 8 & 0xFF00) | v >> 24; }
+constexpr INT32 bswap(INT32 v) { return static_cast<INT32>(bswap(static_cast<UINT32>(v))); }
+
+void swap_bytes(usbip_usb_device &d)
+{
+        d.busnum = bswap(d.busnum);
+        d.devnum = bswap(d.devnum);
+        d.speed = bswap(d.speed);
+
+        d.idVendor = bswap(d.idVendor);
+        d.idProduct = bswap(d.idProduct);
+        d.bcdDevice = bswap(d.bcdDevice);
+}
+
+void swap_bytes(op_common &c)
+{
+        c.version = bswap(c.version);
+        c.code = bswap(c.code);
+        c.status = bswap(c.status);
+}
+
+enum : unsigned char { EP_BULK = 2, EP_INTR = 3 }; // bmAttributes & 3
+enum : unsigned char { USB_DIR_IN = 0x80 };
+
+struct endpoint
+{
+        unsigned char address;
+        unsigned char interval;
+};
+
+/*
+ * A submitted URB.
+ */
+struct urb
+{
+        clock_type::time_point sent;
+        direction dir;
+        unsigned int length;
+};
+
+class engine
+{
+public:
+        engine(transport &t, const usbip_usb_device &udev, const config &cfg) :
+                m_t(t), m_cfg(cfg), m_devid(udev.busnum << 16 | udev.devnum) {}
+
+        bool run(result &res, std::string &error);
+
+private:
+        transport &m_t;
+        const config &m_cfg;
+        UINT32 m_devid;
+
+        seqnum_t m_seqnum{};
+        std::unordered_map<seqnum_t, urb> m_urbs; // in flight
+
+        endpoint m_in{};
+        endpoint m_out{};
+        unsigned int m_maxpkt = 64; // of interrupt IN endpoint
+
+        bytes m_pdu; // CMD_SUBMIT and OUT data
+        bytes m_in_buf;
+        std::vector<float> m_latency; // microseconds
+
+        bool find_endpoints(std::string &error);
+        bool control_in(const unsigned char (&setup)[8], unsigned int length, bytes &data, std::string &error);
+
+        bool submit(direction dir, const endpoint &ep, unsigned int length, const unsigned char *setup = nullptr);
+        bool submit_next(direction dir, unsigned int length);
+
+        bool recv_ret(header &hdr, urb &u, bytes &data, std::string &error);
+};
+
+bool engine::submit(direction dir, const endpoint &ep, unsigned int length, const unsigned char *setup)
+{
+        auto seqnum = ++m_seqnum;
+        auto out_len = dir == direction::out ? length : 0;
+
+        m_pdu.resize(sizeof(header) + out_len); // OUT data is the pattern that was written once
+
+        header hdr{};
+        hdr.command = bswap(UINT32(CMD_SUBMIT));
+        hdr.seqnum = bswap(seqnum);
+        hdr.devid = bswap(m_devid);
+        hdr.direction = bswap(UINT32(dir));
+        hdr.ep = bswap(UINT32(ep.address & 0x0F));
+
+        auto &r = hdr.cmd_submit;
+        r.transfer_buffer_length = bswap(INT32(length));
+        r.number_of_packets = bswap(INT32(number_of_packets_non_isoch));
+        r.interval = bswap(INT32(ep.interval));
+
+        if (setup) {
+                memcpy(r.setup, setup, sizeof(r.setup));
+        }
+
+        memcpy(m_pdu.data(), &hdr, sizeof(hdr));
+
+        m_urbs[seqnum] = urb{ .sent = clock_type::now(), .dir = dir, .length = length };
+        return m_t.send(m_pdu.data(), m_pdu.size());
+}
+
+bool engine::submit_next(direction dir, unsigned int length)
+{
+        static constexpr unsigned char get_device_descriptor[8]{ USB_DIR_IN, 6, 0, 1, 0, 0, 18, 0 };
+
+        switch (m_cfg.type) {
+        case workload::control:
+                return submit(direction::in, endpoint{}, 18, get_device_descriptor);
+        case workload::bulk_out:
+                return submit(direction::out, m_out, m_cfg.length);
+        case workload::bulk_loop:
+                return dir == direction::out ? submit(direction::in, m_in, length) : submit(direction::out, m_out, m_cfg.length);
+        default:
+                return submit(direction::in, m_in, m_cfg.type == workload::interrupt ? length : m_cfg.length);
+        }
+}
+
+bool engine::recv_ret(header &hdr, urb &u, bytes &data, std::string &error)
+{
+        for (;;) {
+                if (!m_t.recv(&hdr, sizeof(hdr))) {
+                        error = "connection closed";
+                        return false;
+                }
+
+                hdr.command = bswap(hdr.command);
+                hdr.seqnum = bswap(hdr.seqnum);
+
+                if (hdr.command == RET_UNLINK) {
+                        continue;
+                } else if (hdr.command != RET_SUBMIT) {
+                        error = "unexpected command " + std::to_string(hdr.command);
+                        return false;
+                }
+
+                auto &r = hdr.ret_submit;
+                r.status = bswap(r.status);
+                r.actual_length = bswap(r.actual_length);
+                r.number_of_packets = bswap(r.number_of_packets);
+
+                auto i = m_urbs.find(hdr.seqnum);
+                if (i == m_urbs.end()) {
+                        error = "unknown seqnum " + std::to_string(hdr.seqnum);
+                        return false;
+                }
+
+                u = i->second;
+                m_urbs.erase(i);
+
+                if (r.actual_length < 0 || unsigned(r.actual_length) > u.length) {
+                        error = "invalid actual_length " + std::to_string(r.actual_length);
+                        return false;
+                }
+
+                size_t len = u.dir == direction::in ? r.actual_length : 0;
+                if (r.number_of_packets > 0) {
+                        len += r.number_of_packets*sizeof(iso_packet_descriptor);
+                }
+
+                data.resize(len);
+
+                if (!m_t.recv(data.data(), len)) {
+                        error = "connection closed";
+                        return false;
+                }
+
+                return true;
+        }
+}
+
+bool engine::control_in(const unsigned char (&setup)[8], unsigned int length, bytes &data, std::string &error)
+{
+        header hdr;
+        urb u;
+
+        if (!submit(direction::in, endpoint{}, length, setup)) {
+                error = "send error";
+                return false;
+        }
+
+        if (!recv_ret(hdr, u, data, error)) {
+                return false;
+        }
+
+        if (auto st = hdr.ret_submit.status) {
+                error = "control transfer status " + std::to_string(st);
+                return false;
+        }
+
+        return true;
+}
+
+/*
+ * Endpoints of alternate setting zero of the current configuration.
+ */
+bool engine::find_endpoints(std::string &error)
+{
+        if (m_cfg.endpoint) {
+                auto &ep = m_cfg.endpoint & USB_DIR_IN ? m_in : m_out;
+                ep.address = static_cast<unsigned char>(m_cfg.endpoint);
+                ep.interval = 1;
+                return true;
+        }
+
+        unsigned char setup[8]{ USB_DIR_IN, 6, 0, 2, 0, 0, 9, 0 }; // GET_DESCRIPTOR(CONFIGURATION)
+        bytes cfg;
+
+        if (!control_in(setup, 9, cfg, error)) {
+                return false;
+        }
+
+        if (cfg.size() < 4) {
+                error = "short configuration descriptor";
+                return false;
+        }
+
+        auto total = static_cast<unsigned int>(cfg[2] | cfg[3] << 8);
+        setup[6] = static_cast<unsigned char>(total);
+        setup[7] = static_cast<unsigned char>(total >> 8);
+
+        if (!control_in(setup, total, cfg, error)) {
+                return false;
+        }
+
+        auto want = m_cfg.type == workload::interrupt ? EP_INTR : EP_BULK;
+        auto alt = 0;
+
+        for (size_t i = 0; i + 2 <= cfg.size() && cfg[i] >= 2; i += cfg[i]) {
+
+                auto d = &cfg[i];
+
+                if (d[1] == 4 && d[0] >= 9) { // interface
+                        alt = d[3];
+                } else if (d[1] == 5 && d[0] >= 7 && !alt && (d[3] & 3) == want) { // endpoint
+                        auto &ep = d[2] & USB_DIR_IN ? m_in : m_out;
+                        if (!ep.address) {
+                                ep.address = d[2];
+                                ep.interval = d[6];
+                                if (want == EP_INTR && ep.address & USB_DIR_IN) {
+                                        m_maxpkt = static_cast<unsigned int>(d[4] | d[5] << 8);
+                                }
+                        }
+                }
+        }
+
+        auto need_in = m_cfg.type != workload::bulk_out;
+        auto need_out = m_cfg.type == workload::bulk_out || m_cfg.type == workload::bulk_loop;
+
+        if ((need_in && !m_in.address) || (need_out && !m_out.address)) {
+                error = std::string("no endpoints for ") + str(m_cfg.type);
+                return false;
+        }
+
+        return true;
+}
+
+bool engine::run(result &res, std::string &error)
+{
+        if (m_cfg.type != workload::control && !find_endpoints(error)) {
+                return false;
+        }
+
+        m_in_buf.reserve(m_cfg.length);
+        m_latency.reserve(m_cfg.count);
+
+        auto first_len = m_cfg.type == workload::interrupt ? m_maxpkt : m_cfg.length;
+        auto first_dir = m_cfg.type == workload::bulk_loop ? direction::in : direction::out; // next will be OUT
+
+        unsigned int submitted = 0;
+        res = {};
+
+        auto start = clock_type::now();
+
+        for (; submitted < std::min(m_cfg.in_flight, m_cfg.count); ++submitted) {
+                if (!submit_next(first_dir, first_len)) {
+                        error = "send error";
+                        return false;
+                }
+        }
+
+        header hdr;
+        urb u;
+
+        while (res.urbs < m_cfg.count) {
+
+                if (!recv_ret(hdr, u, m_in_buf, error)) {
+                        return false;
+                }
+
+                auto &r = hdr.ret_submit;
+                auto now = clock_type::now();
+
+                m_latency.push_back(std::chrono::duration<float, std::micro>(now - u.sent).count());
+
+                ++res.urbs;
+                res.errors += r.status != 0;
+                res.bytes += r.actual_length;
+
+                if (submitted < m_cfg.count) {
+                        if (!submit_next(u.dir, u.length)) {
+                                error = "send error";
+                                return false;
+                        }
+                        ++submitted;
+                }
+        }
+
+        res.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+        auto &v = m_latency;
+        std::ranges::sort(v);
+
+        auto pct = [&v] (double q) { return v.empty() ? 0 : v[std::min(v.size() - 1, static_cast<size_t>(q*v.size()))]; };
+
+        res.min_us = pct(0);
+        res.p50_us = pct(0.5);
+        res.p99_us = pct(0.99);
+        res.p999_us = pct(0.999);
+        res.max_us = v.empty() ? 0 : v.back();
+
+        return true;
+}
+
+} // namespace
+
+
+const char* usbip::bench::str(workload w) noexcept
+{
+        auto i = static_cast<size_t>(w);
+        return i < std::size(workload_names) ? workload_names[i] : "?";
+}
+
+bool usbip::bench::parse(workload &w, const std::string &s) noexcept
+{
+        for (size_t i = 0; i < std::size(workload_names); ++i) {
+                if (s == workload_names[i]) {
+                        w = static_cast<workload>(i);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+bool usbip::bench::import(transport &t, const std::string &busid, usbip_usb_device &udev, std::string &error)
+{
+        op_common c{ .version = USBIP_VERSION, .code = OP_REQ_IMPORT, .status = ST_OK };
+        swap_bytes(c);
+
+        op_import_request req{};
+        strncpy(req.busid, busid.c_str(), sizeof(req.busid) - 1);
+
+        if (!(t.send(&c, sizeof(c)) && t.send(&req, sizeof(req)))) {
+                error = "send error";
+                return false;
+        }
+
+        if (!t.recv(&c, sizeof(c))) {
+                error = "connection closed";
+                return false;
+        }
+
+        swap_bytes(c);
+
+        if (c.code != OP_REP_IMPORT) {
+                error = "unexpected reply " + std::to_string(c.code);
+                return false;
+        }
+
+        if (c.status != ST_OK) {
+                error = "import error, status " + std::to_string(c.status);
+                return false;
+        }
+
+        op_import_reply reply;
+
+        if (!t.recv(&reply, sizeof(reply))) {
+                error = "connection closed";
+                return false;
+        }
+
+        udev = reply.udev;
+        swap_bytes(udev);
+
+        return true;
+}
+
+bool usbip::bench::run(transport &t, const usbip_usb_device &udev, const config &cfg, result &res, std::string &error)
+{
+        return engine(t, udev, cfg).run(res, error);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <usbip/proto_op.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Raw USB/IP client that measures URB latency and throughput of a link, @see usbip bench.
+ *
+ * It does not depend on Windows, the transport is provided by the caller.
+ * Linux: target usbip-bench of CMakeLists.txt or
+ * g++ -std=c++20 -O2 -I../../include -I../posix bench_engine.cpp bench_posix.cpp -o usbip-bench
+ */
+namespace usbip::bench
+{
+
+enum class workload
+{
+        control, // GET_DESCRIPTOR(DEVICE) ping-pong on the default pipe
+        bulk_in,
+        bulk_out,
+        bulk_loop, // OUT followed by IN of the same length, for loopback devices
+        interrupt, // polling of interrupt IN endpoint
+};
+
+const char* str(workload w) noexcept;
+bool parse(workload &w, const std::string &s) noexcept;
+
+/*
+ * Blocking I/O of a connected socket.
+ */
+class transport
+{
+public:
+        virtual ~transport() = default;
+
+        virtual bool send(const void *buf, size_t len) = 0;
+        virtual bool recv(void *buf, size_t len) = 0; // all bytes or error
+};
+
+struct config
+{
+        workload type = workload::control;
+        unsigned int count = 10'000; // URBs to complete
+        unsigned int in_flight = 1; // URBs submitted at once
+        unsigned int length = 64*1024; // of bulk transfers
+        unsigned int endpoint{}; // address, zero to find in configuration descriptor
+};
+
+struct result
+{
+        size_t urbs;
+        size_t errors; // URBs completed with non-zero status
+        unsigned long long bytes; // of transfer buffers
+        double seconds;
+
+        double min_us;
+        double p50_us;
+        double p99_us;
+        double p999_us;
+        double max_us;
+
+        auto mb_per_sec() const { return seconds ? bytes/seconds/1e6 : 0; }
+        auto urb_per_sec() const { return seconds ? urbs/seconds : 0; }
+};
+
+/*
+ * OP_REQ_IMPORT.
+ * @param udev in host byte order
+ */
+bool import(transport &t, const std::string &busid, usbip_usb_device &udev, std::string &error);
+
+/*
+ * Call after successful import.
+ */
+bool run(transport &t, const usbip_usb_device &udev, const config &cfg, result &res, std::string &error);
+
+} // namespace usbip::bench
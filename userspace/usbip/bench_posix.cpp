@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+/*
+ * Standalone "usbip bench" for Linux, @see bench_engine.h.
+ * Run it against usbipd or userspace/loopback to measure the link without the driver.
+ */
+
+#include "bench_engine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+using namespace usbip::bench;
+
+class socket_transport : public transport
+{
+public:
+        explicit socket_transport(int fd) : m_fd(fd) {}
+        ~socket_transport() override { close(m_fd); }
+
+        bool send(const void *buf, size_t len) override
+        {
+                for (auto p = static_cast<const char*>(buf); len; ) {
+                        auto n = ::send(m_fd, p, len, MSG_NOSIGNAL);
+                        if (n <= 0) {
+                                return false;
+                        }
+                        p += n;
+                        len -= n;
+                }
+                return true;
+        }
+
+        bool recv(void *buf, size_t len) override
+        {
+                return !len || ::recv(m_fd, buf, len, MSG_WAITALL) == ssize_t(len);
+        }
+
+private:
+        int m_fd;
+};
+
+int connect(const char *host, const char *port)
+{
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo *res{};
+
+        if (auto err = getaddrinfo(host, port, &hints, &res)) {
+                fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(err));
+                return -1;
+        }
+
+        int fd = -1;
+
+        for (auto a = res; a; a = a->ai_next) {
+                fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd < 0) {
+                        continue;
+                }
+
+                if (!::connect(fd, a->ai_addr, a->ai_addrlen)) {
+                        int on = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                        break;
+                }
+
+                close(fd);
+                fd = -1;
+        }
+
+        freeaddrinfo(res);
+
+        if (fd < 0) {
+                fprintf(stderr, "can't connect to %s:%s\n", host, port);
+        }
+
+        return fd;
+}
+
+void usage(const char *prog)
+{
+        fprintf(stderr,
+                "usage: %s -r host -b busid [-p port] [-w workload] [-n count] [-q in-flight] [-l length] [-e endpoint]\n"
+                "workload: control (default), bulk-in, bulk-out, bulk-loop, interrupt\n", prog);
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        std::string host;
+        std::string port = usbip::tcp_port;
+        std::string busid;
+        config cfg;
+
+        for (int c; (c = getopt(argc, argv, "r:p:b:w:n:q:l:e:h")) != -1; ) {
+                switch (c) {
+                case 'r':
+                        host = optarg;
+                        break;
+                case 'p':
+                        port = optarg;
+                        break;
+                case 'b':
+                        busid = optarg;
+                        break;
+                case 'w':
+                        if (!parse(cfg.type, optarg)) {
+                                fprintf(stderr, "unknown workload '%s'\n", optarg);
+                                return EXIT_FAILURE;
+                        }
+                        break;
+                case 'n':
+                        cfg.count = static_cast<unsigned int>(strtoul(optarg, nullptr, 0));
+                        break;
+                case 'q':
+                        cfg.in_flight = static_cast<unsigned int>(strtoul(optarg, nullptr, 0));
+                        break;
+                case 'l':
+                        cfg.length = static_cast<unsigned int>(strtoul(optarg, nullptr, 0));
+                        break;
+                case 'e':
+                        cfg.endpoint = static_cast<unsigned int>(strtoul(optarg, nullptr, 0));
+                        break;
+                default:
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (host.empty() || busid.empty() || !cfg.count || !cfg.in_flight) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        auto fd = connect(host.c_str(), port.c_str());
+        if (fd < 0) {
+                return EXIT_FAILURE;
+        }
+
+        socket_transport t(fd);
+        usbip::usbip_usb_device udev;
+        result res;
+        std::string error;
+
+        if (!import(t, busid, udev, error) || !run(t, udev, cfg, res, error)) {
+                fprintf(stderr, "%s\n", error.c_str());
+                return EXIT_FAILURE;
+        }
+
+        printf("%s: %zu URBs, %zu errors, %llu bytes in %.3f s\n", str(cfg.type), res.urbs, res.errors, res.bytes, res.seconds);
+        printf("%.1f URB/s, %.2f MB/s\n", res.urb_per_sec(), res.mb_per_sec());
+        printf("latency, us: min %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+                res.min_us, res.p50_us, res.p99_us, res.p999_us, res.max_us);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+#include <usbip\pcapng.h>
+
+#include <spdlog\spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <print>
+#include <thread>
+
+namespace
+{
+
+using namespace usbip;
+
+const auto READ_PERIOD = std::chrono::milliseconds(100);
+const size_t READ_SIZE = 1024*1024;
+
+std::atomic<bool> interrupted;
+
+BOOL WINAPI on_ctrl(DWORD type)
+{
+        switch (type) {
+        case CTRL_C_EVENT:
+        case CTRL_BREAK_EVENT:
+                interrupted = true;
+                return true;
+        }
+
+        return false;
+}
+
+struct port_capture
+{
+        std::vector<char> data;
+        pcapng::stream stream;
+        UINT64 dropped{};
+};
+
+using captures_t = std::map<int, port_capture>;
+
+auto get_ports(_In_ HANDLE dev, _In_ const std::set<int> &ports)
+{
+        std::set<int> result;
+
+        if (!ports.empty()) {
+                result = ports;
+        } else if (auto devices = vhci::get_imported_devices(dev)) {
+                for (auto &d: *devices) {
+                        result.insert(d.port);
+                }
+        } else {
+                spdlog::error(GetLastErrorMsg());
+        }
+
+        return result;
+}
+
+auto write(_Inout_ std::ofstream &f, _In_ const std::vector<char> &buf)
+{
+        f.write(buf.data(), buf.size());
+        return f.good();
+}
+
+/*
+ * Records of all devices are merged by time.
+ * @return number of written packets, -1 if an error
+ */
+int read_and_write(_In_ HANDLE dev, _Inout_ captures_t &captures, _Inout_ std::ofstream &f, _Inout_ std::vector<char> &buf)
+{
+        std::vector<std::pair<const capture::record*, port_capture*>> records;
+
+        for (auto &[port, c]: captures) {
+
+                c.data.resize(READ_SIZE);
+
+                if (UINT64 dropped; !vhci::read_capture(dev, port, c.data, dropped)) {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                        return -1;
+                } else if (dropped != c.dropped) {
+                        spdlog::warn("port {}: {} PDU(s) dropped", port, dropped - c.dropped);
+                        c.dropped = dropped;
+                }
+
+                for (size_t off = 0; off < c.data.size(); ) {
+                        auto &r = *reinterpret_cast<const capture::record*>(c.data.data() + off);
+                        records.emplace_back(&r, &c);
+                        off += r.size;
+                }
+        }
+
+        std::ranges::stable_sort(records, {}, [] (auto &v) { return v.first->time; });
+
+        for (auto [r, c]: records) {
+                auto len = pcapng::packet(buf.data(), buf.size(), c->stream, *r);
+
+                if (len > buf.size()) {
+                        buf.resize(len);
+                        pcapng::packet(buf.data(), buf.size(), c->stream, *r);
+                }
+
+                f.write(buf.data(), len);
+        }
+
+        return f.good() ? static_cast<int>(records.size()) : -1;
+}
+
+} // namespace
+
+
+bool usbip::cmd_capture(void *p)
+{
+        auto &args = *reinterpret_cast<capture_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        auto ports = get_ports(dev.get(), args.ports);
+        if (ports.empty()) {
+                spdlog::error("no devices to capture");
+                return false;
+        }
+
+        std::ofstream f(args.file, std::ios::binary | std::ios::trunc);
+        if (!f) {
+                spdlog::error("can't create '{}'", args.file);
+                return false;
+        }
+
+        std::vector<char> buf(pcapng::file_header(nullptr, 0, args.snaplen));
+        pcapng::file_header(buf.data(), buf.size(), args.snaplen);
+
+        if (!write(f, buf)) {
+                spdlog::error("can't write '{}'", args.file);
+                return false;
+        }
+
+        captures_t captures;
+
+        for (auto port: ports) {
+                if (vhci::set_capture(dev.get(), port, args.snaplen, args.ring_size)) {
+                        captures.emplace(port, port_capture{ .stream = pcapng::make_stream(port) });
+                } else {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                }
+        }
+
+        if (captures.empty()) {
+                return false;
+        }
+
+        std::println("Capturing port(s) {} to '{}', press Ctrl+C to stop", ports, args.file);
+        SetConsoleCtrlHandler(on_ctrl, true);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(args.duration);
+        auto ok = true;
+        int cnt = 0;
+
+        while (!interrupted && (!args.duration || std::chrono::steady_clock::now() < deadline)) {
+                if (auto n = read_and_write(dev.get(), captures, f, buf); n < 0) {
+                        ok = false;
+                        break;
+                } else if (cnt += n; !n) {
+                        std::this_thread::sleep_for(READ_PERIOD);
+                }
+        }
+
+        for (auto &[port, c]: captures) {
+                if (!vhci::set_capture(dev.get(), port, 0)) {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                }
+        }
+
+        if (ok) {
+                if (auto n = read_and_write(dev.get(), captures, f, buf); n < 0) { // the rest
+                        ok = false;
+                } else {
+                        cnt += n;
+                }
+        }
+
+        SetConsoleCtrlHandler(on_ctrl, false);
+        std::println("{} PDU(s) captured", cnt);
+
+        return ok;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+#include <usbip\coalesce.h>
+
+#include <spdlog\spdlog.h>
+#include <print>
+
+namespace
+{
+
+using namespace usbip;
+
+auto get_ports(_In_ HANDLE dev, _In_ const std::set<int> &ports)
+{
+        std::set<int> result;
+
+        if (!ports.empty()) {
+                result = ports;
+        } else if (auto devices = vhci::get_imported_devices(dev)) {
+                for (auto &d: *devices) {
+                        result.insert(d.port);
+                }
+        } else {
+                spdlog::error(GetLastErrorMsg());
+        }
+
+        return result;
+}
+
+auto print(_In_ HANDLE dev, _In_ int port, _In_ bool reset)
+{
+        coalesce::stats s;
+
+        if (!vhci::get_coalesce(dev, port, s, reset)) {
+                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                return false;
+        }
+
+        auto &o = s.overhead;
+        auto ratio = o.sends ? static_cast<double>(o.pdus_sent)/o.sends : 0;
+
+        std::println("{:>4} {:>7} {:>5} {:>12} {:>12} {:>9.2f} {:>12} {:>12} {:>12} {:>10} {:>10} {:>10} {:>10}",
+                     port, s.window, s.max_batch, o.pdus_sent, o.sends, ratio,
+                     o.interrupt_submits, o.ret_submits, o.interrupt_rets,
+                     s.windows, s.closed_by_timer, s.closed_by_size, s.closed_by_traffic);
+
+        return true;
+}
+
+} // namespace
+
+
+bool usbip::cmd_coalesce(void *p)
+{
+        auto &args = *reinterpret_cast<coalesce_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        auto ports = get_ports(dev.get(), args.ports);
+        if (ports.empty()) {
+                spdlog::error("no imported devices");
+                return false;
+        }
+
+        if (auto window = args.window) {
+                for (auto port: ports) {
+                        if (!vhci::set_coalesce(dev.get(), port, *window, args.max_batch)) {
+                                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                                return false;
+                        }
+                }
+        } else if (args.max_batch) {
+                spdlog::warn("--max-batch is ignored without --window");
+        }
+
+        std::println("{:>4} {:>7} {:>5} {:>12} {:>12} {:>9} {:>12} {:>12} {:>12} {:>10} {:>10} {:>10} {:>10}",
+                     "port", "window", "batch", "pdus sent", "sends", "pdus/send",
+                     "intr submits", "ret submits", "intr rets",
+                     "windows", "by timer", "by size", "by traffic");
+
+        auto ok = true;
+
+        for (auto port: ports) {
+                ok = print(dev.get(), port, args.reset) && ok;
+        }
+
+        return ok;
+}
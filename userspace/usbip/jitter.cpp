@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+#include <usbip\isoch_pacing.h>
+
+#include <spdlog\spdlog.h>
+#include <print>
+
+namespace
+{
+
+using namespace usbip;
+
+auto get_ports(_In_ HANDLE dev, _In_ const std::set<int> &ports)
+{
+        std::set<int> result;
+
+        if (!ports.empty()) {
+                result = ports;
+        } else if (auto devices = vhci::get_imported_devices(dev)) {
+                for (auto &d: *devices) {
+                        result.insert(d.port);
+                }
+        } else {
+                spdlog::error(GetLastErrorMsg());
+        }
+
+        return result;
+}
+
+auto print(_In_ HANDLE dev, _In_ int port, _In_ bool reset)
+{
+        UINT64 frame{};
+        isoch::stats stats[isoch::endpoint_count];
+
+        if (!vhci::get_jitter_buffer(dev, port, frame, stats, reset)) {
+                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                return false;
+        }
+
+        spdlog::debug("port {}: frame {}", port, frame);
+
+        for (unsigned int ep = 0; ep < isoch::endpoint_count; ++ep) {
+                if (auto &s = stats[ep]; s.depth || s.urbs) {
+                        std::println("{:>4} {:>2} {:>6} {:>12} {:>10} {:>10} {:>12} {:>9}",
+                                     port, ep, s.depth, s.urbs, s.underruns, s.overruns, s.late_frames, s.max_held);
+                }
+        }
+
+        return true;
+}
+
+} // namespace
+
+
+bool usbip::cmd_jitter(void *p)
+{
+        auto &args = *reinterpret_cast<jitter_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        auto ports = get_ports(dev.get(), args.ports);
+        if (ports.empty()) {
+                spdlog::error("no imported devices");
+                return false;
+        }
+
+        if (auto depth = args.depth) {
+                for (auto port: ports) {
+                        if (!vhci::set_jitter_buffer(dev.get(), port, args.endpoint, *depth)) {
+                                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                                return false;
+                        }
+                }
+        }
+
+        std::println("{:>4} {:>2} {:>6} {:>12} {:>10} {:>10} {:>12} {:>9}",
+                     "port", "ep", "depth", "urbs", "underruns", "overruns", "late frames", "max held");
+
+        auto ok = true;
+
+        for (auto port: ports) {
+                ok = print(dev.get(), port, args.reset) && ok;
+        }
+
+        return ok;
+}
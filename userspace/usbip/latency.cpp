@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+#include <usbip\latency.h>
+
+#include <spdlog\spdlog.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <print>
+#include <thread>
+
+namespace
+{
+
+using namespace usbip;
+
+const auto WAIT_PERIOD = std::chrono::milliseconds(100);
+const size_t READ_SIZE = latency::endpoint_count*sizeof(latency::endpoint_stats);
+
+std::atomic<bool> interrupted;
+
+BOOL WINAPI on_ctrl(DWORD type)
+{
+        switch (type) {
+        case CTRL_C_EVENT:
+        case CTRL_BREAK_EVENT:
+                interrupted = true;
+                return true;
+        }
+
+        return false;
+}
+
+auto get_ports(_In_ HANDLE dev, _In_ const std::set<int> &ports)
+{
+        std::set<int> result;
+
+        if (!ports.empty()) {
+                result = ports;
+        } else if (auto devices = vhci::get_imported_devices(dev)) {
+                for (auto &d: *devices) {
+                        result.insert(d.port);
+                }
+        } else {
+                spdlog::error(GetLastErrorMsg());
+        }
+
+        return result;
+}
+
+void print(_In_ int port, _In_ const latency::endpoint_stats &e)
+{
+        auto addr = e.address;
+
+        for (unsigned int i = 0; i < latency::stage_count; ++i) {
+
+                auto &h = e.stages[i];
+                if (!h.count) {
+                        continue;
+                }
+
+                std::println("{:>4} {:>2} {:<3} {:<8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+                             port, addr & 0x0F, addr & latency::dir_in ? "in" : "out",
+                             latency::str(static_cast<latency::stage>(i)), h.count, h.sum/h.count,
+                             latency::percentile(h, 0.5), latency::percentile(h, 0.9), latency::percentile(h, 0.99), h.max);
+        }
+}
+
+auto read_and_print(_In_ HANDLE dev, _In_ int port)
+{
+        std::vector<char> buf(READ_SIZE);
+
+        if (!vhci::read_latency(dev, port, buf, true)) {
+                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                return false;
+        }
+
+        for (size_t off = 0; off + sizeof(latency::endpoint_stats) <= buf.size(); off += sizeof(latency::endpoint_stats)) {
+                latency::endpoint_stats e; // buf is not aligned
+                memcpy(&e, buf.data() + off, sizeof(e));
+                print(port, e);
+        }
+
+        return true;
+}
+
+} // namespace
+
+
+bool usbip::cmd_latency(void *p)
+{
+        auto &args = *reinterpret_cast<latency_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        auto ports = get_ports(dev.get(), args.ports);
+        if (ports.empty()) {
+                spdlog::error("no imported devices");
+                return false;
+        }
+
+        ULONG stages = 0;
+        for (auto s: args.stages) {
+                stages |= latency::stage_mask(s);
+        }
+
+        for (auto port: ports) {
+                if (!vhci::set_latency(dev.get(), port, args.period, stages)) {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                        return false;
+                }
+                std::vector<char> buf(READ_SIZE);
+                vhci::read_latency(dev.get(), port, buf, true); // discard samples of previous runs
+        }
+
+        std::println("Sampling every {} URB(s) of port(s) {}, press Ctrl+C to stop", args.period, ports);
+        SetConsoleCtrlHandler(on_ctrl, true);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(args.duration);
+
+        while (!interrupted && (!args.duration || std::chrono::steady_clock::now() < deadline)) {
+                std::this_thread::sleep_for(WAIT_PERIOD);
+        }
+
+        SetConsoleCtrlHandler(on_ctrl, false);
+
+        std::println("{:>4} {:>2} {:<3} {:<8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+                     "port", "ep", "dir", "stage", "count", "mean, us", "p50, us", "p90, us", "p99, us", "max, us");
+
+        auto ok = true;
+
+        for (auto port: ports) {
+                ok = read_and_print(dev.get(), port) && ok;
+
+                if (!args.keep && !vhci::set_latency(dev.get(), port, 0)) {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                }
+        }
+
+        return ok;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2026 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+#include <usbip\urb_trace.h>
+
+#include <spdlog\spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <print>
+#include <thread>
+
+namespace
+{
+
+using namespace usbip;
+
+const auto READ_PERIOD = std::chrono::milliseconds(100);
+const size_t READ_SIZE = 1024*1024;
+
+std::atomic<bool> interrupted;
+
+BOOL WINAPI on_ctrl(DWORD type)
+{
+        switch (type) {
+        case CTRL_C_EVENT:
+        case CTRL_BREAK_EVENT:
+                interrupted = true;
+                return true;
+        }
+
+        return false;
+}
+
+using dropped_t = std::map<unsigned int, UINT64>; // processor -> dropped records
+
+/*
+ * The file header is written on the first read because it needs the frequency.
+ * @return number of written records, -1 if an error
+ */
+int read_and_write(_In_ HANDLE dev, _Inout_ std::ofstream &f, _Inout_ std::vector<char> &buf, _Inout_ dropped_t &dropped)
+{
+        buf.resize(READ_SIZE);
+
+        UINT64 frequency;
+        if (!vhci::read_urb_trace(dev, buf, frequency)) {
+                spdlog::error(GetLastErrorMsg());
+                return -1;
+        }
+
+        if (!f.tellp()) {
+                urb_trace::file_header h {
+                        .version = urb_trace::file_version,
+                        .record_size = sizeof(urb_trace::record),
+                        .frequency = frequency
+                };
+
+                std::ranges::copy(urb_trace::file_magic, h.magic);
+                f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        }
+
+        int cnt = 0;
+
+        for (size_t off = 0; off < buf.size(); ) {
+                auto &c = *reinterpret_cast<const urb_trace::chunk*>(buf.data() + off);
+
+                if (auto &d = dropped[c.processor]; c.dropped != d) {
+                        spdlog::warn("processor {}: {} record(s) dropped", c.processor, c.dropped - d);
+                        d = c.dropped;
+                }
+
+                cnt += c.count;
+                off += sizeof(c) + c.count*sizeof(urb_trace::record);
+        }
+
+        f.write(buf.data(), buf.size());
+        return f.good() ? cnt : -1;
+}
+
+} // namespace
+
+
+bool usbip::cmd_trace(void *p)
+{
+        auto &args = *reinterpret_cast<trace_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        std::ofstream f(args.file, std::ios::binary | std::ios::trunc);
+        if (!f) {
+                spdlog::error("can't create '{}'", args.file);
+                return false;
+        }
+
+        if (!vhci::set_urb_trace(dev.get(), args.capacity)) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        std::println("Tracing USB/IP PDUs to '{}', press Ctrl+C to stop", args.file);
+        SetConsoleCtrlHandler(on_ctrl, true);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(args.duration);
+        std::vector<char> buf;
+        dropped_t dropped;
+
+        auto ok = true;
+        int cnt = 0;
+
+        while (!interrupted && (!args.duration || std::chrono::steady_clock::now() < deadline)) {
+                if (auto n = read_and_write(dev.get(), f, buf, dropped); n < 0) {
+                        ok = false;
+                        break;
+                } else if (cnt += n; !n) {
+                        std::this_thread::sleep_for(READ_PERIOD);
+                }
+        }
+
+        if (!vhci::set_urb_trace(dev.get(), 0)) {
+                spdlog::error(GetLastErrorMsg());
+        }
+
+        if (ok) {
+                if (auto n = read_and_write(dev.get(), f, buf, dropped); n < 0) { // the rest
+                        ok = false;
+                } else {
+                        cnt += n;
+                }
+        }
+
+        SetConsoleCtrlHandler(on_ctrl, false);
+        std::println("{} record(s) written, decode them with urbtrace", cnt);
+
+        return ok;
+}
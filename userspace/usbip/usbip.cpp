@@ -142,6 +142,150 @@ void add_cmd_port(CLI::App &app)
 		->expected(1, MAX_HUB_PORTS);
 }
 
+void add_cmd_capture(CLI::App &app)
+{
+	static capture_args r;
+
+	auto cmd = app.add_subcommand("capture", "Capture USB/IP traffic of imported USB devices to pcapng file")
+		->callback(pack(cmd_capture, &r));
+
+	cmd->add_option("-w,--write", r.file, "pcapng file to write")
+		->required();
+
+	cmd->add_option("-s,--snaplen", r.snaplen, "Maximum number of bytes to capture per PDU")
+		->check(CLI::Range(48U, 64U*1024));
+
+	cmd->add_option("-b,--buffer", r.ring_size, "Size of capture buffer of the driver per device in bytes, zero for default")
+		->check(CLI::Range(0U, 64U*1024*1024));
+
+	cmd->add_option("-a,--duration", r.duration, "Stop after the given number of seconds, zero for Ctrl+C");
+
+	cmd->add_option("number", r.ports, "Hub port number, all imported devices if omitted")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->expected(0, MAX_HUB_PORTS);
+}
+
+void add_cmd_trace(CLI::App &app)
+{
+	static trace_args r;
+
+	auto cmd = app.add_subcommand("trace", "Write binary trace of USB/IP PDUs of all devices to a file")
+		->callback(pack(cmd_trace, &r));
+
+	cmd->add_option("-w,--write", r.file, "File to write, decode it with urbtrace")
+		->required();
+
+	cmd->add_option("-n,--records", r.capacity, "Size of trace buffer of the driver per processor in records, all processors get at most 64 MiB")
+		->check(CLI::Range(1024U, 1024U*1024));
+
+	cmd->add_option("-a,--duration", r.duration, "Stop after the given number of seconds, zero for Ctrl+C");
+}
+
+void add_cmd_latency(CLI::App &app)
+{
+	static latency_args r;
+
+	auto cmd = app.add_subcommand("latency", "Show where the time of URBs of imported USB devices goes")
+		->callback(pack(cmd_latency, &r));
+
+	cmd->add_option("-p,--period", r.period, "Sample every Nth URB")
+		->check(CLI::Range(1U, 1024U*1024));
+
+	cmd->add_option("-s,--stage", r.stages, "Stages to record, all if omitted")
+		->transform(CLI::CheckedTransformer(std::map<std::string, latency::stage>{
+			{"prepare", latency::prepare},
+			{"queue", latency::queue},
+			{"send", latency::send},
+			{"server", latency::server},
+			{"receive", latency::receive},
+			{"total", latency::total}}));
+
+	cmd->add_option("-a,--duration", r.duration, "Stop after the given number of seconds, zero for Ctrl+C");
+
+	cmd->add_flag("-k,--keep", r.keep, "Do not disable the sampling on exit");
+
+	cmd->add_option("number", r.ports, "Hub port number, all imported devices if omitted")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->expected(0, MAX_HUB_PORTS);
+}
+
+void add_cmd_jitter(CLI::App &app)
+{
+	static jitter_args r;
+
+	auto cmd = app.add_subcommand("jitter", "Pace isochronous IN endpoints of imported USB devices by a jitter buffer")
+		->callback(pack(cmd_jitter, &r));
+
+	cmd->add_option("-d,--depth", r.depth, "Frames to buffer, 'auto' to follow the jitter, 'off' to disable")
+		->transform(CLI::Transformer(std::map<std::string, unsigned int>{
+			{"auto", isoch::depth_auto},
+			{"off", 0}}));
+
+	cmd->add_option("-e,--endpoint", r.endpoint, "Endpoint number, all if omitted")
+		->check(CLI::Range(1U, isoch::endpoint_count - 1U));
+
+	cmd->add_flag("-r,--reset", r.reset, "Zero the counters after they are printed");
+
+	cmd->add_option("number", r.ports, "Hub port number, all imported devices if omitted")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->expected(0, MAX_HUB_PORTS);
+}
+
+void add_cmd_coalesce(CLI::App &app)
+{
+	static coalesce_args r;
+
+	auto cmd = app.add_subcommand("coalesce", "Coalesce interrupt IN resubmits of imported USB devices")
+		->callback(pack(cmd_coalesce, &r));
+
+	cmd->add_option("-w,--window", r.window, "Microseconds to hold resubmits for, 'off' to disable")
+		->transform(CLI::Transformer(std::map<std::string, unsigned int>{{"off", 0}}))
+		->check(CLI::Range(0U, 1'000'000U));
+
+	cmd->add_option("-b,--max-batch", r.max_batch, "Resubmits of a window")
+		->check(CLI::Range(1U, static_cast<unsigned int>(coalesce::max_batch_limit)));
+
+	cmd->add_flag("-r,--reset", r.reset, "Zero the counters after they are printed");
+
+	cmd->add_option("number", r.ports, "Hub port number, all imported devices if omitted")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->expected(0, MAX_HUB_PORTS);
+}
+
+void add_cmd_bench(CLI::App &app)
+{
+	static bench_args r;
+
+	auto cmd = app.add_subcommand("bench", "Measure URB latency and throughput of a remote USB device without the driver")
+		->callback(pack(cmd_bench, &r));
+
+	cmd->add_option("-r,--remote", r.remote, "Hostname/IP of a USB/IP server with exported USB devices")
+		->required();
+
+	cmd->add_option("-b,--bus-id", r.busid, "Bus Id of the USB device on a server")
+		->required();
+
+	cmd->add_option("-w,--workload", r.cfg.type, "Type of URBs to submit")
+		->transform(CLI::CheckedTransformer(std::map<std::string, bench::workload>{
+			{"control", bench::workload::control},
+			{"bulk-in", bench::workload::bulk_in},
+			{"bulk-out", bench::workload::bulk_out},
+			{"bulk-loop", bench::workload::bulk_loop},
+			{"interrupt", bench::workload::interrupt}}));
+
+	cmd->add_option("-n,--count", r.cfg.count, "Number of URBs to complete")
+		->check(CLI::PositiveNumber);
+
+	cmd->add_option("-q,--in-flight", r.cfg.in_flight, "Number of URBs submitted at once")
+		->check(CLI::Range(1U, 1024U));
+
+	cmd->add_option("-l,--length", r.cfg.length, "Transfer buffer length of bulk URBs")
+		->check(CLI::Range(1U, 16U*1024*1024));
+
+	cmd->add_option("-e,--endpoint", r.cfg.endpoint, "Endpoint address, the first suitable from configuration descriptor if omitted")
+		->check(CLI::Range(0x01U, 0x8FU));
+}
+
 auto &msgtable_dll = L"resources"; // resource-only DLL that contains RT_MESSAGETABLE
 
 auto& get_resource_module() noexcept
@@ -175,6 +319,12 @@ void init(CLI::App &app)
 	add_cmd_detach(app);
 	add_cmd_list(app);
 	add_cmd_port(app);
+	add_cmd_capture(app);
+	add_cmd_trace(app);
+	add_cmd_latency(app);
+	add_cmd_jitter(app);
+	add_cmd_coalesce(app);
+	add_cmd_bench(app);
 
 	app.require_subcommand(1);
 }
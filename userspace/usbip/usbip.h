@@ -6,8 +6,14 @@
 
 #include <string>
 #include <set>
+#include <vector>
+#include <optional>
 
 #include <libusbip\remote.h>
+#include <usbip\latency.h>
+#include <usbip\isoch_pacing.h>
+#include <usbip\coalesce.h>
+#include "bench_engine.h"
 
 namespace usbip
 {
@@ -66,4 +72,58 @@ struct port_args
 };
 command_t cmd_port;
 
+struct capture_args
+{
+        std::set<int> ports;
+        std::string file;
+        unsigned int snaplen = 128;
+        unsigned int ring_size{};
+        unsigned int duration{}; // seconds
+};
+command_t cmd_capture;
+
+struct trace_args
+{
+        std::string file;
+        unsigned int capacity = 16*1024; // records per processor
+        unsigned int duration{}; // seconds
+};
+command_t cmd_trace;
+
+struct latency_args
+{
+        std::set<int> ports;
+        unsigned int period = 1; // every Nth URB is sampled
+        std::vector<latency::stage> stages; // all if empty
+        unsigned int duration{}; // seconds
+        bool keep{}; // do not disable the sampling on exit
+};
+command_t cmd_latency;
+
+struct jitter_args
+{
+        std::set<int> ports;
+        std::optional<unsigned int> depth; // frames, zero disables the pacing, isoch::depth_auto
+        unsigned int endpoint{}; // number, zero for all
+        bool reset{}; // zero the counters after they are printed
+};
+command_t cmd_jitter;
+
+struct coalesce_args
+{
+        std::set<int> ports;
+        std::optional<unsigned int> window; // microseconds, zero disables coalescing
+        unsigned int max_batch{}; // PDUs of a window, zero for coalesce::default_max_batch
+        bool reset{}; // zero the counters after they are printed
+};
+command_t cmd_coalesce;
+
+struct bench_args
+{
+        std::string remote;
+        std::string busid;
+        bench::config cfg;
+};
+command_t cmd_bench;
+
 } // namespace usbip
@@ -26,6 +26,7 @@
 #include <wx/headerctrl.h>
 #include <wx/clipbrd.h>
 #include <wx/persist/dataview.h>
+#include <wx/wupdlock.h>
 
 #include <format>
 #include <set>
@@ -355,17 +356,17 @@ auto get_servers(_In_ const std::vector<device_columns> &devices)
 class DeviceStateEvent : public wxEvent
 {
 public:
-        DeviceStateEvent(_In_ device_state st) : 
+        DeviceStateEvent(_In_ std::vector<device_state> v) : 
                 wxEvent(0, EVT_DEVICE_STATE),
-                m_state(std::move(st)) {}
+                m_states(std::move(v)) {}
 
         wxEvent *Clone() const override { return new DeviceStateEvent(*this); }
 
-        auto& get() const noexcept { return m_state; }
-        auto& get() noexcept { return m_state; }
+        auto& get() const noexcept { return m_states; }
+        auto& get() noexcept { return m_states; }
 
 private:
-        device_state m_state;
+        std::vector<device_state> m_states;
 };
 wxDEFINE_EVENT(EVT_DEVICE_STATE, DeviceStateEvent);
 
@@ -544,13 +545,15 @@ void MainFrame::read_loop()
 
         std::unique_ptr<MainFrame, decltype(on_exit)> ptr(this, on_exit);
 
-        while (auto state = vhci::read_device_state(m_read.get())) {
-                auto evt = new DeviceStateEvent(std::move(*state));
+        enum { MAX_STATES = 64 }; // per read, the driver returns as many as it has
+
+        while (auto v = vhci::read_device_states(m_read.get(), MAX_STATES)) {
+                auto evt = new DeviceStateEvent(std::move(*v));
                 QueueEvent(evt); // see on_device_state()
         }
 
         if (auto err = GetLastError(); err != ERROR_OPERATION_ABORTED) { // see CancelSynchronousIo
-                wxLogError(_("vhci::read_device_state error %lu\n%s"), err, GetLastErrorMsg(err));
+                wxLogError(_("vhci::read_device_states error %lu\n%s"), err, GetLastErrorMsg(err));
         }
 }
 
@@ -581,15 +584,41 @@ void MainFrame::break_read_loop()
  */
 void MainFrame::on_device_state(_In_ DeviceStateEvent &event)
 {
-        auto &tree = *m_treeListCtrl;
+        auto &states = event.get();
 
-        auto &st = event.get();
-        log(st);
+        wxString balloon;
+        bool lost{};
+
+        if (wxWindowUpdateLocker lck(m_treeListCtrl); true) { // the whole batch in one repaint
+                for (auto &st: states) {
+                        if (st.flags & state_lost) { // state_resync is an ordinary update
+                                wxLogVerbose(_("Device states lost, seqnum %llu"), st.seqnum);
+                                lost = true;
+                        }
+
+                        update_device_state(st);
+
+                        if (!balloon.empty()) {
+                                balloon += L'\n';
+                        }
+                        balloon += wxString::FromAscii(vhci::get_state_str(st.state)) + L' ' + 
+                                   make_device_url(st.device.location);
+                }
+
+                if (lost) {
+                        resync_devices();
+                }
+        }
 
         if (m_taskbar_icon && m_taskbar_icon->IsIconInstalled()) {
-                auto s = wxString::FromAscii(vhci::get_state_str(st.state)) + L' ' + make_device_url(st.device.location);
-                m_taskbar_icon->show_balloon(s);
+                m_taskbar_icon->show_balloon(balloon);
         }
+}
+
+void MainFrame::update_device_state(_Inout_ device_state &st)
+{
+        auto &tree = *m_treeListCtrl;
+        log(st);
 
         auto [dev, added] = find_or_add_device(st.device.location);
 
@@ -639,6 +668,48 @@ void MainFrame::on_device_state(_In_ DeviceStateEvent &event)
         log(tree, dev, _("After"));
 }
 
+/*
+ * The driver dropped device states that were not read in time and could not resend the latest ones, see state_lost.
+ * Fix the devices whose state differs from the driver's one instead of reloading the whole tree.
+ */
+void MainFrame::resync_devices()
+{
+        auto &tree = *m_treeListCtrl;
+
+        auto devices = vhci::get_imported_devices(vhci::open().get()); // see comments for on_device_state
+        if (!devices) {
+                auto err = GetLastError();
+                wxLogError(_("Could not get imported devices\nError %lu\n%s"), err, GetLastErrorMsg(err));
+                return;
+        }
+
+        std::set<int> ports;
+
+        for (auto &dev: *devices) {
+                ports.insert(dev.port);
+
+                device_state st {
+                        .device = std::move(dev), 
+                        .state = state::plugged 
+                };
+
+                update_device_state(st);
+        }
+
+        for (auto &dev: get_devices(tree)) {
+                if (auto port = get_port(dev); !port || ports.contains(port)) {
+                        continue;
+                }
+
+                device_columns dc; // COL_PORT and COL_SOURCE_ID are cleared
+                dc[COL_BUSID] = tree.GetItemText(dev);
+                get_url(dc) = tree.GetItemText(tree.GetItemParent(dev));
+                dc[COL_STATE] = to_string(state::unplugged);
+
+                update_device(dev, dc, mkflags({COL_STATE, COL_PORT, COL_SOURCE_ID}));
+        }
+}
+
 void MainFrame::on_has_devices_update_ui(wxUpdateUIEvent &event)
 {
         auto v = get_devices(*m_treeListCtrl);
@@ -1272,7 +1343,7 @@ void MainFrame::on_item_activated(wxTreeListEvent &event)
                 //
         } else if (auto &state = tree.GetItemText(item, COL_STATE); state == to_string(state::unplugged)) {
                 on_attach(event); 
-        } else if (state == to_string(state::plugged)) {
+        } else if (state == to_string(state::plugged) || state == to_string(state::degraded)) {
                 on_detach(event);
         }
 }
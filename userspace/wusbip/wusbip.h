@@ -144,6 +144,8 @@ private:
 	std::pair<wxTreeListItem, bool> find_or_add_device(_In_ const usbip::device_columns &dc);
 
 	void remove_device(_In_ wxTreeListItem dev);
+	void update_device_state(_Inout_ usbip::device_state &st);
+	void resync_devices();
 
         void attach(_In_ bool once);
         DWORD attach(_In_ const wxString &url, _In_ const wxString &busid, _In_ const wxString &serial, _In_ bool once);